@@ -0,0 +1,417 @@
+#include "bundle.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "crc32c.h"
+
+// "hmbundle" in little endian.
+#define MAGIC 0x656c646e75626d68ull
+
+// Version of the format, incremented on incompatible changes.
+#define FORMAT_VERSION 1
+
+// Images are placed at offsets aligned to this, as hm_db_image_view requires.
+#define IMAGE_ALIGNMENT 64
+
+// header_t is the beginning of a bundle.
+typedef struct header {
+  uint64_t magic;
+  uint32_t version;
+
+  // Number of entries in the table of contents following the header.
+  uint32_t count;
+
+  // Size of the whole bundle.
+  uint64_t size;
+  uint32_t reserved;
+
+  // CRC-32C of the header before this field and of the table of contents.
+  uint32_t crc;
+  char padding[32];
+} header_t;
+
+// toc_entry_t describes one database.
+typedef struct toc_entry {
+  // Zero padded name.
+  char name[HM_BUNDLE_NAME_SIZE];
+  uint32_t type;
+
+  // CRC-32C of the image.
+  uint32_t crc;
+
+  // Offset of the image from the beginning of the bundle.
+  uint64_t offset;
+  uint64_t size;
+} toc_entry_t;
+
+typedef struct bundle_db {
+  const char *name;
+  hm_db_type_t type;
+  void *db;
+} bundle_db_t;
+
+struct hm_bundle {
+  // Mapped file, NULL for bundles created by hm_bundle_view.
+  char *mapping;
+  size_t mapping_size;
+
+  size_t count;
+  bundle_db_t *dbs;
+
+  // Places of hm_*_database_t pointing into images.
+  char *view_places;
+};
+
+static uint64_t align_offset(uint64_t offset) {
+  return (offset + IMAGE_ALIGNMENT - 1) & ~(uint64_t)(IMAGE_ALIGNMENT - 1);
+}
+
+// images_offset returns the offset of the first image.
+static uint64_t images_offset(size_t count) {
+  return align_offset(sizeof(header_t) + count * sizeof(toc_entry_t));
+}
+
+static uint32_t header_crc(const char *bundle, size_t count) {
+  uint32_t crc = hm_crc32c(0, bundle, offsetof(header_t, crc));
+  return hm_crc32c(crc, bundle + sizeof(header_t),
+                   count * sizeof(toc_entry_t));
+}
+
+// check_entries checks names and types of the databases to write.
+static hm_error_t check_entries(const hm_bundle_entry_t *entries,
+                                size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    if (entries[i].name == NULL || entries[i].name[0] == 0 ||
+        strlen(entries[i].name) >= HM_BUNDLE_NAME_SIZE ||
+        hm_db_type_name(entries[i].type) == NULL || entries[i].db == NULL) {
+      return HM_ERROR_BAD_VALUE;
+    }
+    for (size_t j = 0; j < i; j++) {
+      if (strcmp(entries[i].name, entries[j].name) == 0) {
+        return HM_ERROR_BAD_VALUE;
+      }
+    }
+  }
+  if (count > UINT32_MAX) {
+    return HM_ERROR_BAD_SIZE;
+  }
+  return HM_SUCCESS;
+}
+
+HM_PUBLIC_API
+hm_error_t HM_CDECL hm_bundle_size(size_t *size,
+                                   const hm_bundle_entry_t *entries,
+                                   size_t count) {
+  hm_error_t hm_err = check_entries(entries, count);
+  if (hm_err != HM_SUCCESS) {
+    return hm_err;
+  }
+  uint64_t offset = images_offset(count);
+  for (size_t i = 0; i < count; i++) {
+    offset = align_offset(offset +
+                          hm_db_image_size(entries[i].type, entries[i].db));
+  }
+  *size = offset;
+  return HM_SUCCESS;
+}
+
+HM_PUBLIC_API
+hm_error_t HM_CDECL hm_bundle_write(char *buffer, size_t buffer_size,
+                                    const hm_bundle_entry_t *entries,
+                                    size_t count) {
+  if (((uintptr_t)(buffer) & (sizeof(uint64_t) - 1)) != 0) {
+    return HM_ERROR_BAD_ALIGNMENT;
+  }
+  size_t size;
+  hm_error_t hm_err = hm_bundle_size(&size, entries, count);
+  if (hm_err != HM_SUCCESS) {
+    return hm_err;
+  }
+  if (buffer_size != size) {
+    return HM_ERROR_BAD_SIZE;
+  }
+
+  // Padding is zeroed, so the same databases produce the same bundle.
+  memset(buffer, 0, size);
+
+  header_t *header = (header_t *)(buffer);
+  header->magic = MAGIC;
+  header->version = FORMAT_VERSION;
+  header->count = count;
+  header->size = size;
+
+  toc_entry_t *toc = (toc_entry_t *)(buffer + sizeof(header_t));
+  uint64_t offset = images_offset(count);
+  for (size_t i = 0; i < count; i++) {
+    size_t image_size = hm_db_image_size(entries[i].type, entries[i].db);
+    hm_err = hm_db_image_write(entries[i].type, buffer + offset, image_size,
+                               entries[i].db);
+    if (hm_err != HM_SUCCESS) {
+      return hm_err;
+    }
+    strcpy(toc[i].name, entries[i].name);
+    toc[i].type = entries[i].type;
+    toc[i].crc = hm_crc32c(0, buffer + offset, image_size);
+    toc[i].offset = offset;
+    toc[i].size = image_size;
+    offset = align_offset(offset + image_size);
+  }
+
+  header->crc = header_crc(buffer, count);
+  return HM_SUCCESS;
+}
+
+// sync_parent_dir makes the rename of the file at path durable.
+static void sync_parent_dir(const char *path) {
+  const char *slash = strrchr(path, '/');
+  char *dir;
+  if (slash == NULL) {
+    dir = strdup(".");
+  } else if (slash == path) {
+    dir = strdup("/");
+  } else {
+    dir = strndup(path, slash - path);
+  }
+  if (dir == NULL) {
+    return;
+  }
+  int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd != -1) {
+    fsync(fd);
+    close(fd);
+  }
+  free(dir);
+}
+
+HM_PUBLIC_API
+hm_error_t HM_CDECL hm_bundle_write_file(const char *path,
+                                         const hm_bundle_entry_t *entries,
+                                         size_t count) {
+  size_t size;
+  hm_error_t hm_err = hm_bundle_size(&size, entries, count);
+  if (hm_err != HM_SUCCESS) {
+    return hm_err;
+  }
+
+  size_t path_size = strlen(path);
+  char *tmp_path = malloc(path_size + sizeof(".XXXXXX"));
+  if (tmp_path == NULL) {
+    return HM_ERROR_NO_MEMORY;
+  }
+  memcpy(tmp_path, path, path_size);
+  memcpy(tmp_path + path_size, ".XXXXXX", sizeof(".XXXXXX"));
+  int fd = mkstemp(tmp_path);
+  if (fd == -1) {
+    free(tmp_path);
+    return HM_ERROR_SYSTEM;
+  }
+
+  // The file is written through a mapping, so the bundle is not copied.
+  hm_err = HM_ERROR_SYSTEM;
+  if (fchmod(fd, 0644) == 0 && ftruncate(fd, size) == 0) {
+    char *mapping =
+        mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapping != MAP_FAILED) {
+      hm_err = hm_bundle_write(mapping, size, entries, count);
+      munmap(mapping, size);
+    }
+  }
+  if (hm_err == HM_SUCCESS && fsync(fd) != 0) {
+    hm_err = HM_ERROR_SYSTEM;
+  }
+  if (close(fd) != 0 && hm_err == HM_SUCCESS) {
+    hm_err = HM_ERROR_SYSTEM;
+  }
+  if (hm_err == HM_SUCCESS && rename(tmp_path, path) != 0) {
+    hm_err = HM_ERROR_SYSTEM;
+  }
+  if (hm_err == HM_SUCCESS) {
+    sync_parent_dir(path);
+  } else {
+    unlink(tmp_path);
+  }
+  free(tmp_path);
+  return hm_err;
+}
+
+// check_toc checks the table of contents of the bundle which passed the
+// checksum of the header.
+static hm_error_t check_toc(const toc_entry_t *toc, size_t count,
+                            size_t buffer_size) {
+  uint64_t toc_end = sizeof(header_t) + count * sizeof(toc_entry_t);
+  for (size_t i = 0; i < count; i++) {
+    const toc_entry_t *entry = &toc[i];
+    size_t name_size = strnlen(entry->name, HM_BUNDLE_NAME_SIZE);
+    if (name_size == 0 || name_size == HM_BUNDLE_NAME_SIZE ||
+        hm_db_type_name((hm_db_type_t)entry->type) == NULL ||
+        entry->offset % IMAGE_ALIGNMENT != 0 || entry->offset < toc_end ||
+        entry->offset > buffer_size ||
+        entry->size > buffer_size - entry->offset) {
+      return HM_ERROR_BAD_FORMAT;
+    }
+    for (size_t j = 0; j < i; j++) {
+      if (strcmp(entry->name, toc[j].name) == 0) {
+        return HM_ERROR_BAD_FORMAT;
+      }
+    }
+  }
+  return HM_SUCCESS;
+}
+
+// create_bundle parses the bundle in buffer.
+static hm_error_t create_bundle(hm_bundle_t **bundle_ptr, const char *buffer,
+                                size_t buffer_size, bool verify) {
+  if (((uintptr_t)(buffer) & (IMAGE_ALIGNMENT - 1)) != 0) {
+    return HM_ERROR_BAD_ALIGNMENT;
+  }
+  if (buffer_size < sizeof(header_t)) {
+    return HM_ERROR_BAD_FORMAT;
+  }
+  const header_t *header = (const header_t *)(buffer);
+  if (header->magic != MAGIC || header->version != FORMAT_VERSION ||
+      header->size != buffer_size ||
+      header->count > (buffer_size - sizeof(header_t)) / sizeof(toc_entry_t)) {
+    return HM_ERROR_BAD_FORMAT;
+  }
+  size_t count = header->count;
+  if (header->crc != header_crc(buffer, count)) {
+    return HM_ERROR_BAD_CHECKSUM;
+  }
+  const toc_entry_t *toc = (const toc_entry_t *)(buffer + sizeof(header_t));
+  hm_error_t hm_err = check_toc(toc, count, buffer_size);
+  if (hm_err != HM_SUCCESS) {
+    return hm_err;
+  }
+  if (verify) {
+    for (size_t i = 0; i < count; i++) {
+      if (hm_crc32c(0, buffer + toc[i].offset, toc[i].size) != toc[i].crc) {
+        return HM_ERROR_BAD_CHECKSUM;
+      }
+    }
+  }
+
+  hm_bundle_t *bundle = calloc(1, sizeof(hm_bundle_t));
+  if (bundle == NULL) {
+    return HM_ERROR_NO_MEMORY;
+  }
+  size_t view_places_size = 0;
+  for (size_t i = 0; i < count; i++) {
+    view_places_size += hm_db_view_place_size((hm_db_type_t)toc[i].type);
+  }
+  bundle->count = count;
+  bundle->dbs = calloc(count, sizeof(bundle_db_t));
+  bundle->view_places = malloc(view_places_size);
+  if ((count != 0 && bundle->dbs == NULL) ||
+      (view_places_size != 0 && bundle->view_places == NULL)) {
+    hm_bundle_free(bundle);
+    return HM_ERROR_NO_MEMORY;
+  }
+
+  char *view_place = bundle->view_places;
+  for (size_t i = 0; i < count; i++) {
+    bundle_db_t *db = &bundle->dbs[i];
+    db->name = toc[i].name;
+    db->type = (hm_db_type_t)toc[i].type;
+    size_t view_place_size = hm_db_view_place_size(db->type);
+    hm_err = hm_db_image_view(db->type, view_place, view_place_size, &db->db,
+                              buffer + toc[i].offset, toc[i].size);
+    if (hm_err != HM_SUCCESS) {
+      hm_bundle_free(bundle);
+      return hm_err;
+    }
+    view_place += view_place_size;
+  }
+
+  *bundle_ptr = bundle;
+  return HM_SUCCESS;
+}
+
+HM_PUBLIC_API
+hm_error_t HM_CDECL hm_bundle_open(hm_bundle_t **bundle_ptr, const char *path,
+                                   bool verify) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    return HM_ERROR_SYSTEM;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return HM_ERROR_SYSTEM;
+  }
+  size_t size = st.st_size;
+  if (size < sizeof(header_t)) {
+    close(fd);
+    return HM_ERROR_BAD_FORMAT;
+  }
+  char *mapping = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    return HM_ERROR_SYSTEM;
+  }
+
+  hm_bundle_t *bundle;
+  hm_error_t hm_err = create_bundle(&bundle, mapping, size, verify);
+  if (hm_err != HM_SUCCESS) {
+    munmap(mapping, size);
+    return hm_err;
+  }
+  bundle->mapping = mapping;
+  bundle->mapping_size = size;
+
+  *bundle_ptr = bundle;
+  return HM_SUCCESS;
+}
+
+HM_PUBLIC_API
+hm_error_t HM_CDECL hm_bundle_view(hm_bundle_t **bundle_ptr,
+                                   const char *buffer, size_t buffer_size,
+                                   bool verify) {
+  return create_bundle(bundle_ptr, buffer, buffer_size, verify);
+}
+
+HM_PUBLIC_API
+size_t HM_CDECL hm_bundle_count(const hm_bundle_t *bundle) {
+  return bundle->count;
+}
+
+HM_PUBLIC_API
+const char *HM_CDECL hm_bundle_name(const hm_bundle_t *bundle, size_t i) {
+  return bundle->dbs[i].name;
+}
+
+HM_PUBLIC_API
+hm_db_type_t HM_CDECL hm_bundle_type(const hm_bundle_t *bundle, size_t i) {
+  return bundle->dbs[i].type;
+}
+
+HM_PUBLIC_API
+const void *HM_CDECL hm_bundle_db(const hm_bundle_t *bundle, size_t i) {
+  return bundle->dbs[i].db;
+}
+
+HM_PUBLIC_API
+const void *HM_CDECL hm_bundle_find(const hm_bundle_t *bundle,
+                                    const char *name, hm_db_type_t type) {
+  for (size_t i = 0; i < bundle->count; i++) {
+    if (bundle->dbs[i].type == type && strcmp(bundle->dbs[i].name, name) == 0) {
+      return bundle->dbs[i].db;
+    }
+  }
+  return NULL;
+}
+
+HM_PUBLIC_API
+void HM_CDECL hm_bundle_free(hm_bundle_t *bundle) {
+  if (bundle->mapping != NULL) {
+    munmap(bundle->mapping, bundle->mapping_size);
+  }
+  free(bundle->dbs);
+  free(bundle->view_places);
+  free(bundle);
+}
@@ -0,0 +1,99 @@
+#ifndef HM_BUNDLE_H
+#define HM_BUNDLE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "common.h"
+#include "database.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Bundle is a file with multiple named databases of any types, e.g. a static
+// map and several sets making up one policy. It starts with a header and a
+// table of contents followed by images of the databases (see hm_*_image_write)
+// at 64 byte aligned offsets, so all of them are used in place from a single
+// mapping. The header and the table of contents are protected by CRC-32C and
+// each image has its own CRC-32C. Like images, bundles can be used on
+// machines with the same endianess.
+
+// HM_BUNDLE_NAME_SIZE is the max length of a database name in a bundle
+// including the terminating zero byte.
+#define HM_BUNDLE_NAME_SIZE 40
+
+// hm_bundle_entry_t is a database to put into a bundle.
+typedef struct hm_bundle_entry {
+  const char *name;
+  hm_db_type_t type;
+  const void *db;
+} hm_bundle_entry_t;
+
+// hm_bundle_size sets size to the size of the bundle with the databases.
+// Returns HM_ERROR_BAD_VALUE if some name is empty, too long or repeated or
+// some type is unknown.
+hm_error_t HM_CDECL hm_bundle_size(size_t *size,
+                                   const hm_bundle_entry_t *entries,
+                                   size_t count);
+
+// hm_bundle_write writes the bundle to buffer, which must be 8 byte aligned
+// and of the size returned by hm_bundle_size.
+hm_error_t HM_CDECL hm_bundle_write(char *buffer, size_t buffer_size,
+                                    const hm_bundle_entry_t *entries,
+                                    size_t count);
+
+// hm_bundle_write_file writes the bundle to the file atomically: it is written
+// to a temporary file in the same directory, synced and renamed over path.
+// Readers opening path see either the old bundle or the new one.
+hm_error_t HM_CDECL hm_bundle_write_file(const char *path,
+                                         const hm_bundle_entry_t *entries,
+                                         size_t count);
+
+struct hm_bundle;
+
+// hm_bundle_t is an opened bundle with databases ready for lookups. All of
+// them can be replaced at once by storing hm_bundle_t in hm_handle_t (see
+// handle.h) and freeing the old bundle after hm_handle_swap returns it.
+typedef struct hm_bundle hm_bundle_t;
+
+// hm_bundle_open maps the file read-only and creates views of its databases.
+// The header and the table of contents are always checked. If verify is set,
+// checksums of all images are checked as well, which reads the whole file.
+// Returns HM_ERROR_BAD_FORMAT or HM_ERROR_BAD_CHECKSUM if the file is not a
+// valid bundle.
+hm_error_t HM_CDECL hm_bundle_open(hm_bundle_t **bundle_ptr, const char *path,
+                                   bool verify);
+
+// hm_bundle_view is hm_bundle_open working with a bundle in memory. buffer
+// must be 64 byte aligned and must outlive the bundle.
+hm_error_t HM_CDECL hm_bundle_view(hm_bundle_t **bundle_ptr,
+                                   const char *buffer, size_t buffer_size,
+                                   bool verify);
+
+// hm_bundle_count returns the number of databases in the bundle.
+size_t HM_CDECL hm_bundle_count(const hm_bundle_t *bundle);
+
+// hm_bundle_name returns the name of database i.
+const char *HM_CDECL hm_bundle_name(const hm_bundle_t *bundle, size_t i);
+
+// hm_bundle_type returns the type of database i.
+hm_db_type_t HM_CDECL hm_bundle_type(const hm_bundle_t *bundle, size_t i);
+
+// hm_bundle_db returns database i. Cast it to the structure of its type.
+const void *HM_CDECL hm_bundle_db(const hm_bundle_t *bundle, size_t i);
+
+// hm_bundle_find returns the database with the given name and type or NULL if
+// there is no such database.
+const void *HM_CDECL hm_bundle_find(const hm_bundle_t *bundle,
+                                    const char *name, hm_db_type_t type);
+
+// hm_bundle_free frees the bundle and unmaps its file.
+void HM_CDECL hm_bundle_free(hm_bundle_t *bundle);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif // HM_BUNDLE_H
@@ -2,6 +2,7 @@
 #include <stdio.h>
 
 #include "cache.h"
+#include "dispatch.h"
 
 #ifdef NDEBUG
 #define debugf(fmt, ...)                                                       \
@@ -36,6 +37,9 @@ typedef struct hm_cache {
 
   uint32_t capacity;
 
+  // Number of IPs in the list.
+  uint32_t size;
+
   // list_storage is an array used to store elements of both the list and the
   // free list. Each element belongs either to the list or to the free list.
   hm_cache_element_t *list_storage;
@@ -354,6 +358,7 @@ hm_error_t HM_CDECL hm_cache_init(char *cache_place, size_t cache_place_size,
 
   cache->mask_for_hash = hash_table_capacity - 1;
   cache->capacity = capacity;
+  cache->size = 0;
 
   // Put NO_INDEX into all hash_table elements.
   for (uint64_t i = 0; i < hash_table_capacity; i++) {
@@ -422,6 +427,7 @@ void HM_CDECL hm_cache_add(hm_cache_t *cache, const uint32_t ip,
 
     // No element was evicted.
     *evicted = false;
+    cache->size++;
   }
 
   // Insert the element into the list as the newest.
@@ -456,6 +462,7 @@ void HM_CDECL hm_cache_remove(hm_cache_t *cache, const uint32_t ip,
 
   // Add the element to the free list.
   set_head(cache->list_storage, &cache->free_nodes, index);
+  cache->size--;
 
   // Remove the element from the hash table.
   table_delete(cache, ip);
@@ -482,6 +489,27 @@ bool HM_CDECL hm_cache_has(hm_cache_t *cache, const uint32_t ip,
   return true;
 }
 
+HM_PUBLIC_API
+void HM_CDECL hm_cache_has_batch(hm_cache_t *cache, const uint32_t *ips,
+                                 bool *exists, uint32_t *values,
+                                 size_t count) {
+  uint32_t mask = cache->mask_for_hash;
+  for (size_t start = 0; start < count; start += HM_BATCH_BLOCK) {
+    size_t n = count - start;
+    if (n > HM_BATCH_BLOCK) {
+      n = HM_BATCH_BLOCK;
+    }
+    for (size_t i = 0; i < n; i++) {
+      __builtin_prefetch(cache->hash_table + (hash32(ips[start + i]) & mask));
+    }
+    for (size_t i = 0; i < n; i++) {
+      uint32_t value = 0;
+      exists[start + i] = hm_cache_has(cache, ips[start + i], &value);
+      values[start + i] = value;
+    }
+  }
+}
+
 HM_PUBLIC_API
 void HM_CDECL hm_cache_dump(hm_cache_t *cache, uint32_t *ips, size_t *ips_len) {
 
@@ -530,6 +558,7 @@ void HM_CDECL hm_cache_dump(hm_cache_t *cache, uint32_t *ips, size_t *ips_len) {
   assert(list_size == list_size2);
   assert(free_list_size == free_list_size2);
   assert(list_size + free_list_size == cache->capacity);
+  assert(list_size == cache->size);
 
   // Make sure the hash table and the list are consistent.
   for (uint32_t i = cache->nodes.head_index; i != NO_INDEX;
@@ -552,3 +581,55 @@ void HM_CDECL hm_cache_dump(hm_cache_t *cache, uint32_t *ips, size_t *ips_len) {
 
   *ips_len = used;
 }
+
+HM_PUBLIC_API
+void HM_CDECL hm_cache_iter_init(const hm_cache_t *cache,
+                                 hm_cache_iter_t *iter) {
+  iter->index = cache->nodes.head_index;
+}
+
+HM_PUBLIC_API
+size_t HM_CDECL hm_cache_iterate(const hm_cache_t *cache, hm_cache_iter_t *iter,
+                                 uint32_t *ips, uint32_t *values,
+                                 size_t count) {
+  size_t used = 0;
+  uint32_t i = iter->index;
+  for (; i != NO_INDEX && used < count;
+       i = cache->list_storage[i].next_index) {
+    ips[used] = cache->list_storage[i].ip;
+    values[used] = cache->list_storage[i].value;
+    used++;
+  }
+  iter->index = i;
+  return used;
+}
+
+HM_PUBLIC_API
+void HM_CDECL hm_cache_stats(const hm_cache_t *cache, hm_cache_stats_t *stats) {
+  uint64_t hash_table_capacity = (uint64_t)(cache->mask_for_hash) + 1;
+
+  *stats = (hm_cache_stats_t){0};
+  stats->capacity = cache->capacity;
+  stats->size = cache->size;
+  stats->hash_table_capacity = hash_table_capacity;
+
+  // Distance from the start bucket of an IP to the bucket where it is stored.
+  for (uint64_t bucket = 0; bucket < hash_table_capacity; bucket++) {
+    uint32_t index = cache->hash_table[bucket];
+    if (index == NO_INDEX) {
+      continue;
+    }
+    uint32_t ip = cache->list_storage[index].ip;
+    uint32_t start = hash32(ip) & cache->mask_for_hash;
+    size_t probe = ((bucket - start) & cache->mask_for_hash) + 1;
+    if (probe > stats->longest_probe) {
+      stats->longest_probe = probe;
+    }
+  }
+
+  stats->header_bytes = sizeof(hm_cache_t);
+  stats->list_storage_bytes = sizeof(hm_cache_element_t) * cache->capacity;
+  stats->hash_table_bytes = sizeof(uint32_t) * hash_table_capacity;
+  stats->total_bytes = stats->header_bytes + stats->list_storage_bytes +
+                       stats->hash_table_bytes;
+}
@@ -15,6 +15,34 @@ struct hm_cache;
 // hm_database_t is in-memory cache type.
 typedef struct hm_cache hm_cache_t;
 
+// hm_cache_iter_t is the position of hm_cache_iterate in the list.
+typedef struct hm_cache_iter {
+  uint32_t index;
+} hm_cache_iter_t;
+
+// hm_cache_stats_t describes the fill and memory usage of a cache.
+typedef struct hm_cache_stats {
+  // Maximum number of IPs stored in the cache.
+  size_t capacity;
+
+  // Number of IPs currently stored in the cache.
+  size_t size;
+
+  // Number of buckets in the hash table. Depends on capacity and speed.
+  size_t hash_table_capacity;
+
+  // Maximum number of hash table buckets visited to find a stored IP.
+  size_t longest_probe;
+
+  // Bytes used by the cache struct, the linked list and the hash table.
+  size_t header_bytes;
+  size_t list_storage_bytes;
+  size_t hash_table_bytes;
+
+  // Sum of the above. cache_place also has up to 8 bytes for alignment.
+  size_t total_bytes;
+} hm_cache_stats_t;
+
 // hm_cache_place_size calculates cache_place size (bytes).
 // capacity must be a power of 2, at least 2.
 // Result is written to cache_place_size.
@@ -52,12 +80,35 @@ void HM_CDECL hm_cache_remove(hm_cache_t *cache, const uint32_t ip,
 bool HM_CDECL hm_cache_has(hm_cache_t *cache, const uint32_t ip,
                            uint32_t *value);
 
+// hm_cache_has_batch calls hm_cache_has for count IPs in order, stores if
+// ips[i] is in the cache to exists[i] and its value (or 0) to values[i].
+// Hash table buckets of neighbouring IPs are prefetched together, so their
+// cache misses overlap.
+void HM_CDECL hm_cache_has_batch(hm_cache_t *cache, const uint32_t *ips,
+                                 bool *exists, uint32_t *values, size_t count);
+
 // hm_cache_dump checks consistency of internal structures and dumps the linked
 // list, from neweset to oldest. ips_len should point to the size of ips array,
 // it must be greater or equal to capacity. It is modified by the function to
 // the actual length of the dumped list.
 void HM_CDECL hm_cache_dump(hm_cache_t *cache, uint32_t *ips, size_t *ips_len);
 
+// hm_cache_iter_init starts iteration of the list, from newest to oldest.
+void HM_CDECL hm_cache_iter_init(const hm_cache_t *cache,
+                                 hm_cache_iter_t *iter);
+
+// hm_cache_iterate stores up to count next IPs and their values in the list to
+// ips and values and returns how many were stored, 0 at the end of the list.
+// Unlike hm_cache_dump, it does not check consistency of the cache, so it can
+// be used for periodic export in production. The cache must not be modified
+// until the iteration is finished.
+size_t HM_CDECL hm_cache_iterate(const hm_cache_t *cache, hm_cache_iter_t *iter,
+                                 uint32_t *ips, uint32_t *values, size_t count);
+
+// hm_cache_stats fills stats of the cache. It walks the whole hash table, so
+// it is not intended for hot paths.
+void HM_CDECL hm_cache_stats(const hm_cache_t *cache, hm_cache_stats_t *stats);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
@@ -1,6 +1,8 @@
 #ifndef HM_COMMON_H
 #define HM_COMMON_H
 
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -42,6 +44,42 @@ typedef int hm_error_t;
 // HM_ERROR_BAD_SIZE is returned if size value is incorrect.
 #define HM_ERROR_BAD_SIZE (6)
 
+// HM_ERROR_NO_MEMORY is returned if the system failed to provide memory.
+#define HM_ERROR_NO_MEMORY (7)
+
+// HM_ERROR_SYSTEM is returned if a system call failed. errno has the reason.
+#define HM_ERROR_SYSTEM (8)
+
+// HM_ERROR_NO_DATABASE is returned if there is no database to attach to.
+#define HM_ERROR_NO_DATABASE (9)
+
+// HM_ERROR_BAD_FORMAT is returned if the data is not in the expected format,
+// e.g. it has wrong magic or unsupported version.
+#define HM_ERROR_BAD_FORMAT (10)
+
+// HM_ERROR_BAD_CHECKSUM is returned if the checksum of the data does not
+// match, i.e. the data is corrupted.
+#define HM_ERROR_BAD_CHECKSUM (11)
+
+// HM_ERROR_CLOSED is returned if the shared memory segment was closed by its
+// publisher, see shm.h.
+#define HM_ERROR_CLOSED (12)
+
+// HM_FD_HEADER_MAX_SIZE is the max size of the beginning of a serialized db
+// kept in hm_fd_header_t.
+#define HM_FD_HEADER_MAX_SIZE 96
+
+// hm_fd_header_t is the beginning of a serialized db read from a file
+// descriptor by hm_*_db_place_size_from_fd and hm_db_serialized_type_fd. It is
+// passed to the next of these calls and to hm_*_deserialize_fd, which read
+// the rest of the db after it, so the fd is read once from start to end and
+// can be a pipe or a socket. Zero it before the first call.
+typedef struct hm_fd_header {
+  // size is the number of bytes of data read so far.
+  uint64_t size;
+  char data[HM_FD_HEADER_MAX_SIZE];
+} hm_fd_header_t;
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
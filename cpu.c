@@ -0,0 +1,62 @@
+#include "cpu.h"
+#include "dispatch.h"
+
+// Bit set in detected_features after the detection has run.
+#define DETECTED (1u << 31)
+
+static unsigned int detected_features = 0;
+static unsigned int features_mask = ~0u;
+
+static unsigned int detect(void) {
+  unsigned int features = 0;
+#ifdef HM_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse4.2")) {
+    features |= HM_CPU_SSE42;
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    features |= HM_CPU_AVX2;
+  }
+  if (__builtin_cpu_supports("bmi") && __builtin_cpu_supports("bmi2")) {
+    features |= HM_CPU_BMI2;
+  }
+  if (__builtin_cpu_supports("avx512f") &&
+      __builtin_cpu_supports("avx512bw") &&
+      __builtin_cpu_supports("avx512vl")) {
+    features |= HM_CPU_AVX512;
+  }
+#endif
+  return features;
+}
+
+HM_PUBLIC_API
+unsigned int HM_CDECL hm_cpu_features(void) {
+  // Detection is idempotent, so concurrent first calls are harmless.
+  unsigned int features = __atomic_load_n(&detected_features, __ATOMIC_RELAXED);
+  if (!(features & DETECTED)) {
+    features = detect() | DETECTED;
+    __atomic_store_n(&detected_features, features, __ATOMIC_RELAXED);
+  }
+  return features & ~DETECTED &
+         __atomic_load_n(&features_mask, __ATOMIC_RELAXED);
+}
+
+HM_PUBLIC_API
+void HM_CDECL hm_cpu_set_features_mask(unsigned int mask) {
+  __atomic_store_n(&features_mask, mask, __ATOMIC_RELAXED);
+}
+
+hm_kernel_level_t hm_kernel_level(void) {
+  unsigned int features = hm_cpu_features();
+  if ((features & HM_CPU_AVX512) && (features & HM_CPU_AVX2) &&
+      (features & HM_CPU_BMI2)) {
+    return HM_KERNEL_AVX512;
+  }
+  if ((features & HM_CPU_AVX2) && (features & HM_CPU_BMI2)) {
+    return HM_KERNEL_AVX2;
+  }
+  if (features & HM_CPU_SSE42) {
+    return HM_KERNEL_SSE42;
+  }
+  return HM_KERNEL_PORTABLE;
+}
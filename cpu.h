@@ -0,0 +1,38 @@
+#ifndef HM_CPU_H
+#define HM_CPU_H
+
+#include "common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Instruction set extensions used by lookup kernels.
+
+// HM_CPU_SSE42 means SSE4.2 is available.
+#define HM_CPU_SSE42 (1 << 0)
+
+// HM_CPU_AVX2 means AVX2 is available.
+#define HM_CPU_AVX2 (1 << 1)
+
+// HM_CPU_BMI2 means BMI1 and BMI2 are available.
+#define HM_CPU_BMI2 (1 << 2)
+
+// HM_CPU_AVX512 means AVX-512 F, BW and VL are available.
+#define HM_CPU_AVX512 (1 << 3)
+
+// hm_cpu_features returns the set of HM_CPU_* flags detected on the current
+// CPU and not disabled by hm_cpu_set_features_mask. Detection runs once.
+unsigned int HM_CDECL hm_cpu_features(void);
+
+// hm_cpu_set_features_mask limits the features used by hipermap to the given
+// mask of HM_CPU_* flags. Pass 0 to use portable code only and ~0 to restore
+// the default. Lookup kernels are selected when a database is compiled or
+// deserialized, so the mask affects only databases created after the call.
+void HM_CDECL hm_cpu_set_features_mask(unsigned int mask);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif // HM_CPU_H
@@ -0,0 +1,28 @@
+#ifndef HM_CRC32C_H
+#define HM_CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// hm_crc32c returns CRC-32C (Castagnoli) of data continuing the checksum crc
+// of the preceding bytes. Pass 0 as crc for the first chunk. It uses the
+// crc32 instruction of SSE4.2 if hm_cpu_features reports it.
+uint32_t HM_CDECL hm_crc32c(uint32_t crc, const void *data, size_t size);
+
+// hm_crc32c_combine returns CRC-32C of two concatenated parts from crc1 of
+// the first part and crc2 and size2 of the second part, so parts can be
+// checksummed in parallel. It takes O(log(size2)) steps.
+uint32_t HM_CDECL hm_crc32c_combine(uint32_t crc1, uint32_t crc2,
+                                    size_t size2);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif // HM_CRC32C_H
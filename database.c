@@ -0,0 +1,242 @@
+#include "database.h"
+
+#include "format.h"
+#include "static_map.h"
+#include "static_uint64_map.h"
+#include "static_uint64_set.h"
+
+HM_PUBLIC_API
+const char *HM_CDECL hm_db_type_name(hm_db_type_t type) {
+  switch (type) {
+  case HM_DB_SM:
+    return "sm";
+  case HM_DB_U64:
+    return "u64";
+  case HM_DB_U64MAP:
+    return "u64map";
+  }
+  return NULL;
+}
+
+HM_PUBLIC_API
+size_t HM_CDECL hm_db_serialized_size(hm_db_type_t type, const void *db) {
+  switch (type) {
+  case HM_DB_SM:
+    return hm_sm_serialized_size(db);
+  case HM_DB_U64:
+    return hm_u64_serialized_size(db);
+  case HM_DB_U64MAP:
+    return hm_u64map_serialized_size(db);
+  }
+  return 0;
+}
+
+HM_PUBLIC_API
+hm_error_t HM_CDECL hm_db_serialize(hm_db_type_t type, char *buffer,
+                                    size_t buffer_size, const void *db) {
+  switch (type) {
+  case HM_DB_SM:
+    return hm_sm_serialize(buffer, buffer_size, db);
+  case HM_DB_U64:
+    return hm_u64_serialize(buffer, buffer_size, db);
+  case HM_DB_U64MAP:
+    return hm_u64map_serialize(buffer, buffer_size, db);
+  }
+  return HM_ERROR_BAD_VALUE;
+}
+
+HM_PUBLIC_API
+hm_error_t HM_CDECL hm_db_serialized_type(hm_db_type_t *type,
+                                          const char *buffer,
+                                          size_t buffer_size) {
+  uint32_t type32;
+  hm_error_t hm_err = hm_format_read_type(buffer, buffer_size, &type32);
+  if (hm_err != HM_SUCCESS) {
+    return hm_err;
+  }
+  if (hm_db_type_name((hm_db_type_t)type32) == NULL) {
+    return HM_ERROR_BAD_FORMAT;
+  }
+  *type = (hm_db_type_t)type32;
+  return HM_SUCCESS;
+}
+
+HM_PUBLIC_API
+hm_error_t HM_CDECL hm_db_place_size_from_serialized(hm_db_type_t type,
+                                                     size_t *db_place_size,
+                                                     const char *buffer,
+                                                     size_t buffer_size) {
+  switch (type) {
+  case HM_DB_SM:
+    return hm_sm_db_place_size_from_serialized(db_place_size, buffer,
+                                               buffer_size);
+  case HM_DB_U64:
+    return hm_u64_db_place_size_from_serialized(db_place_size, buffer,
+                                                buffer_size);
+  case HM_DB_U64MAP:
+    return hm_u64map_db_place_size_from_serialized(db_place_size, buffer,
+                                                   buffer_size);
+  }
+  return HM_ERROR_BAD_VALUE;
+}
+
+HM_PUBLIC_API
+hm_error_t HM_CDECL hm_db_deserialize(hm_db_type_t type, char *db_place,
+                                      size_t db_place_size, void **db_ptr,
+                                      const char *buffer, size_t buffer_size) {
+  switch (type) {
+  case HM_DB_SM:
+    return hm_sm_deserialize(db_place, db_place_size,
+                             (hm_sm_database_t **)db_ptr, buffer, buffer_size);
+  case HM_DB_U64:
+    return hm_u64_deserialize(db_place, db_place_size,
+                              (hm_u64_database_t **)db_ptr, buffer,
+                              buffer_size);
+  case HM_DB_U64MAP:
+    return hm_u64map_deserialize(db_place, db_place_size,
+                                 (hm_u64map_database_t **)db_ptr, buffer,
+                                 buffer_size);
+  }
+  return HM_ERROR_BAD_VALUE;
+}
+
+HM_PUBLIC_API
+hm_error_t HM_CDECL hm_db_deserialize_ex(hm_db_type_t type, char *db_place,
+                                         size_t db_place_size, void **db_ptr,
+                                         const char *buffer,
+                                         size_t buffer_size,
+                                         const hm_load_options_t *options) {
+  switch (type) {
+  case HM_DB_SM:
+    return hm_sm_deserialize_ex(db_place, db_place_size,
+                                (hm_sm_database_t **)db_ptr, buffer,
+                                buffer_size, options);
+  case HM_DB_U64:
+    return hm_u64_deserialize_ex(db_place, db_place_size,
+                                 (hm_u64_database_t **)db_ptr, buffer,
+                                 buffer_size, options);
+  case HM_DB_U64MAP:
+    return hm_u64map_deserialize_ex(db_place, db_place_size,
+                                    (hm_u64map_database_t **)db_ptr, buffer,
+                                    buffer_size, options);
+  }
+  return HM_ERROR_BAD_VALUE;
+}
+
+HM_PUBLIC_API
+hm_error_t HM_CDECL hm_db_serialize_fd(hm_db_type_t type, int fd,
+                                       const void *db) {
+  switch (type) {
+  case HM_DB_SM:
+    return hm_sm_serialize_fd(fd, db);
+  case HM_DB_U64:
+    return hm_u64_serialize_fd(fd, db);
+  case HM_DB_U64MAP:
+    return hm_u64map_serialize_fd(fd, db);
+  }
+  return HM_ERROR_BAD_VALUE;
+}
+
+HM_PUBLIC_API
+hm_error_t HM_CDECL hm_db_serialized_type_fd(hm_db_type_t *type,
+                                             hm_fd_header_t *header, int fd) {
+  hm_error_t hm_err =
+      hm_format_fill_header_fd(fd, header, HM_FORMAT_HEADER_SIZE);
+  if (hm_err != HM_SUCCESS) {
+    return hm_err;
+  }
+  return hm_db_serialized_type(type, header->data, HM_FORMAT_HEADER_SIZE);
+}
+
+HM_PUBLIC_API
+hm_error_t HM_CDECL hm_db_place_size_from_fd(hm_db_type_t type,
+                                             size_t *db_place_size,
+                                             hm_fd_header_t *header, int fd) {
+  switch (type) {
+  case HM_DB_SM:
+    return hm_sm_db_place_size_from_fd(db_place_size, header, fd);
+  case HM_DB_U64:
+    return hm_u64_db_place_size_from_fd(db_place_size, header, fd);
+  case HM_DB_U64MAP:
+    return hm_u64map_db_place_size_from_fd(db_place_size, header, fd);
+  }
+  return HM_ERROR_BAD_VALUE;
+}
+
+HM_PUBLIC_API
+hm_error_t HM_CDECL hm_db_deserialize_fd(hm_db_type_t type, char *db_place,
+                                         size_t db_place_size, void **db_ptr,
+                                         hm_fd_header_t *header, int fd) {
+  switch (type) {
+  case HM_DB_SM:
+    return hm_sm_deserialize_fd(db_place, db_place_size,
+                                (hm_sm_database_t **)db_ptr, header, fd);
+  case HM_DB_U64:
+    return hm_u64_deserialize_fd(db_place, db_place_size,
+                                 (hm_u64_database_t **)db_ptr, header, fd);
+  case HM_DB_U64MAP:
+    return hm_u64map_deserialize_fd(db_place, db_place_size,
+                                    (hm_u64map_database_t **)db_ptr, header,
+                                    fd);
+  }
+  return HM_ERROR_BAD_VALUE;
+}
+
+HM_PUBLIC_API
+size_t HM_CDECL hm_db_image_size(hm_db_type_t type, const void *db) {
+  switch (type) {
+  case HM_DB_SM:
+    return hm_sm_image_size(db);
+  case HM_DB_U64:
+    return hm_u64_image_size(db);
+  case HM_DB_U64MAP:
+    return hm_u64map_image_size(db);
+  }
+  return 0;
+}
+
+HM_PUBLIC_API
+hm_error_t HM_CDECL hm_db_image_write(hm_db_type_t type, char *image,
+                                      size_t image_size, const void *db) {
+  switch (type) {
+  case HM_DB_SM:
+    return hm_sm_image_write(image, image_size, db);
+  case HM_DB_U64:
+    return hm_u64_image_write(image, image_size, db);
+  case HM_DB_U64MAP:
+    return hm_u64map_image_write(image, image_size, db);
+  }
+  return HM_ERROR_BAD_VALUE;
+}
+
+HM_PUBLIC_API
+size_t HM_CDECL hm_db_view_place_size(hm_db_type_t type) {
+  switch (type) {
+  case HM_DB_SM:
+    return hm_sm_view_place_size();
+  case HM_DB_U64:
+    return hm_u64_view_place_size();
+  case HM_DB_U64MAP:
+    return hm_u64map_view_place_size();
+  }
+  return 0;
+}
+
+HM_PUBLIC_API
+hm_error_t HM_CDECL hm_db_image_view(hm_db_type_t type, char *view_place,
+                                     size_t view_place_size, void **db_ptr,
+                                     const char *image, size_t image_size) {
+  switch (type) {
+  case HM_DB_SM:
+    return hm_sm_image_view(view_place, view_place_size,
+                            (hm_sm_database_t **)db_ptr, image, image_size);
+  case HM_DB_U64:
+    return hm_u64_image_view(view_place, view_place_size,
+                             (hm_u64_database_t **)db_ptr, image, image_size);
+  case HM_DB_U64MAP:
+    return hm_u64map_image_view(view_place, view_place_size,
+                                (hm_u64map_database_t **)db_ptr, image,
+                                image_size);
+  }
+  return HM_ERROR_BAD_VALUE;
+}
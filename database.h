@@ -0,0 +1,105 @@
+#ifndef HM_DATABASE_H
+#define HM_DATABASE_H
+
+#include <stddef.h>
+
+#include "common.h"
+#include "load.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Functions working with databases of any type. db arguments are pointers to
+// hm_sm_database_t, hm_u64_database_t or hm_u64map_database_t according to
+// the type.
+
+// hm_db_type_t is the type of a database.
+typedef enum hm_db_type {
+  // hm_sm_database_t, see static_map.h.
+  HM_DB_SM = 1,
+
+  // hm_u64_database_t, see static_uint64_set.h.
+  HM_DB_U64 = 2,
+
+  // hm_u64map_database_t, see static_uint64_map.h.
+  HM_DB_U64MAP = 3,
+} hm_db_type_t;
+
+// hm_db_type_name returns human readable name of the database type or NULL
+// if the type is unknown.
+const char *HM_CDECL hm_db_type_name(hm_db_type_t type);
+
+// hm_db_serialized_size calls hm_*_serialized_size for the type.
+size_t HM_CDECL hm_db_serialized_size(hm_db_type_t type, const void *db);
+
+// hm_db_serialize calls hm_*_serialize for the type.
+hm_error_t HM_CDECL hm_db_serialize(hm_db_type_t type, char *buffer,
+                                    size_t buffer_size, const void *db);
+
+// hm_db_serialized_type sets type to the type of the serialized database.
+// It checks the header of the buffer only.
+hm_error_t HM_CDECL hm_db_serialized_type(hm_db_type_t *type,
+                                          const char *buffer,
+                                          size_t buffer_size);
+
+// hm_db_place_size_from_serialized calls hm_*_db_place_size_from_serialized
+// for the type.
+hm_error_t HM_CDECL hm_db_place_size_from_serialized(hm_db_type_t type,
+                                                     size_t *db_place_size,
+                                                     const char *buffer,
+                                                     size_t buffer_size);
+
+// hm_db_deserialize calls hm_*_deserialize for the type.
+hm_error_t HM_CDECL hm_db_deserialize(hm_db_type_t type, char *db_place,
+                                      size_t db_place_size, void **db_ptr,
+                                      const char *buffer, size_t buffer_size);
+
+// hm_db_deserialize_ex calls hm_*_deserialize_ex for the type.
+hm_error_t HM_CDECL hm_db_deserialize_ex(hm_db_type_t type, char *db_place,
+                                         size_t db_place_size, void **db_ptr,
+                                         const char *buffer,
+                                         size_t buffer_size,
+                                         const hm_load_options_t *options);
+
+// hm_db_serialize_fd calls hm_*_serialize_fd for the type.
+hm_error_t HM_CDECL hm_db_serialize_fd(hm_db_type_t type, int fd,
+                                       const void *db);
+
+// hm_db_serialized_type_fd is hm_db_serialized_type for the db serialized to
+// fd. It reads the header of the db from the current position of fd and keeps
+// it in header, which is passed to hm_db_place_size_from_fd then.
+hm_error_t HM_CDECL hm_db_serialized_type_fd(hm_db_type_t *type,
+                                             hm_fd_header_t *header, int fd);
+
+// hm_db_place_size_from_fd calls hm_*_db_place_size_from_fd for the type.
+hm_error_t HM_CDECL hm_db_place_size_from_fd(hm_db_type_t type,
+                                             size_t *db_place_size,
+                                             hm_fd_header_t *header, int fd);
+
+// hm_db_deserialize_fd calls hm_*_deserialize_fd for the type.
+hm_error_t HM_CDECL hm_db_deserialize_fd(hm_db_type_t type, char *db_place,
+                                         size_t db_place_size, void **db_ptr,
+                                         hm_fd_header_t *header, int fd);
+
+// hm_db_image_size calls hm_*_image_size for the type.
+size_t HM_CDECL hm_db_image_size(hm_db_type_t type, const void *db);
+
+// hm_db_image_write calls hm_*_image_write for the type.
+hm_error_t HM_CDECL hm_db_image_write(hm_db_type_t type, char *image,
+                                      size_t image_size, const void *db);
+
+// hm_db_view_place_size calls hm_*_view_place_size for the type.
+size_t HM_CDECL hm_db_view_place_size(hm_db_type_t type);
+
+// hm_db_image_view calls hm_*_image_view for the type. Images of all types
+// are valid if they are 64 byte aligned.
+hm_error_t HM_CDECL hm_db_image_view(hm_db_type_t type, char *view_place,
+                                     size_t view_place_size, void **db_ptr,
+                                     const char *image, size_t image_size);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif // HM_DATABASE_H
@@ -0,0 +1,44 @@
+#ifndef HM_DISPATCH_H
+#define HM_DISPATCH_H
+
+// Internal helpers for runtime selection of lookup kernels. Not installed.
+//
+// Each structure compiles one kernel per level using function-level target
+// attributes, so the library itself is built for baseline x86-64 and the best
+// kernel is picked at runtime. The chosen kernel table is stored in the
+// database struct when it is compiled or deserialized.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HM_X86 1
+#include <immintrin.h>
+#define HM_TARGET_SSE42 __attribute__((target("sse4.2")))
+#define HM_TARGET_AVX2 __attribute__((target("avx2,bmi,bmi2")))
+#define HM_TARGET_AVX512                                                       \
+  __attribute__((target("avx512f,avx512bw,avx512vl,avx2,bmi,bmi2")))
+#endif
+
+#define HM_ALWAYS_INLINE inline __attribute__((always_inline))
+
+// Number of keys processed per block in batch lookups. Buckets of the whole
+// block are prefetched before the first probe.
+#define HM_BATCH_BLOCK 16
+
+typedef enum hm_kernel_level {
+  HM_KERNEL_PORTABLE = 0,
+  HM_KERNEL_SSE42 = 1,
+  HM_KERNEL_AVX2 = 2,
+  HM_KERNEL_AVX512 = 3,
+} hm_kernel_level_t;
+
+// hm_kernel_level returns the best kernel level allowed by hm_cpu_features.
+hm_kernel_level_t hm_kernel_level(void);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif // HM_DISPATCH_H
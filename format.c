@@ -0,0 +1,401 @@
+#include "format.h"
+
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "crc32c.h"
+
+// "hipermap" in little endian.
+#define MAGIC 0x70616d7265706968ull
+
+// Version of the format, incremented on incompatible changes.
+#define FORMAT_VERSION 1
+
+// Version of the image form, incremented on incompatible changes.
+#define IMAGE_VERSION 1
+
+// Offsets of header fields.
+#define MAGIC_OFFSET 0
+#define VERSION_OFFSET 8
+#define TYPE_OFFSET 12
+#define PAYLOAD_SIZE_OFFSET 16
+#define PAYLOAD_CRC_OFFSET 24
+#define HEADER_CRC_OFFSET 60
+
+// Indices of uint64_t fields in the image header.
+#define IMAGE_MAGIC_INDEX 3
+#define IMAGE_VERSION_INDEX 4
+#define IMAGE_TYPE_INDEX 5
+
+// Size of chunks of payload converted to little endian on big endian
+// machines (bytes).
+#define CHUNK_SIZE (1 << 16)
+
+// Size of reads from a file descriptor, checksummed while in cache (bytes).
+#define READ_SIZE (1 << 20)
+
+// write_header writes the header with the given payload checksum.
+static void write_header(char *buffer, uint32_t type, size_t payload_size,
+                         uint32_t payload_crc) {
+  memset(buffer, 0, HM_FORMAT_HEADER_SIZE);
+  hm_store_le64(buffer + MAGIC_OFFSET, MAGIC);
+  hm_store_le32(buffer + VERSION_OFFSET, FORMAT_VERSION);
+  hm_store_le32(buffer + TYPE_OFFSET, type);
+  hm_store_le64(buffer + PAYLOAD_SIZE_OFFSET, payload_size);
+  hm_store_le32(buffer + PAYLOAD_CRC_OFFSET, payload_crc);
+  hm_store_le32(buffer + HEADER_CRC_OFFSET,
+                hm_crc32c(0, buffer, HEADER_CRC_OFFSET));
+}
+
+void hm_format_write_header(char *buffer, uint32_t type, size_t payload_size) {
+  write_header(buffer, type, payload_size,
+               hm_crc32c(0, buffer + HM_FORMAT_HEADER_SIZE, payload_size));
+}
+
+// check_header checks the fields common for all types.
+static hm_error_t check_header(const char *buffer, size_t buffer_size) {
+  if (buffer_size < HM_FORMAT_HEADER_SIZE ||
+      hm_load_le64(buffer + MAGIC_OFFSET) != MAGIC) {
+    return HM_ERROR_BAD_FORMAT;
+  }
+  if (hm_load_le32(buffer + HEADER_CRC_OFFSET) !=
+      hm_crc32c(0, buffer, HEADER_CRC_OFFSET)) {
+    return HM_ERROR_BAD_CHECKSUM;
+  }
+  if (hm_load_le32(buffer + VERSION_OFFSET) != FORMAT_VERSION) {
+    return HM_ERROR_BAD_FORMAT;
+  }
+  return HM_SUCCESS;
+}
+
+hm_error_t hm_format_read_header(const char *buffer, size_t buffer_size,
+                                 uint32_t type, bool check_payload,
+                                 const char **payload, size_t *payload_size) {
+  hm_error_t hm_err = check_header(buffer, buffer_size);
+  if (hm_err != HM_SUCCESS) {
+    return hm_err;
+  }
+  if (hm_load_le32(buffer + TYPE_OFFSET) != type) {
+    return HM_ERROR_BAD_FORMAT;
+  }
+  uint64_t size = hm_load_le64(buffer + PAYLOAD_SIZE_OFFSET);
+  if (size != buffer_size - HM_FORMAT_HEADER_SIZE) {
+    return HM_ERROR_BAD_SIZE;
+  }
+  if (check_payload &&
+      hm_load_le32(buffer + PAYLOAD_CRC_OFFSET) !=
+          hm_crc32c(0, buffer + HM_FORMAT_HEADER_SIZE, size)) {
+    return HM_ERROR_BAD_CHECKSUM;
+  }
+  *payload = buffer + HM_FORMAT_HEADER_SIZE;
+  *payload_size = size;
+  return HM_SUCCESS;
+}
+
+hm_error_t hm_format_read_type(const char *buffer, size_t buffer_size,
+                               uint32_t *type) {
+  hm_error_t hm_err = check_header(buffer, buffer_size);
+  if (hm_err != HM_SUCCESS) {
+    return hm_err;
+  }
+  *type = hm_load_le32(buffer + TYPE_OFFSET);
+  return HM_SUCCESS;
+}
+
+void hm_format_write_patch_header(char *payload, const char *old_buffer,
+                                  const char *new_buffer) {
+  hm_store_le32(payload, hm_load_le32(old_buffer + PAYLOAD_CRC_OFFSET));
+  hm_store_le32(payload + 4, hm_load_le32(new_buffer + PAYLOAD_CRC_OFFSET));
+  hm_store_le64(payload + 8, hm_load_le64(old_buffer + PAYLOAD_SIZE_OFFSET));
+  hm_store_le64(payload + 16, hm_load_le64(new_buffer + PAYLOAD_SIZE_OFFSET));
+}
+
+hm_error_t hm_format_read_patch_header(const char *payload,
+                                       size_t payload_size,
+                                       const char *old_buffer,
+                                       size_t *new_size) {
+  if (payload_size < HM_FORMAT_PATCH_HEADER_SIZE) {
+    return HM_ERROR_BAD_SIZE;
+  }
+  if (hm_load_le32(payload) != hm_load_le32(old_buffer + PAYLOAD_CRC_OFFSET) ||
+      hm_load_le64(payload + 8) !=
+          hm_load_le64(old_buffer + PAYLOAD_SIZE_OFFSET)) {
+    return HM_ERROR_BAD_VALUE;
+  }
+  uint64_t size = hm_load_le64(payload + 16);
+  if (size > SIZE_MAX - HM_FORMAT_HEADER_SIZE) {
+    return HM_ERROR_BAD_SIZE;
+  }
+  *new_size = HM_FORMAT_HEADER_SIZE + size;
+  return HM_SUCCESS;
+}
+
+hm_error_t hm_format_check_patched(const char *payload, const char *buffer) {
+  if (hm_load_le32(payload + 4) != hm_load_le32(buffer + PAYLOAD_CRC_OFFSET) ||
+      hm_load_le64(payload + 16) !=
+          hm_load_le64(buffer + PAYLOAD_SIZE_OFFSET)) {
+    return HM_ERROR_BAD_CHECKSUM;
+  }
+  return HM_SUCCESS;
+}
+
+// le_chunk returns n numbers of the segment starting from the number i in
+// little endian. On big endian machines it converts them to buf.
+static const char *le_chunk(const hm_format_segment_t *segment, size_t i,
+                            size_t n, char *buf) {
+  const char *src = (const char *)(segment->data) + i * segment->elem_size;
+#ifdef HM_BIG_ENDIAN
+  if (segment->elem_size == sizeof(uint32_t)) {
+    hm_store_le32_array(buf, (const uint32_t *)(src), n);
+  } else {
+    hm_store_le64_array(buf, (const uint64_t *)(src), n);
+  }
+  return buf;
+#else
+  (void)(n);
+  (void)(buf);
+  return src;
+#endif
+}
+
+// write_all writes the buffers to fd, resuming after partial writes.
+static hm_error_t write_all(int fd, struct iovec *iov, int count) {
+  while (count != 0) {
+    ssize_t n = writev(fd, iov, count);
+    if (n == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return HM_ERROR_SYSTEM;
+    }
+    while (count != 0 && (size_t)(n) >= iov->iov_len) {
+      n -= iov->iov_len;
+      iov++;
+      count--;
+    }
+    if (count != 0) {
+      iov->iov_base = (char *)(iov->iov_base) + n;
+      iov->iov_len -= n;
+    }
+  }
+  return HM_SUCCESS;
+}
+
+hm_error_t hm_format_write_fd(int fd, uint32_t type,
+                              const hm_format_segment_t *segments,
+                              size_t segment_count) {
+  if (segment_count > HM_FORMAT_MAX_SEGMENTS) {
+    return HM_ERROR_BAD_VALUE;
+  }
+#ifdef HM_BIG_ENDIAN
+  char buf[CHUNK_SIZE];
+#else
+  char *buf = NULL;
+#endif
+
+  // The header contains the checksum of the payload, so checksum it first.
+  size_t payload_size = 0;
+  uint32_t crc = 0;
+  for (size_t s = 0; s < segment_count; s++) {
+    const hm_format_segment_t *segment = &segments[s];
+    size_t chunk_count = CHUNK_SIZE / segment->elem_size;
+    for (size_t i = 0; i < segment->count; i += chunk_count) {
+      size_t n = segment->count - i;
+      if (n > chunk_count) {
+        n = chunk_count;
+      }
+      crc = hm_crc32c(crc, le_chunk(segment, i, n, buf),
+                      n * segment->elem_size);
+    }
+    payload_size += segment->count * segment->elem_size;
+  }
+
+  char header[HM_FORMAT_HEADER_SIZE];
+  write_header(header, type, payload_size, crc);
+  struct iovec iov[1 + HM_FORMAT_MAX_SEGMENTS];
+  iov[0].iov_base = header;
+  iov[0].iov_len = HM_FORMAT_HEADER_SIZE;
+  int count = 1;
+
+#ifdef HM_BIG_ENDIAN
+  hm_error_t hm_err = write_all(fd, iov, count);
+  if (hm_err != HM_SUCCESS) {
+    return hm_err;
+  }
+  for (size_t s = 0; s < segment_count; s++) {
+    const hm_format_segment_t *segment = &segments[s];
+    size_t chunk_count = CHUNK_SIZE / segment->elem_size;
+    for (size_t i = 0; i < segment->count; i += chunk_count) {
+      size_t n = segment->count - i;
+      if (n > chunk_count) {
+        n = chunk_count;
+      }
+      iov[0].iov_base = (void *)(le_chunk(segment, i, n, buf));
+      iov[0].iov_len = n * segment->elem_size;
+      hm_err = write_all(fd, iov, 1);
+      if (hm_err != HM_SUCCESS) {
+        return hm_err;
+      }
+    }
+  }
+  return HM_SUCCESS;
+#else
+  for (size_t s = 0; s < segment_count; s++) {
+    if (segments[s].count != 0) {
+      iov[count].iov_base = (void *)(segments[s].data);
+      iov[count].iov_len = segments[s].count * segments[s].elem_size;
+      count++;
+    }
+  }
+  return write_all(fd, iov, count);
+#endif
+}
+
+hm_error_t hm_format_read_all(int fd, char *buf, size_t size) {
+  while (size != 0) {
+    ssize_t n = read(fd, buf, size);
+    if (n == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return HM_ERROR_SYSTEM;
+    }
+    if (n == 0) {
+      return HM_ERROR_BAD_SIZE;
+    }
+    buf += n;
+    size -= n;
+  }
+  return HM_SUCCESS;
+}
+
+hm_error_t hm_format_fill_header_fd(int fd, hm_fd_header_t *header,
+                                    size_t size) {
+  if (size > HM_FD_HEADER_MAX_SIZE ||
+      header->size > HM_FD_HEADER_MAX_SIZE) {
+    return HM_ERROR_BAD_SIZE;
+  }
+  if (header->size >= size) {
+    return HM_SUCCESS;
+  }
+  hm_error_t hm_err = hm_format_read_all(fd, header->data + header->size,
+                                         size - header->size);
+  if (hm_err == HM_ERROR_BAD_SIZE) {
+    // The stream is shorter than any serialized db.
+    return HM_ERROR_BAD_FORMAT;
+  }
+  if (hm_err != HM_SUCCESS) {
+    return hm_err;
+  }
+  header->size = size;
+  return HM_SUCCESS;
+}
+
+hm_error_t hm_format_read_start_fd(int fd, uint32_t type,
+                                   hm_fd_header_t *header,
+                                   size_t payload_header_size,
+                                   size_t *payload_size, uint32_t *crc) {
+  // The header of the format is checked before reading the payload header,
+  // so a stream of another kind is not read further than needed.
+  hm_error_t hm_err = hm_format_fill_header_fd(fd, header,
+                                               HM_FORMAT_HEADER_SIZE);
+  if (hm_err != HM_SUCCESS) {
+    return hm_err;
+  }
+  hm_err = check_header(header->data, HM_FORMAT_HEADER_SIZE);
+  if (hm_err != HM_SUCCESS) {
+    return hm_err;
+  }
+  if (hm_load_le32(header->data + TYPE_OFFSET) != type) {
+    return HM_ERROR_BAD_FORMAT;
+  }
+  uint64_t size = hm_load_le64(header->data + PAYLOAD_SIZE_OFFSET);
+  if (size > SIZE_MAX - HM_FORMAT_HEADER_SIZE) {
+    return HM_ERROR_BAD_SIZE;
+  }
+  if (size < payload_header_size) {
+    return HM_ERROR_BAD_SIZE;
+  }
+  // The db starts where the bytes kept in header were read from. Streams
+  // have no size to check.
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    return HM_ERROR_SYSTEM;
+  }
+  off_t pos = lseek(fd, 0, SEEK_CUR);
+  if (S_ISREG(st.st_mode) && pos != -1 &&
+      (uint64_t)(st.st_size - (pos - header->size)) !=
+          HM_FORMAT_HEADER_SIZE + size) {
+    return HM_ERROR_BAD_SIZE;
+  }
+
+  hm_err = hm_format_fill_header_fd(
+      fd, header, HM_FORMAT_HEADER_SIZE + payload_header_size);
+  if (hm_err == HM_ERROR_BAD_FORMAT) {
+    return HM_ERROR_BAD_SIZE;
+  }
+  if (hm_err != HM_SUCCESS) {
+    return hm_err;
+  }
+  *payload_size = size;
+  *crc = hm_crc32c(0, header->data + HM_FORMAT_HEADER_SIZE,
+                   payload_header_size);
+  return HM_SUCCESS;
+}
+
+hm_error_t hm_format_read_fd(int fd, void *dst, size_t count,
+                             size_t elem_size, uint32_t *crc) {
+  char *p = (char *)(dst);
+  size_t size = count * elem_size;
+  while (size != 0) {
+    size_t n = size < READ_SIZE ? size : READ_SIZE;
+    hm_error_t hm_err = hm_format_read_all(fd, p, n);
+    if (hm_err != HM_SUCCESS) {
+      return hm_err;
+    }
+    *crc = hm_crc32c(*crc, p, n);
+    p += n;
+    size -= n;
+  }
+#ifdef HM_BIG_ENDIAN
+  for (size_t i = 0; i < count; i++) {
+    char *x = (char *)(dst) + i * elem_size;
+    if (elem_size == sizeof(uint32_t)) {
+      uint32_t v = hm_load_le32(x);
+      memcpy(x, &v, sizeof(v));
+    } else {
+      uint64_t v = hm_load_le64(x);
+      memcpy(x, &v, sizeof(v));
+    }
+  }
+#endif
+  return HM_SUCCESS;
+}
+
+hm_error_t hm_format_check_crc(const char *header, uint32_t crc) {
+  if (hm_load_le32(header + PAYLOAD_CRC_OFFSET) != crc) {
+    return HM_ERROR_BAD_CHECKSUM;
+  }
+  return HM_SUCCESS;
+}
+
+void hm_format_write_image_header(char *image, uint32_t type) {
+  uint64_t header[HM_FORMAT_IMAGE_HEADER_SIZE / sizeof(uint64_t)] = {0};
+  header[IMAGE_MAGIC_INDEX] = MAGIC;
+  header[IMAGE_VERSION_INDEX] = IMAGE_VERSION;
+  header[IMAGE_TYPE_INDEX] = type;
+  memcpy(image, header, sizeof(header));
+}
+
+hm_error_t hm_format_check_image_header(const char *image, uint32_t type) {
+  uint64_t header[HM_FORMAT_IMAGE_HEADER_SIZE / sizeof(uint64_t)];
+  memcpy(header, image, sizeof(header));
+  if (header[IMAGE_MAGIC_INDEX] != MAGIC ||
+      header[IMAGE_VERSION_INDEX] != IMAGE_VERSION ||
+      header[IMAGE_TYPE_INDEX] != type) {
+    return HM_ERROR_BAD_FORMAT;
+  }
+  return HM_SUCCESS;
+}
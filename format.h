@@ -0,0 +1,318 @@
+#ifndef HM_FORMAT_H
+#define HM_FORMAT_H
+
+// Internal helpers for the serialized form of databases. Not installed.
+//
+// Serialized databases of all types start with a 64 byte header:
+//   uint64_t magic "hipermap"
+//   uint32_t format version
+//   uint32_t database type (hm_db_type_t)
+//   uint64_t payload size
+//   uint32_t CRC-32C of the payload
+//   zeros
+//   uint32_t CRC-32C of the header before this field
+// followed by the payload specific to the type. All numbers in the header and
+// in the payload are little endian, so a database serialized on one machine
+// can be loaded on any other.
+//
+// Packed form (hm_*_pack) has the same header with HM_FORMAT_PACKED added to
+// the type and a compact payload made mostly of varints.
+//
+// Patch (hm_*_diff) has the same header with HM_FORMAT_PATCH added to the
+// type. Its payload starts with HM_FORMAT_PATCH_HEADER_SIZE bytes identifying
+// the serialized db it applies to and the one it produces:
+//   uint32_t payload CRC-32C of the old db
+//   uint32_t payload CRC-32C of the new db
+//   uint64_t payload size of the old db
+//   uint64_t payload size of the new db
+// followed by the changes specific to the type.
+//
+// hm_*_serialize_fd and hm_*_deserialize_fd stream the same serialized form
+// to and from a file descriptor without a buffer of the whole db. Writing
+// checksums the payload before writing it, so the header goes first, and
+// loading reads it sequentially right into db_place, so any stream can be
+// loaded.
+//
+// Images (hm_*_image_write) are used in place, so they are in host byte
+// order. They start with a 64 byte header of uint64_t:
+//   three fields specific to the type
+//   magic "hipermap"
+//   image version
+//   database type (hm_db_type_t)
+//   zeros
+// The magic is in host byte order too, so an image written on a machine
+// with another byte order is rejected like a file of another kind.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "common.h"
+#include "load.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// HM_FORMAT_HEADER_SIZE is the size of the header. Payload starts right
+// after it, so it is 64 byte aligned in a 64 byte aligned buffer.
+#define HM_FORMAT_HEADER_SIZE 64
+
+// HM_FORMAT_PACKED is added to the database type in headers of packed form.
+#define HM_FORMAT_PACKED 0x100
+
+// HM_FORMAT_PATCH is added to the database type in headers of patches.
+#define HM_FORMAT_PATCH 0x200
+
+// HM_FORMAT_PATCH_HEADER_SIZE is the size of the beginning of patch payload
+// identifying the old and the new db.
+#define HM_FORMAT_PATCH_HEADER_SIZE 24
+
+// HM_FORMAT_IMAGE_HEADER_SIZE is the size of the header of images. The
+// arrays of the db follow it, so they are 64 byte aligned in an aligned
+// image.
+#define HM_FORMAT_IMAGE_HEADER_SIZE 64
+
+// HM_FORMAT_MAX_SEGMENTS is the max number of segments in hm_format_write_fd.
+#define HM_FORMAT_MAX_SEGMENTS 8
+
+// HM_VARINT_MAX_SIZE is the max size of a varint encoding uint64.
+#define HM_VARINT_MAX_SIZE 10
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define HM_BIG_ENDIAN 1
+#endif
+
+static inline uint32_t hm_load_le32(const char *src) {
+  uint32_t x;
+  memcpy(&x, src, sizeof(x));
+#ifdef HM_BIG_ENDIAN
+  x = __builtin_bswap32(x);
+#endif
+  return x;
+}
+
+static inline uint64_t hm_load_le64(const char *src) {
+  uint64_t x;
+  memcpy(&x, src, sizeof(x));
+#ifdef HM_BIG_ENDIAN
+  x = __builtin_bswap64(x);
+#endif
+  return x;
+}
+
+static inline void hm_store_le32(char *dst, uint32_t x) {
+#ifdef HM_BIG_ENDIAN
+  x = __builtin_bswap32(x);
+#endif
+  memcpy(dst, &x, sizeof(x));
+}
+
+static inline void hm_store_le64(char *dst, uint64_t x) {
+#ifdef HM_BIG_ENDIAN
+  x = __builtin_bswap64(x);
+#endif
+  memcpy(dst, &x, sizeof(x));
+}
+
+// Array versions copy count numbers, on little endian machines with memcpy.
+
+static inline void hm_load_le32_array(uint32_t *dst, const char *src,
+                                      size_t count) {
+#ifdef HM_BIG_ENDIAN
+  for (size_t i = 0; i < count; i++) {
+    dst[i] = hm_load_le32(src + i * sizeof(uint32_t));
+  }
+#else
+  memcpy(dst, src, count * sizeof(uint32_t));
+#endif
+}
+
+static inline void hm_load_le64_array(uint64_t *dst, const char *src,
+                                      size_t count) {
+#ifdef HM_BIG_ENDIAN
+  for (size_t i = 0; i < count; i++) {
+    dst[i] = hm_load_le64(src + i * sizeof(uint64_t));
+  }
+#else
+  memcpy(dst, src, count * sizeof(uint64_t));
+#endif
+}
+
+static inline void hm_store_le32_array(char *dst, const uint32_t *src,
+                                       size_t count) {
+#ifdef HM_BIG_ENDIAN
+  for (size_t i = 0; i < count; i++) {
+    hm_store_le32(dst + i * sizeof(uint32_t), src[i]);
+  }
+#else
+  memcpy(dst, src, count * sizeof(uint32_t));
+#endif
+}
+
+static inline void hm_store_le64_array(char *dst, const uint64_t *src,
+                                       size_t count) {
+#ifdef HM_BIG_ENDIAN
+  for (size_t i = 0; i < count; i++) {
+    hm_store_le64(dst + i * sizeof(uint64_t), src[i]);
+  }
+#else
+  memcpy(dst, src, count * sizeof(uint64_t));
+#endif
+}
+
+// Varints are LEB128: 7 bits per byte starting from the least significant ones,
+// the high bit is set in all bytes but the last one.
+
+// hm_store_varint writes x to dst and returns the number of bytes written.
+static inline size_t hm_store_varint(char *dst, uint64_t x) {
+  size_t n = 0;
+  while (x >= 0x80) {
+    dst[n++] = (char)(x | 0x80);
+    x >>= 7;
+  }
+  dst[n++] = (char)(x);
+  return n;
+}
+
+// hm_load_varint reads a varint from *src not reading past end and advances
+// *src. Returns false if the varint is truncated or too long.
+static inline bool hm_load_varint(const char **src, const char *end,
+                                  uint64_t *x) {
+  const uint8_t *p = (const uint8_t *)(*src);
+  if ((const char *)(p) != end && *p < 0x80) {
+    // Fast path for small numbers.
+    *x = *p;
+    *src = (const char *)(p + 1);
+    return true;
+  }
+  uint64_t result = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    if ((const char *)(p) == end) {
+      return false;
+    }
+    uint8_t byte = *p++;
+    result |= (uint64_t)(byte & 0x7f) << shift;
+    if (byte < 0x80) {
+      *x = result;
+      *src = (const char *)(p);
+      return true;
+    }
+  }
+  return false;
+}
+
+// hm_format_write_header writes the header of the database of the given type
+// to buffer. The payload must already be written after the header.
+void hm_format_write_header(char *buffer, uint32_t type, size_t payload_size);
+
+// hm_format_read_header checks the header in buffer and sets payload and
+// payload_size. If check_payload is set, it also checks the checksum of the
+// payload, which reads all of it. Returns HM_ERROR_BAD_FORMAT if the buffer
+// is not a serialized database of the given type, HM_ERROR_BAD_SIZE if its
+// size does not match the header and HM_ERROR_BAD_CHECKSUM if it is
+// corrupted.
+hm_error_t hm_format_read_header(const char *buffer, size_t buffer_size,
+                                 uint32_t type, bool check_payload,
+                                 const char **payload, size_t *payload_size);
+
+// hm_format_read_type sets type to the database type from the header.
+hm_error_t hm_format_read_type(const char *buffer, size_t buffer_size,
+                               uint32_t *type);
+
+// hm_format_write_patch_header writes the beginning of patch payload from
+// the headers of the old and the new serialized dbs, which must be checked.
+void hm_format_write_patch_header(char *payload, const char *old_buffer,
+                                  const char *new_buffer);
+
+// hm_format_read_patch_header checks that the patch payload applies to the
+// old serialized db, which must be checked, and sets new_size to the size of
+// the new serialized db. Returns HM_ERROR_BAD_VALUE if the patch was made for
+// another db.
+hm_error_t hm_format_read_patch_header(const char *payload,
+                                       size_t payload_size,
+                                       const char *old_buffer,
+                                       size_t *new_size);
+
+// hm_format_check_patched checks that the header of the serialized db
+// produced by the patch matches the new db the patch was made for. Returns
+// HM_ERROR_BAD_CHECKSUM otherwise.
+hm_error_t hm_format_check_patched(const char *payload, const char *buffer);
+
+// hm_format_segment_t is a part of the payload written by hm_format_write_fd:
+// count numbers of elem_size bytes (4 or 8) in host byte order.
+typedef struct hm_format_segment {
+  const void *data;
+  size_t count;
+  size_t elem_size;
+} hm_format_segment_t;
+
+// hm_format_write_fd writes the serialized database of the given type with
+// the payload made of the segments to fd. On little endian machines the
+// segments are passed to writev as is, otherwise they are converted in small
+// chunks. Returns HM_ERROR_SYSTEM with errno set if writing fails.
+hm_error_t hm_format_write_fd(int fd, uint32_t type,
+                              const hm_format_segment_t *segments,
+                              size_t segment_count);
+
+// hm_format_read_all reads size bytes from fd to buf. Returns
+// HM_ERROR_BAD_SIZE if the stream ends earlier and HM_ERROR_SYSTEM with errno
+// set if reading fails.
+hm_error_t hm_format_read_all(int fd, char *buf, size_t size);
+
+// hm_format_fill_header_fd reads from fd to header until it has size bytes.
+// Returns HM_ERROR_BAD_FORMAT if the stream ends earlier.
+hm_error_t hm_format_fill_header_fd(int fd, hm_fd_header_t *header,
+                                    size_t size);
+
+// hm_format_read_start_fd reads the header and the payload header of
+// payload_header_size bytes after it from fd to header, unless they were
+// read earlier, and checks the header like hm_format_read_header without the
+// payload checksum. crc is started with the payload header; the caller
+// continues it with hm_format_read_fd and passes it to hm_format_check_crc.
+// If fd is a regular file, its size must match the header.
+hm_error_t hm_format_read_start_fd(int fd, uint32_t type,
+                                   hm_fd_header_t *header,
+                                   size_t payload_header_size,
+                                   size_t *payload_size, uint32_t *crc);
+
+// hm_format_read_fd reads count numbers of elem_size bytes (4 or 8) from fd
+// to dst converting them to host byte order and continues crc over the bytes
+// read.
+hm_error_t hm_format_read_fd(int fd, void *dst, size_t count,
+                             size_t elem_size, uint32_t *crc);
+
+// hm_format_check_crc returns HM_ERROR_BAD_CHECKSUM if crc of the payload
+// accumulated while loading it does not match the header.
+hm_error_t hm_format_check_crc(const char *header, uint32_t crc);
+
+// hm_format_write_image_header writes the header of the image of the
+// database of the given type to image, leaving the fields specific to the
+// type zero.
+void hm_format_write_image_header(char *image, uint32_t type);
+
+// hm_format_check_image_header returns HM_ERROR_BAD_FORMAT if the header of
+// the image, which must be at least HM_FORMAT_IMAGE_HEADER_SIZE bytes, is
+// not the header of an image of the given type written on a machine with the
+// same byte order by this version of the library.
+hm_error_t hm_format_check_image_header(const char *image, uint32_t type);
+
+// Helpers of hm_*_deserialize_ex, implemented in load.c.
+
+// hm_load_array copies count little endian numbers of elem_size bytes (4 or
+// 8) from src to dst in host byte order and continues crc over src. Large
+// arrays are split between options->threads threads.
+void hm_load_array(void *dst, const char *src, size_t count, size_t elem_size,
+                   const hm_load_options_t *options, uint32_t *crc);
+
+// hm_load_lock locks [place, place + size) in memory if options have
+// HM_LOAD_MLOCK. Returns HM_ERROR_SYSTEM with errno set if it fails.
+hm_error_t hm_load_lock(const char *place, size_t size,
+                        const hm_load_options_t *options);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif // HM_FORMAT_H
@@ -13,6 +13,11 @@ type Cache struct {
 	cachePlace []byte
 	cache      *C.hm_cache_t
 	capacity   int
+
+	// iter is the position of DumpTo and Range in the list. It is kept here
+	// rather than on the stack, since a pointer passed to C would move it to
+	// the heap on every call.
+	iter C.hm_cache_iter_t
 }
 
 func New(capacity, speed int) (*Cache, error) {
@@ -85,6 +90,25 @@ func (c *Cache) Has(ip uint32) (exists bool, value uint32) {
 	return bool(cexists), uint32(cvalue)
 }
 
+// HasBatch calls Has for each of ips in order, making one cgo call for the
+// whole slice. It stores the results to exists[i] and values[i] (0 if the IP
+// is not in the cache). It panics if exists or values is shorter than ips.
+func (c *Cache) HasBatch(ips []uint32, exists []bool, values []uint32) {
+	if len(exists) < len(ips) || len(values) < len(ips) {
+		panic("gocache: len(exists) or len(values) < len(ips)")
+	}
+	if len(ips) == 0 {
+		return
+	}
+	C.hm_cache_has_batch(
+		c.cache,
+		(*C.uint32_t)(unsafe.Pointer(&ips[0])),
+		(*C.bool)(unsafe.Pointer(&exists[0])),
+		(*C.uint32_t)(unsafe.Pointer(&values[0])),
+		C.size_t(len(ips)),
+	)
+}
+
 func (c *Cache) Dump() []uint32 {
 	ips := make([]uint32, c.capacity)
 	ipsLen := C.size_t(c.capacity)
@@ -95,3 +119,76 @@ func (c *Cache) Dump() []uint32 {
 	)
 	return ips[:ipsLen]
 }
+
+// DumpTo stores up to min(len(ips), len(values)) IPs in the cache and their
+// values to ips and values, from newest to oldest, and returns how many were
+// stored. Unlike Dump, it does not allocate and does not check consistency of
+// the cache.
+func (c *Cache) DumpTo(ips, values []uint32) int {
+	count := len(ips)
+	if len(values) < count {
+		count = len(values)
+	}
+	if count == 0 {
+		return 0
+	}
+	C.hm_cache_iter_init(c.cache, &c.iter)
+	return int(C.hm_cache_iterate(
+		c.cache,
+		&c.iter,
+		(*C.uint32_t)(unsafe.Pointer(&ips[0])),
+		(*C.uint32_t)(unsafe.Pointer(&values[0])),
+		C.size_t(count),
+	))
+}
+
+// Range calls f with chunks of IPs in the cache and their values, from newest
+// to oldest, until f returns false. Chunks are stored to ips and values, which
+// must have the same non-zero length, so no memory is allocated. The slices
+// passed to f are only valid until it returns. f must not use the cache.
+func (c *Cache) Range(ips, values []uint32, f func(ips, values []uint32) bool) {
+	if len(ips) == 0 || len(ips) != len(values) {
+		panic("gocache: len(ips) != len(values) or they are empty")
+	}
+	C.hm_cache_iter_init(c.cache, &c.iter)
+	for {
+		count := int(C.hm_cache_iterate(
+			c.cache,
+			&c.iter,
+			(*C.uint32_t)(unsafe.Pointer(&ips[0])),
+			(*C.uint32_t)(unsafe.Pointer(&values[0])),
+			C.size_t(len(ips)),
+		))
+		if count == 0 || !f(ips[:count], values[:count]) {
+			return
+		}
+	}
+}
+
+// Stats describes the fill and memory usage of a Cache.
+type Stats struct {
+	Capacity          int
+	Size              int
+	HashTableCapacity int
+	LongestProbe      int
+
+	HeaderBytes      int
+	ListStorageBytes int
+	HashTableBytes   int
+	TotalBytes       int
+}
+
+func (c *Cache) Stats() Stats {
+	var cstats C.hm_cache_stats_t
+	C.hm_cache_stats(c.cache, &cstats)
+	return Stats{
+		Capacity:          int(cstats.capacity),
+		Size:              int(cstats.size),
+		HashTableCapacity: int(cstats.hash_table_capacity),
+		LongestProbe:      int(cstats.longest_probe),
+		HeaderBytes:       int(cstats.header_bytes),
+		ListStorageBytes:  int(cstats.list_storage_bytes),
+		HashTableBytes:    int(cstats.hash_table_bytes),
+		TotalBytes:        int(cstats.total_bytes),
+	}
+}
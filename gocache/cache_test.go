@@ -1,8 +1,11 @@
 package gocache
 
 import (
+	"fmt"
 	"math/rand"
 	"strconv"
+	"sync"
+	"sync/atomic"
 	"testing"
 
 	"github.com/stretchr/testify/require"
@@ -109,3 +112,322 @@ func TestCacheControl(t *testing.T) {
 		}
 	}
 }
+
+func TestCacheStats(t *testing.T) {
+	const capacity = 16
+	const speed = 3
+	c, err := New(capacity, speed)
+	require.NoError(t, err)
+
+	stats := c.Stats()
+	require.Equal(t, capacity, stats.Capacity)
+	require.Equal(t, 0, stats.Size)
+	require.Equal(t, 0, stats.LongestProbe)
+	require.Equal(t, stats.HeaderBytes+stats.ListStorageBytes+stats.HashTableBytes, stats.TotalBytes)
+	require.LessOrEqual(t, stats.TotalBytes, len(c.cachePlace))
+
+	for i := uint32(0); i < 10; i++ {
+		c.Add(i, i)
+	}
+	require.Equal(t, 10, c.Stats().Size)
+	require.Greater(t, c.Stats().LongestProbe, 0)
+
+	for i := uint32(10); i < 30; i++ {
+		c.Add(i, i)
+	}
+	require.Equal(t, capacity, c.Stats().Size)
+
+	c.Remove(29)
+	c.Remove(100)
+	require.Equal(t, capacity-1, c.Stats().Size)
+}
+
+func TestHasBatch(t *testing.T) {
+	const capacity = 1024
+	c1, err := New(capacity, 2)
+	require.NoError(t, err)
+	c2, err := New(capacity, 2)
+	require.NoError(t, err)
+
+	r := rand.New(rand.NewSource(400))
+	for i := 0; i < 2*capacity; i++ {
+		ip := uint32(r.Intn(4 * capacity))
+		c1.Add(ip, ip+1)
+		c2.Add(ip, ip+1)
+	}
+
+	// HasBatch moves found IPs to the head of the list in the same order as
+	// Has does.
+	ips := make([]uint32, 5000)
+	for i := range ips {
+		ips[i] = uint32(r.Intn(4 * capacity))
+	}
+	exists := make([]bool, len(ips))
+	values := make([]uint32, len(ips))
+	c1.HasBatch(ips, exists, values)
+	for i, ip := range ips {
+		has, value := c2.Has(ip)
+		require.Equal(t, has, exists[i], ip)
+		require.Equal(t, value, values[i], ip)
+		if has {
+			require.Equal(t, ip+1, value)
+		}
+	}
+	require.Equal(t, c2.Dump(), c1.Dump())
+
+	c1.HasBatch(nil, nil, nil)
+	require.Panics(t, func() {
+		c1.HasBatch(ips, exists[:1], values)
+	})
+}
+
+func TestShardedCache(t *testing.T) {
+	_, err := NewSharded(3, 1024, 2)
+	require.Error(t, err)
+	_, err = NewSharded(4, 1000, 2)
+	require.Error(t, err)
+
+	const capacity = 1 << 12
+	c, err := NewSharded(8, capacity, 2)
+	require.NoError(t, err)
+	twin, err := NewSharded(8, capacity, 2)
+	require.NoError(t, err)
+
+	// Goroutines add and look up their own IPs. The cache is large enough to
+	// keep all of them.
+	const goroutines = 8
+	const perGoroutine = capacity / goroutines / 4
+	var wg sync.WaitGroup
+	for g := 0; g < goroutines; g++ {
+		wg.Add(1)
+		go func(g int) {
+			defer wg.Done()
+			for i := 0; i < perGoroutine; i++ {
+				ip := uint32(g*perGoroutine + i)
+				c.Add(ip, ip+1)
+				if has, value := c.Has(ip); !has || value != ip+1 {
+					t.Errorf("ip %d: has=%v, value=%d", ip, has, value)
+				}
+			}
+		}(g)
+	}
+	wg.Wait()
+	require.Equal(t, goroutines*perGoroutine, c.Stats().Size)
+	require.Equal(t, capacity, c.Stats().Capacity)
+
+	existed, existedValue := c.Remove(10)
+	require.True(t, existed)
+	require.Equal(t, uint32(11), existedValue)
+	has, _ := c.Has(10)
+	require.False(t, has)
+
+	// HasBatch changes the state of shards in the same way as Has.
+	r := rand.New(rand.NewSource(700))
+	for i := 0; i < 2*capacity; i++ {
+		ip := r.Uint32() % (4 * capacity)
+		c.Add(ip, ip+1)
+		twin.Add(ip, ip+1)
+	}
+	ips := make([]uint32, 5000)
+	for i := range ips {
+		ips[i] = r.Uint32() % (4 * capacity)
+	}
+	exists := make([]bool, len(ips))
+	values := make([]uint32, len(ips))
+	c.HasBatch(ips, exists, values)
+	for i, ip := range ips {
+		has, value := twin.Has(ip)
+		require.Equal(t, has, exists[i], ip)
+		require.Equal(t, value, values[i], ip)
+	}
+	for i := range c.shards {
+		require.Equal(t, twin.shards[i].cache.Dump(), c.shards[i].cache.Dump())
+	}
+
+	// Buffers of HasBatch are reused, so only cgo calls allocate.
+	if !raceEnabled {
+		allocs := testing.AllocsPerRun(10, func() {
+			c.HasBatch(ips, exists, values)
+		})
+		require.LessOrEqual(t, allocs, float64(len(c.shards)))
+	}
+
+	c.HasBatch(nil, nil, nil)
+	require.Panics(t, func() {
+		c.HasBatch(ips, exists, values[:1])
+	})
+}
+
+// benchSink keeps results of lookups in benchmarks, so they are not dropped
+// by the compiler.
+var benchSink uint64
+
+// benchBatch is the number of IPs per call in batch benchmarks.
+const benchBatch = 1024
+
+// BenchmarkCache measures the Go API of a cache filled with capacity IPs:
+// one cgo call per IP and one per batch, and concurrent lookups from all
+// goroutines with a global lock and with a sharded cache. Half of the IPs
+// looked up are in the cache. The time is per IP.
+func BenchmarkCache(b *testing.B) {
+	const speed = 2
+	for _, capacity := range []int{1 << 10, 1 << 20} {
+		c, err := New(capacity, speed)
+		require.NoError(b, err)
+		sharded, err := NewSharded(16, capacity, speed)
+		require.NoError(b, err)
+		for i := 0; i < capacity; i++ {
+			c.Add(uint32(i), uint32(i))
+			sharded.Add(uint32(i), uint32(i))
+		}
+
+		r := rand.New(rand.NewSource(900))
+		queries := make([]uint32, 1<<16)
+		for i := range queries {
+			queries[i] = uint32(r.Intn(2 * capacity))
+		}
+		const mask = 1<<16 - 1
+
+		b.Run(fmt.Sprintf("capacity=%d/Has", capacity), func(b *testing.B) {
+			var sum uint64
+			for i := 0; i < b.N; i++ {
+				_, value := c.Has(queries[i&mask])
+				sum += uint64(value)
+			}
+			benchSink = sum
+		})
+		b.Run(fmt.Sprintf("capacity=%d/HasBatch", capacity), func(b *testing.B) {
+			exists := make([]bool, benchBatch)
+			values := make([]uint32, benchBatch)
+			for i := 0; i < b.N; i += benchBatch {
+				count := b.N - i
+				if count > benchBatch {
+					count = benchBatch
+				}
+				start := i & mask
+				c.HasBatch(queries[start:start+count], exists, values)
+			}
+			benchSink = uint64(values[0])
+		})
+		b.Run(fmt.Sprintf("capacity=%d/Add", capacity), func(b *testing.B) {
+			for i := 0; i < b.N; i++ {
+				ip := queries[i&mask]
+				c.Add(ip, ip)
+			}
+		})
+		b.Run(fmt.Sprintf("capacity=%d/HasParallelMutex", capacity), func(b *testing.B) {
+			var mu sync.Mutex
+			b.RunParallel(func(pb *testing.PB) {
+				var sum uint64
+				for i := 0; pb.Next(); i++ {
+					mu.Lock()
+					_, value := c.Has(queries[i&mask])
+					mu.Unlock()
+					sum += uint64(value)
+				}
+				atomic.AddUint64(&benchSink, sum)
+			})
+		})
+		b.Run(fmt.Sprintf("capacity=%d/HasParallelSharded", capacity), func(b *testing.B) {
+			b.RunParallel(func(pb *testing.PB) {
+				var sum uint64
+				for i := 0; pb.Next(); i++ {
+					_, value := sharded.Has(queries[i&mask])
+					sum += uint64(value)
+				}
+				atomic.AddUint64(&benchSink, sum)
+			})
+		})
+		b.Run(fmt.Sprintf("capacity=%d/HasBatchParallelSharded", capacity), func(b *testing.B) {
+			b.RunParallel(func(pb *testing.PB) {
+				exists := make([]bool, benchBatch)
+				values := make([]uint32, benchBatch)
+				start := 0
+				for pb.Next() {
+					// pb.Next counts IPs, a batch is looked up once per
+					// benchBatch of them.
+					start++
+					if start%benchBatch == 0 {
+						begin := start & mask
+						sharded.HasBatch(queries[begin:begin+benchBatch], exists, values)
+					}
+				}
+				atomic.AddUint64(&benchSink, uint64(values[0]))
+			})
+		})
+	}
+}
+
+func TestDumpToRange(t *testing.T) {
+	const capacity = 256
+	c, err := New(capacity, 2)
+	require.NoError(t, err)
+
+	ips := make([]uint32, capacity)
+	values := make([]uint32, capacity)
+	require.Equal(t, 0, c.DumpTo(ips, values))
+
+	r := rand.New(rand.NewSource(1000))
+	for i := 0; i < 1000; i++ {
+		ip := uint32(r.Intn(4 * capacity))
+		c.Add(ip, ip+1)
+		if i%3 == 0 {
+			c.Remove(uint32(r.Intn(4 * capacity)))
+		}
+	}
+	want := c.Dump()
+
+	n := c.DumpTo(ips, values)
+	require.Equal(t, want, ips[:n])
+	for i := 0; i < n; i++ {
+		require.Equal(t, ips[i]+1, values[i])
+	}
+
+	// A short buffer gets the newest IPs.
+	require.Equal(t, 10, c.DumpTo(ips[:10], values))
+	require.Equal(t, want[:10], ips[:10])
+
+	// Range in chunks of 7.
+	var got []uint32
+	c.Range(ips[:7], values[:7], func(chunkIps, chunkValues []uint32) bool {
+		for i, ip := range chunkIps {
+			require.Equal(t, ip+1, chunkValues[i])
+		}
+		got = append(got, chunkIps...)
+		return true
+	})
+	require.Equal(t, want, got)
+
+	chunks := 0
+	c.Range(ips[:7], values[:7], func(chunkIps, chunkValues []uint32) bool {
+		chunks++
+		return false
+	})
+	require.Equal(t, 1, chunks)
+
+	// cgo calls allocate a few bytes per call, but nothing depends on the
+	// size of the cache.
+	allocs := testing.AllocsPerRun(10, func() {
+		c.DumpTo(ips, values)
+	})
+	require.LessOrEqual(t, allocs, float64(2))
+
+	// The order inside each shard of the sharded cache is the same as Dump
+	// of the shard.
+	sharded, err := NewSharded(4, capacity, 2)
+	require.NoError(t, err)
+	for i := 0; i < 1000; i++ {
+		ip := uint32(r.Intn(4 * capacity))
+		sharded.Add(ip, ip+1)
+	}
+	var want2 []uint32
+	for i := range sharded.shards {
+		want2 = append(want2, sharded.shards[i].cache.Dump()...)
+	}
+	var got2 []uint32
+	sharded.Range(ips[:5], values[:5], func(chunkIps, chunkValues []uint32) bool {
+		got2 = append(got2, chunkIps...)
+		return true
+	})
+	require.Equal(t, want2, got2)
+}
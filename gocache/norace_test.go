@@ -0,0 +1,5 @@
+//go:build !race
+
+package gocache
+
+const raceEnabled = false
@@ -0,0 +1,7 @@
+//go:build race
+
+package gocache
+
+// raceEnabled is set if the race detector is on. It makes sync.Pool drop
+// items at random, so tests of allocations are skipped.
+const raceEnabled = true
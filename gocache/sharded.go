@@ -0,0 +1,232 @@
+package gocache
+
+import (
+	"fmt"
+	"math/bits"
+	"sync"
+)
+
+// ShardedCache is a cache safe for concurrent use. IPs are spread over shards,
+// each of them is a Cache with its own lock, so goroutines working with
+// different shards do not contend. Each shard evicts its own oldest IPs, so
+// the eviction order is LRU per shard, not across the whole cache.
+type ShardedCache struct {
+	shards []shard
+
+	// shift selects the shard from the highest bits of the hash of IP. The
+	// lowest bits select buckets of the hash table inside the shard, so they
+	// are not used to avoid piling all IPs of a shard in the same buckets.
+	shift uint
+
+	// batches keeps *batchScratch reused by HasBatch, so the calls do not
+	// allocate once the buffers have grown to the size of batches.
+	batches sync.Pool
+}
+
+// batchScratch holds buffers of one HasBatch call.
+type batchScratch struct {
+	starts       []int
+	next         []int
+	indices      []int32
+	positions    []int
+	sorted       []uint32
+	sortedExists []bool
+	sortedValues []uint32
+}
+
+// grow makes the buffers fit a batch of n IPs over shards shards.
+func (b *batchScratch) grow(shards, n int) {
+	if cap(b.starts) < shards+1 {
+		b.starts = make([]int, shards+1)
+		b.next = make([]int, shards)
+	}
+	b.starts = b.starts[:shards+1]
+	for i := range b.starts {
+		b.starts[i] = 0
+	}
+	b.next = b.next[:shards]
+	if cap(b.indices) < n {
+		b.indices = make([]int32, n)
+		b.positions = make([]int, n)
+		b.sorted = make([]uint32, n)
+		b.sortedExists = make([]bool, n)
+		b.sortedValues = make([]uint32, n)
+	}
+	b.indices = b.indices[:n]
+	b.positions = b.positions[:n]
+	b.sorted = b.sorted[:n]
+	b.sortedExists = b.sortedExists[:n]
+	b.sortedValues = b.sortedValues[:n]
+}
+
+type shard struct {
+	mu    sync.Mutex
+	cache *Cache
+
+	// Padding to a cache line, so locks of neighbouring shards do not share
+	// one.
+	_ [64 - 16]byte
+}
+
+// NewSharded creates a cache of capacity IPs split evenly into shards. Both
+// shards and capacity must be powers of 2, with at least 2 IPs per shard.
+// Speed is the same as in New.
+func NewSharded(shards, capacity, speed int) (*ShardedCache, error) {
+	if shards <= 0 || shards&(shards-1) != 0 {
+		return nil, fmt.Errorf("number of shards %d is not a power of 2", shards)
+	}
+	if capacity%shards != 0 {
+		return nil, fmt.Errorf("capacity %d is not a multiple of number of shards %d", capacity, shards)
+	}
+	c := &ShardedCache{
+		shards: make([]shard, shards),
+		shift:  uint(32 - bits.TrailingZeros(uint(shards))),
+	}
+	for i := range c.shards {
+		cache, err := New(capacity/shards, speed)
+		if err != nil {
+			return nil, err
+		}
+		c.shards[i].cache = cache
+	}
+	return c, nil
+}
+
+// hash32 is the hash function of cache.c.
+func hash32(x uint32) uint32 {
+	x ^= x >> 16
+	x *= 0x21f0aaad
+	x ^= x >> 15
+	x *= 0xd35a2d97
+	x ^= x >> 15
+	return x
+}
+
+func (c *ShardedCache) shardIndex(ip uint32) int {
+	// Shift by 32 yields 0 for a single shard.
+	return int(uint64(hash32(ip)) >> c.shift)
+}
+
+func (c *ShardedCache) Add(ip, value uint32) (existed, evicted bool, evictedIp, evictedValue uint32) {
+	s := &c.shards[c.shardIndex(ip)]
+	s.mu.Lock()
+	defer s.mu.Unlock()
+	return s.cache.Add(ip, value)
+}
+
+func (c *ShardedCache) Remove(ip uint32) (existed bool, existedValue uint32) {
+	s := &c.shards[c.shardIndex(ip)]
+	s.mu.Lock()
+	defer s.mu.Unlock()
+	return s.cache.Remove(ip)
+}
+
+func (c *ShardedCache) Has(ip uint32) (exists bool, value uint32) {
+	s := &c.shards[c.shardIndex(ip)]
+	s.mu.Lock()
+	defer s.mu.Unlock()
+	return s.cache.Has(ip)
+}
+
+// HasBatch is Cache.HasBatch for the sharded cache. IPs are grouped by shard,
+// so each shard is locked once and is looked up with one cgo call. IPs of one
+// shard are looked up in their order in ips. It panics if exists or values is
+// shorter than ips.
+func (c *ShardedCache) HasBatch(ips []uint32, exists []bool, values []uint32) {
+	if len(exists) < len(ips) || len(values) < len(ips) {
+		panic("gocache: len(exists) or len(values) < len(ips)")
+	}
+	if len(c.shards) == 1 {
+		s := &c.shards[0]
+		s.mu.Lock()
+		s.cache.HasBatch(ips, exists, values)
+		s.mu.Unlock()
+		return
+	}
+
+	b, _ := c.batches.Get().(*batchScratch)
+	if b == nil {
+		b = new(batchScratch)
+	}
+	defer c.batches.Put(b)
+	b.grow(len(c.shards), len(ips))
+
+	// Sort IPs by shard with counting sort, keeping the order inside shards.
+	// starts[i] is the position of the first IP of shard i in sorted.
+	starts, indices := b.starts, b.indices
+	for i, ip := range ips {
+		shardIndex := c.shardIndex(ip)
+		indices[i] = int32(shardIndex)
+		starts[shardIndex+1]++
+	}
+	for i := 1; i < len(starts); i++ {
+		starts[i] += starts[i-1]
+	}
+	sorted, positions, next := b.sorted, b.positions, b.next
+	copy(next, starts)
+	for i, ip := range ips {
+		pos := next[indices[i]]
+		next[indices[i]]++
+		sorted[pos] = ip
+		positions[i] = pos
+	}
+
+	sortedExists, sortedValues := b.sortedExists, b.sortedValues
+	for i := range c.shards {
+		begin, end := starts[i], starts[i+1]
+		if begin == end {
+			continue
+		}
+		s := &c.shards[i]
+		s.mu.Lock()
+		s.cache.HasBatch(sorted[begin:end], sortedExists[begin:end], sortedValues[begin:end])
+		s.mu.Unlock()
+	}
+
+	for i, pos := range positions {
+		exists[i] = sortedExists[pos]
+		values[i] = sortedValues[pos]
+	}
+}
+
+// Range calls Cache.Range of each shard, holding the lock of the shard, until
+// f returns false. IPs are ordered from newest to oldest inside each shard.
+// f must not use the cache.
+func (c *ShardedCache) Range(ips, values []uint32, f func(ips, values []uint32) bool) {
+	for i := range c.shards {
+		s := &c.shards[i]
+		stopped := false
+		s.mu.Lock()
+		s.cache.Range(ips, values, func(ips, values []uint32) bool {
+			stopped = !f(ips, values)
+			return !stopped
+		})
+		s.mu.Unlock()
+		if stopped {
+			return
+		}
+	}
+}
+
+// Stats returns the sum of stats of shards. LongestProbe is the maximum over
+// shards and HashTableCapacity is the sum of their hash tables.
+func (c *ShardedCache) Stats() Stats {
+	var total Stats
+	for i := range c.shards {
+		s := &c.shards[i]
+		s.mu.Lock()
+		stats := s.cache.Stats()
+		s.mu.Unlock()
+		total.Capacity += stats.Capacity
+		total.Size += stats.Size
+		total.HashTableCapacity += stats.HashTableCapacity
+		if stats.LongestProbe > total.LongestProbe {
+			total.LongestProbe = stats.LongestProbe
+		}
+		total.HeaderBytes += stats.HeaderBytes
+		total.ListStorageBytes += stats.ListStorageBytes
+		total.HashTableBytes += stats.HashTableBytes
+		total.TotalBytes += stats.TotalBytes
+	}
+	return total
+}
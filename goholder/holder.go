@@ -0,0 +1,126 @@
+// Package goholder publishes databases which are replaced while goroutines
+// use them, e.g. maps reloaded from files every few seconds.
+//
+// It is the Go counterpart of hm_handle_t (handle.h). Unlike hm_handle_swap,
+// Swap does not wait for readers: the old database is closed by the last
+// reader releasing it, so a reload never blocks on lookups in flight.
+package goholder
+
+import (
+	"sync/atomic"
+)
+
+// Closer is a database freed by Close, e.g. *gosm.StaticMap or
+// *gostaticuint64map.StaticUint64Map opened by OpenFile.
+type Closer interface {
+	Close() error
+}
+
+// pinned is a value with the number of its pins. The holder has one pin of
+// the current value, readers have the rest. The value is closed when the
+// number drops to 0 and it is never pinned again after that.
+type pinned[T Closer] struct {
+	value  T
+	pins   atomic.Int64
+	closed chan struct{}
+}
+
+func (p *pinned[T]) tryPin() bool {
+	for {
+		pins := p.pins.Load()
+		if pins == 0 {
+			return false
+		}
+		if p.pins.CompareAndSwap(pins, pins+1) {
+			return true
+		}
+	}
+}
+
+func (p *pinned[T]) unpin() {
+	if p.pins.Add(-1) == 0 {
+		// Errors of closing can not be returned to the reader which happens
+		// to release the value last, so they are dropped.
+		_ = p.value.Close()
+		close(p.closed)
+	}
+}
+
+// Holder holds the current value. It is safe for concurrent use.
+type Holder[T Closer] struct {
+	current atomic.Pointer[pinned[T]]
+}
+
+// New returns a holder of value.
+func New[T Closer](value T) *Holder[T] {
+	h := &Holder[T]{}
+	h.current.Store(newPinned(value))
+	return h
+}
+
+func newPinned[T Closer](value T) *pinned[T] {
+	p := &pinned[T]{
+		value:  value,
+		closed: make(chan struct{}),
+	}
+	p.pins.Store(1)
+	return p
+}
+
+// Ref is a pin of a value returned by Acquire.
+type Ref[T Closer] struct {
+	p *pinned[T]
+}
+
+// Value returns the pinned value. It must not be used after Release.
+func (r Ref[T]) Value() T {
+	return r.p.value
+}
+
+// Release unpins the value. It must be called once per Acquire.
+func (r Ref[T]) Release() {
+	r.p.unpin()
+}
+
+// Acquire pins the current value, so it is not closed until Release even if
+// it is replaced meanwhile. Pins update a counter shared by readers of the
+// value, so pin it once per batch of lookups rather than per lookup. Acquire
+// must not be called after Close.
+func (h *Holder[T]) Acquire() Ref[T] {
+	for {
+		p := h.current.Load()
+		if p == nil {
+			panic("goholder: Acquire after Close")
+		}
+		// If the value was replaced and released by all its readers since
+		// the load, it can not be pinned anymore, but current is already
+		// the new value.
+		if p.tryPin() {
+			return Ref[T]{p: p}
+		}
+	}
+}
+
+// Swap publishes value and releases the old one. The old value is closed
+// when the last reader which pinned it releases it, and the returned channel
+// is closed after that. Waiting for it before loading the next value keeps at
+// most two values in memory. Swap must not be called after Close.
+func (h *Holder[T]) Swap(value T) <-chan struct{} {
+	old := h.current.Swap(newPinned(value))
+	if old == nil {
+		panic("goholder: Swap after Close")
+	}
+	old.unpin()
+	return old.closed
+}
+
+// Close releases the current value, which is closed when its last reader
+// releases it. The returned channel is closed after that.
+func (h *Holder[T]) Close() <-chan struct{} {
+	old := h.current.Swap(nil)
+	if old == nil {
+		panic("goholder: Close after Close")
+	}
+	old.unpin()
+	return old.closed
+}
@@ -0,0 +1,163 @@
+package goholder
+
+import (
+	"fmt"
+	"os"
+	"path/filepath"
+	"sync"
+	"sync/atomic"
+	"testing"
+	"time"
+
+	"github.com/starius/hipermap/gostaticuint64map"
+	"github.com/stretchr/testify/require"
+)
+
+type fakeDB struct {
+	version int
+	closed  atomic.Bool
+}
+
+func (d *fakeDB) Close() error {
+	if d.closed.Swap(true) {
+		panic("closed twice")
+	}
+	return nil
+}
+
+func TestHolder(t *testing.T) {
+	db1 := &fakeDB{version: 1}
+	h := New(db1)
+
+	ref := h.Acquire()
+	require.Equal(t, 1, ref.Value().version)
+
+	db2 := &fakeDB{version: 2}
+	closed1 := h.Swap(db2)
+	// db1 is pinned by ref.
+	require.False(t, db1.closed.Load())
+	select {
+	case <-closed1:
+		t.Fatal("closed while pinned")
+	default:
+	}
+	require.Equal(t, 1, ref.Value().version)
+
+	ref2 := h.Acquire()
+	require.Equal(t, 2, ref2.Value().version)
+	ref2.Release()
+
+	ref.Release()
+	<-closed1
+	require.True(t, db1.closed.Load())
+
+	// Nobody pins db2.
+	db3 := &fakeDB{version: 3}
+	<-h.Swap(db3)
+	require.True(t, db2.closed.Load())
+
+	<-h.Close()
+	require.True(t, db3.closed.Load())
+	require.Panics(t, func() {
+		h.Acquire()
+	})
+}
+
+func TestHolderConcurrent(t *testing.T) {
+	h := New(&fakeDB{})
+
+	var stop atomic.Bool
+	var wg sync.WaitGroup
+	for g := 0; g < 8; g++ {
+		wg.Add(1)
+		go func() {
+			defer wg.Done()
+			for !stop.Load() {
+				ref := h.Acquire()
+				if ref.Value().closed.Load() {
+					t.Error("pinned value is closed")
+				}
+				ref.Release()
+			}
+		}()
+	}
+
+	var dbs []*fakeDB
+	for i := 1; i <= 1000; i++ {
+		db := &fakeDB{version: i}
+		dbs = append(dbs, db)
+		h.Swap(db)
+	}
+	stop.Store(true)
+	wg.Wait()
+	<-h.Close()
+
+	for _, db := range dbs {
+		require.True(t, db.closed.Load(), db.version)
+	}
+}
+
+// TestHolderReload reloads a map opened from a file outside of the Go heap
+// while goroutines look up keys in it.
+func TestHolderReload(t *testing.T) {
+	dir := t.TempDir()
+	writeVersion := func(version uint64) string {
+		m := make(map[uint64]uint64)
+		for key := uint64(1); key <= 1000; key++ {
+			m[key] = version
+		}
+		db, err := gostaticuint64map.Compile(m)
+		require.NoError(t, err)
+		path := filepath.Join(dir, fmt.Sprintf("db%d", version))
+		f, err := os.Create(path)
+		require.NoError(t, err)
+		require.NoError(t, db.SerializeTo(f))
+		require.NoError(t, f.Close())
+		return path
+	}
+	const versions = 20
+	paths := make([]string, versions+1)
+	for version := uint64(1); version <= versions; version++ {
+		paths[version] = writeVersion(version)
+	}
+
+	db, err := gostaticuint64map.OpenFile(paths[1])
+	require.NoError(t, err)
+	h := New(db)
+
+	var stop atomic.Bool
+	var wg sync.WaitGroup
+	for g := 0; g < 4; g++ {
+		wg.Add(1)
+		go func() {
+			defer wg.Done()
+			for !stop.Load() {
+				ref := h.Acquire()
+				version := ref.Value().Find(1)
+				for key := uint64(2); key <= 1000; key++ {
+					if value := ref.Value().Find(key); value != version {
+						t.Errorf("key %d: got version %d, want %d", key, value, version)
+					}
+				}
+				ref.Release()
+			}
+		}()
+	}
+
+	for version := 2; version <= versions; version++ {
+		db, err := gostaticuint64map.OpenFile(paths[version])
+		require.NoError(t, err)
+		select {
+		case <-h.Swap(db):
+		case <-time.After(10 * time.Second):
+			t.Fatal("old db is not released")
+		}
+	}
+	stop.Store(true)
+	wg.Wait()
+
+	ref := h.Acquire()
+	require.Equal(t, uint64(versions), ref.Value().Find(1))
+	ref.Release()
+	<-h.Close()
+}
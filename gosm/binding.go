@@ -3,9 +3,14 @@ package gosm
 import (
 	"errors"
 	"fmt"
+	"os"
+	"runtime"
+	"syscall"
 	"unsafe"
 )
 
+// #include <stdlib.h>
+// #include <hipermap/place.h>
 // #include <hipermap/static_map.h>
 // #cgo LDFLAGS: -l hipermap -lstdc++
 import "C"
@@ -13,6 +18,9 @@ import "C"
 type StaticMap struct {
 	dbPlace []byte
 	db      *C.hm_sm_database_t
+
+	// place holds the db instead of dbPlace if it was opened by OpenFile.
+	place *C.hm_place_t
 }
 
 func Compile(ips []uint32, cidrPrefixes []uint8, values []uint64) (*StaticMap, error) {
@@ -43,8 +51,184 @@ func Compile(ips []uint32, cidrPrefixes []uint8, values []uint64) (*StaticMap, e
 	}, nil
 }
 
+// CompileWithProfile compiles the map with the layout tuned for the query
+// profile: bucketHits has 65536 elements, the number of lookups per /16 bucket.
+// Up to hotBuckets hottest buckets are placed in a dense region.
+func CompileWithProfile(ips []uint32, cidrPrefixes []uint8, values []uint64, bucketHits []uint64, hotBuckets int) (*StaticMap, error) {
+	if len(ips) != len(cidrPrefixes) {
+		return nil, errors.New("len(ips) != len(cidrPrefixes)")
+	}
+	if len(ips) != len(values) {
+		return nil, errors.New("len(ips) != len(values)")
+	}
+	if len(bucketHits) != C.HM_SM_BUCKETS {
+		return nil, fmt.Errorf("len(bucketHits) = %d, want %d", len(bucketHits), C.HM_SM_BUCKETS)
+	}
+	dbPlaceSize := C.hm_sm_db_place_size_with_profile(C.uint(len(ips)), C.uint(hotBuckets))
+	dbPlace := make([]byte, dbPlaceSize)
+	var db *C.hm_sm_database_t
+	hmErr := C.hm_sm_compile_with_profile(
+		(*C.char)(unsafe.Pointer(&dbPlace[0])),
+		dbPlaceSize,
+		&db,
+		(*C.uint32_t)(unsafe.Pointer(&ips[0])),
+		(*C.uint8_t)(unsafe.Pointer(&cidrPrefixes[0])),
+		(*C.uint64_t)(unsafe.Pointer(&values[0])),
+		C.uint(len(ips)),
+		(*C.uint64_t)(unsafe.Pointer(&bucketHits[0])),
+		C.uint(hotBuckets),
+	)
+	if hmErr != C.HM_SUCCESS {
+		return nil, fmt.Errorf("hm_sm_compile_with_profile failed: %d", hmErr)
+	}
+	return &StaticMap{
+		dbPlace: dbPlace,
+		db:      db,
+	}, nil
+}
+
 func (m *StaticMap) Find(ip uint32) uint64 {
-	return uint64(C.hm_sm_find(m.db, C.uint32_t(ip)))
+	value := C.hm_sm_find(m.db, C.uint32_t(ip))
+	// m.db points into m.dbPlace, which cgo does not keep alive.
+	runtime.KeepAlive(m)
+	return uint64(value)
+}
+
+// FindBatch stores the value of ips[i] to out[i], making one cgo call for the
+// whole slice. It panics if out is shorter than ips.
+func (m *StaticMap) FindBatch(ips []uint32, out []uint64) {
+	if len(out) < len(ips) {
+		panic("gosm: len(out) < len(ips)")
+	}
+	if len(ips) == 0 {
+		return
+	}
+	C.hm_sm_find_batch(
+		m.db,
+		(*C.uint32_t)(unsafe.Pointer(&ips[0])),
+		(*C.uint64_t)(unsafe.Pointer(&out[0])),
+		C.size_t(len(ips)),
+	)
+	runtime.KeepAlive(m)
+}
+
+// Reader returns a pure Go reader of the map, see Reader.
+func (m *StaticMap) Reader() *Reader {
+	var view C.hm_sm_view_t
+	C.hm_sm_view(m.db, &view)
+	runtime.KeepAlive(m)
+	return &Reader{
+		hashtable: (*[1 << 16]uint32)(unsafe.Pointer(view.hashtable)),
+		maxIPs:    unsafe.Slice((*int32)(unsafe.Pointer(view.max_ips)), view.scan_size),
+		values:    unsafe.Slice((*uint64)(unsafe.Pointer(view.values)), view.scan_size),
+	}
+}
+
+// Profiler records samples of lookups made with FindSampled. A Profiler must
+// not be used by multiple goroutines at the same time. It lives outside of the
+// Go heap, so pointers to it can be passed to C in arrays, and must be freed
+// with Close.
+type Profiler struct {
+	place    *C.hm_place_t
+	profiler *C.hm_sm_profiler_t
+}
+
+// NewProfiler creates a profiler keeping the last capacity samples, one of
+// sampleRate lookups is sampled.
+func NewProfiler(capacity, sampleRate int) (*Profiler, error) {
+	var placeSize C.size_t
+	hmErr := C.hm_sm_profiler_place_size(&placeSize, C.uint(capacity))
+	if hmErr != C.HM_SUCCESS {
+		return nil, fmt.Errorf("hm_sm_profiler_place_size failed: %d", hmErr)
+	}
+
+	place, err := allocPlace(placeSize)
+	if err != nil {
+		return nil, err
+	}
+	var profiler *C.hm_sm_profiler_t
+	hmErr = C.hm_sm_profiler_init(
+		place.data,
+		place.size,
+		&profiler,
+		C.uint(capacity),
+		C.uint(sampleRate),
+	)
+	if hmErr != C.HM_SUCCESS {
+		C.hm_place_free(place)
+		return nil, fmt.Errorf("hm_sm_profiler_init failed: %d", hmErr)
+	}
+
+	return &Profiler{
+		place:    place,
+		profiler: profiler,
+	}, nil
+}
+
+func (p *Profiler) Reset() {
+	C.hm_sm_profiler_reset(p.profiler)
+}
+
+// Close frees the profiler. It must not be used after Close.
+func (p *Profiler) Close() error {
+	if p.place != nil {
+		C.hm_place_free(p.place)
+		p.place = nil
+	}
+	p.profiler = nil
+	return nil
+}
+
+func (m *StaticMap) FindSampled(p *Profiler, ip uint32) uint64 {
+	value := C.hm_sm_find_sampled(m.db, p.profiler, C.uint32_t(ip))
+	runtime.KeepAlive(m)
+	return uint64(value)
+}
+
+// BucketProfile aggregates samples of one /16 bucket.
+type BucketProfile struct {
+	Samples   uint64
+	ScanTotal uint64
+	MaxScan   uint64
+}
+
+// Profile aggregates samples of profilers. It returns a profile for each of
+// 65536 /16 buckets and the number of hits of each range of the sorted list.
+func (m *StaticMap) Profile(profilers ...*Profiler) ([]BucketProfile, []uint64, error) {
+	// The array of pointers to profilers is passed to C, so it is allocated
+	// with malloc. The profilers are in C memory too, see Profiler.
+	ptrSize := C.size_t(unsafe.Sizeof((*C.hm_sm_profiler_t)(nil)))
+	cprofilers := (**C.hm_sm_profiler_t)(C.malloc(ptrSize * C.size_t(len(profilers)+1)))
+	defer C.free(unsafe.Pointer(cprofilers))
+	cprofilersSlice := unsafe.Slice(cprofilers, len(profilers))
+	for i, p := range profilers {
+		cprofilersSlice[i] = p.profiler
+	}
+
+	cbuckets := make([]C.hm_sm_bucket_profile_t, C.HM_SM_BUCKETS)
+	rangeHits := make([]uint64, m.Stats().ListSize)
+	hmErr := C.hm_sm_profile_export(
+		m.db,
+		cprofilers,
+		C.size_t(len(profilers)),
+		&cbuckets[0],
+		(*C.uint64_t)(unsafe.Pointer(&rangeHits[0])),
+		C.size_t(len(rangeHits)),
+	)
+	runtime.KeepAlive(m)
+	if hmErr != C.HM_SUCCESS {
+		return nil, nil, fmt.Errorf("hm_sm_profile_export failed: %d", hmErr)
+	}
+
+	buckets := make([]BucketProfile, len(cbuckets))
+	for i, b := range cbuckets {
+		buckets[i] = BucketProfile{
+			Samples:   uint64(b.samples),
+			ScanTotal: uint64(b.scan_total),
+			MaxScan:   uint64(b.max_scan),
+		}
+	}
+	return buckets, rangeHits, nil
 }
 
 func (m *StaticMap) Serialize() ([]byte, error) {
@@ -55,6 +239,7 @@ func (m *StaticMap) Serialize() ([]byte, error) {
 		serSize,
 		m.db,
 	)
+	runtime.KeepAlive(m)
 	if hmErr != C.HM_SUCCESS {
 		return nil, fmt.Errorf("hm_sm_serialize failed: %d", hmErr)
 	}
@@ -94,3 +279,313 @@ func FromSerialized(buffer []byte) (*StaticMap, error) {
 		db:      db,
 	}, nil
 }
+
+// SerializeTo writes the serialized db to f, which can be a file, a pipe or a
+// socket. Unlike Serialize, it does not allocate a buffer of the whole db.
+func (m *StaticMap) SerializeTo(f *os.File) error {
+	hmErr, err := C.hm_sm_serialize_fd(C.int(f.Fd()), m.db)
+	// m owns the memory of the db, which is written while blocked on f.
+	runtime.KeepAlive(m)
+	runtime.KeepAlive(f)
+	if hmErr == C.HM_ERROR_SYSTEM {
+		return fmt.Errorf("hm_sm_serialize_fd failed: %w", err)
+	}
+	if hmErr != C.HM_SUCCESS {
+		return fmt.Errorf("hm_sm_serialize_fd failed: %d", hmErr)
+	}
+	return nil
+}
+
+// FromFile loads the db written by SerializeTo or Serialize from f, starting
+// at its current position. f is read sequentially right into the memory of
+// the db, without a buffer of the whole db, so it can be a file, a pipe or a
+// socket.
+func FromFile(f *os.File) (*StaticMap, error) {
+	defer runtime.KeepAlive(f)
+	fd := C.int(f.Fd())
+
+	// header keeps the beginning of the db read by the first call.
+	var header C.hm_fd_header_t
+	var dbPlaceSize C.size_t
+	hmErr, err := C.hm_sm_db_place_size_from_fd(&dbPlaceSize, &header, fd)
+	if hmErr == C.HM_ERROR_SYSTEM {
+		return nil, fmt.Errorf("hm_sm_db_place_size_from_fd failed: %w", err)
+	}
+	if hmErr != C.HM_SUCCESS {
+		return nil, fmt.Errorf("hm_sm_db_place_size_from_fd failed: %d", hmErr)
+	}
+
+	dbPlace := make([]byte, dbPlaceSize)
+	var db *C.hm_sm_database_t
+	hmErr, err = C.hm_sm_deserialize_fd(
+		(*C.char)(unsafe.Pointer(&dbPlace[0])),
+		dbPlaceSize,
+		&db,
+		&header,
+		fd,
+	)
+	if hmErr == C.HM_ERROR_SYSTEM {
+		return nil, fmt.Errorf("hm_sm_deserialize_fd failed: %w", err)
+	}
+	if hmErr != C.HM_SUCCESS {
+		return nil, fmt.Errorf("hm_sm_deserialize_fd failed: %d", hmErr)
+	}
+
+	return &StaticMap{
+		dbPlace: dbPlace,
+		db:      db,
+	}, nil
+}
+
+// OpenFile loads the serialized db from the file at path. The file is mapped
+// into memory and the db is built outside of the Go heap, so the garbage
+// collector neither scans nor counts it. Large databases are placed on
+// transparent huge pages. The db must be freed with Close. The file must not
+// be truncated while it is loaded.
+func OpenFile(path string) (*StaticMap, error) {
+	f, err := os.Open(path)
+	if err != nil {
+		return nil, err
+	}
+	defer f.Close()
+	info, err := f.Stat()
+	if err != nil {
+		return nil, err
+	}
+	if info.Size() == 0 {
+		return nil, fmt.Errorf("empty file")
+	}
+	buffer, err := syscall.Mmap(int(f.Fd()), 0, int(info.Size()), syscall.PROT_READ, syscall.MAP_SHARED)
+	if err != nil {
+		return nil, fmt.Errorf("mmap failed: %w", err)
+	}
+	defer syscall.Munmap(buffer)
+	// The file is read once from start to end.
+	_ = syscall.Madvise(buffer, syscall.MADV_SEQUENTIAL)
+
+	var dbPlaceSize C.size_t
+	hmErr := C.hm_sm_db_place_size_from_serialized(
+		&dbPlaceSize,
+		(*C.char)(unsafe.Pointer(&buffer[0])),
+		C.size_t(len(buffer)),
+	)
+	if hmErr != C.HM_SUCCESS {
+		return nil, fmt.Errorf("hm_sm_db_place_size_from_serialized failed: %d", hmErr)
+	}
+
+	place, err := allocPlace(dbPlaceSize)
+	if err != nil {
+		return nil, err
+	}
+	var db *C.hm_sm_database_t
+	hmErr = C.hm_sm_deserialize(
+		place.data,
+		place.size,
+		&db,
+		(*C.char)(unsafe.Pointer(&buffer[0])),
+		C.size_t(len(buffer)),
+	)
+	if hmErr != C.HM_SUCCESS {
+		C.hm_place_free(place)
+		return nil, fmt.Errorf("hm_sm_deserialize failed: %d", hmErr)
+	}
+
+	return &StaticMap{
+		db:    db,
+		place: place,
+	}, nil
+}
+
+// allocPlace allocates db place outside of the Go heap. Large databases are
+// placed on transparent huge pages.
+func allocPlace(dbPlaceSize C.size_t) (*C.hm_place_t, error) {
+	pages := C.hm_page_kind_t(C.HM_PAGES_DEFAULT)
+	if dbPlaceSize >= 2<<20 {
+		pages = C.HM_PAGES_THP
+	}
+	place := new(C.hm_place_t)
+	hmErr := C.hm_place_alloc(place, dbPlaceSize, pages)
+	if hmErr != C.HM_SUCCESS {
+		return nil, fmt.Errorf("hm_place_alloc failed: %d", hmErr)
+	}
+	return place, nil
+}
+
+// Close frees the db opened by OpenFile. The db and its Readers must not be
+// used after Close. For databases in the Go heap it only drops the reference
+// to the memory.
+func (m *StaticMap) Close() error {
+	if m.place != nil {
+		C.hm_place_free(m.place)
+		m.place = nil
+	}
+	m.dbPlace = nil
+	m.db = nil
+	return nil
+}
+
+// Pack returns the db in packed form, which is much smaller than the
+// serialized form and is meant for distribution. Use FromPacked to load it.
+func (m *StaticMap) Pack() ([]byte, error) {
+	maxSize := C.hm_sm_packed_max_size(m.db)
+	packed := make([]byte, maxSize)
+	var packedSize C.size_t
+	hmErr := C.hm_sm_pack(
+		(*C.char)(unsafe.Pointer(&packed[0])),
+		maxSize,
+		m.db,
+		&packedSize,
+	)
+	// m.db points into m.dbPlace, which cgo does not keep alive.
+	runtime.KeepAlive(m)
+	if hmErr != C.HM_SUCCESS {
+		return nil, fmt.Errorf("hm_sm_pack failed: %d", hmErr)
+	}
+	return packed[:packedSize], nil
+}
+
+// FromPacked loads the db from the output of Pack.
+func FromPacked(buffer []byte) (*StaticMap, error) {
+	if len(buffer) == 0 {
+		return nil, fmt.Errorf("empty buffer")
+	}
+
+	var dbPlaceSize C.size_t
+	hmErr := C.hm_sm_db_place_size_from_packed(
+		&dbPlaceSize,
+		(*C.char)(unsafe.Pointer(&buffer[0])),
+		C.size_t(len(buffer)),
+	)
+	if hmErr != C.HM_SUCCESS {
+		return nil, fmt.Errorf("hm_sm_db_place_size_from_packed failed: %d", hmErr)
+	}
+
+	dbPlace := make([]byte, dbPlaceSize)
+	var db *C.hm_sm_database_t
+	hmErr = C.hm_sm_unpack(
+		(*C.char)(unsafe.Pointer(&dbPlace[0])),
+		dbPlaceSize,
+		&db,
+		(*C.char)(unsafe.Pointer(&buffer[0])),
+		C.size_t(len(buffer)),
+	)
+	if hmErr != C.HM_SUCCESS {
+		return nil, fmt.Errorf("hm_sm_unpack failed: %d", hmErr)
+	}
+
+	return &StaticMap{
+		dbPlace: dbPlace,
+		db:      db,
+	}, nil
+}
+
+// Diff returns a patch turning serialized db oldSer into serialized db newSer.
+// Its size is proportional to the number of changed elements. Use Patch to
+// apply it.
+func Diff(oldSer, newSer []byte) ([]byte, error) {
+	if len(oldSer) == 0 || len(newSer) == 0 {
+		return nil, fmt.Errorf("empty buffer")
+	}
+
+	var maxSize C.size_t
+	hmErr := C.hm_sm_diff_max_size(
+		&maxSize,
+		(*C.char)(unsafe.Pointer(&oldSer[0])),
+		C.size_t(len(oldSer)),
+		(*C.char)(unsafe.Pointer(&newSer[0])),
+		C.size_t(len(newSer)),
+	)
+	if hmErr != C.HM_SUCCESS {
+		return nil, fmt.Errorf("hm_sm_diff_max_size failed: %d", hmErr)
+	}
+
+	patch := make([]byte, maxSize)
+	var patchSize C.size_t
+	hmErr = C.hm_sm_diff(
+		(*C.char)(unsafe.Pointer(&patch[0])),
+		maxSize,
+		(*C.char)(unsafe.Pointer(&oldSer[0])),
+		C.size_t(len(oldSer)),
+		(*C.char)(unsafe.Pointer(&newSer[0])),
+		C.size_t(len(newSer)),
+		&patchSize,
+	)
+	if hmErr != C.HM_SUCCESS {
+		return nil, fmt.Errorf("hm_sm_diff failed: %d", hmErr)
+	}
+	return patch[:patchSize], nil
+}
+
+// Patch applies the output of Diff to serialized db oldSer and returns the new
+// serialized db, which can be loaded with FromSerialized.
+func Patch(oldSer, patch []byte) ([]byte, error) {
+	if len(oldSer) == 0 || len(patch) == 0 {
+		return nil, fmt.Errorf("empty buffer")
+	}
+
+	var serSize C.size_t
+	hmErr := C.hm_sm_patched_size(
+		&serSize,
+		(*C.char)(unsafe.Pointer(&oldSer[0])),
+		C.size_t(len(oldSer)),
+		(*C.char)(unsafe.Pointer(&patch[0])),
+		C.size_t(len(patch)),
+	)
+	if hmErr != C.HM_SUCCESS {
+		return nil, fmt.Errorf("hm_sm_patched_size failed: %d", hmErr)
+	}
+
+	ser := make([]byte, serSize)
+	hmErr = C.hm_sm_patch(
+		(*C.char)(unsafe.Pointer(&ser[0])),
+		serSize,
+		(*C.char)(unsafe.Pointer(&oldSer[0])),
+		C.size_t(len(oldSer)),
+		(*C.char)(unsafe.Pointer(&patch[0])),
+		C.size_t(len(patch)),
+	)
+	if hmErr != C.HM_SUCCESS {
+		return nil, fmt.Errorf("hm_sm_patch failed: %d", hmErr)
+	}
+	return ser, nil
+}
+
+// Stats describes the layout and memory usage of a StaticMap.
+type Stats struct {
+	ListSize      int
+	LongestScan   int
+	ScanHistogram []int
+	HotBuckets    int
+	HotListSize   int
+
+	HeaderBytes     int
+	HashtableBytes  int
+	MaxIpsBytes     int
+	ValuesBytes     int
+	HotBucketsBytes int
+	TotalBytes      int
+}
+
+func (m *StaticMap) Stats() Stats {
+	var cstats C.hm_sm_stats_t
+	C.hm_sm_stats(m.db, &cstats)
+	// m.db points into m.dbPlace, which cgo does not keep alive.
+	runtime.KeepAlive(m)
+	histogram := make([]int, len(cstats.scan_histogram))
+	for i, count := range cstats.scan_histogram {
+		histogram[i] = int(count)
+	}
+	return Stats{
+		ListSize:        int(cstats.list_size),
+		LongestScan:     int(cstats.longest_scan),
+		ScanHistogram:   histogram,
+		HotBuckets:      int(cstats.hot_buckets),
+		HotListSize:     int(cstats.hot_list_size),
+		HeaderBytes:     int(cstats.header_bytes),
+		HashtableBytes:  int(cstats.hashtable_bytes),
+		MaxIpsBytes:     int(cstats.max_ips_bytes),
+		ValuesBytes:     int(cstats.values_bytes),
+		HotBucketsBytes: int(cstats.hot_buckets_bytes),
+		TotalBytes:      int(cstats.total_bytes),
+	}
+}
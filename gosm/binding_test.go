@@ -1,8 +1,16 @@
 package gosm
 
 import (
+	"encoding/binary"
 	"encoding/hex"
 	"fmt"
+	"io"
+	"math/rand"
+	"os"
+	"path/filepath"
+	"runtime"
+	"strings"
+	"sync/atomic"
 	"testing"
 
 	"github.com/stretchr/testify/require"
@@ -274,25 +282,774 @@ func FuzzSerialize(f *testing.F) {
 		require.NoError(t, err)
 
 		require.Equal(t, sm2.dbPlace, sm2.dbPlace[:len(sm2.dbPlace)])
-	})
-}
 
-func FuzzDeserialize(f *testing.F) {
-	sample1, err := hex.DecodeString("1400000000000000ffffff80ffff1081ffff1181ffffff81ffffff82ffff0e83ffff0f83ffffff83ffffff84ffffff90ffff1091ffff1191ffffff91ffffffa1ffffffa2ffff0e23ffff0f23ffffff33ffffff34ffffff7fffffffffffffffff0a0000000000000014000000000000000a000000000000001e00000000000000ffffffffffffffff2800000000000000ffffffffffffffff3200000000000000ffffffffffffffff6e0000000000000078000000000000006e00000000000000ffffffffffffffff8200000000000000ffffffffffffffff8c00000000000000ffffffffffffffff9600000000000000ffffffffffffffff")
-	require.NoError(f, err)
+		packed, err := sm.Pack()
+		require.NoError(t, err)
+		require.Less(t, len(packed), len(ser))
 
-	sample2, err := hex.DecodeString("0400000000000000ffffff80ffffff81ffffff82ffffff7fffffffffffffffff0a000000000000001400000000000000ffffffffffffffff")
-	require.NoError(f, err)
+		sm3, err := FromPacked(packed)
+		require.NoError(t, err)
 
-	sample3, err := hex.DecodeString("0600000000000000ffff0080ffff0180ffffff80ffffff81ffffff82ffffff7fffffffffffffffff0b00000000000000ffffffffffffffff0a000000000000001400000000000000ffffffffffffffff")
-	require.NoError(f, err)
+		for _, ip := range sampleIps(ips) {
+			require.Equal(t, sm.Find(ip), sm3.Find(ip), fmt.Sprintf("%x", ip))
+		}
+	})
+}
 
-	f.Add(sample1)
-	f.Add(sample2)
-	f.Add(sample3)
+func FuzzDeserialize(f *testing.F) {
+	for _, n := range []int{1, 2, 4, 10} {
+		ips := []uint32{
+			0x01000000, 0x01110000, 0x02000000, 0x030F0000, 0x04000000,
+			0x11000000, 0x11110000, 0x22000000, 0xA30F0000, 0xB4000000,
+		}[:n]
+		prefixes := []uint8{8, 16, 8, 16, 8, 8, 16, 8, 16, 8}[:n]
+		values := []uint64{10, 20, 30, 40, 50, 110, 120, 130, 140, 150}[:n]
+		sm, err := Compile(ips, prefixes, values)
+		require.NoError(f, err)
+		ser, err := sm.Serialize()
+		require.NoError(f, err)
+		f.Add(ser)
+	}
 
 	f.Fuzz(func(t *testing.T, ser []byte) {
 		t.Log(hex.EncodeToString(ser))
 		_, _ = FromSerialized(ser)
 	})
 }
+
+func FuzzUnpack(f *testing.F) {
+	for _, n := range []int{1, 2, 4, 10} {
+		ips := []uint32{
+			0x01000000, 0x01110000, 0x02000000, 0x030F0000, 0x04000000,
+			0x11000000, 0x11110000, 0x22000000, 0xA30F0000, 0xB4000000,
+		}[:n]
+		prefixes := []uint8{8, 16, 8, 16, 8, 8, 16, 8, 16, 8}[:n]
+		values := []uint64{10, 20, 30, 40, 50, 110, 120, 130, 140, 150}[:n]
+		sm, err := Compile(ips, prefixes, values)
+		require.NoError(f, err)
+		packed, err := sm.Pack()
+		require.NoError(f, err)
+		f.Add(packed)
+	}
+
+	f.Fuzz(func(t *testing.T, packed []byte) {
+		t.Log(hex.EncodeToString(packed))
+		_, _ = FromPacked(packed)
+	})
+}
+
+func TestSerializedCorruption(t *testing.T) {
+	ips := []uint32{0x01000000, 0x01110000, 0x02000000}
+	prefixes := []uint8{8, 16, 8}
+	values := []uint64{10, 20, 30}
+	sm, err := Compile(ips, prefixes, values)
+	require.NoError(t, err)
+	ser, err := sm.Serialize()
+	require.NoError(t, err)
+
+	// Header: magic, format version and type.
+	require.Equal(t, "hipermap", string(ser[:8]))
+	require.Equal(t, uint32(1), binary.LittleEndian.Uint32(ser[8:]))
+	require.Equal(t, uint32(1), binary.LittleEndian.Uint32(ser[12:]))
+
+	// Any flipped bit is detected.
+	for i := range ser {
+		for bit := 0; bit < 8; bit++ {
+			ser[i] ^= 1 << bit
+			_, err := FromSerialized(ser)
+			require.Error(t, err, fmt.Sprintf("byte %d bit %d", i, bit))
+			ser[i] ^= 1 << bit
+		}
+	}
+
+	_, err = FromSerialized(ser[:len(ser)-1])
+	require.Error(t, err)
+	_, err = FromSerialized(append(ser, 0))
+	require.Error(t, err)
+
+	sm2, err := FromSerialized(ser)
+	require.NoError(t, err)
+	require.Equal(t, uint64(20), sm2.Find(0x01110101))
+}
+
+func TestPackedCorruption(t *testing.T) {
+	ips := []uint32{0x01000000, 0x01110000, 0x02000000}
+	prefixes := []uint8{8, 16, 8}
+	values := []uint64{10, 20, 30}
+	sm, err := Compile(ips, prefixes, values)
+	require.NoError(t, err)
+	packed, err := sm.Pack()
+	require.NoError(t, err)
+
+	// Packed type is the type of the static map plus 0x100.
+	require.Equal(t, "hipermap", string(packed[:8]))
+	require.Equal(t, uint32(0x101), binary.LittleEndian.Uint32(packed[12:]))
+
+	for i := range packed {
+		for bit := 0; bit < 8; bit++ {
+			packed[i] ^= 1 << bit
+			_, err := FromPacked(packed)
+			require.Error(t, err, fmt.Sprintf("byte %d bit %d", i, bit))
+			packed[i] ^= 1 << bit
+		}
+	}
+
+	_, err = FromPacked(packed[:len(packed)-1])
+	require.Error(t, err)
+	_, err = FromPacked(append(packed, 0))
+	require.Error(t, err)
+
+	// The serialized form is not accepted as packed and vice versa.
+	ser, err := sm.Serialize()
+	require.NoError(t, err)
+	_, err = FromPacked(ser)
+	require.Error(t, err)
+	_, err = FromSerialized(packed)
+	require.Error(t, err)
+
+	sm2, err := FromPacked(packed)
+	require.NoError(t, err)
+	require.Equal(t, uint64(20), sm2.Find(0x01110101))
+	require.Equal(t, uint64(10), sm2.Find(0x01120101))
+	require.Equal(t, uint64(0xFFFFFFFFFFFFFFFF), sm2.Find(0x03000000))
+}
+
+func TestFile(t *testing.T) {
+	r := rand.New(rand.NewSource(300))
+	const N = 10001
+	ips := make([]uint32, N)
+	prefixes := make([]uint8, N)
+	values := make([]uint64, N)
+	for i := range ips {
+		ips[i] = r.Uint32()
+		prefixes[i] = uint8(16 + r.Intn(17))
+		values[i] = uint64(i)
+	}
+	adjustInputs(ips, prefixes, values)
+	bucketHits := make([]uint64, 1<<16)
+	for i := range bucketHits {
+		bucketHits[i] = uint64(r.Intn(3))
+	}
+	db, err := CompileWithProfile(ips, prefixes, values, bucketHits, 100)
+	require.NoError(t, err)
+
+	f, err := os.Create(filepath.Join(t.TempDir(), "db"))
+	require.NoError(t, err)
+	defer f.Close()
+	require.NoError(t, db.SerializeTo(f))
+
+	// The file is the same as the serialized buffer.
+	ser, err := db.Serialize()
+	require.NoError(t, err)
+	data, err := os.ReadFile(f.Name())
+	require.NoError(t, err)
+	require.Equal(t, ser, data)
+
+	// f is read from its current position.
+	_, err = FromFile(f)
+	require.Error(t, err)
+	_, err = f.Seek(0, io.SeekStart)
+	require.NoError(t, err)
+	db2, err := FromFile(f)
+	require.NoError(t, err)
+	require.Equal(t, db.Stats(), db2.Stats())
+	for i := 0; i < 100000; i++ {
+		ip := r.Uint32()
+		require.Equal(t, db.Find(ip), db2.Find(ip))
+	}
+
+	// Corruption is detected.
+	i := len(ser) / 2
+	_, err = f.WriteAt([]byte{ser[i] ^ 1}, int64(i))
+	require.NoError(t, err)
+	_, err = f.Seek(0, io.SeekStart)
+	require.NoError(t, err)
+	_, err = FromFile(f)
+	require.Error(t, err)
+	require.NoError(t, f.Truncate(int64(len(ser)-1)))
+	_, err = f.Seek(0, io.SeekStart)
+	require.NoError(t, err)
+	_, err = FromFile(f)
+	require.Error(t, err)
+
+	// Dbs are loaded from a pipe one after another.
+	pr, pw, err := os.Pipe()
+	require.NoError(t, err)
+	defer pr.Close()
+	errs := make(chan error, 1)
+	go func() {
+		err := db.SerializeTo(pw)
+		if err == nil {
+			err = db.SerializeTo(pw)
+		}
+		pw.Close()
+		errs <- err
+	}()
+	for j := 0; j < 2; j++ {
+		db3, err := FromFile(pr)
+		require.NoError(t, err)
+		ser3, err := db3.Serialize()
+		require.NoError(t, err)
+		require.Equal(t, ser, ser3)
+	}
+	_, err = FromFile(pr)
+	require.Error(t, err)
+	require.NoError(t, <-errs)
+}
+
+func TestDiffPatch(t *testing.T) {
+	r := rand.New(rand.NewSource(300))
+
+	const N = 10000
+	ips := make([]uint32, N)
+	prefixes := make([]uint8, N)
+	values := make([]uint64, N)
+	for i := range ips {
+		prefixes[i] = uint8(16 + r.Intn(17))
+		ips[i] = r.Uint32() &^ (1<<(32-prefixes[i]) - 1)
+		values[i] = uint64(r.Intn(100))
+	}
+	adjustInputs(ips, prefixes, values)
+	sm, err := Compile(ips, prefixes, values)
+	require.NoError(t, err)
+	ser, err := sm.Serialize()
+	require.NoError(t, err)
+
+	// Change some values, remove some ranges and add new ones.
+	ips2 := append([]uint32{}, ips[10:]...)
+	prefixes2 := append([]uint8{}, prefixes[10:]...)
+	values2 := append([]uint64{}, values[10:]...)
+	for i := 0; i < 10; i++ {
+		values2[r.Intn(len(values2))] = 1000 + uint64(i)
+		prefix := uint8(16 + r.Intn(17))
+		ips2 = append(ips2, r.Uint32()&^(1<<(32-prefix)-1))
+		prefixes2 = append(prefixes2, prefix)
+		values2 = append(values2, 2000+uint64(i))
+	}
+	adjustInputs(ips2, prefixes2, values2)
+	sm2, err := Compile(ips2, prefixes2, values2)
+	require.NoError(t, err)
+	ser2, err := sm2.Serialize()
+	require.NoError(t, err)
+
+	patch, err := Diff(ser, ser2)
+	require.NoError(t, err)
+	t.Logf("serialized: %d bytes, patch: %d bytes", len(ser2), len(patch))
+	require.Less(t, len(patch)*100, len(ser2))
+
+	patched, err := Patch(ser, patch)
+	require.NoError(t, err)
+	require.Equal(t, ser2, patched)
+
+	// The patch does not apply to another db.
+	_, err = Patch(ser2, patch)
+	require.Error(t, err)
+
+	// Any flipped bit is detected.
+	for i := range patch {
+		for bit := 0; bit < 8; bit++ {
+			patch[i] ^= 1 << bit
+			_, err := Patch(ser, patch)
+			require.Error(t, err, fmt.Sprintf("byte %d bit %d", i, bit))
+			patch[i] ^= 1 << bit
+		}
+	}
+
+	// Reverse patch.
+	patch2, err := Diff(ser2, ser)
+	require.NoError(t, err)
+	patched2, err := Patch(ser2, patch2)
+	require.NoError(t, err)
+	require.Equal(t, ser, patched2)
+}
+
+func TestStats(t *testing.T) {
+	sm, err := Compile(
+		[]uint32{0x01000000, 0x01020000, 0x01020300, 0x02000000},
+		[]uint8{8, 16, 24, 8},
+		[]uint64{10, 20, 30, 40},
+	)
+	require.NoError(t, err)
+
+	stats := sm.Stats()
+	require.Greater(t, stats.ListSize, 4)
+	require.Greater(t, stats.LongestScan, 1)
+	require.Len(t, stats.ScanHistogram, 32)
+
+	buckets := 0
+	for _, count := range stats.ScanHistogram {
+		buckets += count
+	}
+	require.Equal(t, 1<<16, buckets)
+	require.Equal(t, 0, stats.HotBuckets)
+	require.Equal(t, stats.HeaderBytes+stats.HashtableBytes+stats.MaxIpsBytes+stats.ValuesBytes+stats.HotBucketsBytes, stats.TotalBytes)
+	require.LessOrEqual(t, stats.TotalBytes, len(sm.dbPlace))
+}
+
+func TestProfiler(t *testing.T) {
+	sm, err := Compile(
+		[]uint32{0x01000000, 0x01020000, 0x01020300, 0x02000000},
+		[]uint8{8, 16, 24, 8},
+		[]uint64{10, 20, 30, 40},
+	)
+	require.NoError(t, err)
+
+	_, err = NewProfiler(0, 1)
+	require.ErrorContains(t, err, "hm_sm_profiler_place_size failed: 6")
+	_, err = NewProfiler(16, 0)
+	require.ErrorContains(t, err, "hm_sm_profiler_init failed: 4")
+
+	p1, err := NewProfiler(1000, 1)
+	require.NoError(t, err)
+	p2, err := NewProfiler(1000, 10)
+	require.NoError(t, err)
+
+	for i := 0; i < 100; i++ {
+		require.Equal(t, uint64(30), sm.FindSampled(p1, 0x01020304))
+		require.Equal(t, uint64(40), sm.FindSampled(p2, 0x02000001))
+	}
+
+	buckets, rangeHits, err := sm.Profile(p1, p2)
+	require.NoError(t, err)
+	require.Len(t, buckets, 1<<16)
+	require.Equal(t, uint64(100), buckets[0x0102].Samples)
+	require.Equal(t, uint64(10), buckets[0x0200].Samples)
+	require.Equal(t, buckets[0x0102].MaxScan*100, buckets[0x0102].ScanTotal)
+
+	var total uint64
+	for _, hits := range rangeHits {
+		total += hits
+	}
+	require.Equal(t, uint64(110), total)
+
+	// The ring buffer keeps only the last samples.
+	p3, err := NewProfiler(7, 1)
+	require.NoError(t, err)
+	for i := 0; i < 100; i++ {
+		sm.FindSampled(p3, 0x01000000)
+	}
+	buckets, _, err = sm.Profile(p3)
+	require.NoError(t, err)
+	require.Equal(t, uint64(7), buckets[0x0100].Samples)
+
+	p3.Reset()
+	buckets, _, err = sm.Profile(p3)
+	require.NoError(t, err)
+	require.Equal(t, uint64(0), buckets[0x0100].Samples)
+
+	require.NoError(t, p1.Close())
+	require.NoError(t, p2.Close())
+	require.NoError(t, p3.Close())
+	require.NoError(t, p3.Close())
+}
+
+func TestCompileWithProfile(t *testing.T) {
+	r := rand.New(rand.NewSource(1))
+	const n = 10000
+	ips := make([]uint32, n)
+	cidrPrefixes := make([]uint8, n)
+	values := make([]uint64, n)
+	for i := range ips {
+		// Concentrate ranges in a few /8 networks to get long scans.
+		ips[i] = uint32(r.Intn(4)+1)<<24 | r.Uint32()&0xFFFFFF
+		cidrPrefixes[i] = uint8(16 + r.Intn(17))
+		values[i] = uint64(i)
+	}
+	adjustInputs(ips, cidrPrefixes, values)
+
+	sm, err := Compile(ips, cidrPrefixes, values)
+	require.NoError(t, err)
+
+	// Skewed traffic: most lookups hit a few buckets.
+	queries := make([]uint32, 100000)
+	for i := range queries {
+		if r.Intn(10) != 0 {
+			queries[i] = ips[r.Intn(10)] | r.Uint32()&0xFFFF
+		} else {
+			queries[i] = r.Uint32()
+		}
+	}
+	p, err := NewProfiler(len(queries), 1)
+	require.NoError(t, err)
+	for _, ip := range queries {
+		sm.FindSampled(p, ip)
+	}
+	buckets, _, err := sm.Profile(p)
+	require.NoError(t, err)
+	defer p.Close()
+	bucketHits := make([]uint64, len(buckets))
+	for i, b := range buckets {
+		bucketHits[i] = b.Samples
+	}
+
+	_, err = CompileWithProfile(ips, cidrPrefixes, values, bucketHits[:10], 16)
+	require.Error(t, err)
+
+	hot, err := CompileWithProfile(ips, cidrPrefixes, values, bucketHits, 16)
+	require.NoError(t, err)
+	stats := hot.Stats()
+	require.Equal(t, 16, stats.HotBuckets)
+	require.Greater(t, stats.HotListSize, 16)
+	require.Equal(t, sm.Stats().ScanHistogram, stats.ScanHistogram)
+	require.LessOrEqual(t, stats.TotalBytes, len(hot.dbPlace))
+
+	ser, err := hot.Serialize()
+	require.NoError(t, err)
+	hot2, err := FromSerialized(ser)
+	require.NoError(t, err)
+	require.Equal(t, stats, hot2.Stats())
+
+	// Hot buckets take 4 bytes each. Garbage after the data is not accepted.
+	ser0, err := sm.Serialize()
+	require.NoError(t, err)
+	require.Equal(t, len(ser0)+16*4, len(ser))
+	_, err = FromSerialized(append(ser0, 1, 2, 3))
+	require.Error(t, err)
+
+	for _, ip := range queries {
+		want := sm.Find(ip)
+		require.Equal(t, want, hot.Find(ip), ip)
+		require.Equal(t, want, hot2.Find(ip), ip)
+	}
+	for b := range bucketHits {
+		if bucketHits[b] == 0 {
+			continue
+		}
+		for low := 0; low <= 0xFFFF; low += 4099 {
+			ip := uint32(b)<<16 | uint32(low)
+			require.Equal(t, sm.Find(ip), hot.Find(ip), ip)
+		}
+		ip := uint32(b)<<16 | 0xFFFF
+		require.Equal(t, sm.Find(ip), hot.Find(ip), ip)
+	}
+
+	// Samples of copies are attributed to the original ranges.
+	p.Reset()
+	for _, ip := range queries {
+		hot.FindSampled(p, ip)
+	}
+	_, rangeHits, err := hot.Profile(p)
+	require.NoError(t, err)
+	require.Len(t, rangeHits, stats.ListSize)
+	var total uint64
+	for _, hits := range rangeHits {
+		total += hits
+	}
+	require.Equal(t, uint64(len(queries)), total)
+}
+
+func TestFindBatch(t *testing.T) {
+	r := rand.New(rand.NewSource(400))
+	const N = 10001
+	ips := make([]uint32, N)
+	prefixes := make([]uint8, N)
+	values := make([]uint64, N)
+	for i := range ips {
+		ips[i] = r.Uint32()
+		prefixes[i] = uint8(16 + r.Intn(17))
+		values[i] = uint64(i)
+	}
+	adjustInputs(ips, prefixes, values)
+	db, err := Compile(ips, prefixes, values)
+	require.NoError(t, err)
+
+	// Queries are starts of ranges, mixed with random IPs.
+	queries := make([]uint32, 3*N)
+	for i := range queries {
+		if i%2 == 0 {
+			queries[i] = ips[r.Intn(len(ips))]
+		} else {
+			queries[i] = r.Uint32()
+		}
+	}
+	out := make([]uint64, len(queries))
+	db.FindBatch(queries, out)
+	for i, ip := range queries {
+		require.Equal(t, db.Find(ip), out[i], fmt.Sprintf("ip %08x", ip))
+	}
+
+	db.FindBatch(nil, nil)
+	require.Panics(t, func() {
+		db.FindBatch(queries, out[:1])
+	})
+}
+
+func TestReader(t *testing.T) {
+	r := rand.New(rand.NewSource(500))
+	const N = 10001
+	ips := make([]uint32, N)
+	prefixes := make([]uint8, N)
+	values := make([]uint64, N)
+	for i := range ips {
+		ips[i] = r.Uint32()
+		prefixes[i] = uint8(16 + r.Intn(17))
+		values[i] = uint64(i)
+	}
+	adjustInputs(ips, prefixes, values)
+	bucketHits := make([]uint64, 1<<16)
+	for i := range bucketHits {
+		bucketHits[i] = uint64(r.Intn(3))
+	}
+	db, err := Compile(ips, prefixes, values)
+	require.NoError(t, err)
+	hot, err := CompileWithProfile(ips, prefixes, values, bucketHits, 100)
+	require.NoError(t, err)
+	ser, err := hot.Serialize()
+	require.NoError(t, err)
+	loaded, err := FromSerialized(ser)
+	require.NoError(t, err)
+
+	for _, m := range []*StaticMap{db, hot, loaded} {
+		reader := m.Reader()
+		check := func(ip uint32) {
+			require.Equal(t, m.Find(ip), reader.Find(ip), fmt.Sprintf("ip %08x", ip))
+		}
+		for i := range ips {
+			check(ips[i])
+			check(ips[i] - 1)
+		}
+		for i := 0; i < 3*N; i++ {
+			check(r.Uint32())
+		}
+		check(0)
+		check(0xFFFFFFFF)
+	}
+}
+
+func TestOpenFile(t *testing.T) {
+	r := rand.New(rand.NewSource(600))
+	const N = 10001
+	ips := make([]uint32, N)
+	prefixes := make([]uint8, N)
+	values := make([]uint64, N)
+	for i := range ips {
+		ips[i] = r.Uint32()
+		prefixes[i] = uint8(16 + r.Intn(17))
+		values[i] = uint64(i)
+	}
+	adjustInputs(ips, prefixes, values)
+	db, err := Compile(ips, prefixes, values)
+	require.NoError(t, err)
+
+	path := filepath.Join(t.TempDir(), "db")
+	f, err := os.Create(path)
+	require.NoError(t, err)
+	require.NoError(t, db.SerializeTo(f))
+	require.NoError(t, f.Close())
+
+	db2, err := OpenFile(path)
+	require.NoError(t, err)
+	reader := db2.Reader()
+	for i := 0; i < 3*N; i++ {
+		ip := r.Uint32()
+		require.Equal(t, db.Find(ip), db2.Find(ip), fmt.Sprintf("ip %08x", ip))
+		require.Equal(t, db.Find(ip), reader.Find(ip), fmt.Sprintf("ip %08x", ip))
+	}
+	require.NoError(t, db2.Close())
+	require.NoError(t, db2.Close())
+
+	_, err = OpenFile(filepath.Join(t.TempDir(), "missing"))
+	require.Error(t, err)
+
+	empty := filepath.Join(t.TempDir(), "empty")
+	require.NoError(t, os.WriteFile(empty, nil, 0o644))
+	_, err = OpenFile(empty)
+	require.Error(t, err)
+
+	ser, err := db.Serialize()
+	require.NoError(t, err)
+	ser[len(ser)-1] ^= 1
+	corrupted := filepath.Join(t.TempDir(), "corrupted")
+	require.NoError(t, os.WriteFile(corrupted, ser, 0o644))
+	_, err = OpenFile(corrupted)
+	require.Error(t, err)
+}
+
+// benchSink keeps results of lookups in benchmarks, so they are not dropped
+// by the compiler.
+var benchSink uint64
+
+// benchBatch is the number of IPs per call in batch benchmarks.
+const benchBatch = 1024
+
+// benchMap compiles a map of n random ranges.
+func benchMap(b *testing.B, n int) *StaticMap {
+	r := rand.New(rand.NewSource(900))
+	ips := make([]uint32, n)
+	prefixes := make([]uint8, n)
+	values := make([]uint64, n)
+	for i := range ips {
+		ips[i] = r.Uint32()
+		prefixes[i] = uint8(16 + r.Intn(17))
+		values[i] = uint64(i)
+	}
+	adjustInputs(ips, prefixes, values)
+	db, err := Compile(ips, prefixes, values)
+	require.NoError(b, err)
+	return db
+}
+
+// BenchmarkFind measures lookups of random IPs through the Go API: one cgo
+// call per IP, one per batch and pure Go Reader, from one and from all
+// goroutines. The time is per IP.
+func BenchmarkFind(b *testing.B) {
+	for _, n := range []int{1000, 100000} {
+		db := benchMap(b, n)
+		reader := db.Reader()
+
+		r := rand.New(rand.NewSource(901))
+		queries := make([]uint32, 1<<16)
+		for i := range queries {
+			queries[i] = r.Uint32()
+		}
+		const mask = 1<<16 - 1
+
+		b.Run(fmt.Sprintf("n=%d/Find", n), func(b *testing.B) {
+			var sum uint64
+			for i := 0; i < b.N; i++ {
+				sum += db.Find(queries[i&mask])
+			}
+			benchSink = sum
+		})
+		b.Run(fmt.Sprintf("n=%d/FindBatch", n), func(b *testing.B) {
+			out := make([]uint64, benchBatch)
+			for i := 0; i < b.N; i += benchBatch {
+				count := b.N - i
+				if count > benchBatch {
+					count = benchBatch
+				}
+				start := i & mask
+				db.FindBatch(queries[start:start+count], out)
+			}
+			benchSink = out[0]
+		})
+		b.Run(fmt.Sprintf("n=%d/Reader", n), func(b *testing.B) {
+			var sum uint64
+			for i := 0; i < b.N; i++ {
+				sum += reader.Find(queries[i&mask])
+			}
+			benchSink = sum
+		})
+		b.Run(fmt.Sprintf("n=%d/FindParallel", n), func(b *testing.B) {
+			b.RunParallel(func(pb *testing.PB) {
+				var sum uint64
+				for i := 0; pb.Next(); i++ {
+					sum += db.Find(queries[i&mask])
+				}
+				atomic.AddUint64(&benchSink, sum)
+			})
+		})
+		b.Run(fmt.Sprintf("n=%d/ReaderParallel", n), func(b *testing.B) {
+			b.RunParallel(func(pb *testing.PB) {
+				var sum uint64
+				for i := 0; pb.Next(); i++ {
+					sum += reader.Find(queries[i&mask])
+				}
+				atomic.AddUint64(&benchSink, sum)
+			})
+		})
+	}
+}
+
+// BenchmarkSerialize measures serialization and loading of the serialized
+// form. The throughput is of the serialized form.
+func BenchmarkSerialize(b *testing.B) {
+	for _, n := range []int{1000, 100000} {
+		db := benchMap(b, n)
+		ser, err := db.Serialize()
+		require.NoError(b, err)
+
+		b.Run(fmt.Sprintf("n=%d/Serialize", n), func(b *testing.B) {
+			b.SetBytes(int64(len(ser)))
+			for i := 0; i < b.N; i++ {
+				_, err := db.Serialize()
+				if err != nil {
+					b.Fatal(err)
+				}
+			}
+		})
+		b.Run(fmt.Sprintf("n=%d/FromSerialized", n), func(b *testing.B) {
+			b.SetBytes(int64(len(ser)))
+			for i := 0; i < b.N; i++ {
+				_, err := FromSerialized(ser)
+				if err != nil {
+					b.Fatal(err)
+				}
+			}
+		})
+	}
+}
+
+func TestParseCIDRs(t *testing.T) {
+	const drop = `; Spamhaus DROP List 2024/09/01 - (c) 2024 The Spamhaus Project SLU
+; Last-Modified: Sun, 01 Sep 2024 10:31:59 GMT
+
+1.10.16.0/20 ; SBL256894
+1.19.0.0/16 ; SBL434604
+	2.57.122.0/24	; SBL636050
+10.0.0.1
+# other comment
+192.168.0.0/16
+`
+	ips, prefixes, err := ParseCIDRs(strings.NewReader(drop))
+	require.NoError(t, err)
+	require.Equal(t, []uint32{0x010A1000, 0x01130000, 0x02397A00, 0x0A000001, 0xC0A80000}, ips)
+	require.Equal(t, []uint8{20, 16, 24, 32, 16}, prefixes)
+
+	db, err := CompileFromReader(strings.NewReader(drop), 7)
+	require.NoError(t, err)
+	require.Equal(t, uint64(7), db.Find(0x010A1234))
+	require.Equal(t, uint64(7), db.Find(0x0A000001))
+	require.Equal(t, uint64(0xFFFFFFFFFFFFFFFF), db.Find(0x0A000002))
+
+	for _, bad := range []string{
+		"1.2.3/24",
+		"1.2.3.4.5",
+		"1.2.3.256",
+		"01.2.3.4",
+		"1.2.3.0/33",
+		"1.2.3.0/0",
+		"1.2.3.0/",
+		"1.2.3.4/24",
+		"1.2.3.0/24 x",
+		"x",
+	} {
+		_, _, err := ParseCIDRs(strings.NewReader("1.2.3.0/24\n\n" + bad + "\n"))
+		require.Error(t, err, bad)
+		require.True(t, strings.Contains(err.Error(), "line 3:"), err.Error())
+	}
+
+	_, err = CompileFromReader(strings.NewReader("; empty\n"), 1)
+	require.Error(t, err)
+}
+
+func TestParseCIDRsParallel(t *testing.T) {
+	defer runtime.GOMAXPROCS(runtime.GOMAXPROCS(4))
+
+	r := rand.New(rand.NewSource(1100))
+	var text strings.Builder
+	var wantIps []uint32
+	var wantPrefixes []uint8
+	for text.Len() < 4*minParseChunk {
+		prefix := uint8(8 + r.Intn(25))
+		ip := r.Uint32() &^ (1<<(32-prefix) - 1)
+		if r.Intn(10) == 0 {
+			fmt.Fprintf(&text, "; comment %d\n", r.Int())
+		}
+		fmt.Fprintf(&text, "%d.%d.%d.%d/%d ; SBL%d\n", ip>>24, ip>>16&0xFF, ip>>8&0xFF, ip&0xFF, prefix, r.Intn(1000000))
+		wantIps = append(wantIps, ip)
+		wantPrefixes = append(wantPrefixes, prefix)
+	}
+	ips, prefixes, err := ParseCIDRs(strings.NewReader(text.String()))
+	require.NoError(t, err)
+	require.Equal(t, wantIps, ips)
+	require.Equal(t, wantPrefixes, prefixes)
+
+	// The line of an error is counted across chunks.
+	lines := strings.Split(text.String(), "\n")
+	bad := len(lines) - 10
+	lines[bad] = "bad"
+	_, _, err = ParseCIDRs(strings.NewReader(strings.Join(lines, "\n")))
+	require.Error(t, err)
+	require.True(t, strings.Contains(err.Error(), fmt.Sprintf("line %d:", bad+1)), err.Error())
+}
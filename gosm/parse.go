@@ -0,0 +1,207 @@
+package gosm
+
+import (
+	"bytes"
+	"fmt"
+	"io"
+	"runtime"
+	"sync"
+)
+
+// minParseChunk is the minimal size of the part of the input parsed by one
+// goroutine (bytes), so small inputs are parsed by one goroutine.
+const minParseChunk = 256 << 10
+
+// ParseCIDRs parses the list of IPv4 ranges in the format of Spamhaus
+// drop.txt: one range per line as "a.b.c.d/prefix" or "a.b.c.d" (/32),
+// optionally followed by a comment starting with ';' or '#'. Blank lines and
+// comment lines are skipped. The input is split into chunks parsed by all
+// CPUs. Ranges are returned in the order of the input.
+func ParseCIDRs(r io.Reader) (ips []uint32, cidrPrefixes []uint8, err error) {
+	data, err := io.ReadAll(r)
+	if err != nil {
+		return nil, nil, err
+	}
+
+	// Split the input into chunks ending with a line end.
+	workers := runtime.GOMAXPROCS(0)
+	if n := len(data) / minParseChunk; n < workers {
+		workers = n
+	}
+	if workers < 1 {
+		workers = 1
+	}
+	var chunks [][]byte
+	for rest := data; len(rest) != 0; {
+		size := len(data) / workers
+		if size >= len(rest) || len(chunks) == workers-1 {
+			chunks = append(chunks, rest)
+			break
+		}
+		end := bytes.IndexByte(rest[size:], '\n')
+		if end == -1 {
+			chunks = append(chunks, rest)
+			break
+		}
+		end += size + 1
+		chunks = append(chunks, rest[:end])
+		rest = rest[end:]
+	}
+
+	type result struct {
+		ips      []uint32
+		prefixes []uint8
+		// line is the number of the bad line inside the chunk (1-based)
+		// and err is its error.
+		line int
+		err  error
+	}
+	results := make([]result, len(chunks))
+	var wg sync.WaitGroup
+	for i, chunk := range chunks {
+		wg.Add(1)
+		go func(res *result, chunk []byte) {
+			defer wg.Done()
+			res.ips, res.prefixes, res.line, res.err = parseChunk(chunk)
+		}(&results[i], chunk)
+	}
+	wg.Wait()
+
+	total := 0
+	lines := 0
+	for i, res := range results {
+		if res.err != nil {
+			return nil, nil, fmt.Errorf("line %d: %w", lines+res.line, res.err)
+		}
+		total += len(res.ips)
+		lines += bytes.Count(chunks[i], []byte{'\n'})
+	}
+	ips = make([]uint32, 0, total)
+	cidrPrefixes = make([]uint8, 0, total)
+	for _, res := range results {
+		ips = append(ips, res.ips...)
+		cidrPrefixes = append(cidrPrefixes, res.prefixes...)
+	}
+	return ips, cidrPrefixes, nil
+}
+
+// parseChunk parses lines of the chunk. On error it returns the number of the
+// bad line in the chunk.
+func parseChunk(chunk []byte) (ips []uint32, prefixes []uint8, line int, err error) {
+	// Lines of drop.txt are about 30 bytes long.
+	ips = make([]uint32, 0, len(chunk)/24)
+	prefixes = make([]uint8, 0, len(chunk)/24)
+	for len(chunk) != 0 {
+		line++
+		end := bytes.IndexByte(chunk, '\n')
+		var text []byte
+		if end == -1 {
+			text, chunk = chunk, nil
+		} else {
+			text, chunk = chunk[:end], chunk[end+1:]
+		}
+		ip, prefix, ok, err := parseLine(text)
+		if err != nil {
+			return nil, nil, line, err
+		}
+		if ok {
+			ips = append(ips, ip)
+			prefixes = append(prefixes, prefix)
+		}
+	}
+	return ips, prefixes, 0, nil
+}
+
+func isSpace(c byte) bool {
+	return c == ' ' || c == '\t' || c == '\r'
+}
+
+func isComment(c byte) bool {
+	return c == ';' || c == '#'
+}
+
+// parseLine parses one line. ok is false for blank and comment lines.
+func parseLine(text []byte) (ip uint32, prefix uint8, ok bool, err error) {
+	i := 0
+	for i < len(text) && isSpace(text[i]) {
+		i++
+	}
+	if i == len(text) || isComment(text[i]) {
+		return 0, 0, false, nil
+	}
+
+	for part := 0; part < 4; part++ {
+		if part != 0 {
+			if i == len(text) || text[i] != '.' {
+				return 0, 0, false, fmt.Errorf("bad IP in %q", text)
+			}
+			i++
+		}
+		octet, n := parseNumber(text[i:], 255)
+		if n == 0 {
+			return 0, 0, false, fmt.Errorf("bad IP in %q", text)
+		}
+		i += n
+		ip = ip<<8 | octet
+	}
+
+	prefix = 32
+	if i < len(text) && text[i] == '/' {
+		i++
+		p, n := parseNumber(text[i:], 32)
+		if n == 0 || p == 0 {
+			return 0, 0, false, fmt.Errorf("bad prefix in %q", text)
+		}
+		i += n
+		prefix = uint8(p)
+	}
+	if ip&(1<<(32-prefix)-1) != 0 {
+		return 0, 0, false, fmt.Errorf("bits after prefix are set in %q", text)
+	}
+
+	// The rest must be a comment.
+	for i < len(text) && isSpace(text[i]) {
+		i++
+	}
+	if i != len(text) && !isComment(text[i]) {
+		return 0, 0, false, fmt.Errorf("unexpected text after range in %q", text)
+	}
+	return ip, prefix, true, nil
+}
+
+// parseNumber parses a decimal number not greater than max at the start of
+// text without leading zeros. It returns the number of bytes parsed, 0 if
+// there is no valid number.
+func parseNumber(text []byte, max uint32) (uint32, int) {
+	var number uint32
+	n := 0
+	for n < len(text) && text[n] >= '0' && text[n] <= '9' {
+		if n == 1 && number == 0 {
+			// Leading zero.
+			return 0, 0
+		}
+		number = number*10 + uint32(text[n]-'0')
+		if number > max {
+			return 0, 0
+		}
+		n++
+	}
+	return number, n
+}
+
+// CompileFromReader parses ranges with ParseCIDRs and compiles a map of them
+// in which each range has the value.
+func CompileFromReader(r io.Reader, value uint64) (*StaticMap, error) {
+	ips, cidrPrefixes, err := ParseCIDRs(r)
+	if err != nil {
+		return nil, err
+	}
+	if len(ips) == 0 {
+		return nil, fmt.Errorf("no ranges")
+	}
+	values := make([]uint64, len(ips))
+	for i := range values {
+		values[i] = value
+	}
+	return Compile(ips, cidrPrefixes, values)
+}
@@ -0,0 +1,24 @@
+package gosm
+
+// Reader looks up IPs in a StaticMap in pure Go, reading the arrays of the
+// database in place. It avoids the cost of a cgo call per lookup, which is
+// higher than the lookup itself, and can be inlined. A Reader keeps the
+// StaticMap memory alive and is safe for concurrent use.
+type Reader struct {
+	hashtable *[1 << 16]uint32
+	maxIPs    []int32
+	values    []uint64
+}
+
+// Find returns the value corresponding to the given IP, same as
+// StaticMap.Find.
+func (r *Reader) Find(ip uint32) uint64 {
+	// Range ends are stored with the highest bit flipped to sort as signed,
+	// see hm_sm_view_t.
+	needle := int32(ip ^ 1<<31)
+	i := r.hashtable[ip>>16]
+	for r.maxIPs[i] < needle {
+		i++
+	}
+	return r.values[i]
+}
@@ -2,9 +2,13 @@ package gostaticuint64map
 
 import (
 	"fmt"
+	"os"
+	"runtime"
+	"syscall"
 	"unsafe"
 )
 
+// #include <hipermap/place.h>
 // #include <hipermap/static_uint64_map.h>
 // #cgo LDFLAGS: -l hipermap -lstdc++
 import "C"
@@ -12,12 +16,19 @@ import "C"
 type StaticUint64Map struct {
 	dbPlace []byte
 	db      *C.hm_u64map_database_t
+
+	// place holds the db instead of dbPlace if it was opened by OpenFile or
+	// built by Builder.
+	place *C.hm_place_t
 }
 
 func CompileKeyValues(keys, values []uint64) (*StaticUint64Map, error) {
 	if len(keys) != len(values) {
 		return nil, fmt.Errorf("len(keys) != len(values): %d != %d", len(keys), len(values))
 	}
+	if len(keys) > C.HM_U64MAP_MAX_ELEMENTS {
+		return nil, fmt.Errorf("too many keys: %d > %d", len(keys), C.HM_U64MAP_MAX_ELEMENTS)
+	}
 
 	dbPlaceSize := C.hm_u64map_db_place_size(C.uint(len(keys)))
 	dbPlace := make([]byte, dbPlaceSize)
@@ -55,11 +66,48 @@ func Compile(m map[uint64]uint64) (*StaticUint64Map, error) {
 }
 
 func (m *StaticUint64Map) Find(key uint64) uint64 {
-	return uint64(C.hm_u64map_find(m.db, C.uint64_t(key)))
+	value := C.hm_u64map_find(m.db, C.uint64_t(key))
+	// m.db points into m.dbPlace, which cgo does not keep alive.
+	runtime.KeepAlive(m)
+	return uint64(value)
+}
+
+// FindBatch stores the value of keys[i] (or 0 if it is not present) to out[i],
+// making one cgo call for the whole slice. It panics if out is shorter than
+// keys.
+func (m *StaticUint64Map) FindBatch(keys []uint64, out []uint64) {
+	if len(out) < len(keys) {
+		panic("gostaticuint64map: len(out) < len(keys)")
+	}
+	if len(keys) == 0 {
+		return
+	}
+	C.hm_u64map_find_batch(
+		m.db,
+		(*C.uint64_t)(unsafe.Pointer(&keys[0])),
+		(*C.uint64_t)(unsafe.Pointer(&out[0])),
+		C.size_t(len(keys)),
+	)
+	runtime.KeepAlive(m)
+}
+
+// Reader returns a pure Go reader of the map, see Reader.
+func (m *StaticUint64Map) Reader() *Reader {
+	var view C.hm_u64map_view_t
+	C.hm_u64map_view(m.db, &view)
+	runtime.KeepAlive(m)
+	return &Reader{
+		hashTable: unsafe.Slice((*uint64)(unsafe.Pointer(view.hash_table)), 2*view.buckets),
+		factor1:   uint64(view.factor1),
+		factor2:   uint64(view.factor2),
+		mask:      uint64(view.mask_for_hash),
+	}
 }
 
 func (m *StaticUint64Map) Benchmark(beginKey, endKey uint64) uint64 {
-	return uint64(C.hm_u64map_benchmark(m.db, C.uint64_t(beginKey), C.uint64_t(endKey)))
+	result := C.hm_u64map_benchmark(m.db, C.uint64_t(beginKey), C.uint64_t(endKey))
+	runtime.KeepAlive(m)
+	return uint64(result)
 }
 
 func (m *StaticUint64Map) Serialize() ([]byte, error) {
@@ -70,6 +118,7 @@ func (m *StaticUint64Map) Serialize() ([]byte, error) {
 		serSize,
 		m.db,
 	)
+	runtime.KeepAlive(m)
 	if hmErr != C.HM_SUCCESS {
 		return nil, fmt.Errorf("hm_u64map_serialize failed: %d", hmErr)
 	}
@@ -77,9 +126,42 @@ func (m *StaticUint64Map) Serialize() ([]byte, error) {
 }
 
 func FromSerialized(buffer []byte) (*StaticUint64Map, error) {
+	return FromSerializedWithOptions(buffer, LoadOptions{})
+}
+
+// LoadOptions tune FromSerializedWithOptions for large databases.
+type LoadOptions struct {
+	// Threads is the number of threads copying and checksumming the data.
+	// 0 and 1 mean the calling goroutine only.
+	Threads int
+
+	// NonTemporal copies bypassing CPU caches, so loading a large db does
+	// not evict the data of the databases serving lookups meanwhile.
+	NonTemporal bool
+
+	// Prefault populates the memory of the db in bulk before the copy.
+	Prefault bool
+}
+
+// FromSerializedWithOptions is FromSerialized with options. Locking the
+// memory (HM_LOAD_MLOCK) is not offered, since the memory of the db belongs
+// to the Go heap.
+func FromSerializedWithOptions(buffer []byte, opts LoadOptions) (*StaticUint64Map, error) {
 	if len(buffer) == 0 {
 		return nil, fmt.Errorf("empty buffer")
 	}
+	if opts.Threads < 0 {
+		return nil, fmt.Errorf("negative number of threads")
+	}
+	options := C.hm_load_options_t{
+		threads: C.uint(opts.Threads),
+	}
+	if opts.NonTemporal {
+		options.flags |= C.HM_LOAD_NONTEMPORAL
+	}
+	if opts.Prefault {
+		options.flags |= C.HM_LOAD_PREFAULT
+	}
 
 	var dbPlaceSize C.size_t
 	hmErr := C.hm_u64map_db_place_size_from_serialized(
@@ -93,19 +175,323 @@ func FromSerialized(buffer []byte) (*StaticUint64Map, error) {
 
 	dbPlace := make([]byte, dbPlaceSize)
 	var db *C.hm_u64map_database_t
-	hmErr = C.hm_u64map_deserialize(
+	hmErr = C.hm_u64map_deserialize_ex(
 		(*C.char)(unsafe.Pointer(&dbPlace[0])),
 		dbPlaceSize,
 		&db,
 		(*C.char)(unsafe.Pointer(&buffer[0])),
 		C.size_t(len(buffer)),
+		&options,
 	)
 	if hmErr != C.HM_SUCCESS {
+		return nil, fmt.Errorf("hm_u64map_deserialize_ex failed: %d", hmErr)
+	}
+
+	return &StaticUint64Map{
+		dbPlace: dbPlace,
+		db:      db,
+	}, nil
+}
+
+// SerializeTo writes the serialized db to f, which can be a file, a pipe or a
+// socket. Unlike Serialize, it does not allocate a buffer of the whole db.
+func (m *StaticUint64Map) SerializeTo(f *os.File) error {
+	hmErr, err := C.hm_u64map_serialize_fd(C.int(f.Fd()), m.db)
+	// m owns the memory of the db, which is written while blocked on f.
+	runtime.KeepAlive(m)
+	runtime.KeepAlive(f)
+	if hmErr == C.HM_ERROR_SYSTEM {
+		return fmt.Errorf("hm_u64map_serialize_fd failed: %w", err)
+	}
+	if hmErr != C.HM_SUCCESS {
+		return fmt.Errorf("hm_u64map_serialize_fd failed: %d", hmErr)
+	}
+	return nil
+}
+
+// FromFile loads the db written by SerializeTo or Serialize from f, starting
+// at its current position. f is read sequentially right into the memory of
+// the db, without a buffer of the whole db, so it can be a file, a pipe or a
+// socket.
+func FromFile(f *os.File) (*StaticUint64Map, error) {
+	defer runtime.KeepAlive(f)
+	fd := C.int(f.Fd())
+
+	// header keeps the beginning of the db read by the first call.
+	var header C.hm_fd_header_t
+	var dbPlaceSize C.size_t
+	hmErr, err := C.hm_u64map_db_place_size_from_fd(&dbPlaceSize, &header, fd)
+	if hmErr == C.HM_ERROR_SYSTEM {
+		return nil, fmt.Errorf("hm_u64map_db_place_size_from_fd failed: %w", err)
+	}
+	if hmErr != C.HM_SUCCESS {
+		return nil, fmt.Errorf("hm_u64map_db_place_size_from_fd failed: %d", hmErr)
+	}
+
+	dbPlace := make([]byte, dbPlaceSize)
+	var db *C.hm_u64map_database_t
+	hmErr, err = C.hm_u64map_deserialize_fd(
+		(*C.char)(unsafe.Pointer(&dbPlace[0])),
+		dbPlaceSize,
+		&db,
+		&header,
+		fd,
+	)
+	if hmErr == C.HM_ERROR_SYSTEM {
+		return nil, fmt.Errorf("hm_u64map_deserialize_fd failed: %w", err)
+	}
+	if hmErr != C.HM_SUCCESS {
+		return nil, fmt.Errorf("hm_u64map_deserialize_fd failed: %d", hmErr)
+	}
+
+	return &StaticUint64Map{
+		dbPlace: dbPlace,
+		db:      db,
+	}, nil
+}
+
+// OpenFile loads the serialized db from the file at path. The file is mapped
+// into memory and the db is built outside of the Go heap, so the garbage
+// collector neither scans nor counts it. Large databases are placed on
+// transparent huge pages. The db must be freed with Close. The file must not
+// be truncated while it is loaded.
+func OpenFile(path string) (*StaticUint64Map, error) {
+	f, err := os.Open(path)
+	if err != nil {
+		return nil, err
+	}
+	defer f.Close()
+	info, err := f.Stat()
+	if err != nil {
+		return nil, err
+	}
+	if info.Size() == 0 {
+		return nil, fmt.Errorf("empty file")
+	}
+	buffer, err := syscall.Mmap(int(f.Fd()), 0, int(info.Size()), syscall.PROT_READ, syscall.MAP_SHARED)
+	if err != nil {
+		return nil, fmt.Errorf("mmap failed: %w", err)
+	}
+	defer syscall.Munmap(buffer)
+	// The file is read once from start to end.
+	_ = syscall.Madvise(buffer, syscall.MADV_SEQUENTIAL)
+
+	var dbPlaceSize C.size_t
+	hmErr := C.hm_u64map_db_place_size_from_serialized(
+		&dbPlaceSize,
+		(*C.char)(unsafe.Pointer(&buffer[0])),
+		C.size_t(len(buffer)),
+	)
+	if hmErr != C.HM_SUCCESS {
+		return nil, fmt.Errorf("hm_u64map_db_place_size_from_serialized failed: %d", hmErr)
+	}
+
+	place, err := allocPlace(dbPlaceSize)
+	if err != nil {
+		return nil, err
+	}
+	var db *C.hm_u64map_database_t
+	hmErr = C.hm_u64map_deserialize(
+		place.data,
+		place.size,
+		&db,
+		(*C.char)(unsafe.Pointer(&buffer[0])),
+		C.size_t(len(buffer)),
+	)
+	if hmErr != C.HM_SUCCESS {
+		C.hm_place_free(place)
 		return nil, fmt.Errorf("hm_u64map_deserialize failed: %d", hmErr)
 	}
 
+	return &StaticUint64Map{
+		db:    db,
+		place: place,
+	}, nil
+}
+
+// allocPlace allocates db place outside of the Go heap. Large databases are
+// placed on transparent huge pages.
+func allocPlace(dbPlaceSize C.size_t) (*C.hm_place_t, error) {
+	pages := C.hm_page_kind_t(C.HM_PAGES_DEFAULT)
+	if dbPlaceSize >= 2<<20 {
+		pages = C.HM_PAGES_THP
+	}
+	place := new(C.hm_place_t)
+	hmErr := C.hm_place_alloc(place, dbPlaceSize, pages)
+	if hmErr != C.HM_SUCCESS {
+		return nil, fmt.Errorf("hm_place_alloc failed: %d", hmErr)
+	}
+	return place, nil
+}
+
+// Close frees the db opened by OpenFile or built by Builder. The db and its
+// Readers must not be used after Close. For databases in the Go heap it only
+// drops the reference to the memory.
+func (m *StaticUint64Map) Close() error {
+	if m.place != nil {
+		C.hm_place_free(m.place)
+		m.place = nil
+	}
+	m.dbPlace = nil
+	m.db = nil
+	return nil
+}
+
+// Pack returns the db in packed form, which is much smaller than the
+// serialized form and is meant for distribution. Use FromPacked to load it.
+func (m *StaticUint64Map) Pack() ([]byte, error) {
+	maxSize := C.hm_u64map_packed_max_size(m.db)
+	packed := make([]byte, maxSize)
+	var packedSize C.size_t
+	hmErr := C.hm_u64map_pack(
+		(*C.char)(unsafe.Pointer(&packed[0])),
+		maxSize,
+		m.db,
+		&packedSize,
+	)
+	// m.db points into m.dbPlace, which cgo does not keep alive.
+	runtime.KeepAlive(m)
+	if hmErr != C.HM_SUCCESS {
+		return nil, fmt.Errorf("hm_u64map_pack failed: %d", hmErr)
+	}
+	return packed[:packedSize], nil
+}
+
+// FromPacked loads the db from the output of Pack.
+func FromPacked(buffer []byte) (*StaticUint64Map, error) {
+	if len(buffer) == 0 {
+		return nil, fmt.Errorf("empty buffer")
+	}
+
+	var dbPlaceSize C.size_t
+	hmErr := C.hm_u64map_db_place_size_from_packed(
+		&dbPlaceSize,
+		(*C.char)(unsafe.Pointer(&buffer[0])),
+		C.size_t(len(buffer)),
+	)
+	if hmErr != C.HM_SUCCESS {
+		return nil, fmt.Errorf("hm_u64map_db_place_size_from_packed failed: %d", hmErr)
+	}
+
+	dbPlace := make([]byte, dbPlaceSize)
+	var db *C.hm_u64map_database_t
+	hmErr = C.hm_u64map_unpack(
+		(*C.char)(unsafe.Pointer(&dbPlace[0])),
+		dbPlaceSize,
+		&db,
+		(*C.char)(unsafe.Pointer(&buffer[0])),
+		C.size_t(len(buffer)),
+	)
+	if hmErr != C.HM_SUCCESS {
+		return nil, fmt.Errorf("hm_u64map_unpack failed: %d", hmErr)
+	}
+
 	return &StaticUint64Map{
 		dbPlace: dbPlace,
 		db:      db,
 	}, nil
 }
+
+// Diff returns a patch turning serialized db oldSer into serialized db newSer.
+// Its size is proportional to the number of changed elements. Use Patch to
+// apply it.
+func Diff(oldSer, newSer []byte) ([]byte, error) {
+	if len(oldSer) == 0 || len(newSer) == 0 {
+		return nil, fmt.Errorf("empty buffer")
+	}
+
+	var maxSize C.size_t
+	hmErr := C.hm_u64map_diff_max_size(
+		&maxSize,
+		(*C.char)(unsafe.Pointer(&oldSer[0])),
+		C.size_t(len(oldSer)),
+		(*C.char)(unsafe.Pointer(&newSer[0])),
+		C.size_t(len(newSer)),
+	)
+	if hmErr != C.HM_SUCCESS {
+		return nil, fmt.Errorf("hm_u64map_diff_max_size failed: %d", hmErr)
+	}
+
+	patch := make([]byte, maxSize)
+	var patchSize C.size_t
+	hmErr = C.hm_u64map_diff(
+		(*C.char)(unsafe.Pointer(&patch[0])),
+		maxSize,
+		(*C.char)(unsafe.Pointer(&oldSer[0])),
+		C.size_t(len(oldSer)),
+		(*C.char)(unsafe.Pointer(&newSer[0])),
+		C.size_t(len(newSer)),
+		&patchSize,
+	)
+	if hmErr != C.HM_SUCCESS {
+		return nil, fmt.Errorf("hm_u64map_diff failed: %d", hmErr)
+	}
+	return patch[:patchSize], nil
+}
+
+// Patch applies the output of Diff to serialized db oldSer and returns the new
+// serialized db, which can be loaded with FromSerialized.
+func Patch(oldSer, patch []byte) ([]byte, error) {
+	if len(oldSer) == 0 || len(patch) == 0 {
+		return nil, fmt.Errorf("empty buffer")
+	}
+
+	var serSize C.size_t
+	hmErr := C.hm_u64map_patched_size(
+		&serSize,
+		(*C.char)(unsafe.Pointer(&oldSer[0])),
+		C.size_t(len(oldSer)),
+		(*C.char)(unsafe.Pointer(&patch[0])),
+		C.size_t(len(patch)),
+	)
+	if hmErr != C.HM_SUCCESS {
+		return nil, fmt.Errorf("hm_u64map_patched_size failed: %d", hmErr)
+	}
+
+	ser := make([]byte, serSize)
+	hmErr = C.hm_u64map_patch(
+		(*C.char)(unsafe.Pointer(&ser[0])),
+		serSize,
+		(*C.char)(unsafe.Pointer(&oldSer[0])),
+		C.size_t(len(oldSer)),
+		(*C.char)(unsafe.Pointer(&patch[0])),
+		C.size_t(len(patch)),
+	)
+	if hmErr != C.HM_SUCCESS {
+		return nil, fmt.Errorf("hm_u64map_patch failed: %d", hmErr)
+	}
+	return ser, nil
+}
+
+// Stats describes the layout and memory usage of a StaticUint64Map.
+type Stats struct {
+	Elements        int
+	Buckets         int
+	LoadFactor      float64
+	GroupHistogram  [5]int
+	CompileAttempts int
+
+	HeaderBytes    int
+	HashTableBytes int
+	TotalBytes     int
+}
+
+func (m *StaticUint64Map) Stats() Stats {
+	var cstats C.hm_u64map_stats_t
+	C.hm_u64map_stats(m.db, &cstats)
+	runtime.KeepAlive(m)
+	var histogram [5]int
+	for i, count := range cstats.group_histogram {
+		histogram[i] = int(count)
+	}
+	return Stats{
+		Elements:        int(cstats.elements),
+		Buckets:         int(cstats.buckets),
+		LoadFactor:      float64(cstats.load_factor),
+		GroupHistogram:  histogram,
+		CompileAttempts: int(cstats.compile_attempts),
+		HeaderBytes:     int(cstats.header_bytes),
+		HashTableBytes:  int(cstats.hash_table_bytes),
+		TotalBytes:      int(cstats.total_bytes),
+	}
+}
@@ -1,10 +1,15 @@
 package gostaticuint64map
 
 import (
+	"bytes"
 	"encoding/binary"
 	"encoding/hex"
 	"fmt"
+	"io"
 	"math/rand"
+	"os"
+	"path/filepath"
+	"sync/atomic"
 	"testing"
 	"time"
 
@@ -37,6 +42,250 @@ func TestSimple(t *testing.T) {
 	require.Equal(t, uint64(0), db2.Find(0))
 }
 
+func TestSerializedCorruption(t *testing.T) {
+	db, err := Compile(map[uint64]uint64{1: 2, 2: 3})
+	require.NoError(t, err)
+	ser, err := db.Serialize()
+	require.NoError(t, err)
+
+	// Header, factor1, factor2, buckets, then key and value of each bucket.
+	require.Equal(t, "hipermap", string(ser[:8]))
+	buckets := binary.LittleEndian.Uint64(ser[64+16:])
+	require.Equal(t, 64+3*8+int(buckets)*16, len(ser))
+
+	for i := range ser {
+		for bit := 0; bit < 8; bit++ {
+			ser[i] ^= 1 << bit
+			_, err := FromSerialized(ser)
+			require.Error(t, err, fmt.Sprintf("byte %d bit %d", i, bit))
+			ser[i] ^= 1 << bit
+		}
+	}
+
+	_, err = FromSerialized(ser[:len(ser)-1])
+	require.Error(t, err)
+	_, err = FromSerialized(append(ser, 0))
+	require.Error(t, err)
+
+	db2, err := FromSerialized(ser)
+	require.NoError(t, err)
+	require.Equal(t, uint64(3), db2.Find(2))
+}
+
+func TestFile(t *testing.T) {
+	r := rand.New(rand.NewSource(300))
+	m := make(map[uint64]uint64, 10000)
+	for len(m) < 10000 {
+		m[r.Uint64()|1] = r.Uint64() | 1
+	}
+	db, err := Compile(m)
+	require.NoError(t, err)
+
+	f, err := os.Create(filepath.Join(t.TempDir(), "db"))
+	require.NoError(t, err)
+	defer f.Close()
+	require.NoError(t, db.SerializeTo(f))
+
+	// The file is the same as the serialized buffer.
+	ser, err := db.Serialize()
+	require.NoError(t, err)
+	data, err := os.ReadFile(f.Name())
+	require.NoError(t, err)
+	require.Equal(t, ser, data)
+
+	// f is read from its current position.
+	_, err = FromFile(f)
+	require.Error(t, err)
+	_, err = f.Seek(0, io.SeekStart)
+	require.NoError(t, err)
+	db2, err := FromFile(f)
+	require.NoError(t, err)
+	for key, value := range m {
+		require.Equal(t, value, db2.Find(key))
+	}
+
+	// Corruption is detected.
+	i := len(ser) / 2
+	_, err = f.WriteAt([]byte{ser[i] ^ 1}, int64(i))
+	require.NoError(t, err)
+	_, err = f.Seek(0, io.SeekStart)
+	require.NoError(t, err)
+	_, err = FromFile(f)
+	require.Error(t, err)
+	require.NoError(t, f.Truncate(int64(len(ser)-1)))
+	_, err = f.Seek(0, io.SeekStart)
+	require.NoError(t, err)
+	_, err = FromFile(f)
+	require.Error(t, err)
+
+	// Dbs are loaded from a pipe one after another.
+	pr, pw, err := os.Pipe()
+	require.NoError(t, err)
+	defer pr.Close()
+	errs := make(chan error, 1)
+	go func() {
+		err := db.SerializeTo(pw)
+		if err == nil {
+			err = db.SerializeTo(pw)
+		}
+		pw.Close()
+		errs <- err
+	}()
+	for j := 0; j < 2; j++ {
+		db3, err := FromFile(pr)
+		require.NoError(t, err)
+		ser3, err := db3.Serialize()
+		require.NoError(t, err)
+		require.Equal(t, ser, ser3)
+	}
+	_, err = FromFile(pr)
+	require.Error(t, err)
+	require.NoError(t, <-errs)
+}
+
+func TestLoadOptions(t *testing.T) {
+	r := rand.New(rand.NewSource(400))
+	// The hash table of 65537 entries takes 16 MiB. load.c gives each
+	// thread at least 4 MiB, so it is split between up to 4 threads.
+	const N = 65537
+	m := make(map[uint64]uint64, N)
+	for len(m) < N {
+		m[r.Uint64()|1] = r.Uint64() | 1
+	}
+	db, err := Compile(m)
+	require.NoError(t, err)
+	require.Equal(t, 16<<20, db.Stats().HashTableBytes)
+	ser, err := db.Serialize()
+	require.NoError(t, err)
+	plain, err := FromSerialized(ser)
+	require.NoError(t, err)
+	keys := make([]uint64, 0, N)
+	for key := range m {
+		keys = append(keys, key)
+	}
+	values := make([]uint64, N)
+
+	for _, opts := range []LoadOptions{
+		{},
+		{Threads: 4},
+		{Threads: 3, NonTemporal: true},
+		{Threads: 2, Prefault: true},
+		{Threads: 100, NonTemporal: true, Prefault: true},
+	} {
+		db2, err := FromSerializedWithOptions(ser, opts)
+		require.NoError(t, err)
+		db2.FindBatch(keys, values)
+		for i, key := range keys {
+			require.Equal(t, m[key], values[i])
+		}
+		// The db is the same as the one loaded without options.
+		require.Equal(t, plain.Stats(), db2.Stats())
+		ser2, err := db2.Serialize()
+		require.NoError(t, err)
+		require.True(t, bytes.Equal(ser, ser2), fmt.Sprintf("%+v", opts))
+
+		// Corruption is detected in the part of any thread.
+		for _, i := range []int{100, len(ser) / 3, len(ser) * 5 / 8, len(ser) - 1} {
+			ser[i] ^= 1
+			_, err := FromSerializedWithOptions(ser, opts)
+			require.Error(t, err, fmt.Sprintf("%+v byte %d", opts, i))
+			ser[i] ^= 1
+		}
+	}
+
+	_, err = FromSerializedWithOptions(ser, LoadOptions{Threads: -1})
+	require.Error(t, err)
+}
+
+func TestDiffPatch(t *testing.T) {
+	r := rand.New(rand.NewSource(300))
+
+	const N = 10000
+	m := make(map[uint64]uint64, N)
+	for len(m) < N {
+		m[r.Uint64()|1] = r.Uint64()%100 + 1
+	}
+	db, err := Compile(m)
+	require.NoError(t, err)
+	ser, err := db.Serialize()
+	require.NoError(t, err)
+
+	// Change some values, remove some keys and add new ones.
+	m2 := make(map[uint64]uint64, N)
+	removed := 0
+	for k, v := range m {
+		if removed < 10 {
+			removed++
+			continue
+		}
+		m2[k] = v
+	}
+	changed := 0
+	for k := range m2 {
+		if changed == 10 {
+			break
+		}
+		m2[k] = 1000
+		changed++
+	}
+	for i := 0; i < 10; i++ {
+		m2[r.Uint64()|1] = 2000
+	}
+	db2, err := Compile(m2)
+	require.NoError(t, err)
+	ser2, err := db2.Serialize()
+	require.NoError(t, err)
+
+	patch, err := Diff(ser, ser2)
+	require.NoError(t, err)
+	t.Logf("serialized: %d bytes, patch: %d bytes", len(ser2), len(patch))
+	require.Less(t, len(patch)*100, len(ser2))
+
+	patched, err := Patch(ser, patch)
+	require.NoError(t, err)
+	db3, err := FromSerialized(patched)
+	require.NoError(t, err)
+	for k := range m {
+		require.Equal(t, m2[k], db3.Find(k), k)
+	}
+	for k, v := range m2 {
+		require.Equal(t, v, db3.Find(k), k)
+		require.Equal(t, m2[k+2], db3.Find(k+2), k+2)
+	}
+	require.Equal(t, uint64(0), db3.Find(0))
+
+	// The patch does not apply to another db.
+	_, err = Patch(ser2, patch)
+	require.Error(t, err)
+
+	// Any flipped bit is detected.
+	for i := range patch {
+		for bit := 0; bit < 8; bit++ {
+			patch[i] ^= 1 << bit
+			_, err := Patch(ser, patch)
+			require.Error(t, err, fmt.Sprintf("byte %d bit %d", i, bit))
+			patch[i] ^= 1 << bit
+		}
+	}
+
+	// Patch between dbs of different sizes.
+	small, err := Compile(map[uint64]uint64{1: 2, 2: 3})
+	require.NoError(t, err)
+	smallSer, err := small.Serialize()
+	require.NoError(t, err)
+	patch2, err := Diff(smallSer, ser2)
+	require.NoError(t, err)
+	patched2, err := Patch(smallSer, patch2)
+	require.NoError(t, err)
+	require.Equal(t, ser2, patched2)
+
+	patch3, err := Diff(ser2, smallSer)
+	require.NoError(t, err)
+	patched3, err := Patch(ser2, patch3)
+	require.NoError(t, err)
+	require.Equal(t, smallSer, patched3)
+}
+
 func TestCompileFail(t *testing.T) {
 	_, err := Compile(nil)
 	require.ErrorContains(t, err, "no keys")
@@ -113,6 +362,17 @@ func TestLarge(t *testing.T) {
 	for k, v := range m {
 		require.Equal(t, v, db2.Find(k))
 	}
+
+	packed, err := db.Pack()
+	require.NoError(t, err)
+	t.Logf("serialized: %d bytes, packed: %d bytes", len(ser), len(packed))
+
+	db3, err := FromPacked(packed)
+	require.NoError(t, err)
+
+	for k, v := range m {
+		require.Equal(t, v, db3.Find(k))
+	}
 }
 
 func TestBenchmark(t *testing.T) {
@@ -248,3 +508,345 @@ func FuzzFind(f *testing.F) {
 		}
 	})
 }
+
+func TestStats(t *testing.T) {
+	r := rand.New(rand.NewSource(1))
+	m := make(map[uint64]uint64)
+	for len(m) < 10000 {
+		m[uint64(r.Int63())+1] = uint64(r.Int63())
+	}
+	db, err := Compile(m)
+	require.NoError(t, err)
+
+	stats := db.Stats()
+	require.Equal(t, 10000, stats.Elements)
+	require.Equal(t, 0, stats.Buckets%4)
+	require.Equal(t, float64(stats.Elements)/float64(stats.Buckets), stats.LoadFactor)
+	require.Greater(t, stats.CompileAttempts, 0)
+
+	groups, elements := 0, 0
+	for i, count := range stats.GroupHistogram {
+		groups += count
+		elements += i * count
+	}
+	require.Equal(t, stats.Buckets/4, groups)
+	require.Equal(t, stats.Elements, elements)
+	require.Equal(t, stats.HeaderBytes+stats.HashTableBytes, stats.TotalBytes)
+	require.LessOrEqual(t, stats.TotalBytes, len(db.dbPlace))
+
+	ser, err := db.Serialize()
+	require.NoError(t, err)
+	db2, err := FromSerialized(ser)
+	require.NoError(t, err)
+	stats2 := db2.Stats()
+	require.Equal(t, 0, stats2.CompileAttempts)
+	stats2.CompileAttempts = stats.CompileAttempts
+	require.Equal(t, stats, stats2)
+}
+
+func TestPackedCorruption(t *testing.T) {
+	db, err := Compile(map[uint64]uint64{1: 2, 2: 3})
+	require.NoError(t, err)
+	packed, err := db.Pack()
+	require.NoError(t, err)
+
+	require.Equal(t, "hipermap", string(packed[:8]))
+	require.Equal(t, uint32(0x103), binary.LittleEndian.Uint32(packed[12:]))
+
+	for i := range packed {
+		for bit := 0; bit < 8; bit++ {
+			packed[i] ^= 1 << bit
+			_, err := FromPacked(packed)
+			require.Error(t, err, fmt.Sprintf("byte %d bit %d", i, bit))
+			packed[i] ^= 1 << bit
+		}
+	}
+
+	_, err = FromPacked(packed[:len(packed)-1])
+	require.Error(t, err)
+	_, err = FromPacked(append(packed, 0))
+	require.Error(t, err)
+
+	db2, err := FromPacked(packed)
+	require.NoError(t, err)
+	require.Equal(t, uint64(3), db2.Find(2))
+}
+
+func TestFindBatch(t *testing.T) {
+	r := rand.New(rand.NewSource(400))
+	m := make(map[uint64]uint64)
+	keys := make([]uint64, 0, 10001)
+	for len(m) < 10001 {
+		key := r.Uint64()
+		if _, has := m[key]; !has {
+			keys = append(keys, key)
+		}
+		m[key] = r.Uint64()
+	}
+	db, err := Compile(m)
+	require.NoError(t, err)
+
+	queries := make([]uint64, 3*len(keys))
+	for i := range queries {
+		if i%2 == 0 {
+			queries[i] = keys[r.Intn(len(keys))]
+		} else {
+			queries[i] = r.Uint64()
+		}
+	}
+	out := make([]uint64, len(queries))
+	db.FindBatch(queries, out)
+	for i, key := range queries {
+		require.Equal(t, m[key], out[i], fmt.Sprintf("key %d", key))
+	}
+
+	db.FindBatch(nil, nil)
+	require.Panics(t, func() {
+		db.FindBatch(queries, out[:1])
+	})
+}
+
+func TestReader(t *testing.T) {
+	r := rand.New(rand.NewSource(500))
+	m := make(map[uint64]uint64)
+	for len(m) < 10001 {
+		m[r.Uint64()] = r.Uint64() | 1
+	}
+	db, err := Compile(m)
+	require.NoError(t, err)
+	ser, err := db.Serialize()
+	require.NoError(t, err)
+	loaded, err := FromSerialized(ser)
+	require.NoError(t, err)
+
+	for _, d := range []*StaticUint64Map{db, loaded} {
+		reader := d.Reader()
+		for key, value := range m {
+			require.Equal(t, value, reader.Find(key), fmt.Sprintf("key %d", key))
+		}
+		for i := 0; i < 3*len(m); i++ {
+			key := r.Uint64()
+			require.Equal(t, d.Find(key), reader.Find(key), fmt.Sprintf("key %d", key))
+		}
+		require.Equal(t, uint64(0), reader.Find(0))
+	}
+}
+
+func TestOpenFile(t *testing.T) {
+	r := rand.New(rand.NewSource(600))
+	m := make(map[uint64]uint64)
+	for len(m) < 10001 {
+		m[r.Uint64()] = r.Uint64() | 1
+	}
+	db, err := Compile(m)
+	require.NoError(t, err)
+
+	path := filepath.Join(t.TempDir(), "db")
+	f, err := os.Create(path)
+	require.NoError(t, err)
+	require.NoError(t, db.SerializeTo(f))
+	require.NoError(t, f.Close())
+
+	db2, err := OpenFile(path)
+	require.NoError(t, err)
+	reader := db2.Reader()
+	for key, value := range m {
+		require.Equal(t, value, db2.Find(key), fmt.Sprintf("key %d", key))
+		require.Equal(t, value, reader.Find(key), fmt.Sprintf("key %d", key))
+	}
+	require.NoError(t, db2.Close())
+	require.NoError(t, db2.Close())
+
+	_, err = OpenFile(filepath.Join(t.TempDir(), "missing"))
+	require.Error(t, err)
+
+	ser, err := db.Serialize()
+	require.NoError(t, err)
+	ser[len(ser)-1] ^= 1
+	corrupted := filepath.Join(t.TempDir(), "corrupted")
+	require.NoError(t, os.WriteFile(corrupted, ser, 0o644))
+	_, err = OpenFile(corrupted)
+	require.Error(t, err)
+}
+
+func TestBuilder(t *testing.T) {
+	b := NewBuilder(0)
+	defer b.Close()
+	_, err := b.Compile()
+	require.Error(t, err)
+
+	r := rand.New(rand.NewSource(800))
+	m := make(map[uint64]uint64)
+	for len(m) < 10001 {
+		key := r.Uint64()
+		if _, has := m[key]; has {
+			continue
+		}
+		value := r.Uint64() | 1
+		m[key] = value
+		b.Add(key, value)
+	}
+	require.Equal(t, len(m), b.Len())
+
+	db, err := b.Compile()
+	require.NoError(t, err)
+	defer db.Close()
+	for key, value := range m {
+		require.Equal(t, value, db.Find(key), fmt.Sprintf("key %d", key))
+	}
+	for i := 0; i < 10000; i++ {
+		key := r.Uint64()
+		require.Equal(t, m[key], db.Find(key), fmt.Sprintf("key %d", key))
+	}
+
+	// The db is the same as the one compiled from the Go map.
+	db2, err := Compile(m)
+	require.NoError(t, err)
+	ser, err := db.Serialize()
+	require.NoError(t, err)
+	ser2, err := db2.Serialize()
+	require.NoError(t, err)
+	require.Equal(t, len(ser2), len(ser))
+
+	// A duplicate key.
+	for key, value := range m {
+		b.Add(key, value)
+		break
+	}
+	_, err = b.Compile()
+	require.Error(t, err)
+
+	b2 := NewBuilder(1)
+	defer b2.Close()
+	b2.Add(1, 0)
+	_, err = b2.Compile()
+	require.Error(t, err)
+
+	// Sizes the C side can't represent are rejected instead of truncated.
+	// Only the size is faked, so nothing is read past the entries.
+	b2.size = 1<<32 + 1
+	_, err = b2.Compile()
+	require.ErrorContains(t, err, "too many keys")
+	b2.size = 1<<27 + 1
+	_, err = b2.Compile()
+	require.ErrorContains(t, err, "too many keys")
+	b2.size = 1
+}
+
+// benchSink keeps results of lookups in benchmarks, so they are not dropped
+// by the compiler.
+var benchSink uint64
+
+// benchBatch is the number of keys per call in batch benchmarks.
+const benchBatch = 1024
+
+// BenchmarkFind measures lookups through the Go API: one cgo call per key,
+// one per batch and pure Go Reader, from one and from all goroutines. Half of
+// the keys looked up are present. The time is per key.
+func BenchmarkFind(b *testing.B) {
+	for _, n := range []int{1000, 10000, 40000} {
+		r := rand.New(rand.NewSource(900))
+		m := make(map[uint64]uint64, n)
+		keys := make([]uint64, 0, n)
+		for len(m) < n {
+			key := r.Uint64() | 1
+			if _, has := m[key]; !has {
+				keys = append(keys, key)
+			}
+			m[key] = r.Uint64() | 1
+		}
+		db, err := Compile(m)
+		require.NoError(b, err)
+		reader := db.Reader()
+
+		queries := make([]uint64, 1<<16)
+		for i := range queries {
+			if i%2 == 0 {
+				queries[i] = keys[r.Intn(n)]
+			} else {
+				queries[i] = r.Uint64()
+			}
+		}
+		const mask = 1<<16 - 1
+
+		b.Run(fmt.Sprintf("n=%d/Find", n), func(b *testing.B) {
+			var sum uint64
+			for i := 0; i < b.N; i++ {
+				sum += db.Find(queries[i&mask])
+			}
+			benchSink = sum
+		})
+		b.Run(fmt.Sprintf("n=%d/FindBatch", n), func(b *testing.B) {
+			out := make([]uint64, benchBatch)
+			for i := 0; i < b.N; i += benchBatch {
+				count := b.N - i
+				if count > benchBatch {
+					count = benchBatch
+				}
+				start := i & mask
+				db.FindBatch(queries[start:start+count], out)
+			}
+			benchSink = out[0]
+		})
+		b.Run(fmt.Sprintf("n=%d/Reader", n), func(b *testing.B) {
+			var sum uint64
+			for i := 0; i < b.N; i++ {
+				sum += reader.Find(queries[i&mask])
+			}
+			benchSink = sum
+		})
+		b.Run(fmt.Sprintf("n=%d/FindParallel", n), func(b *testing.B) {
+			b.RunParallel(func(pb *testing.PB) {
+				var sum uint64
+				for i := 0; pb.Next(); i++ {
+					sum += db.Find(queries[i&mask])
+				}
+				atomic.AddUint64(&benchSink, sum)
+			})
+		})
+		b.Run(fmt.Sprintf("n=%d/ReaderParallel", n), func(b *testing.B) {
+			b.RunParallel(func(pb *testing.PB) {
+				var sum uint64
+				for i := 0; pb.Next(); i++ {
+					sum += reader.Find(queries[i&mask])
+				}
+				atomic.AddUint64(&benchSink, sum)
+			})
+		})
+	}
+}
+
+// BenchmarkSerialize measures serialization and loading of the serialized
+// form. The throughput is of the serialized form.
+func BenchmarkSerialize(b *testing.B) {
+	for _, n := range []int{1000, 10000, 40000} {
+		r := rand.New(rand.NewSource(901))
+		m := make(map[uint64]uint64, n)
+		for len(m) < n {
+			m[r.Uint64()|1] = r.Uint64() | 1
+		}
+		db, err := Compile(m)
+		require.NoError(b, err)
+		ser, err := db.Serialize()
+		require.NoError(b, err)
+
+		b.Run(fmt.Sprintf("n=%d/Serialize", n), func(b *testing.B) {
+			b.SetBytes(int64(len(ser)))
+			for i := 0; i < b.N; i++ {
+				_, err := db.Serialize()
+				if err != nil {
+					b.Fatal(err)
+				}
+			}
+		})
+		b.Run(fmt.Sprintf("n=%d/FromSerialized", n), func(b *testing.B) {
+			b.SetBytes(int64(len(ser)))
+			for i := 0; i < b.N; i++ {
+				_, err := FromSerialized(ser)
+				if err != nil {
+					b.Fatal(err)
+				}
+			}
+		})
+	}
+}
@@ -0,0 +1,115 @@
+package gostaticuint64map
+
+import (
+	"fmt"
+	"unsafe"
+)
+
+// #include <stdlib.h>
+// #include <hipermap/place.h>
+// #include <hipermap/static_uint64_map.h>
+import "C"
+
+// Builder accumulates keys and values for compilation in memory outside of
+// the Go heap, so large maps can be built from a stream of entries without
+// holding a Go map and copies of it in the heap. The compiled db is placed
+// outside of the Go heap too. A Builder must not be used by multiple
+// goroutines at the same time.
+type Builder struct {
+	// keys and values are arrays allocated with malloc, viewed as slices of
+	// capacity elements.
+	keys, values []uint64
+	size         int
+}
+
+// NewBuilder returns a builder with space for capacity entries. The space
+// grows as needed, so capacity is only a hint saving reallocations.
+func NewBuilder(capacity int) *Builder {
+	b := &Builder{}
+	b.grow(capacity)
+	return b
+}
+
+// grow reallocates the arrays to hold at least capacity entries.
+func (b *Builder) grow(capacity int) {
+	if capacity < 16 {
+		capacity = 16
+	}
+	size := C.size_t(capacity) * C.size_t(unsafe.Sizeof(uint64(0)))
+	keys := C.realloc(b.ptr(b.keys), size)
+	if keys == nil {
+		panic("gostaticuint64map: out of memory")
+	}
+	b.keys = unsafe.Slice((*uint64)(keys), capacity)
+	values := C.realloc(b.ptr(b.values), size)
+	if values == nil {
+		panic("gostaticuint64map: out of memory")
+	}
+	b.values = unsafe.Slice((*uint64)(values), capacity)
+}
+
+func (b *Builder) ptr(array []uint64) unsafe.Pointer {
+	if array == nil {
+		return nil
+	}
+	return unsafe.Pointer(&array[0])
+}
+
+// Add adds the entry. Neither key nor value can be 0 and keys must be unique,
+// otherwise Compile fails.
+func (b *Builder) Add(key, value uint64) {
+	if b.size == len(b.keys) {
+		b.grow(2 * b.size)
+	}
+	b.keys[b.size] = key
+	b.values[b.size] = value
+	b.size++
+}
+
+// Len returns the number of entries added.
+func (b *Builder) Len() int {
+	return b.size
+}
+
+// Compile compiles the entries added so far. The db is placed outside of the
+// Go heap and must be freed with Close. The builder can be used further.
+func (b *Builder) Compile() (*StaticUint64Map, error) {
+	if b.size == 0 {
+		return nil, fmt.Errorf("no keys")
+	}
+	if b.size > C.HM_U64MAP_MAX_ELEMENTS {
+		return nil, fmt.Errorf("too many keys: %d > %d", b.size, C.HM_U64MAP_MAX_ELEMENTS)
+	}
+
+	dbPlaceSize := C.hm_u64map_db_place_size(C.uint(b.size))
+	place, err := allocPlace(dbPlaceSize)
+	if err != nil {
+		return nil, err
+	}
+	var db *C.hm_u64map_database_t
+	hmErr := C.hm_u64map_compile(
+		place.data,
+		place.size,
+		&db,
+		(*C.uint64_t)(b.ptr(b.keys)),
+		(*C.uint64_t)(b.ptr(b.values)),
+		C.uint(b.size),
+	)
+	if hmErr != C.HM_SUCCESS {
+		C.hm_place_free(place)
+		return nil, fmt.Errorf("hm_u64map_compile failed: %d", hmErr)
+	}
+	return &StaticUint64Map{
+		db:    db,
+		place: place,
+	}, nil
+}
+
+// Close frees the entries. The builder must not be used after Close.
+func (b *Builder) Close() {
+	C.free(b.ptr(b.keys))
+	C.free(b.ptr(b.values))
+	b.keys = nil
+	b.values = nil
+	b.size = 0
+}
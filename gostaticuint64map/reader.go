@@ -0,0 +1,35 @@
+package gostaticuint64map
+
+// Reader looks up keys in a StaticUint64Map in pure Go, reading the hash
+// table of the database in place. It avoids the cost of a cgo call per
+// lookup, which is higher than the lookup itself, and can be inlined. A
+// Reader keeps the map memory alive and is safe for concurrent use.
+type Reader struct {
+	// Buckets are pairs of key and value.
+	hashTable        []uint64
+	factor1, factor2 uint64
+	mask             uint64
+}
+
+// hash64 is hm_u64map_hash64 of static_uint64_map.c.
+func (r *Reader) hash64(key uint64) uint64 {
+	key ^= key >> 33
+	key *= r.factor1
+	key ^= key >> 33
+	key *= r.factor2
+	key ^= key >> 33
+	return key
+}
+
+// Find returns the value of the given key or 0 if it is not present, same as
+// StaticUint64Map.Find.
+func (r *Reader) Find(key uint64) uint64 {
+	b := 2 * (r.hash64(key) & r.mask)
+	group := r.hashTable[b : b+8 : b+8]
+	for i := 0; i < 8; i += 2 {
+		if group[i] == key {
+			return group[i+1]
+		}
+	}
+	return 0
+}
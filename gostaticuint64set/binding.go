@@ -2,9 +2,13 @@ package gostaticuint64set
 
 import (
 	"fmt"
+	"os"
+	"runtime"
+	"syscall"
 	"unsafe"
 )
 
+// #include <hipermap/place.h>
 // #include <hipermap/static_uint64_set.h>
 // #cgo LDFLAGS: -l hipermap -lstdc++
 import "C"
@@ -12,6 +16,13 @@ import "C"
 type StaticUint64Set struct {
 	dbPlace []byte
 	db      *C.hm_u64_database_t
+
+	// place holds the db instead of dbPlace if it was opened by OpenFile.
+	place *C.hm_place_t
+
+	// image is the file mapped by OpenImage. The hash table of the db is in
+	// it and dbPlace holds only the header of the db.
+	image []byte
 }
 
 func Compile(keys []uint64) (*StaticUint64Set, error) {
@@ -39,11 +50,47 @@ func Compile(keys []uint64) (*StaticUint64Set, error) {
 }
 
 func (m *StaticUint64Set) Find(key uint64) bool {
-	return bool(C.hm_u64_find(m.db, C.uint64_t(key)))
+	found := C.hm_u64_find(m.db, C.uint64_t(key))
+	// m.db points into m.dbPlace, which cgo does not keep alive.
+	runtime.KeepAlive(m)
+	return bool(found)
+}
+
+// FindBatch stores if keys[i] is in the set to out[i], making one cgo call for
+// the whole slice. It panics if out is shorter than keys.
+func (m *StaticUint64Set) FindBatch(keys []uint64, out []bool) {
+	if len(out) < len(keys) {
+		panic("gostaticuint64set: len(out) < len(keys)")
+	}
+	if len(keys) == 0 {
+		return
+	}
+	C.hm_u64_find_batch(
+		m.db,
+		(*C.uint64_t)(unsafe.Pointer(&keys[0])),
+		(*C.bool)(unsafe.Pointer(&out[0])),
+		C.size_t(len(keys)),
+	)
+	runtime.KeepAlive(m)
+}
+
+// Reader returns a pure Go reader of the set, see Reader.
+func (m *StaticUint64Set) Reader() *Reader {
+	var view C.hm_u64_view_t
+	C.hm_u64_view(m.db, &view)
+	runtime.KeepAlive(m)
+	return &Reader{
+		hashTable: unsafe.Slice((*uint64)(unsafe.Pointer(view.hash_table)), view.buckets),
+		factor1:   uint64(view.factor1),
+		factor2:   uint64(view.factor2),
+		mask:      uint64(view.mask_for_hash),
+	}
 }
 
 func (m *StaticUint64Set) Benchmark(beginKey, endKey uint64) uint64 {
-	return uint64(C.hm_u64_benchmark(m.db, C.uint64_t(beginKey), C.uint64_t(endKey)))
+	result := C.hm_u64_benchmark(m.db, C.uint64_t(beginKey), C.uint64_t(endKey))
+	runtime.KeepAlive(m)
+	return uint64(result)
 }
 
 func (m *StaticUint64Set) Serialize() ([]byte, error) {
@@ -54,6 +101,7 @@ func (m *StaticUint64Set) Serialize() ([]byte, error) {
 		serSize,
 		m.db,
 	)
+	runtime.KeepAlive(m)
 	if hmErr != C.HM_SUCCESS {
 		return nil, fmt.Errorf("hm_u64_serialize failed: %d", hmErr)
 	}
@@ -93,3 +141,241 @@ func FromSerialized(buffer []byte) (*StaticUint64Set, error) {
 		db:      db,
 	}, nil
 }
+
+// SerializeTo writes the serialized db to f, which can be a file, a pipe or a
+// socket. Unlike Serialize, it does not allocate a buffer of the whole db.
+func (m *StaticUint64Set) SerializeTo(f *os.File) error {
+	hmErr, err := C.hm_u64_serialize_fd(C.int(f.Fd()), m.db)
+	// m owns the memory of the db, which is written while blocked on f.
+	runtime.KeepAlive(m)
+	runtime.KeepAlive(f)
+	if hmErr == C.HM_ERROR_SYSTEM {
+		return fmt.Errorf("hm_u64_serialize_fd failed: %w", err)
+	}
+	if hmErr != C.HM_SUCCESS {
+		return fmt.Errorf("hm_u64_serialize_fd failed: %d", hmErr)
+	}
+	return nil
+}
+
+// FromFile loads the db written by SerializeTo or Serialize from f, starting
+// at its current position. f is read sequentially right into the memory of
+// the db, without a buffer of the whole db, so it can be a file, a pipe or a
+// socket.
+func FromFile(f *os.File) (*StaticUint64Set, error) {
+	defer runtime.KeepAlive(f)
+	fd := C.int(f.Fd())
+
+	// header keeps the beginning of the db read by the first call.
+	var header C.hm_fd_header_t
+	var dbPlaceSize C.size_t
+	hmErr, err := C.hm_u64_db_place_size_from_fd(&dbPlaceSize, &header, fd)
+	if hmErr == C.HM_ERROR_SYSTEM {
+		return nil, fmt.Errorf("hm_u64_db_place_size_from_fd failed: %w", err)
+	}
+	if hmErr != C.HM_SUCCESS {
+		return nil, fmt.Errorf("hm_u64_db_place_size_from_fd failed: %d", hmErr)
+	}
+
+	dbPlace := make([]byte, dbPlaceSize)
+	var db *C.hm_u64_database_t
+	hmErr, err = C.hm_u64_deserialize_fd(
+		(*C.char)(unsafe.Pointer(&dbPlace[0])),
+		dbPlaceSize,
+		&db,
+		&header,
+		fd,
+	)
+	if hmErr == C.HM_ERROR_SYSTEM {
+		return nil, fmt.Errorf("hm_u64_deserialize_fd failed: %w", err)
+	}
+	if hmErr != C.HM_SUCCESS {
+		return nil, fmt.Errorf("hm_u64_deserialize_fd failed: %d", hmErr)
+	}
+
+	return &StaticUint64Set{
+		dbPlace: dbPlace,
+		db:      db,
+	}, nil
+}
+
+// OpenFile loads the serialized db from the file at path. The file is mapped
+// into memory and the db is built outside of the Go heap, so the garbage
+// collector neither scans nor counts it. Large databases are placed on
+// transparent huge pages. The db must be freed with Close. The file must not
+// be truncated while it is loaded.
+func OpenFile(path string) (*StaticUint64Set, error) {
+	f, err := os.Open(path)
+	if err != nil {
+		return nil, err
+	}
+	defer f.Close()
+	info, err := f.Stat()
+	if err != nil {
+		return nil, err
+	}
+	if info.Size() == 0 {
+		return nil, fmt.Errorf("empty file")
+	}
+	buffer, err := syscall.Mmap(int(f.Fd()), 0, int(info.Size()), syscall.PROT_READ, syscall.MAP_SHARED)
+	if err != nil {
+		return nil, fmt.Errorf("mmap failed: %w", err)
+	}
+	defer syscall.Munmap(buffer)
+	// The file is read once from start to end.
+	_ = syscall.Madvise(buffer, syscall.MADV_SEQUENTIAL)
+
+	var dbPlaceSize C.size_t
+	hmErr := C.hm_u64_db_place_size_from_serialized(
+		&dbPlaceSize,
+		(*C.char)(unsafe.Pointer(&buffer[0])),
+		C.size_t(len(buffer)),
+	)
+	if hmErr != C.HM_SUCCESS {
+		return nil, fmt.Errorf("hm_u64_db_place_size_from_serialized failed: %d", hmErr)
+	}
+
+	place, err := allocPlace(dbPlaceSize)
+	if err != nil {
+		return nil, err
+	}
+	var db *C.hm_u64_database_t
+	hmErr = C.hm_u64_deserialize(
+		place.data,
+		place.size,
+		&db,
+		(*C.char)(unsafe.Pointer(&buffer[0])),
+		C.size_t(len(buffer)),
+	)
+	if hmErr != C.HM_SUCCESS {
+		C.hm_place_free(place)
+		return nil, fmt.Errorf("hm_u64_deserialize failed: %d", hmErr)
+	}
+
+	return &StaticUint64Set{
+		db:    db,
+		place: place,
+	}, nil
+}
+
+// allocPlace allocates db place outside of the Go heap. Large databases are
+// placed on transparent huge pages.
+func allocPlace(dbPlaceSize C.size_t) (*C.hm_place_t, error) {
+	pages := C.hm_page_kind_t(C.HM_PAGES_DEFAULT)
+	if dbPlaceSize >= 2<<20 {
+		pages = C.HM_PAGES_THP
+	}
+	place := new(C.hm_place_t)
+	hmErr := C.hm_place_alloc(place, dbPlaceSize, pages)
+	if hmErr != C.HM_SUCCESS {
+		return nil, fmt.Errorf("hm_place_alloc failed: %d", hmErr)
+	}
+	return place, nil
+}
+
+// Close frees the db opened by OpenFile or unmaps the db opened by OpenImage
+// or CompileToFile. The db and its Readers must not be used after Close. For
+// databases in the Go heap it only drops the reference to the memory.
+func (m *StaticUint64Set) Close() error {
+	var err error
+	if m.place != nil {
+		C.hm_place_free(m.place)
+		m.place = nil
+	}
+	if m.image != nil {
+		err = syscall.Munmap(m.image)
+		m.image = nil
+	}
+	m.dbPlace = nil
+	m.db = nil
+	return err
+}
+
+// Pack returns the db in packed form, which is much smaller than the
+// serialized form and is meant for distribution. Use FromPacked to load it.
+func (m *StaticUint64Set) Pack() ([]byte, error) {
+	maxSize := C.hm_u64_packed_max_size(m.db)
+	packed := make([]byte, maxSize)
+	var packedSize C.size_t
+	hmErr := C.hm_u64_pack(
+		(*C.char)(unsafe.Pointer(&packed[0])),
+		maxSize,
+		m.db,
+		&packedSize,
+	)
+	// m.db points into m.dbPlace, which cgo does not keep alive.
+	runtime.KeepAlive(m)
+	if hmErr != C.HM_SUCCESS {
+		return nil, fmt.Errorf("hm_u64_pack failed: %d", hmErr)
+	}
+	return packed[:packedSize], nil
+}
+
+// FromPacked loads the db from the output of Pack.
+func FromPacked(buffer []byte) (*StaticUint64Set, error) {
+	if len(buffer) == 0 {
+		return nil, fmt.Errorf("empty buffer")
+	}
+
+	var dbPlaceSize C.size_t
+	hmErr := C.hm_u64_db_place_size_from_packed(
+		&dbPlaceSize,
+		(*C.char)(unsafe.Pointer(&buffer[0])),
+		C.size_t(len(buffer)),
+	)
+	if hmErr != C.HM_SUCCESS {
+		return nil, fmt.Errorf("hm_u64_db_place_size_from_packed failed: %d", hmErr)
+	}
+
+	dbPlace := make([]byte, dbPlaceSize)
+	var db *C.hm_u64_database_t
+	hmErr = C.hm_u64_unpack(
+		(*C.char)(unsafe.Pointer(&dbPlace[0])),
+		dbPlaceSize,
+		&db,
+		(*C.char)(unsafe.Pointer(&buffer[0])),
+		C.size_t(len(buffer)),
+	)
+	if hmErr != C.HM_SUCCESS {
+		return nil, fmt.Errorf("hm_u64_unpack failed: %d", hmErr)
+	}
+
+	return &StaticUint64Set{
+		dbPlace: dbPlace,
+		db:      db,
+	}, nil
+}
+
+// Stats describes the layout and memory usage of a StaticUint64Set.
+type Stats struct {
+	Elements        int
+	Buckets         int
+	LoadFactor      float64
+	GroupHistogram  [5]int
+	CompileAttempts int
+
+	HeaderBytes    int
+	HashTableBytes int
+	TotalBytes     int
+}
+
+func (m *StaticUint64Set) Stats() Stats {
+	var cstats C.hm_u64_stats_t
+	C.hm_u64_stats(m.db, &cstats)
+	// m.db points into m.dbPlace, which cgo does not keep alive.
+	runtime.KeepAlive(m)
+	var histogram [5]int
+	for i, count := range cstats.group_histogram {
+		histogram[i] = int(count)
+	}
+	return Stats{
+		Elements:        int(cstats.elements),
+		Buckets:         int(cstats.buckets),
+		LoadFactor:      float64(cstats.load_factor),
+		GroupHistogram:  histogram,
+		CompileAttempts: int(cstats.compile_attempts),
+		HeaderBytes:     int(cstats.header_bytes),
+		HashTableBytes:  int(cstats.hash_table_bytes),
+		TotalBytes:      int(cstats.total_bytes),
+	}
+}
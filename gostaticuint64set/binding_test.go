@@ -4,7 +4,11 @@ import (
 	"encoding/binary"
 	"encoding/hex"
 	"fmt"
+	"io"
 	"math/rand"
+	"os"
+	"path/filepath"
+	"sync/atomic"
 	"testing"
 
 	"github.com/stretchr/testify/require"
@@ -91,6 +95,17 @@ func TestLarge(t *testing.T) {
 	for _, key := range keys {
 		require.True(t, db2.Find(key))
 	}
+
+	packed, err := db.Pack()
+	require.NoError(t, err)
+	t.Logf("serialized: %d bytes, packed: %d bytes", len(ser), len(packed))
+
+	db3, err := FromPacked(packed)
+	require.NoError(t, err)
+
+	for _, key := range keys {
+		require.True(t, db3.Find(key))
+	}
 }
 
 func TestBenchmark(t *testing.T) {
@@ -207,3 +222,452 @@ func FuzzFind(f *testing.F) {
 		}
 	})
 }
+
+func TestStats(t *testing.T) {
+	r := rand.New(rand.NewSource(1))
+	keys := make([]uint64, 0, 10000)
+	seen := make(map[uint64]bool)
+	for len(keys) < 10000 {
+		key := uint64(r.Int63()) + 1
+		if !seen[key] {
+			seen[key] = true
+			keys = append(keys, key)
+		}
+	}
+	db, err := Compile(keys)
+	require.NoError(t, err)
+
+	stats := db.Stats()
+	require.Equal(t, 10000, stats.Elements)
+	require.Equal(t, 0, stats.Buckets%4)
+	require.Equal(t, float64(stats.Elements)/float64(stats.Buckets), stats.LoadFactor)
+	require.Greater(t, stats.CompileAttempts, 0)
+
+	groups, elements := 0, 0
+	for i, count := range stats.GroupHistogram {
+		groups += count
+		elements += i * count
+	}
+	require.Equal(t, stats.Buckets/4, groups)
+	require.Equal(t, stats.Elements, elements)
+	require.Equal(t, stats.HeaderBytes+stats.HashTableBytes, stats.TotalBytes)
+	require.LessOrEqual(t, stats.TotalBytes, len(db.dbPlace))
+
+	ser, err := db.Serialize()
+	require.NoError(t, err)
+	db2, err := FromSerialized(ser)
+	require.NoError(t, err)
+	stats2 := db2.Stats()
+	require.Equal(t, 0, stats2.CompileAttempts)
+	stats2.CompileAttempts = stats.CompileAttempts
+	require.Equal(t, stats, stats2)
+}
+
+func TestPackedCorruption(t *testing.T) {
+	db, err := Compile([]uint64{1, 2})
+	require.NoError(t, err)
+	packed, err := db.Pack()
+	require.NoError(t, err)
+
+	require.Equal(t, "hipermap", string(packed[:8]))
+	require.Equal(t, uint32(0x102), binary.LittleEndian.Uint32(packed[12:]))
+
+	for i := range packed {
+		for bit := 0; bit < 8; bit++ {
+			packed[i] ^= 1 << bit
+			_, err := FromPacked(packed)
+			require.Error(t, err, fmt.Sprintf("byte %d bit %d", i, bit))
+			packed[i] ^= 1 << bit
+		}
+	}
+
+	_, err = FromPacked(packed[:len(packed)-1])
+	require.Error(t, err)
+	_, err = FromPacked(append(packed, 0))
+	require.Error(t, err)
+
+	db2, err := FromPacked(packed)
+	require.NoError(t, err)
+	require.True(t, db2.Find(2))
+}
+
+func TestFile(t *testing.T) {
+	r := rand.New(rand.NewSource(300))
+	keys := make([]uint64, 10000)
+	for i := range keys {
+		keys[i] = r.Uint64() | 1
+	}
+	db, err := Compile(keys)
+	require.NoError(t, err)
+
+	f, err := os.Create(filepath.Join(t.TempDir(), "db"))
+	require.NoError(t, err)
+	defer f.Close()
+	require.NoError(t, db.SerializeTo(f))
+
+	// The file is the same as the serialized buffer.
+	ser, err := db.Serialize()
+	require.NoError(t, err)
+	data, err := os.ReadFile(f.Name())
+	require.NoError(t, err)
+	require.Equal(t, ser, data)
+
+	// f is read from its current position.
+	_, err = FromFile(f)
+	require.Error(t, err)
+	_, err = f.Seek(0, io.SeekStart)
+	require.NoError(t, err)
+	db2, err := FromFile(f)
+	require.NoError(t, err)
+	for _, key := range keys {
+		require.True(t, db2.Find(key))
+	}
+
+	// Corruption is detected.
+	i := len(ser) / 2
+	_, err = f.WriteAt([]byte{ser[i] ^ 1}, int64(i))
+	require.NoError(t, err)
+	_, err = f.Seek(0, io.SeekStart)
+	require.NoError(t, err)
+	_, err = FromFile(f)
+	require.Error(t, err)
+	require.NoError(t, f.Truncate(int64(len(ser)-1)))
+	_, err = f.Seek(0, io.SeekStart)
+	require.NoError(t, err)
+	_, err = FromFile(f)
+	require.Error(t, err)
+
+	// Dbs are loaded from a pipe one after another.
+	pr, pw, err := os.Pipe()
+	require.NoError(t, err)
+	defer pr.Close()
+	errs := make(chan error, 1)
+	go func() {
+		err := db.SerializeTo(pw)
+		if err == nil {
+			err = db.SerializeTo(pw)
+		}
+		pw.Close()
+		errs <- err
+	}()
+	for j := 0; j < 2; j++ {
+		db3, err := FromFile(pr)
+		require.NoError(t, err)
+		ser3, err := db3.Serialize()
+		require.NoError(t, err)
+		require.Equal(t, ser, ser3)
+	}
+	_, err = FromFile(pr)
+	require.Error(t, err)
+	require.NoError(t, <-errs)
+}
+
+func TestFindBatch(t *testing.T) {
+	r := rand.New(rand.NewSource(400))
+	keys := make([]uint64, 10001)
+	for i := range keys {
+		keys[i] = r.Uint64()
+	}
+	db, err := Compile(keys)
+	require.NoError(t, err)
+
+	queries := make([]uint64, 3*len(keys))
+	for i := range queries {
+		if i%2 == 0 {
+			queries[i] = keys[r.Intn(len(keys))]
+		} else {
+			queries[i] = r.Uint64()
+		}
+	}
+	out := make([]bool, len(queries))
+	db.FindBatch(queries, out)
+	for i, key := range queries {
+		require.Equal(t, db.Find(key), out[i], fmt.Sprintf("key %d", key))
+		require.Equal(t, i%2 == 0, out[i], fmt.Sprintf("key %d", key))
+	}
+
+	db.FindBatch(nil, nil)
+	require.Panics(t, func() {
+		db.FindBatch(queries, out[:1])
+	})
+}
+
+func TestReader(t *testing.T) {
+	r := rand.New(rand.NewSource(500))
+	keys := make([]uint64, 10001)
+	for i := range keys {
+		keys[i] = r.Uint64()
+	}
+	db, err := Compile(keys)
+	require.NoError(t, err)
+	ser, err := db.Serialize()
+	require.NoError(t, err)
+	loaded, err := FromSerialized(ser)
+	require.NoError(t, err)
+
+	for _, m := range []*StaticUint64Set{db, loaded} {
+		reader := m.Reader()
+		for _, key := range keys {
+			require.True(t, reader.Find(key), fmt.Sprintf("key %d", key))
+		}
+		for i := 0; i < 3*len(keys); i++ {
+			key := r.Uint64()
+			require.Equal(t, m.Find(key), reader.Find(key), fmt.Sprintf("key %d", key))
+		}
+		require.False(t, reader.Find(0))
+	}
+}
+
+func TestOpenFile(t *testing.T) {
+	r := rand.New(rand.NewSource(600))
+	keys := make([]uint64, 10001)
+	for i := range keys {
+		keys[i] = r.Uint64()
+	}
+	db, err := Compile(keys)
+	require.NoError(t, err)
+
+	path := filepath.Join(t.TempDir(), "db")
+	f, err := os.Create(path)
+	require.NoError(t, err)
+	require.NoError(t, db.SerializeTo(f))
+	require.NoError(t, f.Close())
+
+	db2, err := OpenFile(path)
+	require.NoError(t, err)
+	reader := db2.Reader()
+	for _, key := range keys {
+		require.True(t, db2.Find(key), fmt.Sprintf("key %d", key))
+		require.True(t, reader.Find(key), fmt.Sprintf("key %d", key))
+	}
+	for i := 0; i < 3*len(keys); i++ {
+		key := r.Uint64()
+		require.Equal(t, db.Find(key), db2.Find(key), fmt.Sprintf("key %d", key))
+	}
+	require.NoError(t, db2.Close())
+	require.NoError(t, db2.Close())
+
+	_, err = OpenFile(filepath.Join(t.TempDir(), "missing"))
+	require.Error(t, err)
+
+	ser, err := db.Serialize()
+	require.NoError(t, err)
+	ser[len(ser)-1] ^= 1
+	corrupted := filepath.Join(t.TempDir(), "corrupted")
+	require.NoError(t, os.WriteFile(corrupted, ser, 0o644))
+	_, err = OpenFile(corrupted)
+	require.Error(t, err)
+}
+
+func TestCompileToFile(t *testing.T) {
+	r := rand.New(rand.NewSource(1000))
+	keys := make([]uint64, 10001)
+	for i := range keys {
+		keys[i] = r.Uint64()
+	}
+	db, err := Compile(keys)
+	require.NoError(t, err)
+
+	path := filepath.Join(t.TempDir(), "db")
+	db2, err := CompileToFile(path, keys)
+	require.NoError(t, err)
+	db3, err := OpenImage(path)
+	require.NoError(t, err)
+	reader := db3.Reader()
+	for _, key := range keys {
+		require.True(t, db2.Find(key), fmt.Sprintf("key %d", key))
+		require.True(t, db3.Find(key), fmt.Sprintf("key %d", key))
+		require.True(t, reader.Find(key), fmt.Sprintf("key %d", key))
+	}
+	for i := 0; i < 3*len(keys); i++ {
+		key := r.Uint64()
+		require.Equal(t, db.Find(key), db3.Find(key), fmt.Sprintf("key %d", key))
+	}
+	ser, err := db3.Serialize()
+	require.NoError(t, err)
+	ser0, err := db.Serialize()
+	require.NoError(t, err)
+	require.Equal(t, len(ser0), len(ser))
+
+	// Replacing the file does not affect dbs opened from it.
+	db4, err := CompileToFile(path, keys[:100])
+	require.NoError(t, err)
+	require.True(t, db4.Find(keys[99]))
+	require.False(t, db4.Find(keys[100]))
+	require.True(t, db3.Find(keys[100]))
+	require.NoError(t, db4.Close())
+
+	require.NoError(t, db2.Close())
+	require.NoError(t, db3.Close())
+	require.NoError(t, db3.Close())
+
+	_, err = CompileToFile(path, nil)
+	require.Error(t, err)
+	_, err = OpenImage(filepath.Join(t.TempDir(), "missing"))
+	require.Error(t, err)
+	bad := filepath.Join(t.TempDir(), "bad")
+	require.NoError(t, os.WriteFile(bad, make([]byte, 100), 0o644))
+	_, err = OpenImage(bad)
+	require.Error(t, err)
+
+	info, err := os.Stat(path)
+	require.NoError(t, err)
+	require.Equal(t, os.FileMode(0o644), info.Mode().Perm())
+
+	// An image with a wrong magic, another byte order or of another type is
+	// rejected, although its sizes are valid. Words 3-5 of the header are
+	// the magic, the version and the type.
+	image, err := os.ReadFile(path)
+	require.NoError(t, err)
+	for _, offset := range []int{24, 32, 40} {
+		for _, swap := range []bool{false, true} {
+			corrupted := append([]byte(nil), image...)
+			word := corrupted[offset : offset+8]
+			if swap {
+				for i := 0; i < 4; i++ {
+					word[i], word[7-i] = word[7-i], word[i]
+				}
+			} else {
+				word[0]++
+			}
+			require.NoError(t, os.WriteFile(bad, corrupted, 0o644))
+			_, err = OpenImage(bad)
+			require.ErrorContains(t, err, "hm_u64_image_view failed: 10")
+		}
+	}
+	require.NoError(t, os.WriteFile(bad, image, 0o644))
+	db5, err := OpenImage(bad)
+	require.NoError(t, err)
+	require.NoError(t, db5.Close())
+}
+
+// benchSink keeps results of lookups in benchmarks, so they are not dropped
+// by the compiler.
+var benchSink uint64
+
+// benchBatch is the number of keys per call in batch benchmarks.
+const benchBatch = 1024
+
+func countTrue(found []bool) uint64 {
+	var count uint64
+	for _, f := range found {
+		if f {
+			count++
+		}
+	}
+	return count
+}
+
+// BenchmarkFind measures lookups through the Go API: one cgo call per key,
+// one per batch and pure Go Reader, from one and from all goroutines. Half of
+// the keys looked up are present. The time is per key.
+func BenchmarkFind(b *testing.B) {
+	for _, n := range []int{1000, 10000, 40000} {
+		r := rand.New(rand.NewSource(900))
+		keys := make([]uint64, n)
+		for i := range keys {
+			keys[i] = r.Uint64() | 1
+		}
+		db, err := Compile(keys)
+		require.NoError(b, err)
+		reader := db.Reader()
+
+		queries := make([]uint64, 1<<16)
+		for i := range queries {
+			if i%2 == 0 {
+				queries[i] = keys[r.Intn(n)]
+			} else {
+				queries[i] = r.Uint64()
+			}
+		}
+		const mask = 1<<16 - 1
+
+		b.Run(fmt.Sprintf("n=%d/Find", n), func(b *testing.B) {
+			var count uint64
+			for i := 0; i < b.N; i++ {
+				if db.Find(queries[i&mask]) {
+					count++
+				}
+			}
+			benchSink = count
+		})
+		b.Run(fmt.Sprintf("n=%d/FindBatch", n), func(b *testing.B) {
+			out := make([]bool, benchBatch)
+			for i := 0; i < b.N; i += benchBatch {
+				count := b.N - i
+				if count > benchBatch {
+					count = benchBatch
+				}
+				start := i & mask
+				db.FindBatch(queries[start:start+count], out)
+			}
+			benchSink = countTrue(out)
+		})
+		b.Run(fmt.Sprintf("n=%d/Reader", n), func(b *testing.B) {
+			var count uint64
+			for i := 0; i < b.N; i++ {
+				if reader.Find(queries[i&mask]) {
+					count++
+				}
+			}
+			benchSink = count
+		})
+		b.Run(fmt.Sprintf("n=%d/FindParallel", n), func(b *testing.B) {
+			b.RunParallel(func(pb *testing.PB) {
+				var count uint64
+				for i := 0; pb.Next(); i++ {
+					if db.Find(queries[i&mask]) {
+						count++
+					}
+				}
+				atomic.AddUint64(&benchSink, count)
+			})
+		})
+		b.Run(fmt.Sprintf("n=%d/ReaderParallel", n), func(b *testing.B) {
+			b.RunParallel(func(pb *testing.PB) {
+				var count uint64
+				for i := 0; pb.Next(); i++ {
+					if reader.Find(queries[i&mask]) {
+						count++
+					}
+				}
+				atomic.AddUint64(&benchSink, count)
+			})
+		})
+	}
+}
+
+// BenchmarkSerialize measures serialization and loading of the serialized
+// form. The throughput is of the serialized form.
+func BenchmarkSerialize(b *testing.B) {
+	for _, n := range []int{1000, 10000, 40000} {
+		r := rand.New(rand.NewSource(901))
+		keys := make([]uint64, n)
+		for i := range keys {
+			keys[i] = r.Uint64() | 1
+		}
+		db, err := Compile(keys)
+		require.NoError(b, err)
+		ser, err := db.Serialize()
+		require.NoError(b, err)
+
+		b.Run(fmt.Sprintf("n=%d/Serialize", n), func(b *testing.B) {
+			b.SetBytes(int64(len(ser)))
+			for i := 0; i < b.N; i++ {
+				_, err := db.Serialize()
+				if err != nil {
+					b.Fatal(err)
+				}
+			}
+		})
+		b.Run(fmt.Sprintf("n=%d/FromSerialized", n), func(b *testing.B) {
+			b.SetBytes(int64(len(ser)))
+			for i := 0; i < b.N; i++ {
+				_, err := FromSerialized(ser)
+				if err != nil {
+					b.Fatal(err)
+				}
+			}
+		})
+	}
+}
@@ -0,0 +1,158 @@
+package gostaticuint64set
+
+import (
+	"fmt"
+	"os"
+	"path/filepath"
+	"syscall"
+	"unsafe"
+)
+
+// #include <hipermap/place.h>
+// #include <hipermap/static_uint64_set.h>
+import "C"
+
+// CompileToFile compiles keys and writes the image of the db to the file at
+// path, replacing it atomically. The image is the memory layout of the db, so
+// it is used in place by OpenImage without loading. The db is compiled
+// outside of the Go heap and the image is written right into the mapped file,
+// so no copy of the db is kept in the Go heap. It returns the set opened from
+// the file with OpenImage, which must be freed with Close.
+//
+// Unlike the serialized form, the image has no checksum and can only be used
+// on machines with the same byte order. OpenImage rejects images written on
+// a machine with another byte order and files of other kinds.
+func CompileToFile(path string, keys []uint64) (*StaticUint64Set, error) {
+	if len(keys) == 0 {
+		return nil, fmt.Errorf("no keys")
+	}
+
+	dbPlaceSize := C.hm_u64_db_place_size(C.uint(len(keys)))
+	place, err := allocPlace(dbPlaceSize)
+	if err != nil {
+		return nil, err
+	}
+	defer C.hm_place_free(place)
+	var db *C.hm_u64_database_t
+	hmErr := C.hm_u64_compile(
+		place.data,
+		place.size,
+		&db,
+		(*C.uint64_t)(unsafe.Pointer(&keys[0])),
+		C.uint(len(keys)),
+	)
+	if hmErr != C.HM_SUCCESS {
+		return nil, fmt.Errorf("hm_u64_compile failed: %d", hmErr)
+	}
+
+	f, err := os.CreateTemp(filepath.Dir(path), filepath.Base(path)+".tmp*")
+	if err != nil {
+		return nil, err
+	}
+	tmpPath := f.Name()
+	if err := writeImage(f, db); err != nil {
+		f.Close()
+		os.Remove(tmpPath)
+		return nil, err
+	}
+	if err := f.Close(); err != nil {
+		os.Remove(tmpPath)
+		return nil, err
+	}
+	if err := os.Rename(tmpPath, path); err != nil {
+		os.Remove(tmpPath)
+		return nil, err
+	}
+	syncParentDir(path)
+
+	return OpenImage(path)
+}
+
+// writeImage writes the image of db to the empty file f and syncs it. The
+// file gets the usual permissions instead of 0600 of CreateTemp.
+func writeImage(f *os.File, db *C.hm_u64_database_t) error {
+	if err := f.Chmod(0o644); err != nil {
+		return err
+	}
+	imageSize := C.hm_u64_image_size(db)
+	if err := f.Truncate(int64(imageSize)); err != nil {
+		return err
+	}
+	image, err := syscall.Mmap(int(f.Fd()), 0, int(imageSize), syscall.PROT_READ|syscall.PROT_WRITE, syscall.MAP_SHARED)
+	if err != nil {
+		return fmt.Errorf("mmap failed: %w", err)
+	}
+	hmErr := C.hm_u64_image_write(
+		(*C.char)(unsafe.Pointer(&image[0])),
+		imageSize,
+		db,
+	)
+	if err := syscall.Munmap(image); err != nil {
+		return fmt.Errorf("munmap failed: %w", err)
+	}
+	if hmErr != C.HM_SUCCESS {
+		return fmt.Errorf("hm_u64_image_write failed: %d", hmErr)
+	}
+	// Dirty pages of a shared mapping are written back to the file, which is
+	// synced before it replaces the old one.
+	return f.Sync()
+}
+
+// syncParentDir makes the rename of the file at path durable. Like
+// hm_bundle_write_file, it is best effort: the file is already replaced.
+func syncParentDir(path string) {
+	dir, err := os.Open(filepath.Dir(path))
+	if err != nil {
+		return
+	}
+	dir.Sync()
+	dir.Close()
+}
+
+// OpenImage opens the file written by CompileToFile. The file is mapped
+// read-only and the db uses it in place, so opening takes constant time and
+// memory, the pages are loaded on first use and processes opening the same
+// file share them. The db must be freed with Close. The file must not be
+// modified or truncated while the db is open; CompileToFile replaces it
+// with a new file, which is safe.
+func OpenImage(path string) (*StaticUint64Set, error) {
+	f, err := os.Open(path)
+	if err != nil {
+		return nil, err
+	}
+	// The mapping stays valid after the file is closed.
+	defer f.Close()
+	info, err := f.Stat()
+	if err != nil {
+		return nil, err
+	}
+	if info.Size() == 0 {
+		return nil, fmt.Errorf("empty file")
+	}
+	image, err := syscall.Mmap(int(f.Fd()), 0, int(info.Size()), syscall.PROT_READ, syscall.MAP_SHARED)
+	if err != nil {
+		return nil, fmt.Errorf("mmap failed: %w", err)
+	}
+
+	// The db header only points to the image, so it can be in the Go heap.
+	viewPlaceSize := C.hm_u64_view_place_size()
+	dbPlace := make([]byte, viewPlaceSize)
+	var db *C.hm_u64_database_t
+	hmErr := C.hm_u64_image_view(
+		(*C.char)(unsafe.Pointer(&dbPlace[0])),
+		viewPlaceSize,
+		&db,
+		(*C.char)(unsafe.Pointer(&image[0])),
+		C.size_t(len(image)),
+	)
+	if hmErr != C.HM_SUCCESS {
+		syscall.Munmap(image)
+		return nil, fmt.Errorf("hm_u64_image_view failed: %d", hmErr)
+	}
+
+	return &StaticUint64Set{
+		dbPlace: dbPlace,
+		db:      db,
+		image:   image,
+	}, nil
+}
@@ -0,0 +1,29 @@
+package gostaticuint64set
+
+// Reader looks up keys in a StaticUint64Set in pure Go, reading the hash
+// table of the database in place. It avoids the cost of a cgo call per
+// lookup, which is higher than the lookup itself, and can be inlined. A
+// Reader keeps the set memory alive and is safe for concurrent use.
+type Reader struct {
+	hashTable        []uint64
+	factor1, factor2 uint64
+	mask             uint64
+}
+
+// hash64 is hm_u64_hash64 of static_uint64_set.c.
+func (r *Reader) hash64(key uint64) uint64 {
+	key ^= key >> 33
+	key *= r.factor1
+	key ^= key >> 33
+	key *= r.factor2
+	key ^= key >> 33
+	return key
+}
+
+// Find returns if the given key is present in the set, same as
+// StaticUint64Set.Find.
+func (r *Reader) Find(key uint64) bool {
+	b := r.hash64(key) & r.mask
+	group := r.hashTable[b : b+4 : b+4]
+	return group[0] == key || group[1] == key || group[2] == key || group[3] == key
+}
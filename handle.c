@@ -0,0 +1,57 @@
+#include "handle.h"
+
+#include <sched.h>
+
+// The handle is a simplified userspace RCU. A reader increments the counter
+// of the current epoch parity before loading the pointer. The writer replaces
+// the pointer and flips the epoch twice, each time waiting for the counter of
+// the previous parity to drain. A reader which could see the old pointer has
+// incremented one of the counters before the replacement, possibly using the
+// parity read before an earlier flip, so after both counters have drained
+// once no such reader remains.
+
+HM_PUBLIC_API
+void HM_CDECL hm_handle_init(hm_handle_t *handle, void *value) {
+  handle->current = value;
+  handle->epoch = 0;
+  handle->swap_lock = 0;
+  handle->readers[0].count = 0;
+  handle->readers[1].count = 0;
+}
+
+HM_PUBLIC_API
+void *HM_CDECL hm_handle_acquire(hm_handle_t *handle, unsigned int *ticket) {
+  unsigned int parity =
+      __atomic_load_n(&handle->epoch, __ATOMIC_SEQ_CST) & 1;
+  __atomic_fetch_add(&handle->readers[parity].count, 1, __ATOMIC_SEQ_CST);
+  *ticket = parity;
+  return __atomic_load_n(&handle->current, __ATOMIC_SEQ_CST);
+}
+
+HM_PUBLIC_API
+void HM_CDECL hm_handle_release(hm_handle_t *handle, unsigned int ticket) {
+  __atomic_fetch_sub(&handle->readers[ticket].count, 1, __ATOMIC_RELEASE);
+}
+
+static void wait_readers(hm_handle_t *handle) {
+  uint64_t epoch = __atomic_load_n(&handle->epoch, __ATOMIC_SEQ_CST);
+  __atomic_store_n(&handle->epoch, epoch + 1, __ATOMIC_SEQ_CST);
+  while (__atomic_load_n(&handle->readers[epoch & 1].count,
+                         __ATOMIC_ACQUIRE) != 0) {
+    sched_yield();
+  }
+}
+
+HM_PUBLIC_API
+void *HM_CDECL hm_handle_swap(hm_handle_t *handle, void *value) {
+  while (__atomic_exchange_n(&handle->swap_lock, 1, __ATOMIC_ACQUIRE) != 0) {
+    sched_yield();
+  }
+
+  void *old = __atomic_exchange_n(&handle->current, value, __ATOMIC_SEQ_CST);
+  wait_readers(handle);
+  wait_readers(handle);
+
+  __atomic_store_n(&handle->swap_lock, 0, __ATOMIC_RELEASE);
+  return old;
+}
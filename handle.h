@@ -0,0 +1,54 @@
+#ifndef HM_HANDLE_H
+#define HM_HANDLE_H
+
+#include <stdint.h>
+
+#include "common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// hm_handle_t holds a pointer to a database (or to hm_replicas_t, see numa.h)
+// which can be replaced while other threads use it. Readers pin the current
+// pointer with hm_handle_acquire and unpin it with hm_handle_release.
+// hm_handle_swap publishes a new pointer and returns the old one when no
+// reader can use it anymore, so the caller can free it right away.
+//
+// Readers never block. They update one of two shared counters, so pin the
+// pointer once per batch of lookups rather than per lookup.
+typedef struct hm_handle {
+  void *current;
+  uint64_t epoch;
+  uint32_t swap_lock;
+  char padding1[44];
+
+  // readers[i].count is the number of readers which pinned the pointer when
+  // the parity of epoch was i. Each counter has its own cache line.
+  struct {
+    uint64_t count;
+    char padding[56];
+  } readers[2];
+} hm_handle_t;
+
+// hm_handle_init initializes the handle with the pointer.
+void HM_CDECL hm_handle_init(hm_handle_t *handle, void *value);
+
+// hm_handle_acquire returns the current pointer and pins it until
+// hm_handle_release is called with the ticket.
+void *HM_CDECL hm_handle_acquire(hm_handle_t *handle, unsigned int *ticket);
+
+// hm_handle_release unpins the pointer returned by hm_handle_acquire.
+void HM_CDECL hm_handle_release(hm_handle_t *handle, unsigned int ticket);
+
+// hm_handle_swap replaces the pointer with value and waits until all readers
+// which could get the old pointer release it. Returns the old pointer.
+// Swaps from multiple threads are serialized. It must not be called by a
+// thread holding a pin of the same handle.
+void *HM_CDECL hm_handle_swap(hm_handle_t *handle, void *value);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif // HM_HANDLE_H
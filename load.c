@@ -0,0 +1,214 @@
+#include "load.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "crc32c.h"
+#include "dispatch.h"
+#include "format.h"
+
+// Max number of threads of one load.
+#define MAX_THREADS 64
+
+// Min size of the part of an array loaded by one thread (bytes), so smaller
+// arrays are not worth starting threads for.
+#define MIN_PART_SIZE (4 << 20)
+
+// Size of blocks of an array which are checksummed and then copied while they
+// are still in the cache (bytes).
+#define BLOCK_SIZE (64 << 10)
+
+#if defined(HM_X86) && defined(__SSE2__) && !defined(HM_BIG_ENDIAN)
+#define HAVE_NONTEMPORAL 1
+#endif
+
+// part_t is the part of an array loaded by one thread.
+typedef struct part {
+  char *dst;
+  const char *src;
+  size_t size;
+  size_t elem_size;
+  unsigned int flags;
+
+  // CRC-32C of the part, set by load_part.
+  uint32_t crc;
+} part_t;
+
+static size_t page_size(void) { return (size_t)(sysconf(_SC_PAGESIZE)); }
+
+// prefault populates the pages of [dst, dst + size). Pages which are only
+// partially inside are touched, since the rest of them belongs to other
+// data.
+static void prefault(char *dst, size_t size) {
+  size_t page = page_size();
+  char *begin = (char *)(((uintptr_t)(dst) + page - 1) & ~(page - 1));
+  char *end = (char *)(((uintptr_t)(dst + size)) & ~(page - 1));
+#ifdef MADV_POPULATE_WRITE
+  if (begin < end && madvise(begin, end - begin, MADV_POPULATE_WRITE) == 0) {
+    if (dst < begin) {
+      *(volatile char *)(dst) = 0;
+    }
+    if (end < dst + size) {
+      *(volatile char *)(end) = 0;
+    }
+    return;
+  }
+#else
+  (void)(end);
+#endif
+  // The kernel does not support MADV_POPULATE_WRITE, so fault the pages in
+  // one by one. The part is overwritten by the copy anyway.
+  for (char *p = dst; p < dst + size; p = begin, begin += page) {
+    *(volatile char *)(p) = 0;
+  }
+}
+
+#ifdef HAVE_NONTEMPORAL
+// copy_nontemporal copies with streaming stores, which do not allocate cache
+// lines. The caller issues _mm_sfence after the last copy.
+static void copy_nontemporal(char *dst, const char *src, size_t size) {
+  size_t head = (16 - (uintptr_t)(dst) % 16) % 16;
+  if (head > size) {
+    head = size;
+  }
+  memcpy(dst, src, head);
+  dst += head;
+  src += head;
+  size -= head;
+  for (; size >= 64; dst += 64, src += 64, size -= 64) {
+    __m128i a = _mm_loadu_si128((const __m128i *)(src));
+    __m128i b = _mm_loadu_si128((const __m128i *)(src + 16));
+    __m128i c = _mm_loadu_si128((const __m128i *)(src + 32));
+    __m128i d = _mm_loadu_si128((const __m128i *)(src + 48));
+    _mm_stream_si128((__m128i *)(dst), a);
+    _mm_stream_si128((__m128i *)(dst + 16), b);
+    _mm_stream_si128((__m128i *)(dst + 32), c);
+    _mm_stream_si128((__m128i *)(dst + 48), d);
+  }
+  memcpy(dst, src, size);
+}
+#endif
+
+// copy_block copies size bytes of little endian numbers to host byte order.
+static void copy_block(char *dst, const char *src, size_t size,
+                       size_t elem_size, unsigned int flags) {
+#ifdef HM_BIG_ENDIAN
+  (void)(flags);
+  if (elem_size == sizeof(uint32_t)) {
+    hm_load_le32_array((uint32_t *)(dst), src, size / sizeof(uint32_t));
+  } else {
+    hm_load_le64_array((uint64_t *)(dst), src, size / sizeof(uint64_t));
+  }
+#else
+  (void)(elem_size);
+#ifdef HAVE_NONTEMPORAL
+  if (flags & HM_LOAD_NONTEMPORAL) {
+    copy_nontemporal(dst, src, size);
+    return;
+  }
+#endif
+  memcpy(dst, src, size);
+#endif
+}
+
+static void *load_part(void *arg) {
+  part_t *part = (part_t *)(arg);
+  if (part->flags & HM_LOAD_PREFAULT) {
+    prefault(part->dst, part->size);
+  }
+  uint32_t crc = 0;
+  for (size_t done = 0; done < part->size; done += BLOCK_SIZE) {
+    size_t n = part->size - done;
+    if (n > BLOCK_SIZE) {
+      n = BLOCK_SIZE;
+    }
+    crc = hm_crc32c(crc, part->src + done, n);
+    copy_block(part->dst + done, part->src + done, n, part->elem_size,
+               part->flags);
+  }
+#ifdef HAVE_NONTEMPORAL
+  if (part->flags & HM_LOAD_NONTEMPORAL) {
+    _mm_sfence();
+  }
+#endif
+  part->crc = crc;
+  return NULL;
+}
+
+void hm_load_array(void *dst, const char *src, size_t count, size_t elem_size,
+                   const hm_load_options_t *options, uint32_t *crc) {
+  size_t size = count * elem_size;
+  size_t threads = 1;
+  unsigned int flags = 0;
+  if (options != NULL) {
+    threads = options->threads;
+    flags = options->flags;
+  }
+  if (threads > MAX_THREADS) {
+    threads = MAX_THREADS;
+  }
+  if (threads > size / MIN_PART_SIZE) {
+    threads = size / MIN_PART_SIZE;
+  }
+  if (threads == 0) {
+    threads = 1;
+  }
+
+  // Parts are whole pages, so threads do not fault the same pages, and
+  // whole numbers, since the page size is a multiple of 8.
+  size_t page = page_size();
+  size_t part_size = (size / threads + page - 1) & ~(page - 1);
+  part_t parts[MAX_THREADS];
+  size_t offset = 0;
+  for (size_t i = 0; i < threads; i++) {
+    size_t n = size - offset;
+    if (n > part_size) {
+      n = part_size;
+    }
+    parts[i] = (part_t){
+        .dst = (char *)(dst) + offset,
+        .src = src + offset,
+        .size = n,
+        .elem_size = elem_size,
+        .flags = flags,
+    };
+    offset += n;
+  }
+
+  // If a thread fails to start, its part is loaded by the calling thread.
+  pthread_t tids[MAX_THREADS];
+  bool started[MAX_THREADS];
+  for (size_t i = 1; i < threads; i++) {
+    started[i] = pthread_create(&tids[i], NULL, load_part, &parts[i]) == 0;
+  }
+  load_part(&parts[0]);
+  for (size_t i = 1; i < threads; i++) {
+    if (started[i]) {
+      pthread_join(tids[i], NULL);
+    } else {
+      load_part(&parts[i]);
+    }
+  }
+
+  for (size_t i = 0; i < threads; i++) {
+    *crc = hm_crc32c_combine(*crc, parts[i].crc, parts[i].size);
+  }
+}
+
+hm_error_t hm_load_lock(const char *place, size_t size,
+                        const hm_load_options_t *options) {
+  if (options == NULL || !(options->flags & HM_LOAD_MLOCK)) {
+    return HM_SUCCESS;
+  }
+  size_t page = page_size();
+  const char *begin = (const char *)((uintptr_t)(place) & ~(page - 1));
+  if (mlock(begin, place + size - begin) != 0) {
+    return HM_ERROR_SYSTEM;
+  }
+  return HM_SUCCESS;
+}
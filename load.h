@@ -0,0 +1,47 @@
+#ifndef HM_LOAD_H
+#define HM_LOAD_H
+
+#include <stddef.h>
+
+#include "common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Options of hm_*_deserialize_ex for loading large databases. A plain
+// deserialize copies the data in one thread and leaves the pages of db_place
+// to be faulted in by the copy and by the first lookups.
+
+// HM_LOAD_NONTEMPORAL copies with non-temporal stores, which bypass the CPU
+// caches, so loading a large db does not evict the working set of the
+// databases serving lookups in the meantime.
+#define HM_LOAD_NONTEMPORAL (1 << 0)
+
+// HM_LOAD_PREFAULT populates the pages of db_place before the copy, in bulk
+// and from all the threads, instead of taking a page fault per page.
+#define HM_LOAD_PREFAULT (1 << 1)
+
+// HM_LOAD_MLOCK locks the pages of the loaded db in memory with mlock, so
+// they are not swapped out or reclaimed. The caller must munlock or unmap the
+// memory when freeing the db. If locking fails, HM_ERROR_SYSTEM is returned
+// with errno set (see RLIMIT_MEMLOCK).
+#define HM_LOAD_MLOCK (1 << 2)
+
+// hm_load_options_t tunes hm_*_deserialize_ex. Zeroed options load like
+// hm_*_deserialize.
+typedef struct hm_load_options {
+  // Number of threads copying and checksumming the data, including the
+  // calling one. 0 and 1 mean the calling thread only. Small databases are
+  // loaded by fewer threads.
+  unsigned int threads;
+
+  // HM_LOAD_* flags.
+  unsigned int flags;
+} hm_load_options_t;
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif // HM_LOAD_H
@@ -0,0 +1,217 @@
+#define _GNU_SOURCE
+
+#include "numa.h"
+
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Memory policy of mbind(2), see linux/mempolicy.h.
+#define MPOL_PREFERRED 1
+
+// Largest number of nodes supported.
+#define MAX_NODES 1024
+
+struct hm_replicas {
+  hm_db_type_t type;
+
+  // Number of elements in places and dbs.
+  int nodes;
+
+  // places[i] is the memory of the copy on node i. If node i is offline, its
+  // place is empty and dbs[i] points to the copy of the first online node.
+  hm_place_t *places;
+  void **dbs;
+};
+
+// read_online_nodes fills online with ids of online nodes from sysfs, e.g.
+// "0-1,3". Returns the number of nodes (largest id + 1) or 0 on failure.
+static int read_online_nodes(bool online[MAX_NODES]) {
+  FILE *f = fopen("/sys/devices/system/node/online", "r");
+  if (f == NULL) {
+    return 0;
+  }
+
+  int nodes = 0;
+  int first, last;
+  while (fscanf(f, "%d", &first) == 1) {
+    last = first;
+    int c = fgetc(f);
+    if (c == '-') {
+      if (fscanf(f, "%d", &last) != 1) {
+        break;
+      }
+      c = fgetc(f);
+    }
+    for (int node = first; node <= last && node < MAX_NODES; node++) {
+      if (node >= 0) {
+        online[node] = true;
+        nodes = node + 1;
+      }
+    }
+    if (c != ',') {
+      break;
+    }
+  }
+
+  fclose(f);
+  return nodes;
+}
+
+// prefer_node asks the kernel to allocate pages of the range on the node.
+// Pages which are already allocated are not moved.
+static void prefer_node(char *addr, size_t len, int node) {
+#ifdef SYS_mbind
+  unsigned long mask[MAX_NODES / (8 * sizeof(unsigned long))] = {0};
+  mask[node / (8 * sizeof(unsigned long))] |=
+      1ul << (node % (8 * sizeof(unsigned long)));
+  // Failure means there is no NUMA support, then the node does not matter.
+  syscall(SYS_mbind, addr, len, MPOL_PREFERRED, mask, MAX_NODES + 1, 0);
+#endif
+}
+
+HM_PUBLIC_API
+int HM_CDECL hm_numa_nodes(void) {
+  bool online[MAX_NODES] = {false};
+  int nodes = read_online_nodes(online);
+  if (nodes == 0) {
+    return 1;
+  }
+  return nodes;
+}
+
+HM_PUBLIC_API
+int HM_CDECL hm_numa_current_node(void) {
+  unsigned int cpu, node;
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 29)
+  // Uses vDSO, so it does not enter the kernel.
+  if (getcpu(&cpu, &node) == 0) {
+    return node;
+  }
+#elif defined(SYS_getcpu)
+  if (syscall(SYS_getcpu, &cpu, &node, NULL) == 0) {
+    return node;
+  }
+#endif
+  return 0;
+}
+
+HM_PUBLIC_API
+hm_error_t HM_CDECL hm_replicas_create(hm_replicas_t **replicas_ptr,
+                                       hm_db_type_t type, const char *buffer,
+                                       size_t buffer_size,
+                                       hm_page_kind_t max_pages) {
+  size_t db_place_size;
+  hm_error_t hm_err = hm_db_place_size_from_serialized(
+      type, &db_place_size, buffer, buffer_size);
+  if (hm_err != HM_SUCCESS) {
+    return hm_err;
+  }
+
+  bool online[MAX_NODES] = {false};
+  int nodes = read_online_nodes(online);
+  if (nodes == 0) {
+    nodes = 1;
+    online[0] = true;
+  }
+
+  hm_replicas_t *replicas = calloc(1, sizeof(hm_replicas_t));
+  if (replicas == NULL) {
+    return HM_ERROR_NO_MEMORY;
+  }
+  replicas->type = type;
+  replicas->nodes = nodes;
+  replicas->places = calloc(nodes, sizeof(hm_place_t));
+  replicas->dbs = calloc(nodes, sizeof(void *));
+  if (replicas->places == NULL || replicas->dbs == NULL) {
+    hm_replicas_free(replicas);
+    return HM_ERROR_NO_MEMORY;
+  }
+
+  void *first_db = NULL;
+  for (int node = 0; node < nodes; node++) {
+    if (!online[node]) {
+      continue;
+    }
+    hm_place_t *place = &replicas->places[node];
+    hm_err = hm_place_alloc(place, db_place_size, max_pages);
+    if (hm_err != HM_SUCCESS) {
+      hm_replicas_free(replicas);
+      return hm_err;
+    }
+    // The memory is not touched yet, so deserialization allocates its pages
+    // on the node.
+    prefer_node(place->data, place->mapped_size, node);
+    hm_err = hm_db_deserialize(type, place->data, place->size,
+                               &replicas->dbs[node], buffer, buffer_size);
+    if (hm_err != HM_SUCCESS) {
+      hm_replicas_free(replicas);
+      return hm_err;
+    }
+    if (first_db == NULL) {
+      first_db = replicas->dbs[node];
+    }
+  }
+
+  for (int node = 0; node < nodes; node++) {
+    if (replicas->dbs[node] == NULL) {
+      replicas->dbs[node] = first_db;
+    }
+  }
+
+  *replicas_ptr = replicas;
+  return HM_SUCCESS;
+}
+
+HM_PUBLIC_API
+hm_error_t HM_CDECL hm_replicas_create_from_db(hm_replicas_t **replicas_ptr,
+                                               hm_db_type_t type,
+                                               const void *db,
+                                               hm_page_kind_t max_pages) {
+  if (hm_db_type_name(type) == NULL) {
+    return HM_ERROR_BAD_VALUE;
+  }
+
+  size_t buffer_size = hm_db_serialized_size(type, db);
+  char *buffer = malloc(buffer_size);
+  if (buffer == NULL) {
+    return HM_ERROR_NO_MEMORY;
+  }
+  hm_error_t hm_err = hm_db_serialize(type, buffer, buffer_size, db);
+  if (hm_err == HM_SUCCESS) {
+    hm_err = hm_replicas_create(replicas_ptr, type, buffer, buffer_size,
+                                max_pages);
+  }
+  free(buffer);
+  return hm_err;
+}
+
+HM_PUBLIC_API
+const void *HM_CDECL hm_replicas_local(const hm_replicas_t *replicas) {
+  return hm_replicas_node(replicas, hm_numa_current_node());
+}
+
+HM_PUBLIC_API
+const void *HM_CDECL hm_replicas_node(const hm_replicas_t *replicas,
+                                      int node) {
+  if (node < 0 || node >= replicas->nodes) {
+    node = 0;
+  }
+  return replicas->dbs[node];
+}
+
+HM_PUBLIC_API
+void HM_CDECL hm_replicas_free(hm_replicas_t *replicas) {
+  if (replicas->places != NULL) {
+    for (int node = 0; node < replicas->nodes; node++) {
+      hm_place_free(&replicas->places[node]);
+    }
+  }
+  free(replicas->places);
+  free(replicas->dbs);
+  free(replicas);
+}
@@ -0,0 +1,61 @@
+#ifndef HM_NUMA_H
+#define HM_NUMA_H
+
+#include <stddef.h>
+
+#include "common.h"
+#include "database.h"
+#include "place.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// hm_numa_nodes returns the number of NUMA nodes (the largest id of an online
+// node + 1). It is 1 if the system does not report NUMA topology.
+int HM_CDECL hm_numa_nodes(void);
+
+// hm_numa_current_node returns the NUMA node of the CPU running the calling
+// thread or 0 if it is unknown.
+int HM_CDECL hm_numa_current_node(void);
+
+struct hm_replicas;
+
+// hm_replicas_t is a set of copies of a database, one in the memory of each
+// NUMA node. It can be stored in hm_handle_t (see handle.h) to swap all the
+// copies at once.
+typedef struct hm_replicas hm_replicas_t;
+
+// hm_replicas_create deserializes the database of the given type from buffer
+// into memory of each NUMA node. The memory of each copy is allocated by
+// hm_place_alloc with max_pages and bound to its node with preference, so it
+// still works if the node runs out of memory.
+hm_error_t HM_CDECL hm_replicas_create(hm_replicas_t **replicas_ptr,
+                                       hm_db_type_t type, const char *buffer,
+                                       size_t buffer_size,
+                                       hm_page_kind_t max_pages);
+
+// hm_replicas_create_from_db is hm_replicas_create taking a compiled db.
+hm_error_t HM_CDECL hm_replicas_create_from_db(hm_replicas_t **replicas_ptr,
+                                               hm_db_type_t type,
+                                               const void *db,
+                                               hm_page_kind_t max_pages);
+
+// hm_replicas_local returns the copy of the database on the NUMA node of the
+// calling thread. Threads can migrate between nodes, so long running threads
+// should call it again from time to time, e.g. per batch of lookups.
+const void *HM_CDECL hm_replicas_local(const hm_replicas_t *replicas);
+
+// hm_replicas_node returns the copy of the database used by the given node.
+// A negative node or one not known when the replicas were created (e.g. added
+// by hotplug later) gets the copy of node 0, so the result is never NULL.
+const void *HM_CDECL hm_replicas_node(const hm_replicas_t *replicas, int node);
+
+// hm_replicas_free frees all copies.
+void HM_CDECL hm_replicas_free(hm_replicas_t *replicas);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif // HM_NUMA_H
@@ -0,0 +1,147 @@
+#include "place.h"
+
+#include <stdint.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define SIZE_2M ((size_t)1 << 21)
+#define SIZE_1G ((size_t)1 << 30)
+
+// Bits of mmap flags selecting the size of huge pages, see mmap(2).
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+
+// round_up returns size rounded up to page or 0 on overflow.
+static size_t round_up(size_t size, size_t page) {
+  if (size > SIZE_MAX - (page - 1)) {
+    return 0;
+  }
+  return (size + page - 1) & ~(page - 1);
+}
+
+static char *map_hugetlb(size_t mapped_size, int page_shift) {
+#ifdef MAP_HUGETLB
+  void *addr = mmap(NULL, mapped_size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB |
+                        (page_shift << MAP_HUGE_SHIFT),
+                    -1, 0);
+  if (addr != MAP_FAILED) {
+    return addr;
+  }
+#endif
+  return NULL;
+}
+
+// map_aligned maps mapped_size bytes starting at an address aligned to
+// alignment. It maps more and unmaps the extra memory around the result.
+static char *map_aligned(size_t mapped_size, size_t alignment) {
+  size_t total = mapped_size + alignment;
+  if (total < mapped_size) {
+    return NULL;
+  }
+  void *addr = mmap(NULL, total, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (addr == MAP_FAILED) {
+    return NULL;
+  }
+  uintptr_t begin = (uintptr_t)addr;
+  uintptr_t start = (begin + alignment - 1) & ~(uintptr_t)(alignment - 1);
+  size_t head = start - begin;
+  size_t tail = total - head - mapped_size;
+  if (head != 0) {
+    munmap(addr, head);
+  }
+  if (tail != 0) {
+    munmap((char *)start + mapped_size, tail);
+  }
+  return (char *)start;
+}
+
+HM_PUBLIC_API
+const char *HM_CDECL hm_page_kind_name(hm_page_kind_t pages) {
+  switch (pages) {
+  case HM_PAGES_DEFAULT:
+    return "default";
+  case HM_PAGES_THP:
+    return "thp";
+  case HM_PAGES_2M:
+    return "2M";
+  case HM_PAGES_1G:
+    return "1G";
+  }
+  return "unknown";
+}
+
+HM_PUBLIC_API
+hm_error_t HM_CDECL hm_place_alloc(hm_place_t *place, size_t size,
+                                   hm_page_kind_t max_pages) {
+  if (size == 0) {
+    return HM_ERROR_BAD_SIZE;
+  }
+  if (max_pages < HM_PAGES_DEFAULT || max_pages > HM_PAGES_1G) {
+    return HM_ERROR_BAD_VALUE;
+  }
+
+  for (int kind = max_pages; kind >= HM_PAGES_DEFAULT; kind--) {
+    size_t mapped_size = 0;
+    char *data = NULL;
+    hm_page_kind_t pages = (hm_page_kind_t)kind;
+
+    switch (pages) {
+    case HM_PAGES_1G:
+      mapped_size = round_up(size, SIZE_1G);
+      if (mapped_size != 0) {
+        data = map_hugetlb(mapped_size, 30);
+      }
+      break;
+    case HM_PAGES_2M:
+      mapped_size = round_up(size, SIZE_2M);
+      if (mapped_size != 0) {
+        data = map_hugetlb(mapped_size, 21);
+      }
+      break;
+    case HM_PAGES_THP:
+      // THP can back only 2 MiB aligned ranges of 2 MiB.
+      mapped_size = round_up(size, SIZE_2M);
+      if (mapped_size != 0) {
+        data = map_aligned(mapped_size, SIZE_2M);
+      }
+#ifdef MADV_HUGEPAGE
+      if (data != NULL && madvise(data, mapped_size, MADV_HUGEPAGE) != 0) {
+        // THP is disabled in the system. The memory is still usable.
+        pages = HM_PAGES_DEFAULT;
+      }
+#else
+      pages = HM_PAGES_DEFAULT;
+#endif
+      break;
+    case HM_PAGES_DEFAULT:
+      mapped_size = round_up(size, (size_t)sysconf(_SC_PAGESIZE));
+      if (mapped_size != 0) {
+        data = map_aligned(mapped_size, (size_t)sysconf(_SC_PAGESIZE));
+      }
+      break;
+    }
+
+    if (data != NULL) {
+      place->data = data;
+      place->size = size;
+      place->mapped_size = mapped_size;
+      place->pages = pages;
+      return HM_SUCCESS;
+    }
+  }
+
+  return HM_ERROR_NO_MEMORY;
+}
+
+HM_PUBLIC_API
+void HM_CDECL hm_place_free(hm_place_t *place) {
+  if (place->data != NULL) {
+    munmap(place->data, place->mapped_size);
+  }
+  place->data = NULL;
+  place->size = 0;
+  place->mapped_size = 0;
+}
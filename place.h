@@ -0,0 +1,65 @@
+#ifndef HM_PLACE_H
+#define HM_PLACE_H
+
+#include <stddef.h>
+
+#include "common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Helpers to allocate db_place and cache_place on huge pages. Large tables
+// accessed at random addresses miss dTLB on almost every lookup when they are
+// backed by 4 KiB pages. Pass place.data and place.size to any of
+// hm_*_compile, hm_*_deserialize or hm_cache_init.
+
+// hm_page_kind_t is the kind of pages backing a place.
+typedef enum hm_page_kind {
+  // Regular pages of the system.
+  HM_PAGES_DEFAULT = 0,
+
+  // Regular pages with transparent huge pages requested by madvise. The
+  // kernel promotes the memory to 2 MiB pages when it can.
+  HM_PAGES_THP = 1,
+
+  // 2 MiB pages from the hugetlb pool (vm.nr_hugepages).
+  HM_PAGES_2M = 2,
+
+  // 1 GiB pages from the hugetlb pool.
+  HM_PAGES_1G = 3,
+} hm_page_kind_t;
+
+// hm_place_t is memory allocated by hm_place_alloc.
+typedef struct hm_place {
+  // Start of the place, aligned to the page size.
+  char *data;
+
+  // Size requested by the caller.
+  size_t size;
+
+  // Size of the mapping, size rounded up to the page size.
+  size_t mapped_size;
+
+  // Kind of pages actually backing the place.
+  hm_page_kind_t pages;
+} hm_place_t;
+
+// hm_page_kind_name returns human readable name of the page kind.
+const char *HM_CDECL hm_page_kind_name(hm_page_kind_t pages);
+
+// hm_place_alloc allocates size bytes backed by pages of kind max_pages or,
+// if the system can not provide them, by the next smaller kind, down to
+// HM_PAGES_DEFAULT. place->pages is set to the kind used. The memory is zeroed.
+// Huge pages are reserved by the call, so later page faults do not fail.
+hm_error_t HM_CDECL hm_place_alloc(hm_place_t *place, size_t size,
+                                   hm_page_kind_t max_pages);
+
+// hm_place_free frees the place allocated by hm_place_alloc.
+void HM_CDECL hm_place_free(hm_place_t *place);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif // HM_PLACE_H
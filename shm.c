@@ -0,0 +1,502 @@
+#define _GNU_SOURCE
+
+#include "shm.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// "hmshmctl" and "hmshmimg" in little endian.
+#define CONTROL_MAGIC 0x6c74636d68736d68ull
+#define IMAGE_MAGIC 0x676d696d68736d68ull
+
+// Size of the header of a memfd. The image follows it, so it is 64 byte
+// aligned as hm_db_image_view requires.
+#define IMAGE_OFFSET 64
+
+// Number of attempts to attach while the publisher replaces the database.
+#define ATTACH_ATTEMPTS 100
+
+// Number of attempts to read the announcement while the publisher updates
+// it. The update takes a few stores, so running out of them means that the
+// publisher died in the middle of it.
+#define READ_ATTEMPTS 10000
+
+// control_t is the content of the control segment. All fields except magic
+// are accessed atomically. Fields after seq are protected by the sequence
+// lock: seq is odd while the publisher updates them. closed is set once when
+// the segment is abandoned by its publisher.
+typedef struct control {
+  uint64_t magic;
+  uint64_t seq;
+  uint64_t version;
+  uint64_t type;
+  uint64_t image_size;
+  int64_t pid;
+  int64_t fd;
+  uint64_t closed;
+} control_t;
+
+// image_header_t is the beginning of a memfd.
+typedef struct image_header {
+  uint64_t magic;
+  uint64_t version;
+  uint64_t type;
+  uint64_t image_size;
+} image_header_t;
+
+// announcement_t is a consistent copy of fields of control_t.
+typedef struct announcement {
+  uint64_t version;
+  uint64_t type;
+  uint64_t image_size;
+  int64_t pid;
+  int64_t fd;
+} announcement_t;
+
+struct hm_shm_publisher {
+  char *name;
+  control_t *control;
+
+  // Identity of the control segment, so a segment created under the same
+  // name by a newer publisher is not removed by this one.
+  dev_t dev;
+  ino_t ino;
+
+  // Memfd of the current database or -1.
+  int fd;
+  uint64_t version;
+};
+
+struct hm_shm_subscriber {
+  const control_t *control;
+};
+
+struct hm_shm_view {
+  hm_db_type_t type;
+  uint64_t version;
+  char *mapping;
+  size_t mapping_size;
+  void *db;
+
+  // Place of hm_*_database_t pointing into the mapping.
+  char view_place[];
+};
+
+// close_keeping_errno closes fd without changing errno of a failure being
+// reported.
+static void close_keeping_errno(int fd) {
+  int saved_errno = errno;
+  close(fd);
+  errno = saved_errno;
+}
+
+static void announce(control_t *control, const announcement_t *a) {
+  uint64_t seq = __atomic_load_n(&control->seq, __ATOMIC_RELAXED);
+  __atomic_store_n(&control->seq, seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  __atomic_store_n(&control->version, a->version, __ATOMIC_RELAXED);
+  __atomic_store_n(&control->type, a->type, __ATOMIC_RELAXED);
+  __atomic_store_n(&control->image_size, a->image_size, __ATOMIC_RELAXED);
+  __atomic_store_n(&control->pid, a->pid, __ATOMIC_RELAXED);
+  __atomic_store_n(&control->fd, a->fd, __ATOMIC_RELAXED);
+  __atomic_store_n(&control->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+// read_announcement copies the announcement to a. Returns false if the
+// publisher never finished updating it.
+static bool read_announcement(const control_t *control, announcement_t *a) {
+  for (int attempt = 0; attempt < READ_ATTEMPTS; attempt++) {
+    uint64_t seq = __atomic_load_n(&control->seq, __ATOMIC_ACQUIRE);
+    if (seq % 2 == 1) {
+      // Let the publisher finish if it was preempted.
+      sched_yield();
+      continue;
+    }
+    a->version = __atomic_load_n(&control->version, __ATOMIC_RELAXED);
+    a->type = __atomic_load_n(&control->type, __ATOMIC_RELAXED);
+    a->image_size = __atomic_load_n(&control->image_size, __ATOMIC_RELAXED);
+    a->pid = __atomic_load_n(&control->pid, __ATOMIC_RELAXED);
+    a->fd = __atomic_load_n(&control->fd, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&control->seq, __ATOMIC_RELAXED) == seq) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// close_control marks the control segment closed, so its subscribers know
+// that it is not updated anymore.
+static void close_control(control_t *control) {
+  __atomic_store_n(&control->closed, 1, __ATOMIC_RELEASE);
+}
+
+// close_old_segment marks the segment with the given name closed if it is a
+// control segment, e.g. left by a publisher which crashed.
+static void close_old_segment(const char *name) {
+  int fd = shm_open(name, O_RDWR | O_CLOEXEC, 0);
+  if (fd == -1) {
+    return;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size != sizeof(control_t)) {
+    close(fd);
+    return;
+  }
+  control_t *control = mmap(NULL, sizeof(control_t), PROT_READ | PROT_WRITE,
+                            MAP_SHARED, fd, 0);
+  close(fd);
+  if (control == MAP_FAILED) {
+    return;
+  }
+  if (__atomic_load_n(&control->magic, __ATOMIC_ACQUIRE) == CONTROL_MAGIC) {
+    close_control(control);
+  }
+  munmap(control, sizeof(control_t));
+}
+
+HM_PUBLIC_API
+hm_error_t HM_CDECL hm_shm_publisher_create(hm_shm_publisher_t **publisher_ptr,
+                                            const char *name) {
+  hm_shm_publisher_t *publisher = calloc(1, sizeof(hm_shm_publisher_t));
+  if (publisher == NULL) {
+    return HM_ERROR_NO_MEMORY;
+  }
+  publisher->fd = -1;
+  publisher->name = strdup(name);
+  if (publisher->name == NULL) {
+    free(publisher);
+    return HM_ERROR_NO_MEMORY;
+  }
+
+  // Subscribers of the old segment keep reading it, but it is not updated.
+  close_old_segment(name);
+  shm_unlink(name);
+  int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+  void *control = MAP_FAILED;
+  if (fd != -1) {
+    struct stat st;
+    if (ftruncate(fd, sizeof(control_t)) == 0 && fstat(fd, &st) == 0) {
+      control = mmap(NULL, sizeof(control_t), PROT_READ | PROT_WRITE,
+                     MAP_SHARED, fd, 0);
+      publisher->dev = st.st_dev;
+      publisher->ino = st.st_ino;
+    }
+    close_keeping_errno(fd);
+  }
+  if (control == MAP_FAILED) {
+    int saved_errno = errno;
+    if (fd != -1) {
+      shm_unlink(name);
+    }
+    free(publisher->name);
+    free(publisher);
+    errno = saved_errno;
+    return HM_ERROR_SYSTEM;
+  }
+
+  publisher->control = control;
+  // The segment is zeroed, so subscribers see version 0 until magic is set.
+  __atomic_store_n(&publisher->control->magic, CONTROL_MAGIC,
+                   __ATOMIC_RELEASE);
+
+  *publisher_ptr = publisher;
+  return HM_SUCCESS;
+}
+
+// write_memfd creates a sealed memfd with the image of the database.
+// Returns -1 on failure.
+static int write_memfd(hm_db_type_t type, const void *db, uint64_t version,
+                       size_t image_size) {
+  int fd = memfd_create("hipermap", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (fd == -1) {
+    return -1;
+  }
+  size_t size = IMAGE_OFFSET + image_size;
+  char *mapping = MAP_FAILED;
+  if (ftruncate(fd, size) == 0) {
+    mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  if (mapping == MAP_FAILED) {
+    close_keeping_errno(fd);
+    return -1;
+  }
+  image_header_t header = {
+      .magic = IMAGE_MAGIC,
+      .version = version,
+      .type = type,
+      .image_size = image_size,
+  };
+  memcpy(mapping, &header, sizeof(header));
+  hm_error_t hm_err =
+      hm_db_image_write(type, mapping + IMAGE_OFFSET, image_size, db);
+  // F_SEAL_WRITE requires that there are no writable mappings.
+  munmap(mapping, size);
+  if (hm_err != HM_SUCCESS) {
+    close(fd);
+    errno = EINVAL;
+    return -1;
+  }
+  int seals = F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL;
+  if (fcntl(fd, F_ADD_SEALS, seals) != 0) {
+    close_keeping_errno(fd);
+    return -1;
+  }
+  return fd;
+}
+
+HM_PUBLIC_API
+hm_error_t HM_CDECL hm_shm_publish(hm_shm_publisher_t *publisher,
+                                   hm_db_type_t type, const void *db) {
+  if (hm_db_type_name(type) == NULL) {
+    return HM_ERROR_BAD_VALUE;
+  }
+  size_t image_size = hm_db_image_size(type, db);
+  uint64_t version = publisher->version + 1;
+  int fd = write_memfd(type, db, version, image_size);
+  if (fd == -1) {
+    return HM_ERROR_SYSTEM;
+  }
+
+  announcement_t a = {
+      .version = version,
+      .type = type,
+      .image_size = image_size,
+      .pid = getpid(),
+      .fd = fd,
+  };
+  announce(publisher->control, &a);
+
+  // Subscribers which have not opened the old memfd yet notice that the
+  // announcement changed and retry.
+  if (publisher->fd != -1) {
+    close(publisher->fd);
+  }
+  publisher->fd = fd;
+  publisher->version = version;
+  return HM_SUCCESS;
+}
+
+HM_PUBLIC_API
+uint64_t HM_CDECL
+hm_shm_publisher_version(const hm_shm_publisher_t *publisher) {
+  return publisher->version;
+}
+
+// owns_segment returns if the segment under the name of the publisher is
+// still its control segment.
+static bool owns_segment(const hm_shm_publisher_t *publisher) {
+  int fd = shm_open(publisher->name, O_RDONLY | O_CLOEXEC, 0);
+  if (fd == -1) {
+    return false;
+  }
+  struct stat st;
+  bool owns = fstat(fd, &st) == 0 && st.st_dev == publisher->dev &&
+              st.st_ino == publisher->ino;
+  close(fd);
+  return owns;
+}
+
+HM_PUBLIC_API
+void HM_CDECL hm_shm_publisher_free(hm_shm_publisher_t *publisher) {
+  close_control(publisher->control);
+  if (owns_segment(publisher)) {
+    shm_unlink(publisher->name);
+  }
+  munmap(publisher->control, sizeof(control_t));
+  if (publisher->fd != -1) {
+    close(publisher->fd);
+  }
+  free(publisher->name);
+  free(publisher);
+}
+
+HM_PUBLIC_API
+hm_error_t HM_CDECL hm_shm_subscriber_open(hm_shm_subscriber_t **subscriber_ptr,
+                                           const char *name) {
+  int fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+  if (fd == -1) {
+    return HM_ERROR_SYSTEM;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close_keeping_errno(fd);
+    return HM_ERROR_SYSTEM;
+  }
+  if (st.st_size != sizeof(control_t)) {
+    close(fd);
+    return HM_ERROR_BAD_VALUE;
+  }
+  const control_t *control =
+      mmap(NULL, sizeof(control_t), PROT_READ, MAP_SHARED, fd, 0);
+  close_keeping_errno(fd);
+  if (control == MAP_FAILED) {
+    return HM_ERROR_SYSTEM;
+  }
+
+  if (__atomic_load_n(&control->magic, __ATOMIC_ACQUIRE) != CONTROL_MAGIC) {
+    munmap((void *)control, sizeof(control_t));
+    return HM_ERROR_BAD_VALUE;
+  }
+
+  hm_shm_subscriber_t *subscriber = malloc(sizeof(hm_shm_subscriber_t));
+  if (subscriber == NULL) {
+    munmap((void *)control, sizeof(control_t));
+    return HM_ERROR_NO_MEMORY;
+  }
+  subscriber->control = control;
+
+  *subscriber_ptr = subscriber;
+  return HM_SUCCESS;
+}
+
+HM_PUBLIC_API
+uint64_t HM_CDECL
+hm_shm_subscriber_version(const hm_shm_subscriber_t *subscriber) {
+  if (__atomic_load_n(&subscriber->control->closed, __ATOMIC_ACQUIRE)) {
+    return HM_SHM_VERSION_CLOSED;
+  }
+  return __atomic_load_n(&subscriber->control->version, __ATOMIC_RELAXED);
+}
+
+// map_announced maps the memfd from the announcement. Returns
+// HM_ERROR_NO_DATABASE if it was replaced in the meantime.
+static hm_error_t map_announced(const announcement_t *a, char **mapping_ptr,
+                                size_t *mapping_size) {
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/%lld/fd/%lld", (long long)a->pid,
+           (long long)a->fd);
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    // The publisher closed the memfd or exited.
+    return errno == ENOENT ? HM_ERROR_NO_DATABASE : HM_ERROR_SYSTEM;
+  }
+
+  // The fd number can be reused by the publisher for anything, so check that
+  // the file is the announced memfd before mapping it.
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close_keeping_errno(fd);
+    return HM_ERROR_SYSTEM;
+  }
+  size_t size = IMAGE_OFFSET + a->image_size;
+  if (!S_ISREG(st.st_mode) || (uint64_t)st.st_size != size) {
+    close(fd);
+    return HM_ERROR_NO_DATABASE;
+  }
+  int seals = fcntl(fd, F_GET_SEALS);
+  if (seals == -1 || (seals & F_SEAL_WRITE) == 0) {
+    close(fd);
+    return HM_ERROR_NO_DATABASE;
+  }
+  char *mapping = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+  close_keeping_errno(fd);
+  if (mapping == MAP_FAILED) {
+    return HM_ERROR_SYSTEM;
+  }
+
+  image_header_t header;
+  memcpy(&header, mapping, sizeof(header));
+  if (header.magic != IMAGE_MAGIC || header.version != a->version ||
+      header.type != a->type || header.image_size != a->image_size) {
+    munmap(mapping, size);
+    return HM_ERROR_NO_DATABASE;
+  }
+
+  *mapping_ptr = mapping;
+  *mapping_size = size;
+  return HM_SUCCESS;
+}
+
+HM_PUBLIC_API
+hm_error_t HM_CDECL hm_shm_attach(hm_shm_subscriber_t *subscriber,
+                                  hm_shm_view_t **view_ptr) {
+  announcement_t a;
+  char *mapping;
+  size_t mapping_size;
+  hm_error_t hm_err = HM_ERROR_NO_DATABASE;
+  for (int attempt = 0; attempt < ATTACH_ATTEMPTS; attempt++) {
+    if (__atomic_load_n(&subscriber->control->closed, __ATOMIC_ACQUIRE)) {
+      return HM_ERROR_CLOSED;
+    }
+    if (!read_announcement(subscriber->control, &a) || a.version == 0) {
+      return HM_ERROR_NO_DATABASE;
+    }
+    hm_err = map_announced(&a, &mapping, &mapping_size);
+    if (hm_err != HM_ERROR_NO_DATABASE) {
+      break;
+    }
+    announcement_t b;
+    if (!read_announcement(subscriber->control, &b)) {
+      return HM_ERROR_NO_DATABASE;
+    }
+    if (b.version == a.version) {
+      // The announcement is current, but the memfd is gone: the publisher
+      // exited, maybe closing the segment meanwhile.
+      if (__atomic_load_n(&subscriber->control->closed, __ATOMIC_ACQUIRE)) {
+        return HM_ERROR_CLOSED;
+      }
+      return HM_ERROR_NO_DATABASE;
+    }
+  }
+  if (hm_err != HM_SUCCESS) {
+    return hm_err;
+  }
+
+  hm_db_type_t type = (hm_db_type_t)a.type;
+  size_t view_place_size = hm_db_view_place_size(type);
+  hm_shm_view_t *view = malloc(sizeof(hm_shm_view_t) + view_place_size);
+  if (view == NULL) {
+    munmap(mapping, mapping_size);
+    return HM_ERROR_NO_MEMORY;
+  }
+  view->type = type;
+  view->version = a.version;
+  view->mapping = mapping;
+  view->mapping_size = mapping_size;
+  hm_err = hm_db_image_view(type, view->view_place, view_place_size, &view->db,
+                            mapping + IMAGE_OFFSET, a.image_size);
+  if (hm_err != HM_SUCCESS) {
+    hm_shm_view_free(view);
+    return hm_err;
+  }
+
+  *view_ptr = view;
+  return HM_SUCCESS;
+}
+
+HM_PUBLIC_API
+hm_db_type_t HM_CDECL hm_shm_view_type(const hm_shm_view_t *view) {
+  return view->type;
+}
+
+HM_PUBLIC_API
+uint64_t HM_CDECL hm_shm_view_version(const hm_shm_view_t *view) {
+  return view->version;
+}
+
+HM_PUBLIC_API
+const void *HM_CDECL hm_shm_view_db(const hm_shm_view_t *view) {
+  return view->db;
+}
+
+HM_PUBLIC_API
+void HM_CDECL hm_shm_view_free(hm_shm_view_t *view) {
+  munmap(view->mapping, view->mapping_size);
+  free(view);
+}
+
+HM_PUBLIC_API
+void HM_CDECL hm_shm_subscriber_free(hm_shm_subscriber_t *subscriber) {
+  munmap((void *)subscriber->control, sizeof(control_t));
+  free(subscriber);
+}
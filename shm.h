@@ -0,0 +1,116 @@
+#ifndef HM_SHM_H
+#define HM_SHM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "common.h"
+#include "database.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Publishing of databases to other processes without copying.
+//
+// The publisher writes the image of a database (see hm_*_image_write) into a
+// memfd, seals it against any modification and announces it in a small POSIX
+// shared memory segment (the control segment) with the given name. The
+// announcement is protected by a sequence lock, so subscribers can poll the
+// version without any syscalls.
+//
+// A subscriber attaches to the current database by opening the memfd through
+// /proc/<pid>/fd/<fd> of the publisher and mapping it read-only. The database
+// is used in place: all processes share the same physical pages. A view stays
+// valid after the publisher publishes a new version or exits, because the
+// mapping holds a reference to the memfd. The subscriber needs permission to
+// access /proc/<pid>/fd of the publisher, i.e. the same user or root.
+//
+// When the publisher is freed or a new publisher replaces the segment, e.g.
+// after a restart, the old segment is marked closed and is never updated
+// again. Subscribers of it see HM_SHM_VERSION_CLOSED and HM_ERROR_CLOSED and
+// must call hm_shm_subscriber_open again to follow the new publisher.
+
+// HM_SHM_VERSION_CLOSED is the version of a closed segment.
+#define HM_SHM_VERSION_CLOSED UINT64_MAX
+
+struct hm_shm_publisher;
+
+// hm_shm_publisher_t publishes databases under some name.
+typedef struct hm_shm_publisher hm_shm_publisher_t;
+
+// hm_shm_publisher_create creates the control segment with the given name,
+// e.g. "/hipermap-drop". The segment is replaced if it exists and the old one
+// is marked closed.
+hm_error_t HM_CDECL hm_shm_publisher_create(hm_shm_publisher_t **publisher_ptr,
+                                            const char *name);
+
+// hm_shm_publish publishes a copy of the database of the given type.
+// The database can be freed after the call. Returns HM_ERROR_SYSTEM if some
+// syscall failed, errno has the reason.
+hm_error_t HM_CDECL hm_shm_publish(hm_shm_publisher_t *publisher,
+                                   hm_db_type_t type, const void *db);
+
+// hm_shm_publisher_version returns the version of the last published database
+// (1 for the first one) or 0 if nothing was published.
+uint64_t HM_CDECL hm_shm_publisher_version(const hm_shm_publisher_t *publisher);
+
+// hm_shm_publisher_free marks the control segment closed and removes it.
+// Views attached by subscribers stay valid.
+void HM_CDECL hm_shm_publisher_free(hm_shm_publisher_t *publisher);
+
+struct hm_shm_subscriber;
+
+// hm_shm_subscriber_t follows databases published under some name.
+typedef struct hm_shm_subscriber hm_shm_subscriber_t;
+
+struct hm_shm_view;
+
+// hm_shm_view_t is a mapped published database.
+typedef struct hm_shm_view hm_shm_view_t;
+
+// hm_shm_subscriber_open opens the control segment with the given name.
+// Returns HM_ERROR_BAD_VALUE if it was not created by hm_shm_publisher_create.
+hm_error_t HM_CDECL hm_shm_subscriber_open(hm_shm_subscriber_t **subscriber_ptr,
+                                           const char *name);
+
+// hm_shm_subscriber_version returns the version of the latest published
+// database, 0 if nothing was published yet or HM_SHM_VERSION_CLOSED if the
+// segment was closed by the publisher. It only reads shared memory, so it is
+// cheap enough to be called before every batch of lookups to find out if the
+// view should be replaced or the subscriber reopened.
+uint64_t HM_CDECL
+hm_shm_subscriber_version(const hm_shm_subscriber_t *subscriber);
+
+// hm_shm_attach maps the latest published database. Returns
+// HM_ERROR_NO_DATABASE if nothing was published or the publisher exited
+// without closing the segment, even in the middle of publishing, and
+// HM_ERROR_CLOSED if it closed the segment.
+// In both latter cases the subscriber should be opened again, which succeeds
+// once a new publisher is created.
+// The view can be stored in hm_handle_t (see handle.h) and freed by
+// hm_shm_view_free after hm_handle_swap returns it.
+hm_error_t HM_CDECL hm_shm_attach(hm_shm_subscriber_t *subscriber,
+                                  hm_shm_view_t **view_ptr);
+
+// hm_shm_view_type returns the type of the database.
+hm_db_type_t HM_CDECL hm_shm_view_type(const hm_shm_view_t *view);
+
+// hm_shm_view_version returns the version of the database.
+uint64_t HM_CDECL hm_shm_view_version(const hm_shm_view_t *view);
+
+// hm_shm_view_db returns the database. Cast it to hm_sm_database_t,
+// hm_u64_database_t or hm_u64map_database_t depending on the type.
+const void *HM_CDECL hm_shm_view_db(const hm_shm_view_t *view);
+
+// hm_shm_view_free unmaps the database.
+void HM_CDECL hm_shm_view_free(hm_shm_view_t *view);
+
+// hm_shm_subscriber_free closes the control segment. Views stay valid.
+void HM_CDECL hm_shm_subscriber_free(hm_shm_subscriber_t *subscriber);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif // HM_SHM_H
@@ -4,6 +4,10 @@
 #include <vector>
 
 extern "C" {
+#include "crc32c.h"
+#include "database.h"
+#include "dispatch.h"
+#include "format.h"
 #include "static_map.h"
 }
 
@@ -32,13 +36,34 @@ const size_t alignment = 8;
 // set for negative numbers in two’s complement. [Gie16]
 const uint32_t ip_xor = 1 << 31;
 
+struct hm_sm_kernels;
+
 typedef struct hm_sm_database {
   size_t list_size;
   uint32_t *hashtable;
   int32_t *max_ips;
   uint64_t *values;
+
+  // Lookup kernels selected for this CPU.
+  const hm_sm_kernels *kernels;
+
+  // Number of elements in max_ips and values. The sorted list of list_size
+  // elements is followed by copies of the segments of hot buckets, see
+  // place_hot_segments.
+  size_t scan_size;
+
+  // Hot buckets in the order of their segments.
+  uint32_t *hot_buckets;
+  size_t hot_count;
 } hm_sm_database_t;
 
+struct hm_sm_kernels {
+  size_t (*scan)(const hm_sm_database_t *db, size_t begin, int32_t ip);
+  uint64_t (*find)(const hm_sm_database_t *db, uint32_t ip);
+  void (*find_batch)(const hm_sm_database_t *db, const uint32_t *ips,
+                     uint64_t *values, size_t count);
+};
+
 struct hm_input_elem {
   uint32_t ip;
   uint8_t cidr_prefix;
@@ -64,52 +89,360 @@ static inline char *align8(char *addr) {
   return (char *)(((uintptr_t)(addr) & ~(alignment - 1)) + alignment);
 }
 
-static inline size_t list_size_to_db_place_size(size_t list_size) {
+static inline size_t layout_size(size_t scan_size, size_t hot_count) {
   return sizeof(hm_sm_database_t) + hm_hashtable_size_bytes +
-         hm_aligned_size(list_size) * sizeof(uint32_t) +
-         list_size * sizeof(uint64_t);
+         hm_aligned_size(scan_size) * sizeof(uint32_t) +
+         scan_size * sizeof(uint64_t) +
+         hm_aligned_size(hot_count) * sizeof(uint32_t);
+}
+
+static inline size_t list_size_to_db_place_size(size_t list_size) {
+  return layout_size(list_size, 0);
 }
 
-static inline hm_error_t list_size_to_serialized_size(size_t *out,
-                                                      size_t list_size) {
-  // Serialized form:
-  // uint64_t list_size
-  // list_size * uint32_t elements - max_ips.
-  // list_size * uint64_t elements - values.
-  // The order of bytes is host.
-  size_t res = 8 + list_size * (4 + 8);
+// Segment of bucket is the part of the sorted list scanned by lookups of IPs
+// of the bucket: from the hash table entry to the element where the scan for
+// the last IP of the bucket stops.
+static inline void bucket_segment(const int32_t *max_ips, size_t list_size,
+                                  uint32_t bucket, size_t *begin,
+                                  size_t *end) {
+  uint32_t first_ip = bucket << 16;
+  uint32_t last_ip = first_ip | 0xFFFF;
+  const int32_t *list_end = max_ips + list_size;
+  *begin = std::lower_bound(max_ips, list_end, int32_t(first_ip ^ ip_xor)) -
+           max_ips;
+  *end = std::lower_bound(max_ips + *begin, list_end,
+                          int32_t(last_ip ^ ip_xor)) -
+         max_ips;
+  // The last element is the largest int32, so it only matters for a list
+  // which is not sorted properly.
+  *end = std::min(*end, list_size - 1);
+  *begin = std::min(*begin, *end);
+}
 
-  // Check against overflow.
-  if ((res - 8) / (4 + 8) != list_size) {
-    return HM_ERROR_SMALL_PLACE;
+// hot_segments_size returns the number of elements in segments of buckets.
+// Segments of different buckets overlap in at most one element, so it does
+// not exceed list_size + hot_count.
+static inline size_t hot_segments_size(const int32_t *max_ips,
+                                       size_t list_size,
+                                       const uint32_t *hot_buckets,
+                                       size_t hot_count) {
+  size_t total = 0;
+  for (size_t i = 0; i < hot_count; i++) {
+    size_t begin, end;
+    bucket_segment(max_ips, list_size, hot_buckets[i], &begin, &end);
+    total += end - begin + 1;
   }
-
-  *out = res;
-  return HM_SUCCESS;
+  return total;
 }
 
+// fill_hashtable points each hash table entry to the first element of the
+// sorted list not less than the first IP of the bucket. It makes one pass
+// over the list instead of a binary search over the whole list for each
+// bucket: the entries do not decrease, so each search starts where the
+// previous one stopped and gallops forward. All buckets up to the one of the
+// found element point to it and are filled at once, so the number of searches
+// is the number of distinct buckets of the list. The list must be valid, see
+// valid_list.
 static inline void fill_hashtable(hm_sm_database_t *db) {
-  int32_t *db_ips_end = db->max_ips + db->list_size;
-  for (uint32_t hash = 0; hash <= hm_max_hash; hash++) {
-    uint32_t ip = hash << 16;
-    const int32_t *it =
-        std::lower_bound(db->max_ips, db_ips_end, int32_t(ip ^ ip_xor));
-    size_t index = it - db->max_ips;
-    db->hashtable[hash] = index;
+  const int32_t *it = db->max_ips;
+  const int32_t *db_ips_end = db->max_ips + db->list_size;
+  uint32_t hash = 0;
+  while (hash <= hm_max_hash) {
+    int32_t first_ip = int32_t((hash << 16) ^ ip_xor);
+    if (*it < first_ip) {
+      // it[step / 2] < first_ip, find the step after which it[step] is not.
+      size_t step = 1;
+      size_t left = db_ips_end - it;
+      while (step < left && it[step] < first_ip) {
+        step *= 2;
+      }
+      it = std::lower_bound(it + step / 2 + 1, it + std::min(step + 1, left),
+                            first_ip);
+    }
+    uint32_t last = (uint32_t(*it) ^ ip_xor) >> 16;
+    std::fill(db->hashtable + hash, db->hashtable + last + 1,
+              uint32_t(it - db->max_ips));
+    hash = last + 1;
+  }
+}
+
+// place_hot_segments copies segments of hot buckets after the sorted list, one
+// after another in the order of db->hot_buckets, and points their hash table
+// entries to the copies. A lookup in a hot bucket stays in the copy, because
+// the copy includes the element where the scan stops. This way the elements
+// and values of hot buckets share cache lines and pages. The hash table must
+// be filled before the call.
+static inline void place_hot_segments(hm_sm_database_t *db) {
+  size_t pos = db->list_size;
+  for (size_t i = 0; i < db->hot_count; i++) {
+    uint32_t bucket = db->hot_buckets[i];
+    size_t begin, end;
+    bucket_segment(db->max_ips, db->list_size, bucket, &begin, &end);
+    std::copy(db->max_ips + begin, db->max_ips + end + 1, db->max_ips + pos);
+    std::copy(db->values + begin, db->values + end + 1, db->values + pos);
+    db->hashtable[bucket] = pos;
+    pos += end - begin + 1;
+  }
+  assert(pos == db->scan_size);
+}
+
+// scan_* functions return the index of the first element of max_ips not less
+// than ip, starting from begin. The last element of the sorted list and of each
+// hot segment is not less than any IP of the bucket, so the scan always stops.
+// Vector kernels compare whole registers while they fit into max_ips and
+// finish with the portable loop.
+
+static inline size_t scan_portable(const hm_sm_database_t *db, size_t begin,
+                                   int32_t ip) {
+  const int32_t *it = db->max_ips + begin;
+
+  // Find the first IP in the list greater than the provided IP.
+  while (*it < ip) {
+    it++;
+  }
+
+  return it - db->max_ips;
+}
+
+#ifdef HM_X86
+HM_TARGET_SSE42 static inline size_t
+scan_sse42(const hm_sm_database_t *db, size_t begin, int32_t ip) {
+  __m128i needle = _mm_set1_epi32(ip);
+  for (; begin + 4 <= db->scan_size; begin += 4) {
+    __m128i chunk = _mm_loadu_si128((const __m128i *)(db->max_ips + begin));
+    // Bit i is set if max_ips[begin + i] < ip. Since max_ips is sorted, the
+    // set bits are the lowest ones.
+    unsigned int less =
+        _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(needle, chunk)));
+    if (less != 0xF) {
+      return begin + __builtin_ctz(~less);
+    }
+  }
+  return scan_portable(db, begin, ip);
+}
+
+HM_TARGET_AVX2 static inline size_t
+scan_avx2(const hm_sm_database_t *db, size_t begin, int32_t ip) {
+  __m256i needle = _mm256_set1_epi32(ip);
+  for (; begin + 8 <= db->scan_size; begin += 8) {
+    __m256i chunk =
+        _mm256_loadu_si256((const __m256i *)(db->max_ips + begin));
+    unsigned int less = _mm256_movemask_ps(
+        _mm256_castsi256_ps(_mm256_cmpgt_epi32(needle, chunk)));
+    if (less != 0xFF) {
+      return begin + _tzcnt_u32(~less);
+    }
+  }
+  return scan_portable(db, begin, ip);
+}
+
+HM_TARGET_AVX512 static inline size_t
+scan_avx512(const hm_sm_database_t *db, size_t begin, int32_t ip) {
+  __m512i needle = _mm512_set1_epi32(ip);
+  for (; begin + 16 <= db->scan_size; begin += 16) {
+    __m512i chunk = _mm512_loadu_si512(db->max_ips + begin);
+    unsigned int less = _mm512_cmplt_epi32_mask(chunk, needle);
+    if (less != 0xFFFF) {
+      return begin + _tzcnt_u32(~less);
+    }
+  }
+  return scan_avx2(db, begin, ip);
+}
+#endif
+
+// find_template uses the hash table to find /16 place in the sorted list and
+// scans from there.
+template <size_t (*scan)(const hm_sm_database_t *, size_t, int32_t)>
+static HM_ALWAYS_INLINE uint64_t find_template(const hm_sm_database_t *db,
+                                               uint32_t ip) {
+  size_t index = scan(db, db->hashtable[ip >> 16], int32_t(ip ^ ip_xor));
+  return db->values[index];
+}
+
+// find_batch_template looks up IPs block by block. Hash table entries of the
+// block are prefetched first, then the beginnings of their ranges, so cache
+// misses of the block overlap.
+template <size_t (*scan)(const hm_sm_database_t *, size_t, int32_t)>
+static HM_ALWAYS_INLINE void find_batch_template(const hm_sm_database_t *db,
+                                                 const uint32_t *ips,
+                                                 uint64_t *values,
+                                                 size_t count) {
+  uint32_t begins[HM_BATCH_BLOCK];
+  for (size_t start = 0; start < count; start += HM_BATCH_BLOCK) {
+    size_t n = std::min(count - start, size_t(HM_BATCH_BLOCK));
+    for (size_t i = 0; i < n; i++) {
+      __builtin_prefetch(db->hashtable + (ips[start + i] >> 16));
+    }
+    for (size_t i = 0; i < n; i++) {
+      begins[i] = db->hashtable[ips[start + i] >> 16];
+      __builtin_prefetch(db->max_ips + begins[i]);
+    }
+    for (size_t i = 0; i < n; i++) {
+      size_t index = scan(db, begins[i], int32_t(ips[start + i] ^ ip_xor));
+      values[start + i] = db->values[index];
+    }
+  }
+}
+
+static uint64_t find_portable(const hm_sm_database_t *db, uint32_t ip) {
+  return find_template<scan_portable>(db, ip);
+}
+
+static void find_batch_portable(const hm_sm_database_t *db,
+                                const uint32_t *ips, uint64_t *values,
+                                size_t count) {
+  find_batch_template<scan_portable>(db, ips, values, count);
+}
+
+static const hm_sm_kernels kernels_portable = {
+    .scan = scan_portable,
+    .find = find_portable,
+    .find_batch = find_batch_portable,
+};
+
+#ifdef HM_X86
+HM_TARGET_SSE42 static uint64_t find_sse42(const hm_sm_database_t *db,
+                                           uint32_t ip) {
+  return find_template<scan_sse42>(db, ip);
+}
+
+HM_TARGET_SSE42 static void find_batch_sse42(const hm_sm_database_t *db,
+                                             const uint32_t *ips,
+                                             uint64_t *values, size_t count) {
+  find_batch_template<scan_sse42>(db, ips, values, count);
+}
+
+HM_TARGET_AVX2 static uint64_t find_avx2(const hm_sm_database_t *db,
+                                         uint32_t ip) {
+  return find_template<scan_avx2>(db, ip);
+}
+
+HM_TARGET_AVX2 static void find_batch_avx2(const hm_sm_database_t *db,
+                                           const uint32_t *ips,
+                                           uint64_t *values, size_t count) {
+  find_batch_template<scan_avx2>(db, ips, values, count);
+}
+
+HM_TARGET_AVX512 static uint64_t find_avx512(const hm_sm_database_t *db,
+                                             uint32_t ip) {
+  return find_template<scan_avx512>(db, ip);
+}
+
+HM_TARGET_AVX512 static void find_batch_avx512(const hm_sm_database_t *db,
+                                               const uint32_t *ips,
+                                               uint64_t *values,
+                                               size_t count) {
+  find_batch_template<scan_avx512>(db, ips, values, count);
+}
+
+static const hm_sm_kernels kernels_sse42 = {
+    .scan = scan_sse42,
+    .find = find_sse42,
+    .find_batch = find_batch_sse42,
+};
+
+static const hm_sm_kernels kernels_avx2 = {
+    .scan = scan_avx2,
+    .find = find_avx2,
+    .find_batch = find_batch_avx2,
+};
+
+static const hm_sm_kernels kernels_avx512 = {
+    .scan = scan_avx512,
+    .find = find_avx512,
+    .find_batch = find_batch_avx512,
+};
+#endif
+
+// select_kernels returns the best kernels for the current CPU.
+static const hm_sm_kernels *select_kernels() {
+#ifdef HM_X86
+  switch (hm_kernel_level()) {
+  case HM_KERNEL_AVX512:
+    return &kernels_avx512;
+  case HM_KERNEL_AVX2:
+    return &kernels_avx2;
+  case HM_KERNEL_SSE42:
+    return &kernels_sse42;
+  default:
+    break;
+  }
+#endif
+  return &kernels_portable;
+}
+
+// locate sets pointers of db to the arrays starting at db_place. Normally they
+// follow the struct, but in a view they are in the image.
+static inline void locate(hm_sm_database_t *db, char *db_place,
+                          size_t list_size, size_t scan_size,
+                          size_t hot_count) {
+  db->list_size = list_size;
+  db->scan_size = scan_size;
+  db->hot_count = hot_count;
+  db->kernels = select_kernels();
+
+  db->hashtable = reinterpret_cast<uint32_t *>(db_place);
+  db_place += hm_hashtable_size_bytes;
+
+  db->max_ips = reinterpret_cast<int32_t *>(db_place);
+  db_place += hm_aligned_size(scan_size) * sizeof(uint32_t);
+
+  db->values = reinterpret_cast<uint64_t *>(db_place);
+  db_place += scan_size * sizeof(uint64_t);
+
+  db->hot_buckets = reinterpret_cast<uint32_t *>(db_place);
+}
+
+// choose_hot_buckets returns up to hot_buckets buckets with the largest
+// non-zero number of hits, the hottest first.
+static std::vector<uint32_t> choose_hot_buckets(const uint64_t *bucket_hits,
+                                                unsigned int hot_buckets) {
+  std::vector<uint32_t> hot;
+  if (bucket_hits == NULL) {
+    return hot;
+  }
+  for (uint32_t bucket = 0; bucket <= hm_max_hash; bucket++) {
+    if (bucket_hits[bucket] != 0) {
+      hot.push_back(bucket);
+    }
   }
+  size_t n = std::min(hot.size(), size_t(hot_buckets));
+  std::partial_sort(hot.begin(), hot.begin() + n, hot.end(),
+                    [bucket_hits](uint32_t a, uint32_t b) {
+                      if (bucket_hits[a] != bucket_hits[b]) {
+                        return bucket_hits[a] > bucket_hits[b];
+                      }
+                      return a < b;
+                    });
+  hot.resize(n);
+  return hot;
 }
 
 extern "C" HM_PUBLIC_API size_t HM_CDECL
 hm_sm_db_place_size(unsigned int elements) {
+  return hm_sm_db_place_size_with_profile(elements, 0);
+}
+
+extern "C" HM_PUBLIC_API size_t HM_CDECL
+hm_sm_db_place_size_with_profile(unsigned int elements,
+                                 unsigned int hot_buckets) {
   // +1 for 0.0.0.0 and +1 for 255.255.255.255.
-  size_t max_sorted_size = elements * 2 + 2;
-  return list_size_to_db_place_size(max_sorted_size) + alignment;
+  size_t max_sorted_size = size_t(elements) * 2 + 2;
+  size_t hot_count = std::min(hot_buckets, unsigned(HM_SM_BUCKETS));
+  size_t max_scan_size = max_sorted_size;
+  if (hot_count != 0) {
+    // See hot_segments_size.
+    max_scan_size += max_sorted_size + hot_count;
+  }
+  return layout_size(max_scan_size, hot_count) + alignment;
 }
 
-extern "C" HM_PUBLIC_API hm_error_t HM_CDECL
-hm_sm_compile(char *db_place, size_t db_place_size, hm_sm_database_t **db_ptr,
-              const uint32_t *ips, const uint8_t *cidr_prefixes,
-              const uint64_t *values, unsigned int elements) {
+static hm_error_t compile(char *db_place, size_t db_place_size,
+                          hm_sm_database_t **db_ptr, const uint32_t *ips,
+                          const uint8_t *cidr_prefixes, const uint64_t *values,
+                          unsigned int elements, const uint64_t *bucket_hits,
+                          unsigned int hot_buckets) {
   if (elements == 0) {
     return HM_ERROR_NO_MASKS;
   }
@@ -267,82 +600,394 @@ hm_sm_compile(char *db_place, size_t db_place_size, hm_sm_database_t **db_ptr,
     sorted[i].ip ^= ip_xor;
   }
 
-  hm_sm_database_t *db = reinterpret_cast<hm_sm_database_t *>(db_place);
-  *db_ptr = db;
-  db->list_size = sorted.size() - 1;
-  db_place += sizeof(hm_sm_database_t);
-
-  if (db_place_size < list_size_to_db_place_size(db->list_size)) {
-    return HM_ERROR_SMALL_PLACE;
+  size_t list_size = sorted.size() - 1;
+  std::vector<int32_t> max_ips(list_size);
+  for (int i = 0; i < list_size; i++) {
+    max_ips[i] = sorted[i + 1].ip - 1;
   }
 
-  db->hashtable = reinterpret_cast<uint32_t *>(db_place);
-  db_place += hm_hashtable_size_bytes;
+  std::vector<uint32_t> hot = choose_hot_buckets(bucket_hits, hot_buckets);
+  size_t scan_size = list_size + hot_segments_size(max_ips.data(), list_size,
+                                                   hot.data(), hot.size());
 
-  db->max_ips = reinterpret_cast<int32_t *>(db_place);
-  db_place += hm_aligned_size(sorted.size() - 1) * sizeof(uint32_t);
+  if (db_place_size < layout_size(scan_size, hot.size())) {
+    return HM_ERROR_SMALL_PLACE;
+  }
 
-  db->values = reinterpret_cast<uint64_t *>(db_place);
+  hm_sm_database_t *db = reinterpret_cast<hm_sm_database_t *>(db_place);
+  *db_ptr = db;
+  locate(db, db_place + sizeof(hm_sm_database_t), list_size, scan_size,
+         hot.size());
 
-  for (int i = 0; i < sorted.size() - 1; i++) {
-    db->max_ips[i] = sorted[i + 1].ip - 1;
+  for (int i = 0; i < list_size; i++) {
+    db->max_ips[i] = max_ips[i];
     db->values[i] = sorted[i].value;
   }
+  std::copy(hot.begin(), hot.end(), db->hot_buckets);
 
   fill_hashtable(db);
+  place_hot_segments(db);
 
   return HM_SUCCESS;
 }
 
+extern "C" HM_PUBLIC_API hm_error_t HM_CDECL
+hm_sm_compile(char *db_place, size_t db_place_size, hm_sm_database_t **db_ptr,
+              const uint32_t *ips, const uint8_t *cidr_prefixes,
+              const uint64_t *values, unsigned int elements) {
+  return compile(db_place, db_place_size, db_ptr, ips, cidr_prefixes, values,
+                 elements, NULL, 0);
+}
+
+extern "C" HM_PUBLIC_API hm_error_t HM_CDECL hm_sm_compile_with_profile(
+    char *db_place, size_t db_place_size, hm_sm_database_t **db_ptr,
+    const uint32_t *ips, const uint8_t *cidr_prefixes, const uint64_t *values,
+    unsigned int elements, const uint64_t *bucket_hits,
+    unsigned int hot_buckets) {
+  return compile(db_place, db_place_size, db_ptr, ips, cidr_prefixes, values,
+                 elements, bucket_hits, hot_buckets);
+}
+
 extern "C" HM_PUBLIC_API uint64_t HM_CDECL
-hm_sm_find(const hm_sm_database_t *db, const uint32_t ip0) {
-  // Use the hash table to find /16 place in the sorted list and use binary
-  // search inside it.
-  uint32_t begin = db->hashtable[ip0 >> 16];
+hm_sm_find(const hm_sm_database_t *db, const uint32_t ip) {
+  return db->kernels->find(db, ip);
+}
 
-  int32_t ip = ip0 ^ ip_xor;
+extern "C" HM_PUBLIC_API void HM_CDECL
+hm_sm_find_batch(const hm_sm_database_t *db, const uint32_t *ips,
+                 uint64_t *values, size_t count) {
+  db->kernels->find_batch(db, ips, values, count);
+}
 
-  const int32_t *it = db->max_ips + begin;
+extern "C" HM_PUBLIC_API void HM_CDECL hm_sm_view(const hm_sm_database_t *db,
+                                                  hm_sm_view_t *view) {
+  *view = hm_sm_view_t{
+      .hashtable = db->hashtable,
+      .max_ips = db->max_ips,
+      .values = db->values,
+      .scan_size = db->scan_size,
+  };
+}
 
-  // Find the first IP in the list greater than the provided IP.
-  while (*it < ip) {
-    it++;
+typedef struct hm_sm_profiler {
+  // Ring buffer of samples, see pack_sample.
+  uint64_t *samples;
+
+  uint32_t capacity;
+  uint32_t sample_rate;
+
+  // Number of lookups left before the next sample.
+  uint32_t countdown;
+
+  // Number of samples ever written. Only the last capacity of them are kept.
+  // It is read by exporting threads, so it is accessed atomically.
+  uint64_t written;
+} hm_sm_profiler_t;
+
+// A sample takes 64 bits: /16 bucket, scan length (saturated) and range index.
+static inline uint64_t pack_sample(uint32_t bucket, size_t scan,
+                                   size_t index) {
+  uint64_t scan16 = std::min(scan, size_t(0xFFFF));
+  uint64_t index32 = std::min(index, size_t(0xFFFFFFFF));
+  return (uint64_t(bucket) << 48) | (scan16 << 32) | index32;
+}
+
+extern "C" HM_PUBLIC_API hm_error_t HM_CDECL
+hm_sm_profiler_place_size(size_t *profiler_place_size, unsigned int capacity) {
+  if (capacity == 0) {
+    return HM_ERROR_BAD_SIZE;
+  }
+
+  *profiler_place_size = sizeof(hm_sm_profiler_t) +
+                         size_t(capacity) * sizeof(uint64_t) + alignment;
+
+  return HM_SUCCESS;
+}
+
+extern "C" HM_PUBLIC_API hm_error_t HM_CDECL hm_sm_profiler_init(
+    char *profiler_place, size_t profiler_place_size,
+    hm_sm_profiler_t **profiler_ptr, unsigned int capacity,
+    unsigned int sample_rate) {
+  if (sample_rate == 0) {
+    return HM_ERROR_BAD_VALUE;
+  }
+
+  size_t want_place_size;
+  hm_error_t hm_err = hm_sm_profiler_place_size(&want_place_size, capacity);
+  if (hm_err != HM_SUCCESS) {
+    return hm_err;
+  }
+  if (profiler_place_size < want_place_size) {
+    return HM_ERROR_SMALL_PLACE;
+  }
+
+  // Align profiler_place forward, if needed.
+  profiler_place = align8(profiler_place);
+
+  hm_sm_profiler_t *profiler =
+      reinterpret_cast<hm_sm_profiler_t *>(profiler_place);
+  profiler->samples =
+      reinterpret_cast<uint64_t *>(profiler_place + sizeof(hm_sm_profiler_t));
+  profiler->capacity = capacity;
+  profiler->sample_rate = sample_rate;
+  profiler->countdown = sample_rate;
+  profiler->written = 0;
+
+  *profiler_ptr = profiler;
+
+  return HM_SUCCESS;
+}
+
+extern "C" HM_PUBLIC_API void HM_CDECL
+hm_sm_profiler_reset(hm_sm_profiler_t *profiler) {
+  profiler->countdown = profiler->sample_rate;
+  __atomic_store_n(&profiler->written, 0, __ATOMIC_RELEASE);
+}
+
+extern "C" HM_PUBLIC_API uint64_t HM_CDECL
+hm_sm_find_sampled(const hm_sm_database_t *db, hm_sm_profiler_t *profiler,
+                   const uint32_t ip) {
+  if (--profiler->countdown != 0) {
+    return db->kernels->find(db, ip);
   }
+  profiler->countdown = profiler->sample_rate;
+
+  uint32_t bucket = ip >> 16;
+  size_t begin = db->hashtable[bucket];
+  size_t index = db->kernels->scan(db, begin, int32_t(ip ^ ip_xor));
 
-  size_t index = it - db->max_ips;
+  // Only this thread writes the profiler, so a plain read of written is fine.
+  // Exporters see the sample after the release store of the counter.
+  uint64_t written = profiler->written;
+  __atomic_store_n(&profiler->samples[written % profiler->capacity],
+                   pack_sample(bucket, index - begin + 1, index),
+                   __ATOMIC_RELAXED);
+  __atomic_store_n(&profiler->written, written + 1, __ATOMIC_RELEASE);
 
   return db->values[index];
 }
 
+extern "C" HM_PUBLIC_API hm_error_t HM_CDECL hm_sm_profile_export(
+    const hm_sm_database_t *db, const hm_sm_profiler_t *const *profilers,
+    size_t profilers_count, hm_sm_bucket_profile_t *buckets,
+    uint64_t *range_hits, size_t range_hits_size) {
+  if (range_hits != NULL && range_hits_size < db->list_size) {
+    return HM_ERROR_SMALL_PLACE;
+  }
+
+  std::fill(buckets, buckets + HM_SM_BUCKETS, hm_sm_bucket_profile_t{});
+  if (range_hits != NULL) {
+    std::fill(range_hits, range_hits + db->list_size, 0);
+  }
+
+  for (size_t p = 0; p < profilers_count; p++) {
+    const hm_sm_profiler_t *profiler = profilers[p];
+    uint64_t written = __atomic_load_n(&profiler->written, __ATOMIC_ACQUIRE);
+    uint64_t n = std::min(written, uint64_t(profiler->capacity));
+    for (uint64_t i = 0; i < n; i++) {
+      // If the owner wraps around the buffer while we read it, some samples
+      // are replaced by newer ones. Each sample is still consistent.
+      uint64_t sample =
+          __atomic_load_n(&profiler->samples[i], __ATOMIC_RELAXED);
+      uint32_t bucket = sample >> 48;
+      uint64_t scan = (sample >> 32) & 0xFFFF;
+      uint64_t index = sample & 0xFFFFFFFF;
+      if (index >= db->scan_size) {
+        continue;
+      }
+      if (index >= db->list_size) {
+        // Copy in a hot segment. Ends of ranges are unique in the sorted list,
+        // so the original range is found by its end.
+        index = std::lower_bound(db->max_ips, db->max_ips + db->list_size,
+                                 db->max_ips[index]) -
+                db->max_ips;
+      }
+
+      hm_sm_bucket_profile_t *b = &buckets[bucket];
+      b->samples++;
+      b->scan_total += scan;
+      b->max_scan = std::max(b->max_scan, scan);
+      if (range_hits != NULL) {
+        range_hits[index]++;
+      }
+    }
+  }
+
+  return HM_SUCCESS;
+}
+
+extern "C" HM_PUBLIC_API void HM_CDECL hm_sm_stats(const hm_sm_database_t *db,
+                                                   hm_sm_stats_t *stats) {
+  *stats = hm_sm_stats_t{};
+  stats->list_size = db->list_size;
+
+  for (uint32_t hash = 0; hash <= hm_max_hash; hash++) {
+    // The longest scan in a bucket is the one for its last IP.
+    size_t begin, end;
+    bucket_segment(db->max_ips, db->list_size, hash, &begin, &end);
+    size_t scan = end - begin + 1;
+    stats->longest_scan = std::max(stats->longest_scan, scan);
+    size_t bin = std::min(scan, size_t(HM_SM_SCAN_HISTOGRAM_SIZE)) - 1;
+    stats->scan_histogram[bin]++;
+  }
+
+  stats->hot_buckets = db->hot_count;
+  stats->hot_list_size = db->scan_size - db->list_size;
+
+  stats->header_bytes = sizeof(hm_sm_database_t);
+  stats->hashtable_bytes = hm_hashtable_size_bytes;
+  stats->max_ips_bytes = hm_aligned_size(db->scan_size) * sizeof(uint32_t);
+  stats->values_bytes = db->scan_size * sizeof(uint64_t);
+  stats->hot_buckets_bytes = hm_aligned_size(db->hot_count) * sizeof(uint32_t);
+  stats->total_bytes = stats->header_bytes + stats->hashtable_bytes +
+                       stats->max_ips_bytes + stats->values_bytes +
+                       stats->hot_buckets_bytes;
+  assert(stats->total_bytes == layout_size(db->scan_size, db->hot_count));
+}
+
+// Serialized form: header (see format.h), then payload:
+// uint64_t list_size
+// uint64_t hot_count
+// list_size * uint32_t elements - max_ips, padded to even number.
+// list_size * uint64_t elements - values.
+// hot_count * uint32_t elements - hot buckets, hottest first.
+static const size_t payload_header_size = 2 * sizeof(uint64_t);
+
+static inline hm_error_t serialized_payload_size(size_t *out,
+                                                 uint64_t list_size,
+                                                 uint64_t hot_count) {
+  // The hash table stores indices as uint32, so larger lists are invalid.
+  // The limits also protect the computation against overflow.
+  if (list_size > UINT32_MAX || hot_count > HM_SM_BUCKETS) {
+    return HM_ERROR_BAD_SIZE;
+  }
+  uint64_t res = payload_header_size +
+                 (list_size + (list_size & 1)) * sizeof(uint32_t) +
+                 list_size * sizeof(uint64_t) + hot_count * sizeof(uint32_t);
+  if (res > SIZE_MAX) {
+    return HM_ERROR_BAD_SIZE;
+  }
+
+  *out = res;
+  return HM_SUCCESS;
+}
+
+// read_serialized checks the serialized db and returns its payload and sizes.
+static hm_error_t read_serialized(const char *buffer, size_t buffer_size,
+                                  bool check_payload, const char **payload,
+                                  uint64_t *list_size, uint64_t *hot_count) {
+  size_t payload_size;
+  hm_error_t hm_err =
+      hm_format_read_header(buffer, buffer_size, HM_DB_SM, check_payload,
+                            payload, &payload_size);
+  if (hm_err != HM_SUCCESS) {
+    return hm_err;
+  }
+  if (payload_size < payload_header_size) {
+    return HM_ERROR_BAD_SIZE;
+  }
+
+  *list_size = hm_load_le64(*payload);
+  *hot_count = hm_load_le64(*payload + sizeof(uint64_t));
+  if (*list_size == 0) {
+    return HM_ERROR_NO_MASKS;
+  }
+  size_t want_payload_size;
+  hm_err = serialized_payload_size(&want_payload_size, *list_size, *hot_count);
+  if (hm_err != HM_SUCCESS) {
+    return hm_err;
+  }
+  if (payload_size != want_payload_size) {
+    return HM_ERROR_BAD_SIZE;
+  }
+
+  return HM_SUCCESS;
+}
+
+// check_hot_buckets checks that hot buckets loaded from a buffer are valid
+// and unique.
+static hm_error_t check_hot_buckets(const std::vector<uint32_t> &hot_buckets) {
+  std::vector<bool> seen(HM_SM_BUCKETS);
+  for (uint32_t bucket : hot_buckets) {
+    if (bucket > hm_max_hash || seen[bucket]) {
+      return HM_ERROR_BAD_VALUE;
+    }
+    seen[bucket] = true;
+  }
+  return HM_SUCCESS;
+}
+
+// load_hot_buckets loads and validates the serialized list of hot buckets.
+static hm_error_t load_hot_buckets(const char *src, size_t hot_count,
+                                   std::vector<uint32_t> &hot_buckets) {
+  hot_buckets.resize(hot_count);
+  if (hot_count == 0) {
+    return HM_SUCCESS;
+  }
+  hm_load_le32_array(hot_buckets.data(), src, hot_count);
+  return check_hot_buckets(hot_buckets);
+}
+
+// serialized_scan_size returns scan_size of the serialized database.
+static size_t serialized_scan_size(const char *max_ips_src, size_t list_size,
+                                   const std::vector<uint32_t> &hot_buckets) {
+  if (hot_buckets.empty()) {
+    return list_size;
+  }
+  std::vector<int32_t> max_ips(list_size);
+  hm_load_le32_array(reinterpret_cast<uint32_t *>(max_ips.data()),
+                     max_ips_src, list_size);
+  return list_size + hot_segments_size(max_ips.data(), list_size,
+                                       hot_buckets.data(), hot_buckets.size());
+}
+
+// valid_list checks that the sorted list loaded from a buffer is sorted and
+// ends with the largest element, so scans stop inside the list.
+static bool valid_list(const int32_t *max_ips, size_t list_size) {
+  for (size_t i = 1; i < list_size; i++) {
+    if (max_ips[i - 1] > max_ips[i]) {
+      return false;
+    }
+  }
+  return max_ips[list_size - 1] == INT32_MAX;
+}
+
 extern "C" HM_PUBLIC_API size_t HM_CDECL
 hm_sm_serialized_size(const hm_sm_database_t *db) {
-  size_t want_buffer_size;
+  size_t payload_size;
   hm_error_t hm_err =
-      list_size_to_serialized_size(&want_buffer_size, db->list_size);
+      serialized_payload_size(&payload_size, db->list_size, db->hot_count);
   assert(hm_err == HM_SUCCESS);
-  return want_buffer_size;
+  return HM_FORMAT_HEADER_SIZE + payload_size;
 }
 
 extern "C" HM_PUBLIC_API hm_error_t HM_CDECL
 hm_sm_serialize(char *buffer, size_t buffer_size, const hm_sm_database_t *db) {
-  if (buffer_size < hm_sm_serialized_size(db)) {
+  size_t serialized_size = hm_sm_serialized_size(db);
+  if (buffer_size < serialized_size) {
     return HM_ERROR_SMALL_PLACE;
   }
 
-  uint64_t *list_size = reinterpret_cast<uint64_t *>(buffer);
-  *list_size = db->list_size;
-  buffer += sizeof(uint64_t);
-
-  uint32_t *max_ips = reinterpret_cast<uint32_t *>(buffer);
-  for (int i = 0; i < db->list_size; i++) {
-    max_ips[i] = db->max_ips[i];
+  char *payload = buffer + HM_FORMAT_HEADER_SIZE;
+  hm_store_le64(payload, db->list_size);
+  hm_store_le64(payload + sizeof(uint64_t), db->hot_count);
+  char *dst = payload + payload_header_size;
+
+  hm_store_le32_array(dst, reinterpret_cast<const uint32_t *>(db->max_ips),
+                      db->list_size);
+  dst += sizeof(uint32_t) * db->list_size;
+  if (db->list_size & 1) {
+    hm_store_le32(dst, 0);
+    dst += sizeof(uint32_t);
   }
-  buffer += sizeof(uint32_t) * db->list_size;
 
-  uint64_t *values = reinterpret_cast<uint64_t *>(buffer);
-  for (int i = 0; i < db->list_size; i++) {
-    values[i] = db->values[i];
-  }
+  hm_store_le64_array(dst, db->values, db->list_size);
+  dst += sizeof(uint64_t) * db->list_size;
+
+  hm_store_le32_array(dst, db->hot_buckets, db->hot_count);
+
+  hm_format_write_header(buffer, HM_DB_SM,
+                         serialized_size - HM_FORMAT_HEADER_SIZE);
 
   return HM_SUCCESS;
 }
@@ -350,26 +995,25 @@ hm_sm_serialize(char *buffer, size_t buffer_size, const hm_sm_database_t *db) {
 extern "C" HM_PUBLIC_API hm_error_t HM_CDECL
 hm_sm_db_place_size_from_serialized(size_t *db_place_size, const char *buffer,
                                     size_t buffer_size) {
-  if (buffer_size < sizeof(uint64_t)) {
-    return HM_ERROR_SMALL_PLACE;
-  }
-
-  const uint64_t *list_size = reinterpret_cast<const uint64_t *>(buffer);
-  size_t want_buffer_size;
-  hm_error_t hm_err =
-      list_size_to_serialized_size(&want_buffer_size, *list_size);
+  const char *payload;
+  uint64_t list_size, hot_count;
+  hm_error_t hm_err = read_serialized(buffer, buffer_size, false, &payload,
+                                      &list_size, &hot_count);
   if (hm_err != HM_SUCCESS) {
     return hm_err;
   }
-  if (buffer_size < want_buffer_size) {
-    return HM_ERROR_SMALL_PLACE;
-  }
 
-  if (*list_size == 0) {
-    return HM_ERROR_NO_MASKS;
+  const char *max_ips = payload + payload_header_size;
+  const char *values = max_ips + hm_aligned_size(list_size) * sizeof(uint32_t);
+  const char *hot_src = values + list_size * sizeof(uint64_t);
+  std::vector<uint32_t> hot_buckets;
+  hm_err = load_hot_buckets(hot_src, hot_count, hot_buckets);
+  if (hm_err != HM_SUCCESS) {
+    return hm_err;
   }
+  size_t scan_size = serialized_scan_size(max_ips, list_size, hot_buckets);
 
-  *db_place_size = list_size_to_db_place_size(*list_size) + alignment;
+  *db_place_size = layout_size(scan_size, hot_count) + alignment;
 
   return HM_SUCCESS;
 }
@@ -377,24 +1021,32 @@ hm_sm_db_place_size_from_serialized(size_t *db_place_size, const char *buffer,
 extern "C" HM_PUBLIC_API hm_error_t HM_CDECL hm_sm_deserialize(
     char *db_place, size_t db_place_size, hm_sm_database_t **db_ptr,
     const char *buffer, size_t buffer_size) {
-  if (buffer_size < sizeof(uint64_t)) {
-    return HM_ERROR_SMALL_PLACE;
-  }
+  return hm_sm_deserialize_ex(db_place, db_place_size, db_ptr, buffer,
+                              buffer_size, NULL);
+}
 
-  const uint64_t *list_size = reinterpret_cast<const uint64_t *>(buffer);
-  size_t want_buffer_size;
-  hm_error_t hm_err =
-      list_size_to_serialized_size(&want_buffer_size, *list_size);
+extern "C" HM_PUBLIC_API hm_error_t HM_CDECL hm_sm_deserialize_ex(
+    char *db_place, size_t db_place_size, hm_sm_database_t **db_ptr,
+    const char *buffer, size_t buffer_size, const hm_load_options_t *options) {
+  const char *payload;
+  uint64_t list_size, hot_count;
+  hm_error_t hm_err = read_serialized(buffer, buffer_size, false, &payload,
+                                      &list_size, &hot_count);
   if (hm_err != HM_SUCCESS) {
     return hm_err;
   }
-  if (buffer_size < want_buffer_size) {
-    return HM_ERROR_SMALL_PLACE;
-  }
 
-  if (*list_size == 0) {
-    return HM_ERROR_NO_MASKS;
+  // Now locate max_ips, values and hot buckets in the payload.
+  const char *max_ips = payload + payload_header_size;
+  const char *values = max_ips + hm_aligned_size(list_size) * sizeof(uint32_t);
+  const char *hot_src = values + list_size * sizeof(uint64_t);
+
+  std::vector<uint32_t> hot_buckets;
+  hm_err = load_hot_buckets(hot_src, hot_count, hot_buckets);
+  if (hm_err != HM_SUCCESS) {
+    return hm_err;
   }
+  size_t scan_size = serialized_scan_size(max_ips, list_size, hot_buckets);
 
   // Align db_place forward, if needed.
   {
@@ -403,39 +1055,800 @@ extern "C" HM_PUBLIC_API hm_error_t HM_CDECL hm_sm_deserialize(
     db_place = db_place2;
   }
 
-  if (db_place_size < list_size_to_db_place_size(*list_size)) {
+  if (db_place_size < layout_size(scan_size, hot_count)) {
     return HM_ERROR_SMALL_PLACE;
   }
 
   // Locate max_ips and values in the db_place.
   hm_sm_database_t *db = reinterpret_cast<hm_sm_database_t *>(db_place);
   *db_ptr = db;
-  db->list_size = *list_size;
-  db_place += sizeof(hm_sm_database_t);
+  locate(db, db_place + sizeof(hm_sm_database_t), list_size, scan_size,
+         hot_count);
+
+  // Copy the list, checksumming the payload on the way. max_ips are copied
+  // with the padding, which fits before the hot segments.
+  uint32_t crc = hm_crc32c(0, payload, payload_header_size);
+  hm_load_array(db->max_ips, max_ips, hm_aligned_size(list_size),
+                sizeof(uint32_t), options, &crc);
+  hm_load_array(db->values, values, list_size, sizeof(uint64_t), options,
+                &crc);
+  crc = hm_crc32c(crc, hot_src, hot_count * sizeof(uint32_t));
+  hm_err = hm_format_check_crc(buffer, crc);
+  if (hm_err != HM_SUCCESS) {
+    return hm_err;
+  }
+  std::copy(hot_buckets.begin(), hot_buckets.end(), db->hot_buckets);
 
-  db->hashtable = reinterpret_cast<uint32_t *>(db_place);
-  db_place += hm_hashtable_size_bytes;
+  if (!valid_list(db->max_ips, list_size)) {
+    return HM_ERROR_BAD_FORMAT;
+  }
 
-  db->max_ips = reinterpret_cast<int32_t *>(db_place);
-  db_place += hm_aligned_size(*list_size) * sizeof(uint32_t);
+  fill_hashtable(db);
+  place_hot_segments(db);
 
-  db->values = reinterpret_cast<uint64_t *>(db_place);
+  return hm_load_lock(db_place, layout_size(scan_size, hot_count), options);
+}
 
-  // Now locate max_ips and values in the buffer.
-  buffer += sizeof(uint64_t);
-  const uint32_t *max_ips = reinterpret_cast<const uint32_t *>(buffer);
-  buffer += sizeof(uint32_t) * (*list_size);
-  const uint64_t *values = reinterpret_cast<const uint64_t *>(buffer);
+// read_serialized_fd reads and checks the header and the payload header of
+// the db serialized to fd, unless they are in header already. crc is started
+// with the payload header.
+static hm_error_t read_serialized_fd(int fd, hm_fd_header_t *header,
+                                     uint64_t *list_size, uint64_t *hot_count,
+                                     uint32_t *crc) {
+  size_t payload_size;
+  hm_error_t hm_err =
+      hm_format_read_start_fd(fd, HM_DB_SM, header, payload_header_size,
+                              &payload_size, crc);
+  if (hm_err != HM_SUCCESS) {
+    return hm_err;
+  }
 
-  // Copy the values.
-  for (int i = 0; i < *list_size; i++) {
-    db->max_ips[i] = max_ips[i];
+  uint64_t payload_header[2];
+  hm_load_le64_array(payload_header, header->data + HM_FORMAT_HEADER_SIZE, 2);
+  *list_size = payload_header[0];
+  *hot_count = payload_header[1];
+  if (*list_size == 0) {
+    return HM_ERROR_NO_MASKS;
+  }
+  size_t want_payload_size;
+  hm_err = serialized_payload_size(&want_payload_size, *list_size, *hot_count);
+  if (hm_err != HM_SUCCESS) {
+    return hm_err;
+  }
+  if (payload_size != want_payload_size) {
+    return HM_ERROR_BAD_SIZE;
+  }
+
+  return HM_SUCCESS;
+}
+
+extern "C" HM_PUBLIC_API hm_error_t HM_CDECL
+hm_sm_serialize_fd(int fd, const hm_sm_database_t *db) {
+  uint64_t payload_header[2] = {db->list_size, db->hot_count};
+  uint32_t padding = 0;
+  hm_format_segment_t segments[] = {
+      {payload_header, 2, sizeof(uint64_t)},
+      {db->max_ips, db->list_size, sizeof(uint32_t)},
+      {&padding, db->list_size & 1, sizeof(uint32_t)},
+      {db->values, db->list_size, sizeof(uint64_t)},
+      {db->hot_buckets, db->hot_count, sizeof(uint32_t)},
+  };
+  return hm_format_write_fd(fd, HM_DB_SM, segments, 5);
+}
+
+extern "C" HM_PUBLIC_API hm_error_t HM_CDECL
+hm_sm_db_place_size_from_fd(size_t *db_place_size, hm_fd_header_t *header,
+                            int fd) {
+  uint64_t list_size, hot_count;
+  uint32_t crc;
+  hm_error_t hm_err =
+      read_serialized_fd(fd, header, &list_size, &hot_count, &crc);
+  if (hm_err != HM_SUCCESS) {
+    return hm_err;
+  }
+
+  // scan_size depends on the whole list, use its upper bound, see
+  // hot_segments_size.
+  size_t max_scan_size = list_size;
+  if (hot_count != 0) {
+    max_scan_size += list_size + hot_count;
+  }
+  *db_place_size = layout_size(max_scan_size, hot_count) + alignment;
+
+  return HM_SUCCESS;
+}
+
+extern "C" HM_PUBLIC_API hm_error_t HM_CDECL
+hm_sm_deserialize_fd(char *db_place, size_t db_place_size,
+                     hm_sm_database_t **db_ptr, hm_fd_header_t *header,
+                     int fd) {
+  uint64_t list_size, hot_count;
+  uint32_t crc;
+  hm_error_t hm_err =
+      read_serialized_fd(fd, header, &list_size, &hot_count, &crc);
+  if (hm_err != HM_SUCCESS) {
+    return hm_err;
+  }
+
+  // Align db_place forward, if needed.
+  {
+    char *db_place2 = align8(db_place);
+    db_place_size -= (db_place2 - db_place);
+    db_place = db_place2;
+  }
+
+  // max_ips start right after the hash table whatever scan_size is. The
+  // values are read right after them, where they are if there are no hot
+  // segments, and moved to their place when hot buckets following them in
+  // the stream give scan_size.
+  if (db_place_size < layout_size(list_size, hot_count)) {
+    return HM_ERROR_SMALL_PLACE;
+  }
+  int32_t *max_ips = reinterpret_cast<int32_t *>(
+      db_place + sizeof(hm_sm_database_t) + hm_hashtable_size_bytes);
+  hm_err = hm_format_read_fd(fd, max_ips, hm_aligned_size(list_size),
+                             sizeof(uint32_t), &crc);
+  if (hm_err != HM_SUCCESS) {
+    return hm_err;
+  }
+  uint64_t *values =
+      reinterpret_cast<uint64_t *>(max_ips + hm_aligned_size(list_size));
+  hm_err = hm_format_read_fd(fd, values, list_size, sizeof(uint64_t), &crc);
+  if (hm_err != HM_SUCCESS) {
+    return hm_err;
+  }
+  std::vector<char> hot_src(hot_count * sizeof(uint32_t));
+  if (hot_count != 0) {
+    hm_err = hm_format_read_all(fd, hot_src.data(), hot_src.size());
+    if (hm_err != HM_SUCCESS) {
+      return hm_err;
+    }
+    crc = hm_crc32c(crc, hot_src.data(), hot_src.size());
+  }
+  hm_err = hm_format_check_crc(header->data, crc);
+  if (hm_err != HM_SUCCESS) {
+    return hm_err;
+  }
+  std::vector<uint32_t> hot_buckets;
+  hm_err = load_hot_buckets(hot_src.data(), hot_count, hot_buckets);
+  if (hm_err != HM_SUCCESS) {
+    return hm_err;
+  }
+
+  size_t scan_size = list_size + hot_segments_size(max_ips, list_size,
+                                                   hot_buckets.data(),
+                                                   hot_count);
+  if (db_place_size < layout_size(scan_size, hot_count)) {
+    return HM_ERROR_SMALL_PLACE;
+  }
+
+  hm_sm_database_t *db = reinterpret_cast<hm_sm_database_t *>(db_place);
+  *db_ptr = db;
+  locate(db, db_place + sizeof(hm_sm_database_t), list_size, scan_size,
+         hot_count);
+  memmove(db->values, values, list_size * sizeof(uint64_t));
+  std::copy(hot_buckets.begin(), hot_buckets.end(), db->hot_buckets);
+
+  if (!valid_list(db->max_ips, list_size)) {
+    return HM_ERROR_BAD_FORMAT;
+  }
+
+  fill_hashtable(db);
+  place_hot_segments(db);
+
+  return HM_SUCCESS;
+}
+
+// Packed form: header (see format.h), then payload of varints:
+// list_size
+// hot_count
+// hot_count hot buckets, hottest first.
+// list_size deltas between consecutive max_ips as unsigned IPs, from 0.
+// list_size values plus 1, so HM_NO_VALUE takes one byte.
+// Hot buckets go first, so unpacking knows scan_size before the list.
+
+// Max sizes of varints encoding a bucket and an IP.
+static const size_t bucket_varint_max_size = 3;
+static const size_t ip_varint_max_size = 5;
+
+extern "C" HM_PUBLIC_API size_t HM_CDECL
+hm_sm_packed_max_size(const hm_sm_database_t *db) {
+  return HM_FORMAT_HEADER_SIZE + 2 * HM_VARINT_MAX_SIZE +
+         db->hot_count * bucket_varint_max_size +
+         db->list_size * (ip_varint_max_size + HM_VARINT_MAX_SIZE);
+}
+
+extern "C" HM_PUBLIC_API hm_error_t HM_CDECL
+hm_sm_pack(char *buffer, size_t buffer_size, const hm_sm_database_t *db,
+           size_t *packed_size) {
+  if (buffer_size < hm_sm_packed_max_size(db)) {
+    return HM_ERROR_SMALL_PLACE;
+  }
+
+  char *dst = buffer + HM_FORMAT_HEADER_SIZE;
+  dst += hm_store_varint(dst, db->list_size);
+  dst += hm_store_varint(dst, db->hot_count);
+  for (size_t i = 0; i < db->hot_count; i++) {
+    dst += hm_store_varint(dst, db->hot_buckets[i]);
+  }
+  uint32_t prev_ip = 0;
+  for (size_t i = 0; i < db->list_size; i++) {
+    uint32_t ip = uint32_t(db->max_ips[i]) ^ ip_xor;
+    dst += hm_store_varint(dst, ip - prev_ip);
+    prev_ip = ip;
+  }
+  for (size_t i = 0; i < db->list_size; i++) {
+    dst += hm_store_varint(dst, db->values[i] + 1);
+  }
+
+  *packed_size = dst - buffer;
+  hm_format_write_header(buffer, HM_DB_SM | HM_FORMAT_PACKED,
+                         *packed_size - HM_FORMAT_HEADER_SIZE);
+
+  return HM_SUCCESS;
+}
+
+// read_packed checks the packed db, reads its sizes and hot buckets and
+// leaves src at the beginning of the list.
+static hm_error_t read_packed(const char *buffer, size_t buffer_size,
+                              bool check_payload, const char **src,
+                              const char **end, uint64_t *list_size,
+                              std::vector<uint32_t> &hot_buckets) {
+  const char *payload;
+  size_t payload_size;
+  hm_error_t hm_err = hm_format_read_header(
+      buffer, buffer_size, HM_DB_SM | HM_FORMAT_PACKED, check_payload,
+      &payload, &payload_size);
+  if (hm_err != HM_SUCCESS) {
+    return hm_err;
+  }
+  *src = payload;
+  *end = payload + payload_size;
+
+  uint64_t hot_count;
+  if (!hm_load_varint(src, *end, list_size) ||
+      !hm_load_varint(src, *end, &hot_count)) {
+    return HM_ERROR_BAD_FORMAT;
+  }
+  if (*list_size == 0) {
+    return HM_ERROR_NO_MASKS;
+  }
+  // Each element takes at least 2 bytes and each hot bucket at least 1 byte,
+  // which also limits the sizes before anything is allocated.
+  if (*list_size > UINT32_MAX || hot_count > HM_SM_BUCKETS ||
+      2 * *list_size + hot_count > uint64_t(*end - *src)) {
+    return HM_ERROR_BAD_SIZE;
+  }
+
+  hot_buckets.resize(hot_count);
+  for (size_t i = 0; i < hot_count; i++) {
+    uint64_t bucket;
+    if (!hm_load_varint(src, *end, &bucket)) {
+      return HM_ERROR_BAD_FORMAT;
+    }
+    hot_buckets[i] = uint32_t(std::min(bucket, uint64_t(UINT32_MAX)));
+  }
+  return check_hot_buckets(hot_buckets);
+}
+
+// unpack_max_ips decodes the sorted list of max_ips.
+static hm_error_t unpack_max_ips(const char **src, const char *end,
+                                 int32_t *max_ips, size_t list_size) {
+  uint64_t ip = 0;
+  for (size_t i = 0; i < list_size; i++) {
+    uint64_t delta;
+    if (!hm_load_varint(src, end, &delta) || delta > UINT32_MAX - ip) {
+      return HM_ERROR_BAD_FORMAT;
+    }
+    ip += delta;
+    max_ips[i] = int32_t(uint32_t(ip) ^ ip_xor);
+  }
+  // The last element must be the largest one, so scans stop inside the list.
+  if (ip != UINT32_MAX) {
+    return HM_ERROR_BAD_FORMAT;
+  }
+  return HM_SUCCESS;
+}
+
+// unpack_values decodes the values, which must be the rest of the payload.
+static hm_error_t unpack_values(const char **src, const char *end,
+                                uint64_t *values, size_t list_size) {
+  for (size_t i = 0; i < list_size; i++) {
+    uint64_t value;
+    if (!hm_load_varint(src, end, &value)) {
+      return HM_ERROR_BAD_FORMAT;
+    }
+    values[i] = value - 1;
+  }
+  if (*src != end) {
+    return HM_ERROR_BAD_SIZE;
+  }
+  return HM_SUCCESS;
+}
+
+// packed_scan_size decodes the list into max_ips if the db has hot buckets
+// and returns scan_size.
+static hm_error_t packed_scan_size(const char **src, const char *end,
+                                   size_t list_size,
+                                   const std::vector<uint32_t> &hot_buckets,
+                                   std::vector<int32_t> &max_ips,
+                                   size_t *scan_size) {
+  *scan_size = list_size;
+  if (hot_buckets.empty()) {
+    return HM_SUCCESS;
+  }
+  max_ips.resize(list_size);
+  hm_error_t hm_err = unpack_max_ips(src, end, max_ips.data(), list_size);
+  if (hm_err != HM_SUCCESS) {
+    return hm_err;
+  }
+  *scan_size += hot_segments_size(max_ips.data(), list_size,
+                                  hot_buckets.data(), hot_buckets.size());
+  return HM_SUCCESS;
+}
+
+extern "C" HM_PUBLIC_API hm_error_t HM_CDECL
+hm_sm_db_place_size_from_packed(size_t *db_place_size, const char *buffer,
+                                size_t buffer_size) {
+  const char *src, *end;
+  uint64_t list_size;
+  std::vector<uint32_t> hot_buckets;
+  hm_error_t hm_err = read_packed(buffer, buffer_size, false, &src, &end,
+                                  &list_size, hot_buckets);
+  if (hm_err != HM_SUCCESS) {
+    return hm_err;
+  }
+  std::vector<int32_t> max_ips;
+  size_t scan_size;
+  hm_err =
+      packed_scan_size(&src, end, list_size, hot_buckets, max_ips, &scan_size);
+  if (hm_err != HM_SUCCESS) {
+    return hm_err;
+  }
+
+  *db_place_size = layout_size(scan_size, hot_buckets.size()) + alignment;
+
+  return HM_SUCCESS;
+}
+
+extern "C" HM_PUBLIC_API hm_error_t HM_CDECL
+hm_sm_unpack(char *db_place, size_t db_place_size, hm_sm_database_t **db_ptr,
+             const char *buffer, size_t buffer_size) {
+  const char *src, *end;
+  uint64_t list_size;
+  std::vector<uint32_t> hot_buckets;
+  hm_error_t hm_err = read_packed(buffer, buffer_size, true, &src, &end,
+                                  &list_size, hot_buckets);
+  if (hm_err != HM_SUCCESS) {
+    return hm_err;
+  }
+  std::vector<int32_t> max_ips;
+  size_t scan_size;
+  hm_err =
+      packed_scan_size(&src, end, list_size, hot_buckets, max_ips, &scan_size);
+  if (hm_err != HM_SUCCESS) {
+    return hm_err;
   }
-  for (int i = 0; i < *list_size; i++) {
-    db->values[i] = values[i];
+
+  // Align db_place forward, if needed.
+  {
+    char *db_place2 = align8(db_place);
+    db_place_size -= (db_place2 - db_place);
+    db_place = db_place2;
   }
 
+  if (db_place_size < layout_size(scan_size, hot_buckets.size())) {
+    return HM_ERROR_SMALL_PLACE;
+  }
+
+  hm_sm_database_t *db = reinterpret_cast<hm_sm_database_t *>(db_place);
+  *db_ptr = db;
+  locate(db, db_place + sizeof(hm_sm_database_t), list_size, scan_size,
+         hot_buckets.size());
+
+  // Without hot buckets the list is decoded right into the db.
+  if (max_ips.empty()) {
+    hm_err = unpack_max_ips(&src, end, db->max_ips, list_size);
+    if (hm_err != HM_SUCCESS) {
+      return hm_err;
+    }
+  } else {
+    std::copy(max_ips.begin(), max_ips.end(), db->max_ips);
+  }
+  hm_err = unpack_values(&src, end, db->values, list_size);
+  if (hm_err != HM_SUCCESS) {
+    return hm_err;
+  }
+  std::copy(hot_buckets.begin(), hot_buckets.end(), db->hot_buckets);
+
   fill_hashtable(db);
+  place_hot_segments(db);
+
+  return HM_SUCCESS;
+}
+
+// Patch: header (see format.h), patch header, then payload of varints:
+// list_size of the new db
+// hot_count of the new db
+// hot_count hot buckets of the new db, hottest first.
+// Then edits turning the list of the old db into the list of the new db, up to
+// the end of the payload. Each edit is:
+//   number of elements copied from the old list
+//   number of elements of the old list skipped
+//   number of inserted elements, then for each of them the delta from the
+//   previous max_ip of the new list and value plus 1, as in the packed form.
+// Elements are copied in runs, so applying a small patch is mostly memcpy.
+
+// Max size of a varint encoding a list index.
+static const size_t index_varint_max_size = 5;
+
+static inline int32_t load_max_ip(const char *max_ips, size_t i) {
+  return int32_t(hm_load_le32(max_ips + i * sizeof(uint32_t)));
+}
+
+static inline uint64_t load_value(const char *values, size_t i) {
+  return hm_load_le64(values + i * sizeof(uint64_t));
+}
+
+extern "C" HM_PUBLIC_API hm_error_t HM_CDECL
+hm_sm_diff_max_size(size_t *diff_max_size, const char *old_buffer,
+                    size_t old_buffer_size, const char *new_buffer,
+                    size_t new_buffer_size) {
+  const char *old_payload, *new_payload;
+  uint64_t old_list_size, old_hot_count, new_list_size, new_hot_count;
+  hm_error_t hm_err = read_serialized(old_buffer, old_buffer_size, false,
+                                      &old_payload, &old_list_size,
+                                      &old_hot_count);
+  if (hm_err != HM_SUCCESS) {
+    return hm_err;
+  }
+  hm_err = read_serialized(new_buffer, new_buffer_size, false, &new_payload,
+                           &new_list_size, &new_hot_count);
+  if (hm_err != HM_SUCCESS) {
+    return hm_err;
+  }
+
+  // Each edit changes at least one element.
+  size_t edits = old_list_size + new_list_size + 1;
+  *diff_max_size = HM_FORMAT_HEADER_SIZE + HM_FORMAT_PATCH_HEADER_SIZE +
+                   2 * HM_VARINT_MAX_SIZE +
+                   new_hot_count * bucket_varint_max_size +
+                   edits * 3 * index_varint_max_size +
+                   new_list_size * (ip_varint_max_size + HM_VARINT_MAX_SIZE);
+
+  return HM_SUCCESS;
+}
+
+extern "C" HM_PUBLIC_API hm_error_t HM_CDECL
+hm_sm_diff(char *buffer, size_t buffer_size, const char *old_buffer,
+           size_t old_buffer_size, const char *new_buffer,
+           size_t new_buffer_size, size_t *diff_size) {
+  size_t diff_max_size;
+  hm_error_t hm_err = hm_sm_diff_max_size(&diff_max_size, old_buffer,
+                                          old_buffer_size, new_buffer,
+                                          new_buffer_size);
+  if (hm_err != HM_SUCCESS) {
+    return hm_err;
+  }
+  if (buffer_size < diff_max_size) {
+    return HM_ERROR_SMALL_PLACE;
+  }
+
+  const char *old_payload, *new_payload;
+  uint64_t old_list_size, old_hot_count, new_list_size, new_hot_count;
+  hm_err = read_serialized(old_buffer, old_buffer_size, true, &old_payload,
+                           &old_list_size, &old_hot_count);
+  if (hm_err != HM_SUCCESS) {
+    return hm_err;
+  }
+  hm_err = read_serialized(new_buffer, new_buffer_size, true, &new_payload,
+                           &new_list_size, &new_hot_count);
+  if (hm_err != HM_SUCCESS) {
+    return hm_err;
+  }
+
+  const char *old_ips = old_payload + payload_header_size;
+  const char *old_values =
+      old_ips + hm_aligned_size(old_list_size) * sizeof(uint32_t);
+  const char *new_ips = new_payload + payload_header_size;
+  const char *new_values =
+      new_ips + hm_aligned_size(new_list_size) * sizeof(uint32_t);
+  const char *new_hot = new_values + new_list_size * sizeof(uint64_t);
+
+  char *payload = buffer + HM_FORMAT_HEADER_SIZE;
+  hm_format_write_patch_header(payload, old_buffer, new_buffer);
+  char *dst = payload + HM_FORMAT_PATCH_HEADER_SIZE;
+  dst += hm_store_varint(dst, new_list_size);
+  dst += hm_store_varint(dst, new_hot_count);
+  for (size_t i = 0; i < new_hot_count; i++) {
+    dst += hm_store_varint(dst, hm_load_le32(new_hot + i * sizeof(uint32_t)));
+  }
+
+  // Both lists are sorted, so walk them together. Equal elements are copied,
+  // an element with the same max_ip and another value is replaced.
+  size_t i = 0, j = 0;
+  while (i < old_list_size || j < new_list_size) {
+    size_t keep = 0;
+    while (i < old_list_size && j < new_list_size &&
+           load_max_ip(old_ips, i) == load_max_ip(new_ips, j) &&
+           load_value(old_values, i) == load_value(new_values, j)) {
+      keep++;
+      i++;
+      j++;
+    }
+
+    size_t remove = 0, insert_begin = j;
+    while (i < old_list_size || j < new_list_size) {
+      if (j == new_list_size ||
+          (i < old_list_size &&
+           load_max_ip(old_ips, i) < load_max_ip(new_ips, j))) {
+        remove++;
+        i++;
+      } else if (i == old_list_size ||
+                 load_max_ip(new_ips, j) < load_max_ip(old_ips, i)) {
+        j++;
+      } else if (load_value(old_values, i) != load_value(new_values, j)) {
+        remove++;
+        i++;
+        j++;
+      } else {
+        break;
+      }
+    }
+
+    dst += hm_store_varint(dst, keep);
+    dst += hm_store_varint(dst, remove);
+    dst += hm_store_varint(dst, j - insert_begin);
+    uint32_t prev_ip =
+        insert_begin == 0
+            ? 0
+            : uint32_t(load_max_ip(new_ips, insert_begin - 1)) ^ ip_xor;
+    for (size_t k = insert_begin; k < j; k++) {
+      uint32_t ip = uint32_t(load_max_ip(new_ips, k)) ^ ip_xor;
+      dst += hm_store_varint(dst, ip - prev_ip);
+      dst += hm_store_varint(dst, load_value(new_values, k) + 1);
+      prev_ip = ip;
+    }
+  }
+
+  *diff_size = dst - buffer;
+  hm_format_write_header(buffer, HM_DB_SM | HM_FORMAT_PATCH,
+                         *diff_size - HM_FORMAT_HEADER_SIZE);
+
+  return HM_SUCCESS;
+}
+
+// read_patch checks the patch against the old serialized db and returns the
+// changes after the patch header and the size of the new serialized db.
+// check_payload tells if the checksum of the old db is checked.
+static hm_error_t read_patch(const char *old_buffer, size_t old_buffer_size,
+                             const char *patch, size_t patch_size,
+                             bool check_payload, const char **src,
+                             const char **end, size_t *new_size) {
+  const char *old_payload;
+  uint64_t old_list_size, old_hot_count;
+  hm_error_t hm_err = read_serialized(old_buffer, old_buffer_size, false,
+                                      &old_payload, &old_list_size,
+                                      &old_hot_count);
+  if (hm_err != HM_SUCCESS) {
+    return hm_err;
+  }
+  const char *payload;
+  size_t payload_size;
+  // The patch is small, so its checksum is always checked.
+  hm_err = hm_format_read_header(patch, patch_size, HM_DB_SM | HM_FORMAT_PATCH,
+                                 true, &payload, &payload_size);
+  if (hm_err != HM_SUCCESS) {
+    return hm_err;
+  }
+  hm_err =
+      hm_format_read_patch_header(payload, payload_size, old_buffer, new_size);
+  if (hm_err != HM_SUCCESS) {
+    return hm_err;
+  }
+  *src = payload + HM_FORMAT_PATCH_HEADER_SIZE;
+  *end = payload + payload_size;
+  // The old db is checked last, so a patch for another db is rejected before
+  // reading all of it.
+  if (check_payload) {
+    return read_serialized(old_buffer, old_buffer_size, true, &old_payload,
+                           &old_list_size, &old_hot_count);
+  }
+  return HM_SUCCESS;
+}
+
+extern "C" HM_PUBLIC_API hm_error_t HM_CDECL
+hm_sm_patched_size(size_t *serialized_size, const char *old_buffer,
+                   size_t old_buffer_size, const char *patch,
+                   size_t patch_size) {
+  const char *src, *end;
+  return read_patch(old_buffer, old_buffer_size, patch, patch_size, false,
+                    &src, &end, serialized_size);
+}
+
+extern "C" HM_PUBLIC_API hm_error_t HM_CDECL
+hm_sm_patch(char *buffer, size_t buffer_size, const char *old_buffer,
+            size_t old_buffer_size, const char *patch, size_t patch_size) {
+  const char *src, *end;
+  size_t new_size;
+  hm_error_t hm_err = read_patch(old_buffer, old_buffer_size, patch,
+                                 patch_size, true, &src, &end, &new_size);
+  if (hm_err != HM_SUCCESS) {
+    return hm_err;
+  }
+  if (buffer_size < new_size) {
+    return HM_ERROR_SMALL_PLACE;
+  }
+
+  const char *old_payload = old_buffer + HM_FORMAT_HEADER_SIZE;
+  uint64_t old_list_size = hm_load_le64(old_payload);
+  const char *old_ips = old_payload + payload_header_size;
+  const char *old_values =
+      old_ips + hm_aligned_size(old_list_size) * sizeof(uint32_t);
+
+  uint64_t list_size, hot_count;
+  if (!hm_load_varint(&src, end, &list_size) ||
+      !hm_load_varint(&src, end, &hot_count)) {
+    return HM_ERROR_BAD_FORMAT;
+  }
+  size_t payload_size;
+  hm_err = serialized_payload_size(&payload_size, list_size, hot_count);
+  if (hm_err != HM_SUCCESS) {
+    return hm_err;
+  }
+  if (HM_FORMAT_HEADER_SIZE + payload_size != new_size) {
+    return HM_ERROR_BAD_SIZE;
+  }
+
+  char *payload = buffer + HM_FORMAT_HEADER_SIZE;
+  hm_store_le64(payload, list_size);
+  hm_store_le64(payload + sizeof(uint64_t), hot_count);
+  char *ips = payload + payload_header_size;
+  char *values = ips + hm_aligned_size(list_size) * sizeof(uint32_t);
+  char *hot = values + list_size * sizeof(uint64_t);
+
+  for (size_t i = 0; i < hot_count; i++) {
+    uint64_t bucket;
+    if (!hm_load_varint(&src, end, &bucket) || bucket > UINT32_MAX) {
+      return HM_ERROR_BAD_FORMAT;
+    }
+    hm_store_le32(hot + i * sizeof(uint32_t), bucket);
+  }
+
+  // i and j are positions in the old and in the new list.
+  size_t i = 0, j = 0;
+  uint64_t prev_ip = 0;
+  while (src != end) {
+    uint64_t keep, remove, insert;
+    if (!hm_load_varint(&src, end, &keep) ||
+        !hm_load_varint(&src, end, &remove) ||
+        !hm_load_varint(&src, end, &insert)) {
+      return HM_ERROR_BAD_FORMAT;
+    }
+    if (keep > old_list_size - i || keep > list_size - j ||
+        remove > old_list_size - i - keep ||
+        insert > list_size - j - keep) {
+      return HM_ERROR_BAD_FORMAT;
+    }
+
+    if (keep != 0) {
+      memcpy(ips + j * sizeof(uint32_t), old_ips + i * sizeof(uint32_t),
+             keep * sizeof(uint32_t));
+      memcpy(values + j * sizeof(uint64_t),
+             old_values + i * sizeof(uint64_t), keep * sizeof(uint64_t));
+      i += keep;
+      j += keep;
+      prev_ip = uint32_t(load_max_ip(ips, j - 1)) ^ ip_xor;
+    }
+    i += remove;
+
+    for (uint64_t k = 0; k < insert; k++) {
+      uint64_t delta, value;
+      if (!hm_load_varint(&src, end, &delta) || delta > UINT32_MAX - prev_ip ||
+          !hm_load_varint(&src, end, &value)) {
+        return HM_ERROR_BAD_FORMAT;
+      }
+      prev_ip += delta;
+      hm_store_le32(ips + j * sizeof(uint32_t), uint32_t(prev_ip) ^ ip_xor);
+      hm_store_le64(values + j * sizeof(uint64_t), value - 1);
+      j++;
+    }
+  }
+  if (i != old_list_size || j != list_size) {
+    return HM_ERROR_BAD_FORMAT;
+  }
+  if (list_size & 1) {
+    hm_store_le32(ips + list_size * sizeof(uint32_t), 0);
+  }
+
+  hm_format_write_header(buffer, HM_DB_SM, payload_size);
+
+  return hm_format_check_patched(patch + HM_FORMAT_HEADER_SIZE, buffer);
+}
+
+// Image form: 64 byte header (list_size, scan_size, hot_count, see format.h),
+// then the arrays exactly as they follow the struct in db_place. Unlike the
+// serialized form, it is used in place by hm_sm_image_view.
+static const size_t image_header_size = HM_FORMAT_IMAGE_HEADER_SIZE;
+
+static inline size_t arrays_size(size_t scan_size, size_t hot_count) {
+  return layout_size(scan_size, hot_count) - sizeof(hm_sm_database_t);
+}
+
+extern "C" HM_PUBLIC_API size_t HM_CDECL
+hm_sm_image_size(const hm_sm_database_t *db) {
+  return image_header_size + arrays_size(db->scan_size, db->hot_count);
+}
+
+extern "C" HM_PUBLIC_API hm_error_t HM_CDECL
+hm_sm_image_write(char *image, size_t image_size, const hm_sm_database_t *db) {
+  if (image_size < hm_sm_image_size(db)) {
+    return HM_ERROR_SMALL_PLACE;
+  }
+
+  hm_format_write_image_header(image, HM_DB_SM);
+  uint64_t *header = reinterpret_cast<uint64_t *>(image);
+  header[0] = db->list_size;
+  header[1] = db->scan_size;
+  header[2] = db->hot_count;
+
+  // The arrays are contiguous and start with the hash table.
+  const char *arrays = reinterpret_cast<const char *>(db->hashtable);
+  std::copy(arrays, arrays + arrays_size(db->scan_size, db->hot_count),
+            image + image_header_size);
+
+  return HM_SUCCESS;
+}
+
+extern "C" HM_PUBLIC_API size_t HM_CDECL hm_sm_view_place_size(void) {
+  return sizeof(hm_sm_database_t) + alignment;
+}
+
+extern "C" HM_PUBLIC_API hm_error_t HM_CDECL
+hm_sm_image_view(char *view_place, size_t view_place_size,
+                 hm_sm_database_t **db_ptr, const char *image,
+                 size_t image_size) {
+  if ((uintptr_t(image) & (alignment - 1)) != 0) {
+    return HM_ERROR_BAD_ALIGNMENT;
+  }
+  if (image_size < image_header_size) {
+    return HM_ERROR_SMALL_PLACE;
+  }
+
+  hm_error_t hm_err = hm_format_check_image_header(image, HM_DB_SM);
+  if (hm_err != HM_SUCCESS) {
+    return hm_err;
+  }
+
+  const uint64_t *header = reinterpret_cast<const uint64_t *>(image);
+  uint64_t list_size = header[0];
+  uint64_t scan_size = header[1];
+  uint64_t hot_count = header[2];
+  if (list_size == 0) {
+    return HM_ERROR_NO_MASKS;
+  }
+  if (scan_size < list_size || scan_size - list_size > list_size + hot_count ||
+      hot_count > HM_SM_BUCKETS ||
+      image_size != image_header_size + arrays_size(scan_size, hot_count)) {
+    return HM_ERROR_BAD_SIZE;
+  }
+
+  // Align view_place forward, if needed.
+  {
+    char *view_place2 = align8(view_place);
+    view_place_size -= (view_place2 - view_place);
+    view_place = view_place2;
+  }
+
+  if (view_place_size < sizeof(hm_sm_database_t)) {
+    return HM_ERROR_SMALL_PLACE;
+  }
+
+  // Lookups never write to the arrays, so the image can be read-only.
+  hm_sm_database_t *db = reinterpret_cast<hm_sm_database_t *>(view_place);
+  *db_ptr = db;
+  locate(db, const_cast<char *>(image) + image_header_size, list_size,
+         scan_size, hot_count);
 
   return HM_SUCCESS;
 }
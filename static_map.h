@@ -4,6 +4,7 @@
 #include <stdint.h>
 
 #include "common.h"
+#include "load.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -17,6 +18,76 @@ struct hm_sm_database;
 // hm_sm_database_t is in-memory database type.
 typedef struct hm_sm_database hm_sm_database_t;
 
+// HM_SM_BUCKETS is the number of /16 buckets of the hash table.
+#define HM_SM_BUCKETS 65536
+
+// HM_SM_SCAN_HISTOGRAM_SIZE is the number of bins in
+// hm_sm_stats_t.scan_histogram.
+#define HM_SM_SCAN_HISTOGRAM_SIZE 32
+
+// hm_sm_stats_t describes the layout and memory usage of a database.
+typedef struct hm_sm_stats {
+  // Number of ranges in the sorted list.
+  size_t list_size;
+
+  // Maximum number of list elements compared by hm_sm_find for one IP.
+  size_t longest_scan;
+
+  // scan_histogram[i] is the number of /16 buckets in which the longest scan
+  // compares i+1 list elements. The last bin also counts longer scans.
+  size_t scan_histogram[HM_SM_SCAN_HISTOGRAM_SIZE];
+
+  // Number of hot buckets placed by hm_sm_compile_with_profile and the number
+  // of list elements copied for them.
+  size_t hot_buckets;
+  size_t hot_list_size;
+
+  // Bytes used by the database struct, the /16 hash table, the sorted list of
+  // range ends and the values (both with copies for hot buckets) and the list
+  // of hot buckets.
+  size_t header_bytes;
+  size_t hashtable_bytes;
+  size_t max_ips_bytes;
+  size_t values_bytes;
+  size_t hot_buckets_bytes;
+
+  // Sum of the above. db_place also has up to 8 bytes for alignment.
+  size_t total_bytes;
+} hm_sm_stats_t;
+
+// hm_sm_view_t exposes the arrays searched by hm_sm_find, so lookups can be
+// reimplemented outside of the library (e.g. in another language) over the
+// same memory. The value of ip is values[i], where i is the first index not
+// less than hashtable[ip >> 16] such that max_ips[i] >= (int32_t)(ip ^
+// 0x80000000). The scan never leaves the arrays.
+typedef struct hm_sm_view {
+  // HM_SM_BUCKETS start indices of /16 buckets.
+  const uint32_t *hashtable;
+
+  // scan_size range ends (flipped to sort as signed) and their values.
+  const int32_t *max_ips;
+  const uint64_t *values;
+  size_t scan_size;
+} hm_sm_view_t;
+
+struct hm_sm_profiler;
+
+// hm_sm_profiler_t is a ring buffer of lookup samples written by
+// hm_sm_find_sampled. Each thread must use its own profiler.
+typedef struct hm_sm_profiler hm_sm_profiler_t;
+
+// hm_sm_bucket_profile_t aggregates samples of one /16 bucket.
+typedef struct hm_sm_bucket_profile {
+  // Number of sampled lookups of IPs in the bucket.
+  uint64_t samples;
+
+  // Sum of scan lengths of the sampled lookups.
+  uint64_t scan_total;
+
+  // Maximum scan length of the sampled lookups.
+  uint64_t max_scan;
+} hm_sm_bucket_profile_t;
+
 // hm_sm_db_place_size returns db_place size.
 size_t HM_CDECL hm_sm_db_place_size(unsigned int elements);
 
@@ -32,20 +103,90 @@ hm_error_t HM_CDECL hm_sm_compile(char *db_place, size_t db_place_size,
                                   const uint64_t *values,
                                   unsigned int elements);
 
+// hm_sm_db_place_size_with_profile returns db_place size for
+// hm_sm_compile_with_profile.
+size_t HM_CDECL hm_sm_db_place_size_with_profile(unsigned int elements,
+                                                 unsigned int hot_buckets);
+
+// hm_sm_compile_with_profile is hm_sm_compile which tunes the layout for the
+// query profile bucket_hits, an array of HM_SM_BUCKETS numbers of lookups per
+// /16 bucket, e.g. hm_sm_bucket_profile_t.samples. Up to hot_buckets buckets
+// with most hits get their part of the list copied to a dense region, hottest
+// first, so lookups in them touch fewer cache lines and pages. db_place must
+// be of size hm_sm_db_place_size_with_profile(elements, hot_buckets). The
+// layout is kept by serialization.
+hm_error_t HM_CDECL hm_sm_compile_with_profile(
+    char *db_place, size_t db_place_size, hm_sm_database_t **db_ptr,
+    const uint32_t *ips, const uint8_t *cidr_prefixes, const uint64_t *values,
+    unsigned int elements, const uint64_t *bucket_hits,
+    unsigned int hot_buckets);
+
 // hm_sm_find returns the value corresponding to the given IP in the database.
 uint64_t HM_CDECL hm_sm_find(const hm_sm_database_t *db, const uint32_t ip);
 
+// hm_sm_find_batch looks up count IPs and stores the value of ips[i] to
+// values[i]. It is faster than calling hm_sm_find in a loop, because memory
+// accesses of neighbouring IPs overlap.
+void HM_CDECL hm_sm_find_batch(const hm_sm_database_t *db, const uint32_t *ips,
+                               uint64_t *values, size_t count);
+
+// hm_sm_profiler_place_size calculates the size of profiler_place needed to
+// hold capacity samples.
+hm_error_t HM_CDECL hm_sm_profiler_place_size(size_t *profiler_place_size,
+                                              unsigned int capacity);
+
+// hm_sm_profiler_init initializes the profiler in profiler_place. One of
+// sample_rate lookups passed to hm_sm_find_sampled is recorded. When the
+// buffer is full, new samples overwrite the oldest ones.
+hm_error_t HM_CDECL hm_sm_profiler_init(char *profiler_place,
+                                        size_t profiler_place_size,
+                                        hm_sm_profiler_t **profiler_ptr,
+                                        unsigned int capacity,
+                                        unsigned int sample_rate);
+
+// hm_sm_profiler_reset drops all samples of the profiler. It must be called
+// from the thread owning the profiler.
+void HM_CDECL hm_sm_profiler_reset(hm_sm_profiler_t *profiler);
+
+// hm_sm_find_sampled is hm_sm_find which records every sample_rate-th lookup
+// to the profiler: the /16 bucket, the number of list elements compared and
+// the index of the matched range. Recording is lock-free, the profiler can be
+// exported from another thread at the same time.
+uint64_t HM_CDECL hm_sm_find_sampled(const hm_sm_database_t *db,
+                                     hm_sm_profiler_t *profiler,
+                                     const uint32_t ip);
+
+// hm_sm_profile_export aggregates samples of profilers_count profilers into
+// buckets, which must have HM_SM_BUCKETS elements. If range_hits is not NULL,
+// range_hits[i] is set to the number of samples matching range i of the list,
+// range_hits_size must be at least hm_sm_stats_t.list_size. Samples which do
+// not fit db (e.g. recorded with another database) are skipped. The profilers
+// are not modified.
+hm_error_t HM_CDECL hm_sm_profile_export(
+    const hm_sm_database_t *db, const hm_sm_profiler_t *const *profilers,
+    size_t profilers_count, hm_sm_bucket_profile_t *buckets,
+    uint64_t *range_hits, size_t range_hits_size);
+
+// hm_sm_stats fills stats of the database. It walks the whole hash table, so
+// it is not intended for hot paths.
+void HM_CDECL hm_sm_stats(const hm_sm_database_t *db, hm_sm_stats_t *stats);
+
+// hm_sm_view fills view of the database. The pointers point into db_place.
+void HM_CDECL hm_sm_view(const hm_sm_database_t *db, hm_sm_view_t *view);
+
 // hm_sm_serialized_size returns how many bytes are needed to serialize db.
 size_t HM_CDECL hm_sm_serialized_size(const hm_sm_database_t *db);
 
 // hm_sm_serialize serializes db to buffer.
 // Buffer size must be the equal to the one returned by hm_sm_serialized_size.
-// It can be stored and loaded in machine with the same endianess.
+// The serialized form starts with a header with format version and checksums
+// and is little endian, so it can be loaded on any machine.
 hm_error_t HM_CDECL hm_sm_serialize(char *buffer, size_t buffer_size,
                                     const hm_sm_database_t *db);
 
 // hm_sm_db_place_size_from_serialized returns size needed for db_place
-// using the buffer with serialized db as an input.
+// using the buffer with serialized db as an input. It checks the header, but
+// not the checksum of the data, which is checked by hm_sm_deserialize.
 hm_error_t HM_CDECL hm_sm_db_place_size_from_serialized(size_t *db_place_size,
                                                         const char *buffer,
                                                         size_t buffer_size);
@@ -55,10 +196,128 @@ hm_error_t HM_CDECL hm_sm_db_place_size_from_serialized(size_t *db_place_size,
 // hm_sm_db_place_size_from_serialized. After a successfull call db_ptr points
 // to a pointer to hm_sm_database_t structure, which can be used in hm_sm_find
 // calls. db_place can be modified during the call.
+// Returns HM_ERROR_BAD_FORMAT if the buffer is not a serialized db of this
+// type or version and HM_ERROR_BAD_CHECKSUM if it is corrupted.
 hm_error_t HM_CDECL hm_sm_deserialize(char *db_place, size_t db_place_size,
                                       hm_sm_database_t **db_ptr,
                                       const char *buffer, size_t buffer_size);
 
+// hm_sm_deserialize_ex is hm_sm_deserialize with options for large dbs, see
+// load.h. options can be NULL.
+hm_error_t HM_CDECL hm_sm_deserialize_ex(char *db_place, size_t db_place_size,
+                                         hm_sm_database_t **db_ptr,
+                                         const char *buffer,
+                                         size_t buffer_size,
+                                         const hm_load_options_t *options);
+
+// hm_sm_serialize_fd writes the serialized form of db to fd without a buffer
+// of the whole db, so saving takes constant extra memory. fd can be a file,
+// a pipe or a socket. Returns HM_ERROR_SYSTEM with errno set if writing
+// fails, in which case a part of the db may have been written.
+hm_error_t HM_CDECL hm_sm_serialize_fd(int fd, const hm_sm_database_t *db);
+
+// hm_sm_db_place_size_from_fd is hm_sm_db_place_size_from_serialized for
+// the db serialized to fd, which is read from its current position. It reads
+// only the beginning of the db and keeps it in header, see hm_fd_header_t, so
+// for a db compiled with a profile the size may be larger than needed: the
+// exact size depends on the whole sorted list.
+hm_error_t HM_CDECL hm_sm_db_place_size_from_fd(size_t *db_place_size,
+                                                hm_fd_header_t *header,
+                                                int fd);
+
+// hm_sm_deserialize_fd is hm_sm_deserialize reading the rest of the
+// serialized db after header from fd right into db_place, so loading takes
+// constant extra memory. fd is read sequentially, so it can be a file, a pipe
+// or a socket. header and db_place_size must be the ones filled by
+// hm_sm_db_place_size_from_fd. Returns HM_ERROR_SYSTEM with errno set if
+// reading fails.
+hm_error_t HM_CDECL hm_sm_deserialize_fd(char *db_place, size_t db_place_size,
+                                         hm_sm_database_t **db_ptr,
+                                         hm_fd_header_t *header, int fd);
+
+// hm_sm_packed_max_size returns the size of buffer sufficient for hm_sm_pack.
+size_t HM_CDECL hm_sm_packed_max_size(const hm_sm_database_t *db);
+
+// hm_sm_pack writes db to buffer in packed form, which is several times
+// smaller than the serialized form and is intended for transfers. Boundaries
+// of ranges are delta encoded and boundaries and values are stored as varints.
+// The size of the packed db is stored to packed_size. Buffer size must be at
+// least hm_sm_packed_max_size. Like the serialized form, it has a header with
+// checksums and can be loaded on any machine.
+hm_error_t HM_CDECL hm_sm_pack(char *buffer, size_t buffer_size,
+                               const hm_sm_database_t *db, size_t *packed_size);
+
+// hm_sm_db_place_size_from_packed returns size needed for db_place using the
+// buffer with packed db as an input.
+hm_error_t HM_CDECL hm_sm_db_place_size_from_packed(size_t *db_place_size,
+                                                    const char *buffer,
+                                                    size_t buffer_size);
+
+// hm_sm_unpack loads db from buffer with packed db. db_place_size must be
+// equal to the one returned by hm_sm_db_place_size_from_packed. The db is
+// decoded right into db_place. Returns the same errors as hm_sm_deserialize.
+hm_error_t HM_CDECL hm_sm_unpack(char *db_place, size_t db_place_size,
+                                 hm_sm_database_t **db_ptr,
+                                 const char *buffer, size_t buffer_size);
+
+// hm_sm_diff_max_size returns the size of buffer sufficient for hm_sm_diff of
+// the given serialized dbs.
+hm_error_t HM_CDECL hm_sm_diff_max_size(size_t *diff_max_size,
+                                        const char *old_buffer,
+                                        size_t old_buffer_size,
+                                        const char *new_buffer,
+                                        size_t new_buffer_size);
+
+// hm_sm_diff writes to buffer a patch turning the serialized db in old_buffer
+// into the serialized db in new_buffer. The patch stores only the elements of
+// the sorted list which changed, so its size is proportional to the size of
+// the change. The size of the patch is stored to diff_size. Buffer size must
+// be at least hm_sm_diff_max_size.
+hm_error_t HM_CDECL hm_sm_diff(char *buffer, size_t buffer_size,
+                               const char *old_buffer, size_t old_buffer_size,
+                               const char *new_buffer, size_t new_buffer_size,
+                               size_t *diff_size);
+
+// hm_sm_patched_size returns the size of the serialized db produced by
+// hm_sm_patch. Returns HM_ERROR_BAD_VALUE if the patch was made for another
+// db.
+hm_error_t HM_CDECL hm_sm_patched_size(size_t *serialized_size,
+                                       const char *old_buffer,
+                                       size_t old_buffer_size,
+                                       const char *patch, size_t patch_size);
+
+// hm_sm_patch applies the patch to the serialized db in old_buffer and writes
+// the new serialized db to buffer, which can be loaded by hm_sm_deserialize.
+// Buffer size must be at least hm_sm_patched_size. Nothing is compiled: the
+// unchanged parts of the list are copied. Returns HM_ERROR_BAD_VALUE if the
+// patch was made for another db and HM_ERROR_BAD_CHECKSUM if the result does
+// not match the db the patch was made from.
+hm_error_t HM_CDECL hm_sm_patch(char *buffer, size_t buffer_size,
+                                const char *old_buffer, size_t old_buffer_size,
+                                const char *patch, size_t patch_size);
+
+// hm_sm_image_size returns how many bytes are needed for the image of db.
+size_t HM_CDECL hm_sm_image_size(const hm_sm_database_t *db);
+
+// hm_sm_image_write writes the image of db to image. The image is the memory
+// layout of db without pointers, so it can be used in place from another
+// address or process, e.g. mapped from shared memory. Unlike the
+// serialized form, it can only be used on a machine with the same endianess.
+hm_error_t HM_CDECL hm_sm_image_write(char *image, size_t image_size,
+                                      const hm_sm_database_t *db);
+
+// hm_sm_view_place_size returns view_place size for hm_sm_image_view.
+size_t HM_CDECL hm_sm_view_place_size(void);
+
+// hm_sm_image_view creates in view_place a database using the image in place,
+// without copying. image must be 8 byte aligned and stay mapped while the
+// database is used. It may be read-only. Returns HM_ERROR_BAD_FORMAT if image
+// is not an image of a static map written on a machine with the same byte
+// order.
+hm_error_t HM_CDECL hm_sm_image_view(char *view_place, size_t view_place_size,
+                                     hm_sm_database_t **db_ptr,
+                                     const char *image, size_t image_size);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
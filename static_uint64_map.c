@@ -3,6 +3,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include "crc32c.h"
+#include "database.h"
+#include "dispatch.h"
+#include "format.h"
 #include "static_uint64_map.h"
 
 #ifdef NDEBUG
@@ -23,6 +27,8 @@ typedef struct key_value {
 static const size_t items_in_bucket = 4;
 static const size_t alignment = 64;
 
+typedef struct hm_u64map_kernels hm_u64map_kernels_t;
+
 typedef struct hm_u64map_database {
   // Hash table. See above for the layout.
   key_value_t *hash_table;
@@ -32,8 +38,27 @@ typedef struct hm_u64map_database {
 
   // Mask to go from hash64 to hash_table index.
   uint64_t mask_for_hash;
+
+  // Lookup kernels selected for this CPU.
+  const hm_u64map_kernels_t *kernels;
+
+  // Number of hash functions tried by compile, 0 if deserialized.
+  uint64_t compile_attempts;
+
+  // Padding to keep the hash table (which follows the struct) aligned by
+  // cache line, so a group of 4 buckets never spans two cache lines.
+  uint64_t reserved[2];
 } hm_u64map_database_t;
 
+_Static_assert(sizeof(hm_u64map_database_t) % 64 == 0,
+               "hash table must stay aligned");
+
+struct hm_u64map_kernels {
+  uint64_t (*find)(const hm_u64map_database_t *db, uint64_t key);
+  void (*find_batch)(const hm_u64map_database_t *db, const uint64_t *keys,
+                     uint64_t *values, size_t count);
+};
+
 // https://stackoverflow.com/a/6867612
 static inline uint64_t hm_u64map_hash64(const hm_u64map_database_t *db,
                                         uint64_t key) {
@@ -45,8 +70,174 @@ static inline uint64_t hm_u64map_hash64(const hm_u64map_database_t *db,
   return key;
 }
 
-static inline int round_up_to_power_of_2(int n) {
-  int power = 1;
+// probe_* functions return the value of the key if it is in the group of 4
+// buckets starting at b, otherwise 0.
+
+static HM_ALWAYS_INLINE uint64_t probe_portable(const hm_u64map_database_t *db,
+                                                uint64_t b, uint64_t key) {
+  return db->hash_table[b].key == key       ? db->hash_table[b].value
+         : db->hash_table[b + 1].key == key ? db->hash_table[b + 1].value
+         : db->hash_table[b + 2].key == key ? db->hash_table[b + 2].value
+         : db->hash_table[b + 3].key == key ? db->hash_table[b + 3].value
+                                            : 0;
+}
+
+#ifdef HM_X86
+HM_TARGET_SSE42 static HM_ALWAYS_INLINE uint64_t
+probe_sse42(const hm_u64map_database_t *db, uint64_t b, uint64_t key) {
+  // Each 128-bit lane holds one key_value_t, the key is in the low half.
+  const __m128i *group = (const __m128i *)(db->hash_table + b);
+  __m128i needle = _mm_set1_epi64x(key);
+  int matches = 0;
+  for (int i = 0; i < items_in_bucket; i++) {
+    __m128i eq = _mm_cmpeq_epi64(_mm_loadu_si128(group + i), needle);
+    matches |= (_mm_movemask_pd(_mm_castsi128_pd(eq)) & 1) << i;
+  }
+  if (matches == 0) {
+    return 0;
+  }
+  return db->hash_table[b + __builtin_ctz(matches)].value;
+}
+
+HM_TARGET_AVX2 static HM_ALWAYS_INLINE uint64_t
+probe_avx2(const hm_u64map_database_t *db, uint64_t b, uint64_t key) {
+  const __m256i *group = (const __m256i *)(db->hash_table + b);
+  __m256i needle = _mm256_set1_epi64x(key);
+  __m256i eq_lo = _mm256_cmpeq_epi64(_mm256_loadu_si256(group), needle);
+  __m256i eq_hi = _mm256_cmpeq_epi64(_mm256_loadu_si256(group + 1), needle);
+  // Bits of keys are even, bits of values are odd. Values are ignored.
+  unsigned int lo = _mm256_movemask_pd(_mm256_castsi256_pd(eq_lo));
+  unsigned int hi = _mm256_movemask_pd(_mm256_castsi256_pd(eq_hi));
+  unsigned int matches = (lo | (hi << 4)) & 0x55;
+  if (matches == 0) {
+    return 0;
+  }
+  return db->hash_table[b + _tzcnt_u32(matches) / 2].value;
+}
+
+HM_TARGET_AVX512 static HM_ALWAYS_INLINE uint64_t
+probe_avx512(const hm_u64map_database_t *db, uint64_t b, uint64_t key) {
+  // The whole group is one cache line and one register.
+  __m512i group = _mm512_loadu_si512((const void *)(db->hash_table + b));
+  __mmask8 matches =
+      _mm512_mask_cmpeq_epi64_mask(0x55, group, _mm512_set1_epi64(key));
+  if (matches == 0) {
+    return 0;
+  }
+  return db->hash_table[b + _tzcnt_u32(matches) / 2].value;
+}
+#endif
+
+// find_batch_template looks up keys block by block: it computes buckets of
+// the block and prefetches them first, so cache misses of the block overlap.
+static HM_ALWAYS_INLINE void
+find_batch_template(const hm_u64map_database_t *db, const uint64_t *keys,
+                    uint64_t *values, size_t count,
+                    uint64_t (*probe)(const hm_u64map_database_t *, uint64_t,
+                                      uint64_t)) {
+  uint64_t buckets[HM_BATCH_BLOCK];
+  for (size_t start = 0; start < count; start += HM_BATCH_BLOCK) {
+    size_t n = count - start;
+    if (n > HM_BATCH_BLOCK) {
+      n = HM_BATCH_BLOCK;
+    }
+    for (size_t i = 0; i < n; i++) {
+      buckets[i] = hm_u64map_hash64(db, keys[start + i]) & db->mask_for_hash;
+      __builtin_prefetch(db->hash_table + buckets[i]);
+    }
+    for (size_t i = 0; i < n; i++) {
+      values[start + i] = probe(db, buckets[i], keys[start + i]);
+    }
+  }
+}
+
+static uint64_t find_portable(const hm_u64map_database_t *db, uint64_t key) {
+  return probe_portable(db, hm_u64map_hash64(db, key) & db->mask_for_hash,
+                        key);
+}
+
+static void find_batch_portable(const hm_u64map_database_t *db,
+                                const uint64_t *keys, uint64_t *values,
+                                size_t count) {
+  find_batch_template(db, keys, values, count, probe_portable);
+}
+
+static const hm_u64map_kernels_t kernels_portable = {
+    .find = find_portable,
+    .find_batch = find_batch_portable,
+};
+
+#ifdef HM_X86
+HM_TARGET_SSE42 static uint64_t find_sse42(const hm_u64map_database_t *db,
+                                           uint64_t key) {
+  return probe_sse42(db, hm_u64map_hash64(db, key) & db->mask_for_hash, key);
+}
+
+HM_TARGET_SSE42 static void find_batch_sse42(const hm_u64map_database_t *db,
+                                             const uint64_t *keys,
+                                             uint64_t *values, size_t count) {
+  find_batch_template(db, keys, values, count, probe_sse42);
+}
+
+HM_TARGET_AVX2 static uint64_t find_avx2(const hm_u64map_database_t *db,
+                                         uint64_t key) {
+  return probe_avx2(db, hm_u64map_hash64(db, key) & db->mask_for_hash, key);
+}
+
+HM_TARGET_AVX2 static void find_batch_avx2(const hm_u64map_database_t *db,
+                                           const uint64_t *keys,
+                                           uint64_t *values, size_t count) {
+  find_batch_template(db, keys, values, count, probe_avx2);
+}
+
+HM_TARGET_AVX512 static uint64_t find_avx512(const hm_u64map_database_t *db,
+                                             uint64_t key) {
+  return probe_avx512(db, hm_u64map_hash64(db, key) & db->mask_for_hash,
+                      key);
+}
+
+HM_TARGET_AVX512 static void find_batch_avx512(const hm_u64map_database_t *db,
+                                               const uint64_t *keys,
+                                               uint64_t *values,
+                                               size_t count) {
+  find_batch_template(db, keys, values, count, probe_avx512);
+}
+
+static const hm_u64map_kernels_t kernels_sse42 = {
+    .find = find_sse42,
+    .find_batch = find_batch_sse42,
+};
+
+static const hm_u64map_kernels_t kernels_avx2 = {
+    .find = find_avx2,
+    .find_batch = find_batch_avx2,
+};
+
+static const hm_u64map_kernels_t kernels_avx512 = {
+    .find = find_avx512,
+    .find_batch = find_batch_avx512,
+};
+#endif
+
+// select_kernels returns the best kernels for the current CPU.
+static const hm_u64map_kernels_t *select_kernels(void) {
+#ifdef HM_X86
+  switch (hm_kernel_level()) {
+  case HM_KERNEL_AVX512:
+    return &kernels_avx512;
+  case HM_KERNEL_AVX2:
+    return &kernels_avx2;
+  case HM_KERNEL_SSE42:
+    return &kernels_sse42;
+  default:
+    break;
+  }
+#endif
+  return &kernels_portable;
+}
+
+static inline uint64_t round_up_to_power_of_2(uint64_t n) {
+  uint64_t power = 1;
   while (power < n) {
     power *= 2;
   }
@@ -57,14 +248,14 @@ static inline char *align64(char *addr) {
   return (char *)(((uintptr_t)(addr) & ~(alignment - 1)) + alignment);
 }
 
-static inline int hash_table_buckets(unsigned int elements) {
+static inline uint64_t hash_table_buckets(unsigned int elements) {
   // Calibrate the number of buckets to make probability of having a 5-way
   // collision less than 1 (e.g. 99.5%), so the number of attempts in
   // compilation is not too high. The probability of having a 5-way collision
   // among N elements put into M 4-bucket groups is 1 - exp(-(N choose 5) /
   // M^4). For 10k elements the factor of 2 works well.
 
-  int result = round_up_to_power_of_2(elements) * items_in_bucket * 2;
+  uint64_t result = round_up_to_power_of_2(elements) * items_in_bucket * 2;
   if (result < 16) {
     result = 16;
   }
@@ -84,13 +275,16 @@ static inline void clear_hash_table(hm_u64map_database_t *db) {
   }
 }
 
-static inline size_t get_db_place(int buckets) {
+static inline size_t get_db_place(uint64_t buckets) {
   return sizeof(hm_u64map_database_t) + buckets * sizeof(key_value_t) +
          alignment;
 }
 
 HM_PUBLIC_API
 size_t HM_CDECL hm_u64map_db_place_size(unsigned int elements) {
+  if (elements > HM_U64MAP_MAX_ELEMENTS) {
+    return 0;
+  }
   return get_db_place(hash_table_buckets(elements));
 }
 
@@ -100,6 +294,49 @@ static inline int comp_key_value(const void *elem1, const void *elem2) {
   return (f->key > s->key) - (f->key < s->key);
 }
 
+// place_fillers changes empty buckets in the group to which 0 maps to some
+// key which is not 0 and not mapped there (not to create a false positive).
+static void place_fillers(hm_u64map_database_t *db) {
+  uint64_t h0 = hm_u64map_hash64(db, 0);
+  uint64_t b = h0 & db->mask_for_hash;
+  for (uint64_t shift = 0; shift < items_in_bucket; shift++) {
+    uint64_t b0 = b + shift;
+    if (db->hash_table[b0].key == 0) {
+      while (true) {
+        db->hash_table[b0].key++;
+        uint64_t h1 = hm_u64map_hash64(db, db->hash_table[b0].key);
+        uint64_t b1 = h1 & db->mask_for_hash;
+        if (b1 != (b0 & db->mask_for_hash)) {
+          break;
+        }
+      }
+    }
+  }
+}
+
+// is_key returns true if bucket b has a key, i.e. it is not empty and does not
+// have a filler put to the group to which 0 maps. A filler never maps to the
+// group it is stored in.
+static inline bool is_key(const hm_u64map_database_t *db, uint64_t b) {
+  uint64_t key = db->hash_table[b].key;
+  return key != 0 && (hm_u64map_hash64(db, key) & db->mask_for_hash) ==
+                         (b & ~(uint64_t)(items_in_bucket - 1));
+}
+
+// sort_group sorts keys inside the group of buckets starting at b for speed.
+static inline void sort_group(hm_u64map_database_t *db, uint64_t b) {
+  qsort(db->hash_table + b, items_in_bucket, sizeof(key_value_t),
+        comp_key_value);
+}
+
+// sort_groups sorts keys inside all groups of buckets.
+static void sort_groups(hm_u64map_database_t *db) {
+  uint64_t buckets = get_buckets(db);
+  for (uint64_t b = 0; b < buckets; b += items_in_bucket) {
+    sort_group(db, b);
+  }
+}
+
 HM_PUBLIC_API
 hm_error_t HM_CDECL hm_u64map_compile(char *db_place, size_t db_place_size,
                                       hm_u64map_database_t **db_ptr,
@@ -109,6 +346,9 @@ hm_error_t HM_CDECL hm_u64map_compile(char *db_place, size_t db_place_size,
   if (elements == 0) {
     return HM_ERROR_NO_MASKS;
   }
+  if (elements > HM_U64MAP_MAX_ELEMENTS) {
+    return HM_ERROR_BAD_SIZE;
+  }
 
   // Make sure 0 is not among the keys and the values. We use 0 for empty
   // buckets and return it from hm_u64map_find indicating a missing element, so
@@ -130,17 +370,16 @@ hm_error_t HM_CDECL hm_u64map_compile(char *db_place, size_t db_place_size,
     return HM_ERROR_SMALL_PLACE;
   }
 
-  int buckets = hash_table_buckets(elements);
+  uint64_t buckets = hash_table_buckets(elements);
 
   // Fill database struct and db_ptr.
   hm_u64map_database_t *db = (hm_u64map_database_t *)(db_place);
   db->mask_for_hash = buckets - 1 - 3;
+  db->kernels = select_kernels();
   *db_ptr = db;
   db_place += sizeof(hm_u64map_database_t);
 
   db->hash_table = (key_value_t *)(db_place);
-  db_place += sizeof(key_value_t) * buckets;
-  key_value_t *hash_table_end = (key_value_t *)(db_place);
 
   // Initiate the hash function with some random values.
   db->factor1 = 0xA6C3096657A14E89;
@@ -152,7 +391,10 @@ hm_error_t HM_CDECL hm_u64map_compile(char *db_place, size_t db_place_size,
 
   // Find factor1 and factor2 not resulting in hash collisions overflowing
   // grouped buckets. At the same time check that all the elements are unique.
+  db->compile_attempts = 0;
   while (true) {
+    db->compile_attempts++;
+
     // Clear the hash table.
     clear_hash_table(db);
 
@@ -207,30 +449,8 @@ hm_error_t HM_CDECL hm_u64map_compile(char *db_place, size_t db_place_size,
     db->factor2 = hm_u64map_hash64(db, keys[0]);
   }
 
-  // Now we should change the value stored in the bucket to which 0 maps
-  // to some value which is not 0 and not mapped there (not to create a false
-  // positive).
-  uint64_t h0 = hm_u64map_hash64(db, 0);
-  uint64_t b = h0 & db->mask_for_hash;
-  for (uint64_t shift = 0; shift < items_in_bucket; shift++) {
-    uint64_t b0 = b + shift;
-    if (db->hash_table[b0].key == 0) {
-      while (true) {
-        db->hash_table[b0].key++;
-        uint64_t h1 = hm_u64map_hash64(db, db->hash_table[b0].key);
-        uint64_t b1 = h1 & db->mask_for_hash;
-        if (b1 != (b0 & db->mask_for_hash)) {
-          break;
-        }
-      }
-    }
-  }
-
-  // Sort values insude buckets fot speed.
-  for (key_value_t *start = db->hash_table; start < hash_table_end;
-       start += items_in_bucket) {
-    qsort(start, items_in_bucket, sizeof(key_value_t), comp_key_value);
-  }
+  place_fillers(db);
+  sort_groups(db);
 
   debugf("compile factors: %d %d\n", db->factor1, db->factor2);
   debugf("hash_table: %p\n", db->hash_table);
@@ -241,24 +461,14 @@ hm_error_t HM_CDECL hm_u64map_compile(char *db_place, size_t db_place_size,
 HM_PUBLIC_API
 uint64_t HM_CDECL hm_u64map_find(const hm_u64map_database_t *db,
                                  const uint64_t key) {
-  uint64_t h = hm_u64map_hash64(db, key);
-  uint64_t b = h & db->mask_for_hash;
-
-  debugf("hm_u64map_find: key=0x%" PRIx64 ", h=0x%" PRIx64
-         ", b=%d, hash_table[%d]={0x%" PRIx64 ", 0x%" PRIx64
-         "}, hash_table[%d]={0x%" PRIx64 ", 0x%" PRIx64
-         "}, hash_table[%d]={0x%" PRIx64 ", 0x%" PRIx64
-         "}, hash_table[%d]={0x%" PRIx64 ", 0x%" PRIx64 "}\n",
-         key, h, b, b, db->hash_table[b].key, db->hash_table[b].value, b + 1,
-         db->hash_table[b + 1].key, db->hash_table[b + 1].value, b + 2,
-         db->hash_table[b + 2].key, db->hash_table[b + 2].value, b + 3,
-         db->hash_table[b + 3].key, db->hash_table[b + 3].value);
+  return db->kernels->find(db, key);
+}
 
-  return db->hash_table[b].key == key       ? db->hash_table[b].value
-         : db->hash_table[b + 1].key == key ? db->hash_table[b + 1].value
-         : db->hash_table[b + 2].key == key ? db->hash_table[b + 2].value
-         : db->hash_table[b + 3].key == key ? db->hash_table[b + 3].value
-                                            : 0;
+HM_PUBLIC_API
+void HM_CDECL hm_u64map_find_batch(const hm_u64map_database_t *db,
+                                   const uint64_t *keys, uint64_t *values,
+                                   size_t count) {
+  db->kernels->find_batch(db, keys, values, count);
 }
 
 HM_PUBLIC_API
@@ -272,85 +482,438 @@ uint64_t HM_CDECL hm_u64map_benchmark(const hm_u64map_database_t *db,
   return xor_sum;
 }
 
-// Serialized form:
-// uint64_t factor1
-// uint64_t factor2
-// uint64_t buckets
-// uint64_t 0 (dummy)
-// []key_value_t hash_table
+HM_PUBLIC_API
+void HM_CDECL hm_u64map_stats(const hm_u64map_database_t *db,
+                              hm_u64map_stats_t *stats) {
+  uint64_t buckets = get_buckets(db);
+
+  *stats = (hm_u64map_stats_t){0};
+  for (uint64_t group = 0; group < buckets; group += items_in_bucket) {
+    size_t keys_in_group = 0;
+    for (uint64_t i = group; i < group + items_in_bucket; i++) {
+      if (is_key(db, i)) {
+        keys_in_group++;
+      }
+    }
+    stats->group_histogram[keys_in_group]++;
+    stats->elements += keys_in_group;
+  }
+
+  stats->buckets = buckets;
+  stats->load_factor = (double)(stats->elements) / buckets;
+  stats->compile_attempts = db->compile_attempts;
+  stats->header_bytes = sizeof(hm_u64map_database_t);
+  stats->hash_table_bytes = buckets * sizeof(key_value_t);
+  stats->total_bytes = stats->header_bytes + stats->hash_table_bytes;
+}
+
+HM_PUBLIC_API
+void HM_CDECL hm_u64map_view(const hm_u64map_database_t *db,
+                             hm_u64map_view_t *view) {
+  *view = (hm_u64map_view_t){
+      .hash_table = (const uint64_t *)(db->hash_table),
+      .buckets = get_buckets(db),
+      .factor1 = db->factor1,
+      .factor2 = db->factor2,
+      .mask_for_hash = db->mask_for_hash,
+  };
+}
+
+// Serialized form: header (see format.h), then payload of uint64 numbers:
+// factor1
+// factor2
+// buckets
+// hash_table, key and value of each bucket.
+static const size_t payload_header_size = 3 * sizeof(uint64_t);
 
 HM_PUBLIC_API
 size_t HM_CDECL hm_u64map_serialized_size(const hm_u64map_database_t *db) {
-  return 4 * sizeof(uint64_t) + get_buckets(db) * sizeof(key_value_t);
+  return HM_FORMAT_HEADER_SIZE + payload_header_size +
+         get_buckets(db) * sizeof(key_value_t);
 }
 
 HM_PUBLIC_API
 hm_error_t HM_CDECL hm_u64map_serialize(char *buffer, size_t buffer_size,
                                         const hm_u64map_database_t *db) {
-  if (buffer_size < hm_u64map_serialized_size(db)) {
+  size_t serialized_size = hm_u64map_serialized_size(db);
+  if (buffer_size < serialized_size) {
     return HM_ERROR_SMALL_PLACE;
   }
 
   uint64_t buckets = get_buckets(db);
 
-  uint64_t *dst = (uint64_t *)(buffer);
-  *dst = db->factor1;
-  dst++;
-  *dst = db->factor2;
-  dst++;
-  *dst = buckets;
+  char *payload = buffer + HM_FORMAT_HEADER_SIZE;
+  hm_store_le64(payload, db->factor1);
+  hm_store_le64(payload + sizeof(uint64_t), db->factor2);
+  hm_store_le64(payload + 2 * sizeof(uint64_t), buckets);
+  hm_store_le64_array(payload + payload_header_size,
+                      (const uint64_t *)(db->hash_table), 2 * buckets);
 
-  buffer += 4 * sizeof(uint64_t);
+  hm_format_write_header(buffer, HM_DB_U64MAP,
+                         serialized_size - HM_FORMAT_HEADER_SIZE);
 
-  key_value_t *hash_table2 = (key_value_t *)(buffer);
-  for (int i = 0; i < buckets; i++) {
-    hash_table2[i] = db->hash_table[i];
-  }
+  return HM_SUCCESS;
+}
 
+// check_buckets checks the number of buckets from the payload of the given
+// size.
+static hm_error_t check_buckets(uint64_t buckets, size_t payload_size) {
+  if (buckets == 0) {
+    return HM_ERROR_NO_MASKS;
+  }
+  if (buckets < 16 || (buckets & (buckets - 1)) != 0 ||
+      (payload_size - payload_header_size) / sizeof(key_value_t) != buckets ||
+      (payload_size - payload_header_size) % sizeof(key_value_t) != 0) {
+    return HM_ERROR_BAD_SIZE;
+  }
   return HM_SUCCESS;
 }
 
+// read_serialized checks the serialized db and returns its payload and number
+// of buckets.
+static hm_error_t read_serialized(const char *buffer, size_t buffer_size,
+                                  bool check_payload, const char **payload,
+                                  uint64_t *buckets) {
+  size_t payload_size;
+  hm_error_t err =
+      hm_format_read_header(buffer, buffer_size, HM_DB_U64MAP, check_payload,
+                            payload, &payload_size);
+  if (err != HM_SUCCESS) {
+    return err;
+  }
+  if (payload_size < payload_header_size) {
+    return HM_ERROR_BAD_SIZE;
+  }
+
+  *buckets = hm_load_le64(*payload + 2 * sizeof(uint64_t));
+  return check_buckets(*buckets, payload_size);
+}
+
 HM_PUBLIC_API
 hm_error_t HM_CDECL hm_u64map_db_place_size_from_serialized(
     size_t *db_place_size, const char *buffer, size_t buffer_size) {
+  const char *payload;
+  uint64_t buckets;
+  hm_error_t err =
+      read_serialized(buffer, buffer_size, false, &payload, &buckets);
+  if (err != HM_SUCCESS) {
+    return err;
+  }
+
+  *db_place_size = get_db_place(buckets);
+
+  return HM_SUCCESS;
+}
+
+HM_PUBLIC_API
+hm_error_t HM_CDECL hm_u64map_deserialize(char *db_place, size_t db_place_size,
+                                          hm_u64map_database_t **db_ptr,
+                                          const char *buffer,
+                                          size_t buffer_size) {
+  return hm_u64map_deserialize_ex(db_place, db_place_size, db_ptr, buffer,
+                                  buffer_size, NULL);
+}
+
+HM_PUBLIC_API
+hm_error_t HM_CDECL hm_u64map_deserialize_ex(
+    char *db_place, size_t db_place_size, hm_u64map_database_t **db_ptr,
+    const char *buffer, size_t buffer_size,
+    const hm_load_options_t *options) {
+  const char *payload;
+  uint64_t buckets;
+  hm_error_t err =
+      read_serialized(buffer, buffer_size, false, &payload, &buckets);
+  if (err != HM_SUCCESS) {
+    return err;
+  }
+  size_t min_db_place_size = get_db_place(buckets);
 
-  if (buffer_size <= 4 * sizeof(uint64_t)) {
+  // Align db_place forward, if needed.
+  {
+    char *db_place2 = align64(db_place);
+    db_place_size -= (db_place2 - db_place);
+    db_place = db_place2;
+  }
+
+  if (db_place_size < min_db_place_size - alignment) {
     return HM_ERROR_SMALL_PLACE;
   }
 
-  const uint64_t *src = (const uint64_t *)(buffer);
+  hm_u64map_database_t *db = (hm_u64map_database_t *)(db_place);
+  *db_ptr = db;
+  db->hash_table = (key_value_t *)(db_place + sizeof(hm_u64map_database_t));
 
-  // Skip factor1 and factor2.
-  src++;
-  src++;
+  // The payload is checksummed while it is copied.
+  uint32_t crc = hm_crc32c(0, payload, payload_header_size);
+  hm_load_array(db->hash_table, payload + payload_header_size, 2 * buckets,
+                sizeof(uint64_t), options, &crc);
+  err = hm_format_check_crc(buffer, crc);
+  if (err != HM_SUCCESS) {
+    return err;
+  }
 
-  uint64_t buckets = *src;
+  db->factor1 = hm_load_le64(payload);
+  db->factor2 = hm_load_le64(payload + sizeof(uint64_t));
+  db->mask_for_hash = buckets - 1 - 3;
+  db->kernels = select_kernels();
+  db->compile_attempts = 0;
 
-  if (buckets == 0) {
-    return HM_ERROR_NO_MASKS;
+  debugf("factors: %d %d\n", db->factor1, db->factor2);
+
+  debugf("hash_table: %p\n", db->hash_table);
+
+  return hm_load_lock(db_place, min_db_place_size - alignment, options);
+}
+
+// read_serialized_fd reads and checks the header and the payload header of
+// the db serialized to fd, unless they are in header already. crc is started
+// with the payload header.
+static hm_error_t read_serialized_fd(int fd, hm_fd_header_t *header,
+                                     uint64_t payload_header[3],
+                                     uint32_t *crc) {
+  size_t payload_size;
+  hm_error_t err = hm_format_read_start_fd(fd, HM_DB_U64MAP, header,
+                                           payload_header_size, &payload_size,
+                                           crc);
+  if (err != HM_SUCCESS) {
+    return err;
+  }
+  hm_load_le64_array(payload_header, header->data + HM_FORMAT_HEADER_SIZE, 3);
+  return check_buckets(payload_header[2], payload_size);
+}
+
+HM_PUBLIC_API
+hm_error_t HM_CDECL hm_u64map_serialize_fd(int fd,
+                                           const hm_u64map_database_t *db) {
+  uint64_t buckets = get_buckets(db);
+  uint64_t payload_header[3] = {db->factor1, db->factor2, buckets};
+  hm_format_segment_t segments[] = {
+      {payload_header, 3, sizeof(uint64_t)},
+      {db->hash_table, 2 * buckets, sizeof(uint64_t)},
+  };
+  return hm_format_write_fd(fd, HM_DB_U64MAP, segments, 2);
+}
+
+HM_PUBLIC_API
+hm_error_t HM_CDECL hm_u64map_db_place_size_from_fd(size_t *db_place_size,
+                                                    hm_fd_header_t *header,
+                                                    int fd) {
+  uint64_t payload_header[3];
+  uint32_t crc;
+  hm_error_t err = read_serialized_fd(fd, header, payload_header, &crc);
+  if (err != HM_SUCCESS) {
+    return err;
+  }
+
+  *db_place_size = get_db_place(payload_header[2]);
+
+  return HM_SUCCESS;
+}
+
+HM_PUBLIC_API
+hm_error_t HM_CDECL hm_u64map_deserialize_fd(char *db_place,
+                                             size_t db_place_size,
+                                             hm_u64map_database_t **db_ptr,
+                                             hm_fd_header_t *header, int fd) {
+  uint64_t payload_header[3];
+  uint32_t crc;
+  hm_error_t err = read_serialized_fd(fd, header, payload_header, &crc);
+  if (err != HM_SUCCESS) {
+    return err;
   }
+  uint64_t buckets = payload_header[2];
+  size_t min_db_place_size = get_db_place(buckets);
 
-  size_t min_buffer_size = 3 * sizeof(uint64_t) + buckets * sizeof(key_value_t);
-  if (buffer_size < min_buffer_size) {
+  // Align db_place forward, if needed.
+  {
+    char *db_place2 = align64(db_place);
+    db_place_size -= (db_place2 - db_place);
+    db_place = db_place2;
+  }
+
+  if (db_place_size < min_db_place_size - alignment) {
     return HM_ERROR_SMALL_PLACE;
   }
 
+  hm_u64map_database_t *db = (hm_u64map_database_t *)(db_place);
+  *db_ptr = db;
+  db_place += sizeof(hm_u64map_database_t);
+  db->hash_table = (key_value_t *)(db_place);
+
+  // The hash table is read right into its place.
+  err = hm_format_read_fd(fd, db->hash_table, 2 * buckets, sizeof(uint64_t),
+                          &crc);
+  if (err != HM_SUCCESS) {
+    return err;
+  }
+  err = hm_format_check_crc(header->data, crc);
+  if (err != HM_SUCCESS) {
+    return err;
+  }
+
+  db->factor1 = payload_header[0];
+  db->factor2 = payload_header[1];
+  db->mask_for_hash = buckets - 1 - 3;
+  db->kernels = select_kernels();
+  db->compile_attempts = 0;
+
+  return HM_SUCCESS;
+}
+
+// Packed form: header (see format.h), then payload:
+// uint64_t factor1
+// uint64_t factor2
+// varint buckets
+// varint number of keys
+// varints of deltas between sorted keys, starting from 0.
+// varints of values in the order of keys.
+// Unpacking puts the keys into the hash table with the same factors, so it
+// does not search for factors again.
+static const size_t packed_header_size = 2 * sizeof(uint64_t);
+
+static size_t count_keys(const hm_u64map_database_t *db) {
+  uint64_t buckets = get_buckets(db);
+  size_t count = 0;
+  for (uint64_t b = 0; b < buckets; b++) {
+    count += is_key(db, b);
+  }
+  return count;
+}
+
+// sorted_elements returns a new array of count keys and values of db sorted by
+// key, which the caller frees. Returns NULL if there is no memory.
+static key_value_t *sorted_elements(const hm_u64map_database_t *db,
+                                    size_t count) {
+  // One byte more, so an empty db does not look like a failed malloc.
+  key_value_t *elements = malloc(count * sizeof(key_value_t) + 1);
+  if (elements == NULL) {
+    return NULL;
+  }
+  uint64_t buckets = get_buckets(db);
+  size_t i = 0;
+  for (uint64_t b = 0; b < buckets; b++) {
+    if (is_key(db, b)) {
+      elements[i++] = db->hash_table[b];
+    }
+  }
+  qsort(elements, count, sizeof(key_value_t), comp_key_value);
+  return elements;
+}
+
+static inline size_t packed_max_size(size_t count) {
+  return HM_FORMAT_HEADER_SIZE + packed_header_size +
+         (2 + 2 * count) * HM_VARINT_MAX_SIZE;
+}
+
+HM_PUBLIC_API
+size_t HM_CDECL hm_u64map_packed_max_size(const hm_u64map_database_t *db) {
+  return packed_max_size(count_keys(db));
+}
+
+HM_PUBLIC_API
+hm_error_t HM_CDECL hm_u64map_pack(char *buffer, size_t buffer_size,
+                                   const hm_u64map_database_t *db,
+                                   size_t *packed_size) {
+  size_t count = count_keys(db);
+  if (buffer_size < packed_max_size(count)) {
+    return HM_ERROR_SMALL_PLACE;
+  }
+
+  uint64_t buckets = get_buckets(db);
+  key_value_t *elements = sorted_elements(db, count);
+  if (elements == NULL) {
+    return HM_ERROR_NO_MEMORY;
+  }
+
+  char *dst = buffer + HM_FORMAT_HEADER_SIZE;
+  hm_store_le64(dst, db->factor1);
+  hm_store_le64(dst + sizeof(uint64_t), db->factor2);
+  dst += packed_header_size;
+  dst += hm_store_varint(dst, buckets);
+  dst += hm_store_varint(dst, count);
+  uint64_t prev_key = 0;
+  for (size_t i = 0; i < count; i++) {
+    dst += hm_store_varint(dst, elements[i].key - prev_key);
+    prev_key = elements[i].key;
+  }
+  for (size_t i = 0; i < count; i++) {
+    dst += hm_store_varint(dst, elements[i].value);
+  }
+  free(elements);
+
+  *packed_size = dst - buffer;
+  hm_format_write_header(buffer, HM_DB_U64MAP | HM_FORMAT_PACKED,
+                         *packed_size - HM_FORMAT_HEADER_SIZE);
+
+  return HM_SUCCESS;
+}
+
+// read_packed checks the packed db, reads the numbers before the keys and
+// leaves src at the first key.
+static hm_error_t read_packed(const char *buffer, size_t buffer_size,
+                              bool check_payload, const char **src,
+                              const char **end, uint64_t *buckets,
+                              uint64_t *count) {
+  const char *payload;
+  size_t payload_size;
+  hm_error_t err = hm_format_read_header(
+      buffer, buffer_size, HM_DB_U64MAP | HM_FORMAT_PACKED, check_payload,
+      &payload, &payload_size);
+  if (err != HM_SUCCESS) {
+    return err;
+  }
+  if (payload_size < packed_header_size) {
+    return HM_ERROR_BAD_SIZE;
+  }
+  *src = payload + packed_header_size;
+  *end = payload + payload_size;
+
+  if (!hm_load_varint(src, *end, buckets) ||
+      !hm_load_varint(src, *end, count)) {
+    return HM_ERROR_BAD_FORMAT;
+  }
+  if (*buckets == 0 || *count == 0) {
+    return HM_ERROR_NO_MASKS;
+  }
+  // Each key and each value take at least one byte.
+  if (*buckets < 16 || *buckets > (1u << 30) ||
+      (*buckets & (*buckets - 1)) != 0 || *count > *buckets ||
+      *count > (uint64_t)(*end - *src) / 2) {
+    return HM_ERROR_BAD_SIZE;
+  }
+
+  return HM_SUCCESS;
+}
+
+HM_PUBLIC_API
+hm_error_t HM_CDECL hm_u64map_db_place_size_from_packed(size_t *db_place_size,
+                                                        const char *buffer,
+                                                        size_t buffer_size) {
+  const char *src, *end;
+  uint64_t buckets, count;
+  hm_error_t err = read_packed(buffer, buffer_size, false, &src, &end,
+                               &buckets, &count);
+  if (err != HM_SUCCESS) {
+    return err;
+  }
+
   *db_place_size = get_db_place(buckets);
 
   return HM_SUCCESS;
 }
 
 HM_PUBLIC_API
-hm_error_t HM_CDECL hm_u64map_deserialize(char *db_place, size_t db_place_size,
-                                          hm_u64map_database_t **db_ptr,
-                                          const char *buffer,
-                                          size_t buffer_size) {
-  size_t min_db_place_size;
-  hm_error_t err = hm_u64map_db_place_size_from_serialized(&min_db_place_size,
-                                                           buffer, buffer_size);
+hm_error_t HM_CDECL hm_u64map_unpack(char *db_place, size_t db_place_size,
+                                     hm_u64map_database_t **db_ptr,
+                                     const char *buffer, size_t buffer_size) {
+  const char *src, *end;
+  uint64_t buckets, count;
+  hm_error_t err = read_packed(buffer, buffer_size, true, &src, &end,
+                               &buckets, &count);
   if (err != HM_SUCCESS) {
     return err;
   }
+  size_t min_db_place_size = get_db_place(buckets);
 
   // Align db_place forward, if needed.
   {
@@ -363,29 +926,667 @@ hm_error_t HM_CDECL hm_u64map_deserialize(char *db_place, size_t db_place_size,
     return HM_ERROR_SMALL_PLACE;
   }
 
-  const uint64_t *src = (const uint64_t *)(buffer);
   hm_u64map_database_t *db = (hm_u64map_database_t *)(db_place);
   *db_ptr = db;
-  db->factor1 = *src;
-  src++;
-  db->factor2 = *src;
-  src++;
-  uint64_t buckets = *src;
+  db->factor1 = hm_load_le64(buffer + HM_FORMAT_HEADER_SIZE);
+  db->factor2 = hm_load_le64(buffer + HM_FORMAT_HEADER_SIZE + sizeof(uint64_t));
   db->mask_for_hash = buckets - 1 - 3;
+  db->kernels = select_kernels();
+  db->compile_attempts = 0;
 
-  buffer += 4 * sizeof(uint64_t);
   db_place += sizeof(hm_u64map_database_t);
 
   db->hash_table = (key_value_t *)(db_place);
+  clear_hash_table(db);
+
+  // Keys are sorted, so they are unique. The factors were chosen by compile,
+  // so the groups do not overflow unless the buffer is forged.
+  const char *keys_begin = src;
+  uint64_t key = 0;
+  for (uint64_t i = 0; i < count; i++) {
+    uint64_t delta;
+    if (!hm_load_varint(&src, end, &delta) || delta == 0 ||
+        delta > UINT64_MAX - key) {
+      return HM_ERROR_BAD_FORMAT;
+    }
+    key += delta;
+    uint64_t b = hm_u64map_hash64(db, key) & db->mask_for_hash;
+    uint64_t shift = 0;
+    while (shift < items_in_bucket && db->hash_table[b + shift].key != 0) {
+      shift++;
+    }
+    if (shift == items_in_bucket) {
+      return HM_ERROR_BAD_FORMAT;
+    }
+    db->hash_table[b + shift].key = key;
+  }
+
+  // Values follow the keys in the same order, so the keys are decoded again
+  // (they are already validated) to find their buckets.
+  const char *keys_src = keys_begin;
+  key = 0;
+  for (uint64_t i = 0; i < count; i++) {
+    uint64_t delta, value;
+    if (!hm_load_varint(&keys_src, end, &delta)) {
+      return HM_ERROR_BAD_FORMAT;
+    }
+    key += delta;
+    if (!hm_load_varint(&src, end, &value)) {
+      return HM_ERROR_BAD_FORMAT;
+    }
+    if (value == 0) {
+      return HM_ERROR_BAD_VALUE;
+    }
+    uint64_t b = hm_u64map_hash64(db, key) & db->mask_for_hash;
+    while (db->hash_table[b].key != key) {
+      b++;
+    }
+    db->hash_table[b].value = value;
+  }
+  if (src != end) {
+    return HM_ERROR_BAD_SIZE;
+  }
+
+  place_fillers(db);
+  sort_groups(db);
+
+  return HM_SUCCESS;
+}
+
+// Patch: header (see format.h), patch header, then payload:
+// uint64_t factor1
+// uint64_t factor2
+// varint buckets
+// varint number of removed keys
+// varint number of added or changed keys
+// varints of deltas between sorted removed keys, starting from 0.
+// varints of deltas between sorted added or changed keys, starting from 0.
+// varints of values of added or changed keys.
+// Applying the patch removes keys from the old hash table, moves the rest of
+// the keys to a new hash table if the factors or the number of buckets differ
+// from the old ones and then adds or changes keys. Groups are sorted and
+// fillers depend only on the number of empty buckets in the group, so the
+// result does not depend on the machine. hm_u64map_diff keeps the factors of
+// the old db if all new keys fit into its groups, so applying the patch only
+// touches the groups of changed keys. Then the patched db has the keys and the
+// values of the new db in another hash table, and the patch header has the
+// checksum of the patched db.
+
+// Kinds of changes written by write_changes.
+enum { REMOVED_KEYS, CHANGED_KEYS, CHANGED_VALUES };
+
+// write_changes walks both arrays of elements sorted by key and writes as
+// varints the removed keys, or the added or changed keys, or their values to
+// dst, if it is not NULL. Returns the number of such elements.
+static size_t write_changes(char **dst, int kind,
+                            const key_value_t *old_elems, size_t old_count,
+                            const key_value_t *new_elems, size_t new_count) {
+  size_t changes = 0;
+  uint64_t prev_key = 0;
+  size_t i = 0, j = 0;
+  while (i < old_count || j < new_count) {
+    const key_value_t *elem = NULL;
+    bool removed = false;
+    if (j == new_count ||
+        (i < old_count && old_elems[i].key < new_elems[j].key)) {
+      elem = &old_elems[i++];
+      removed = true;
+    } else if (i == old_count || new_elems[j].key < old_elems[i].key) {
+      elem = &new_elems[j++];
+    } else {
+      if (old_elems[i].value != new_elems[j].value) {
+        elem = &new_elems[j];
+      }
+      i++;
+      j++;
+    }
+    if (elem == NULL || removed != (kind == REMOVED_KEYS)) {
+      continue;
+    }
+    changes++;
+    if (dst != NULL) {
+      if (kind == CHANGED_VALUES) {
+        *dst += hm_store_varint(*dst, elem->value);
+      } else {
+        *dst += hm_store_varint(*dst, elem->key - prev_key);
+        prev_key = elem->key;
+      }
+    }
+  }
+  return changes;
+}
+
+// load_table sets up db from the payload of the serialized db and loads its
+// hash table into a new array, which the caller frees.
+static hm_error_t load_table(hm_u64map_database_t *db, const char *payload,
+                             uint64_t buckets) {
+  db->factor1 = hm_load_le64(payload);
+  db->factor2 = hm_load_le64(payload + sizeof(uint64_t));
+  db->mask_for_hash = buckets - 1 - 3;
+  db->hash_table = malloc(buckets * sizeof(key_value_t));
+  if (db->hash_table == NULL) {
+    return HM_ERROR_NO_MEMORY;
+  }
+  hm_load_le64_array((uint64_t *)(db->hash_table),
+                     payload + payload_header_size, 2 * buckets);
+  return HM_SUCCESS;
+}
+
+// find_key returns the bucket with the key or the number of buckets if the
+// key is not in db.
+static uint64_t find_key(const hm_u64map_database_t *db, uint64_t key) {
+  uint64_t b = hm_u64map_hash64(db, key) & db->mask_for_hash;
+  for (uint64_t shift = 0; shift < items_in_bucket; shift++) {
+    if (db->hash_table[b + shift].key == key) {
+      return b + shift;
+    }
+  }
+  return get_buckets(db);
+}
+
+// insert_key puts the key with a value to its group and sorts the group.
+// Returns false if the group is full.
+static bool insert_key(hm_u64map_database_t *db, uint64_t key,
+                       uint64_t value) {
+  uint64_t b = hm_u64map_hash64(db, key) & db->mask_for_hash;
+  for (uint64_t shift = 0; shift < items_in_bucket; shift++) {
+    if (!is_key(db, b + shift)) {
+      db->hash_table[b + shift].key = key;
+      db->hash_table[b + shift].value = value;
+      sort_group(db, b);
+      return true;
+    }
+  }
+  return false;
+}
+
+// remove_keys removes the keys listed in the patch from db.
+static hm_error_t remove_keys(hm_u64map_database_t *db, const char **src,
+                              const char *end, uint64_t removed) {
+  uint64_t buckets = get_buckets(db);
+  uint64_t key = 0;
+  for (uint64_t i = 0; i < removed; i++) {
+    uint64_t delta;
+    if (!hm_load_varint(src, end, &delta) || delta == 0 ||
+        delta > UINT64_MAX - key) {
+      return HM_ERROR_BAD_FORMAT;
+    }
+    key += delta;
+    uint64_t b = find_key(db, key);
+    if (b == buckets || !is_key(db, b)) {
+      return HM_ERROR_BAD_FORMAT;
+    }
+    db->hash_table[b].key = 0;
+    db->hash_table[b].value = 0;
+    sort_group(db, b & ~(uint64_t)(items_in_bucket - 1));
+  }
+  return HM_SUCCESS;
+}
+
+// change_keys adds or changes the keys listed in the patch, which must be the
+// rest of it, and places fillers again.
+static hm_error_t change_keys(hm_u64map_database_t *db, const char *src,
+                              const char *end, uint64_t changed) {
+  // Values follow the keys, so the keys are decoded twice, like in unpack.
+  const char *values = src;
+  for (uint64_t i = 0; i < changed; i++) {
+    uint64_t delta;
+    if (!hm_load_varint(&values, end, &delta)) {
+      return HM_ERROR_BAD_FORMAT;
+    }
+  }
+  uint64_t buckets = get_buckets(db);
+  uint64_t key = 0;
+  for (uint64_t i = 0; i < changed; i++) {
+    uint64_t delta, value;
+    if (!hm_load_varint(&src, end, &delta) || delta == 0 ||
+        delta > UINT64_MAX - key || !hm_load_varint(&values, end, &value)) {
+      return HM_ERROR_BAD_FORMAT;
+    }
+    if (value == 0) {
+      return HM_ERROR_BAD_VALUE;
+    }
+    key += delta;
+    uint64_t b = find_key(db, key);
+    if (b != buckets && is_key(db, b)) {
+      db->hash_table[b].value = value;
+    } else if (!insert_key(db, key, value)) {
+      return HM_ERROR_BAD_FORMAT;
+    }
+  }
+  if (values != end) {
+    return HM_ERROR_BAD_SIZE;
+  }
+
+  // Keys could take buckets of fillers and removed keys could free buckets in
+  // the group to which 0 maps, so fillers are placed again.
+  uint64_t b0 = hm_u64map_hash64(db, 0) & db->mask_for_hash;
+  for (uint64_t b = b0; b < b0 + items_in_bucket; b++) {
+    if (!is_key(db, b)) {
+      db->hash_table[b].key = 0;
+    }
+  }
+  place_fillers(db);
+  sort_group(db, b0);
+
+  return HM_SUCCESS;
+}
+
+// rebuild_table puts the keys of old_db to the hash table of db, which has
+// other factors or number of buckets.
+static hm_error_t rebuild_table(hm_u64map_database_t *db,
+                                const hm_u64map_database_t *old_db) {
+  clear_hash_table(db);
+  uint64_t old_buckets = get_buckets(old_db);
+  for (uint64_t b = 0; b < old_buckets; b++) {
+    if (!is_key(old_db, b)) {
+      continue;
+    }
+    uint64_t key = old_db->hash_table[b].key;
+    uint64_t group = hm_u64map_hash64(db, key) & db->mask_for_hash;
+    uint64_t shift = 0;
+    while (shift < items_in_bucket && db->hash_table[group + shift].key != 0) {
+      shift++;
+    }
+    if (shift == items_in_bucket) {
+      return HM_ERROR_BAD_FORMAT;
+    }
+    db->hash_table[group + shift] = old_db->hash_table[b];
+  }
+  sort_groups(db);
+  return HM_SUCCESS;
+}
+
+// apply_patch writes to buffer the serialized db of new_size bytes produced
+// from the old db by the changes from the patch.
+static hm_error_t apply_patch(char *buffer, size_t new_size,
+                              const char *old_payload, uint64_t old_buckets,
+                              const char *src, const char *end) {
+  if ((size_t)(end - src) < packed_header_size) {
+    return HM_ERROR_BAD_SIZE;
+  }
+  hm_u64map_database_t db = {0};
+  db.factor1 = hm_load_le64(src);
+  db.factor2 = hm_load_le64(src + sizeof(uint64_t));
+  src += packed_header_size;
+  uint64_t buckets, removed, changed;
+  if (!hm_load_varint(&src, end, &buckets) ||
+      !hm_load_varint(&src, end, &removed) ||
+      !hm_load_varint(&src, end, &changed)) {
+    return HM_ERROR_BAD_FORMAT;
+  }
+  // Each removed key takes at least one byte, each changed key two.
+  if (buckets < 16 || buckets > (1u << 30) ||
+      (buckets & (buckets - 1)) != 0 ||
+      new_size != HM_FORMAT_HEADER_SIZE + payload_header_size +
+                      buckets * sizeof(key_value_t) ||
+      removed > (uint64_t)(end - src) ||
+      changed > ((uint64_t)(end - src) - removed) / 2) {
+    return HM_ERROR_BAD_SIZE;
+  }
+  db.mask_for_hash = buckets - 1 - 3;
+
+  hm_u64map_database_t old_db = {0};
+  hm_error_t err = load_table(&old_db, old_payload, old_buckets);
+  if (err != HM_SUCCESS) {
+    return err;
+  }
+  // Keys are removed before they are moved, because the new factors may not
+  // fit them.
+  err = remove_keys(&old_db, &src, end, removed);
+  if (err != HM_SUCCESS) {
+    free(old_db.hash_table);
+    return err;
+  }
+  if (db.factor1 == old_db.factor1 && db.factor2 == old_db.factor2 &&
+      buckets == old_buckets) {
+    db.hash_table = old_db.hash_table;
+  } else {
+    db.hash_table = malloc(buckets * sizeof(key_value_t));
+    if (db.hash_table == NULL) {
+      err = HM_ERROR_NO_MEMORY;
+    } else {
+      err = rebuild_table(&db, &old_db);
+    }
+    free(old_db.hash_table);
+  }
+  if (err == HM_SUCCESS) {
+    err = change_keys(&db, src, end, changed);
+  }
+  if (err == HM_SUCCESS) {
+    char *payload = buffer + HM_FORMAT_HEADER_SIZE;
+    hm_store_le64(payload, db.factor1);
+    hm_store_le64(payload + sizeof(uint64_t), db.factor2);
+    hm_store_le64(payload + 2 * sizeof(uint64_t), buckets);
+    hm_store_le64_array(payload + payload_header_size,
+                        (const uint64_t *)(db.hash_table), 2 * buckets);
+    hm_format_write_header(buffer, HM_DB_U64MAP,
+                           new_size - HM_FORMAT_HEADER_SIZE);
+  }
+  free(db.hash_table);
+
+  return err;
+}
+
+HM_PUBLIC_API
+hm_error_t HM_CDECL hm_u64map_diff_max_size(size_t *diff_max_size,
+                                            const char *old_buffer,
+                                            size_t old_buffer_size,
+                                            const char *new_buffer,
+                                            size_t new_buffer_size) {
+  const char *old_payload, *new_payload;
+  uint64_t old_buckets, new_buckets;
+  hm_error_t err = read_serialized(old_buffer, old_buffer_size, false,
+                                   &old_payload, &old_buckets);
+  if (err != HM_SUCCESS) {
+    return err;
+  }
+  err = read_serialized(new_buffer, new_buffer_size, false, &new_payload,
+                        &new_buckets);
+  if (err != HM_SUCCESS) {
+    return err;
+  }
+
+  *diff_max_size = HM_FORMAT_HEADER_SIZE + HM_FORMAT_PATCH_HEADER_SIZE +
+                   packed_header_size +
+                   (3 + old_buckets + 2 * new_buckets) * HM_VARINT_MAX_SIZE;
+
+  return HM_SUCCESS;
+}
+
+// write_changes_payload writes the changes of the patch for the hash table
+// with the factors of db after the patch header and returns the end of them.
+static char *write_changes_payload(char *payload,
+                                   const hm_u64map_database_t *db,
+                                   const key_value_t *old_elems,
+                                   size_t old_count,
+                                   const key_value_t *new_elems,
+                                   size_t new_count) {
+  char *dst = payload + HM_FORMAT_PATCH_HEADER_SIZE;
+  hm_store_le64(dst, db->factor1);
+  hm_store_le64(dst + sizeof(uint64_t), db->factor2);
+  dst += packed_header_size;
+  dst += hm_store_varint(dst, get_buckets(db));
+  dst += hm_store_varint(dst, write_changes(NULL, REMOVED_KEYS, old_elems,
+                                            old_count, new_elems, new_count));
+  dst += hm_store_varint(dst, write_changes(NULL, CHANGED_KEYS, old_elems,
+                                            old_count, new_elems, new_count));
+  for (int kind = REMOVED_KEYS; kind <= CHANGED_VALUES; kind++) {
+    write_changes(&dst, kind, old_elems, old_count, new_elems, new_count);
+  }
+  return dst;
+}
+
+// write_diff writes the patch from the sorted elements of both dbs.
+static hm_error_t write_diff(char *buffer, const char *old_buffer,
+                             const char *new_buffer,
+                             const hm_u64map_database_t *old_db,
+                             const hm_u64map_database_t *new_db,
+                             const key_value_t *old_elems, size_t old_count,
+                             const key_value_t *new_elems, size_t new_count,
+                             size_t *diff_size) {
+  char *payload = buffer + HM_FORMAT_HEADER_SIZE;
+  uint64_t old_buckets = get_buckets(old_db);
+  size_t patched_size = HM_FORMAT_HEADER_SIZE + payload_header_size +
+                        old_buckets * sizeof(key_value_t);
+  char *patched = malloc(patched_size);
+  if (patched == NULL) {
+    return HM_ERROR_NO_MEMORY;
+  }
+
+  // Try to keep the factors of the old db if the size of the hash table is
+  // the same. The patch is applied here to find out if the new keys fit and
+  // to get the checksum of the result.
+  char *end = write_changes_payload(payload, old_db, old_elems, old_count,
+                                    new_elems, new_count);
+  hm_error_t err = HM_ERROR_BAD_SIZE;
+  if (old_buckets == get_buckets(new_db)) {
+    err = apply_patch(patched, patched_size,
+                      old_buffer + HM_FORMAT_HEADER_SIZE, old_buckets,
+                      payload + HM_FORMAT_PATCH_HEADER_SIZE, end);
+  }
+  if (err == HM_ERROR_NO_MEMORY) {
+    free(patched);
+    return err;
+  }
+  if (err == HM_SUCCESS) {
+    hm_format_write_patch_header(payload, old_buffer, patched);
+  } else {
+    // Some group overflowed or the size changed, so the keys are moved to the
+    // hash table of the new db.
+    end = write_changes_payload(payload, new_db, old_elems, old_count,
+                                new_elems, new_count);
+    hm_format_write_patch_header(payload, old_buffer, new_buffer);
+  }
+  free(patched);
+
+  *diff_size = end - buffer;
+  hm_format_write_header(buffer, HM_DB_U64MAP | HM_FORMAT_PATCH,
+                         *diff_size - HM_FORMAT_HEADER_SIZE);
+
+  return HM_SUCCESS;
+}
+
+HM_PUBLIC_API
+hm_error_t HM_CDECL hm_u64map_diff(char *buffer, size_t buffer_size,
+                                   const char *old_buffer,
+                                   size_t old_buffer_size,
+                                   const char *new_buffer,
+                                   size_t new_buffer_size,
+                                   size_t *diff_size) {
+  size_t diff_max_size;
+  hm_error_t err =
+      hm_u64map_diff_max_size(&diff_max_size, old_buffer, old_buffer_size,
+                              new_buffer, new_buffer_size);
+  if (err != HM_SUCCESS) {
+    return err;
+  }
+  if (buffer_size < diff_max_size) {
+    return HM_ERROR_SMALL_PLACE;
+  }
+
+  const char *old_payload, *new_payload;
+  uint64_t old_buckets, new_buckets;
+  err = read_serialized(old_buffer, old_buffer_size, true, &old_payload,
+                        &old_buckets);
+  if (err != HM_SUCCESS) {
+    return err;
+  }
+  err = read_serialized(new_buffer, new_buffer_size, true, &new_payload,
+                        &new_buckets);
+  if (err != HM_SUCCESS) {
+    return err;
+  }
+
+  hm_u64map_database_t old_db = {0}, new_db = {0};
+  key_value_t *old_elems = NULL, *new_elems = NULL;
+  size_t old_count = 0, new_count = 0;
+  err = load_table(&old_db, old_payload, old_buckets);
+  if (err == HM_SUCCESS) {
+    err = load_table(&new_db, new_payload, new_buckets);
+  }
+  if (err == HM_SUCCESS) {
+    old_count = count_keys(&old_db);
+    new_count = count_keys(&new_db);
+    old_elems = sorted_elements(&old_db, old_count);
+    new_elems = sorted_elements(&new_db, new_count);
+    if (old_elems == NULL || new_elems == NULL) {
+      err = HM_ERROR_NO_MEMORY;
+    }
+  }
+  if (err == HM_SUCCESS) {
+    err = write_diff(buffer, old_buffer, new_buffer, &old_db, &new_db,
+                     old_elems, old_count, new_elems, new_count, diff_size);
+  }
+  free(old_elems);
+  free(new_elems);
+  free(old_db.hash_table);
+  free(new_db.hash_table);
+
+  return err;
+}
+
+// read_patch checks the patch against the old serialized db and returns the
+// payload of the old db, the changes after the patch header and the size of
+// the new serialized db. check_payload tells if the checksum of the old db is
+// checked.
+static hm_error_t read_patch(const char *old_buffer, size_t old_buffer_size,
+                             const char *patch, size_t patch_size,
+                             bool check_payload, const char **old_payload,
+                             uint64_t *old_buckets, const char **src,
+                             const char **end, size_t *new_size) {
+  hm_error_t err = read_serialized(old_buffer, old_buffer_size, false,
+                                   old_payload, old_buckets);
+  if (err != HM_SUCCESS) {
+    return err;
+  }
+  const char *payload;
+  size_t payload_size;
+  // The patch is small, so its checksum is always checked.
+  err = hm_format_read_header(patch, patch_size,
+                              HM_DB_U64MAP | HM_FORMAT_PATCH, true, &payload,
+                              &payload_size);
+  if (err != HM_SUCCESS) {
+    return err;
+  }
+  err = hm_format_read_patch_header(payload, payload_size, old_buffer,
+                                    new_size);
+  if (err != HM_SUCCESS) {
+    return err;
+  }
+  *src = payload + HM_FORMAT_PATCH_HEADER_SIZE;
+  *end = payload + payload_size;
+  // The old db is checked last, so a patch for another db is rejected before
+  // reading all of it.
+  if (check_payload) {
+    return read_serialized(old_buffer, old_buffer_size, true, old_payload,
+                           old_buckets);
+  }
+  return HM_SUCCESS;
+}
+
+HM_PUBLIC_API
+hm_error_t HM_CDECL hm_u64map_patched_size(size_t *serialized_size,
+                                           const char *old_buffer,
+                                           size_t old_buffer_size,
+                                           const char *patch,
+                                           size_t patch_size) {
+  const char *old_payload, *src, *end;
+  uint64_t old_buckets;
+  return read_patch(old_buffer, old_buffer_size, patch, patch_size, false,
+                    &old_payload, &old_buckets, &src, &end, serialized_size);
+}
+
+HM_PUBLIC_API
+hm_error_t HM_CDECL hm_u64map_patch(char *buffer, size_t buffer_size,
+                                    const char *old_buffer,
+                                    size_t old_buffer_size, const char *patch,
+                                    size_t patch_size) {
+  const char *old_payload, *src, *end;
+  uint64_t old_buckets;
+  size_t new_size;
+  hm_error_t err =
+      read_patch(old_buffer, old_buffer_size, patch, patch_size, true,
+                 &old_payload, &old_buckets, &src, &end, &new_size);
+  if (err != HM_SUCCESS) {
+    return err;
+  }
+  if (buffer_size < new_size) {
+    return HM_ERROR_SMALL_PLACE;
+  }
+
+  err = apply_patch(buffer, new_size, old_payload, old_buckets, src, end);
+  if (err != HM_SUCCESS) {
+    return err;
+  }
+
+  return hm_format_check_patched(patch + HM_FORMAT_HEADER_SIZE, buffer);
+}
+
+// Image form: 64 byte header (factor1, factor2, buckets, see format.h), then
+// hash_table. Unlike the serialized form, the hash table stays aligned and is
+// used in place by hm_u64map_image_view.
+static const size_t image_header_size = HM_FORMAT_IMAGE_HEADER_SIZE;
+
+HM_PUBLIC_API
+size_t HM_CDECL hm_u64map_image_size(const hm_u64map_database_t *db) {
+  return image_header_size + get_buckets(db) * sizeof(key_value_t);
+}
+
+HM_PUBLIC_API
+hm_error_t HM_CDECL hm_u64map_image_write(char *image, size_t image_size,
+                                          const hm_u64map_database_t *db) {
+  if (image_size < hm_u64map_image_size(db)) {
+    return HM_ERROR_SMALL_PLACE;
+  }
+
+  uint64_t buckets = get_buckets(db);
+
+  hm_format_write_image_header(image, HM_DB_U64MAP);
+  uint64_t *header = (uint64_t *)(image);
+  header[0] = db->factor1;
+  header[1] = db->factor2;
+  header[2] = buckets;
 
-  const key_value_t *hash_table0 = (const key_value_t *)(buffer);
+  key_value_t *hash_table2 = (key_value_t *)(image + image_header_size);
   for (int i = 0; i < buckets; i++) {
-    db->hash_table[i] = hash_table0[i];
+    hash_table2[i] = db->hash_table[i];
   }
 
-  debugf("factors: %d %d\n", db->factor1, db->factor2);
+  return HM_SUCCESS;
+}
 
-  debugf("hash_table: %p\n", db->hash_table);
+HM_PUBLIC_API
+size_t HM_CDECL hm_u64map_view_place_size(void) {
+  return sizeof(hm_u64map_database_t) + alignment;
+}
+
+HM_PUBLIC_API
+hm_error_t HM_CDECL hm_u64map_image_view(char *view_place,
+                                         size_t view_place_size,
+                                         hm_u64map_database_t **db_ptr,
+                                         const char *image, size_t image_size) {
+  if (((uintptr_t)(image) & (alignment - 1)) != 0) {
+    return HM_ERROR_BAD_ALIGNMENT;
+  }
+  if (image_size < image_header_size) {
+    return HM_ERROR_SMALL_PLACE;
+  }
+
+  hm_error_t hm_err = hm_format_check_image_header(image, HM_DB_U64MAP);
+  if (hm_err != HM_SUCCESS) {
+    return hm_err;
+  }
+
+  const uint64_t *header = (const uint64_t *)(image);
+  uint64_t buckets = header[2];
+  if (buckets < 16 || (buckets & (buckets - 1)) != 0 ||
+      (image_size - image_header_size) / sizeof(key_value_t) != buckets ||
+      (image_size - image_header_size) % sizeof(key_value_t) != 0) {
+    return HM_ERROR_BAD_SIZE;
+  }
+
+  // Align view_place forward, if needed.
+  {
+    char *view_place2 = align64(view_place);
+    view_place_size -= (view_place2 - view_place);
+    view_place = view_place2;
+  }
+
+  if (view_place_size < sizeof(hm_u64map_database_t)) {
+    return HM_ERROR_SMALL_PLACE;
+  }
+
+  hm_u64map_database_t *db = (hm_u64map_database_t *)(view_place);
+  *db_ptr = db;
+  db->factor1 = header[0];
+  db->factor2 = header[1];
+  db->mask_for_hash = buckets - 1 - 3;
+  db->kernels = select_kernels();
+  db->compile_attempts = 0;
+
+  // Lookups never write to the hash table, so the image can be read-only.
+  db->hash_table = (key_value_t *)(image + image_header_size);
 
   return HM_SUCCESS;
 }
@@ -2,6 +2,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include "crc32c.h"
+#include "database.h"
+#include "dispatch.h"
+#include "format.h"
 #include "static_uint64_set.h"
 
 #ifdef NDEBUG
@@ -16,6 +20,8 @@
 static const size_t items_in_bucket = 4;
 static const size_t alignment = 32;
 
+typedef struct hm_u64_kernels hm_u64_kernels_t;
+
 typedef struct hm_u64_database {
   // Hash table. Elements of the array are uint64 keys.
   uint64_t *hash_table;
@@ -25,8 +31,26 @@ typedef struct hm_u64_database {
 
   // Mask to go from hash64 to bucket index.
   uint64_t mask_for_hash;
+
+  // Lookup kernels selected for this CPU.
+  const hm_u64_kernels_t *kernels;
+
+  // Number of hash functions tried by compile, 0 if deserialized.
+  uint64_t compile_attempts;
+
+  // Padding to keep the hash table (which follows the struct) aligned.
+  uint64_t reserved[2];
 } hm_u64_database_t;
 
+_Static_assert(sizeof(hm_u64_database_t) % 32 == 0,
+               "hash table must stay aligned");
+
+struct hm_u64_kernels {
+  bool (*find)(const hm_u64_database_t *db, uint64_t key);
+  void (*find_batch)(const hm_u64_database_t *db, const uint64_t *keys,
+                     bool *found, size_t count);
+};
+
 // https://stackoverflow.com/a/6867612
 static inline uint64_t hm_u64_hash64(const hm_u64_database_t *db,
                                      uint64_t key) {
@@ -38,6 +62,123 @@ static inline uint64_t hm_u64_hash64(const hm_u64_database_t *db,
   return key;
 }
 
+// probe_* functions check if the key is in the group of 4 buckets starting
+// at b. Keys in a group are compared all at once.
+
+static HM_ALWAYS_INLINE bool probe_portable(const hm_u64_database_t *db,
+                                            uint64_t b, uint64_t key) {
+  return db->hash_table[b] == key || db->hash_table[b + 1] == key ||
+         db->hash_table[b + 2] == key || db->hash_table[b + 3] == key;
+}
+
+#ifdef HM_X86
+HM_TARGET_SSE42 static HM_ALWAYS_INLINE bool
+probe_sse42(const hm_u64_database_t *db, uint64_t b, uint64_t key) {
+  const __m128i *group = (const __m128i *)(db->hash_table + b);
+  __m128i needle = _mm_set1_epi64x(key);
+  __m128i eq_lo = _mm_cmpeq_epi64(_mm_loadu_si128(group), needle);
+  __m128i eq_hi = _mm_cmpeq_epi64(_mm_loadu_si128(group + 1), needle);
+  __m128i eq = _mm_or_si128(eq_lo, eq_hi);
+  return !_mm_testz_si128(eq, eq);
+}
+
+HM_TARGET_AVX2 static HM_ALWAYS_INLINE bool
+probe_avx2(const hm_u64_database_t *db, uint64_t b, uint64_t key) {
+  __m256i group = _mm256_loadu_si256((const __m256i *)(db->hash_table + b));
+  __m256i eq = _mm256_cmpeq_epi64(group, _mm256_set1_epi64x(key));
+  return !_mm256_testz_si256(eq, eq);
+}
+#endif
+
+// find_batch_template looks up keys block by block: it computes buckets of
+// the block and prefetches them first, so cache misses of the block overlap.
+static HM_ALWAYS_INLINE void
+find_batch_template(const hm_u64_database_t *db, const uint64_t *keys,
+                    bool *found, size_t count,
+                    bool (*probe)(const hm_u64_database_t *, uint64_t,
+                                  uint64_t)) {
+  uint64_t buckets[HM_BATCH_BLOCK];
+  for (size_t start = 0; start < count; start += HM_BATCH_BLOCK) {
+    size_t n = count - start;
+    if (n > HM_BATCH_BLOCK) {
+      n = HM_BATCH_BLOCK;
+    }
+    for (size_t i = 0; i < n; i++) {
+      buckets[i] = hm_u64_hash64(db, keys[start + i]) & db->mask_for_hash;
+      __builtin_prefetch(db->hash_table + buckets[i]);
+    }
+    for (size_t i = 0; i < n; i++) {
+      found[start + i] = probe(db, buckets[i], keys[start + i]);
+    }
+  }
+}
+
+static bool find_portable(const hm_u64_database_t *db, uint64_t key) {
+  return probe_portable(db, hm_u64_hash64(db, key) & db->mask_for_hash, key);
+}
+
+static void find_batch_portable(const hm_u64_database_t *db,
+                                const uint64_t *keys, bool *found,
+                                size_t count) {
+  find_batch_template(db, keys, found, count, probe_portable);
+}
+
+static const hm_u64_kernels_t kernels_portable = {
+    .find = find_portable,
+    .find_batch = find_batch_portable,
+};
+
+#ifdef HM_X86
+HM_TARGET_SSE42 static bool find_sse42(const hm_u64_database_t *db,
+                                       uint64_t key) {
+  return probe_sse42(db, hm_u64_hash64(db, key) & db->mask_for_hash, key);
+}
+
+HM_TARGET_SSE42 static void find_batch_sse42(const hm_u64_database_t *db,
+                                             const uint64_t *keys, bool *found,
+                                             size_t count) {
+  find_batch_template(db, keys, found, count, probe_sse42);
+}
+
+HM_TARGET_AVX2 static bool find_avx2(const hm_u64_database_t *db,
+                                     uint64_t key) {
+  return probe_avx2(db, hm_u64_hash64(db, key) & db->mask_for_hash, key);
+}
+
+HM_TARGET_AVX2 static void find_batch_avx2(const hm_u64_database_t *db,
+                                           const uint64_t *keys, bool *found,
+                                           size_t count) {
+  find_batch_template(db, keys, found, count, probe_avx2);
+}
+
+static const hm_u64_kernels_t kernels_sse42 = {
+    .find = find_sse42,
+    .find_batch = find_batch_sse42,
+};
+
+static const hm_u64_kernels_t kernels_avx2 = {
+    .find = find_avx2,
+    .find_batch = find_batch_avx2,
+};
+#endif
+
+// select_kernels returns the best kernels for the current CPU. A group of 4
+// keys fits into one AVX2 register, so AVX-512 uses the AVX2 kernels.
+static const hm_u64_kernels_t *select_kernels(void) {
+#ifdef HM_X86
+  switch (hm_kernel_level()) {
+  case HM_KERNEL_AVX512:
+  case HM_KERNEL_AVX2:
+    return &kernels_avx2;
+  case HM_KERNEL_SSE42:
+    return &kernels_sse42;
+  default:
+    break;
+  }
+#endif
+  return &kernels_portable;
+}
+
 static inline int round_up_to_power_of_2(int n) {
   int power = 1;
   while (power < n) {
@@ -86,11 +227,48 @@ size_t HM_CDECL hm_u64_db_place_size(unsigned int elements) {
 }
 
 static inline int comp_uint64(const void *elem1, const void *elem2) {
-  int f = *((uint64_t *)elem1);
-  int s = *((uint64_t *)elem2);
+  uint64_t f = *((const uint64_t *)elem1);
+  uint64_t s = *((const uint64_t *)elem2);
   return (f > s) - (f < s);
 }
 
+// place_fillers changes empty buckets in the group to which 0 maps to some
+// value which is not 0 and not mapped there (not to create a false positive).
+static void place_fillers(hm_u64_database_t *db) {
+  uint64_t h0 = hm_u64_hash64(db, 0);
+  uint64_t b = h0 & db->mask_for_hash;
+  for (uint64_t shift = 0; shift < items_in_bucket; shift++) {
+    uint64_t b0 = b + shift;
+    if (db->hash_table[b0] == 0) {
+      while (true) {
+        db->hash_table[b0]++;
+        uint64_t h1 = hm_u64_hash64(db, db->hash_table[b0]);
+        uint64_t b1 = h1 & db->mask_for_hash;
+        if (b1 != (b0 & db->mask_for_hash)) {
+          break;
+        }
+      }
+    }
+  }
+}
+
+// is_key returns true if bucket b has a key, i.e. it is not empty and does not
+// have a filler put to the group to which 0 maps. A filler never maps to the
+// group it is stored in.
+static inline bool is_key(const hm_u64_database_t *db, uint64_t b) {
+  uint64_t key = db->hash_table[b];
+  return key != 0 && (hm_u64_hash64(db, key) & db->mask_for_hash) ==
+                         (b & ~(uint64_t)(items_in_bucket - 1));
+}
+
+// sort_groups sorts keys inside groups of buckets for speed.
+static void sort_groups(hm_u64_database_t *db) {
+  uint64_t buckets = get_buckets(db);
+  for (uint64_t b = 0; b < buckets; b += items_in_bucket) {
+    qsort(db->hash_table + b, items_in_bucket, sizeof(uint64_t), comp_uint64);
+  }
+}
+
 HM_PUBLIC_API
 hm_error_t HM_CDECL hm_u64_compile(char *db_place, size_t db_place_size,
                                    hm_u64_database_t **db_ptr,
@@ -124,12 +302,11 @@ hm_error_t HM_CDECL hm_u64_compile(char *db_place, size_t db_place_size,
   // Fill database struct and db_ptr.
   hm_u64_database_t *db = (hm_u64_database_t *)(db_place);
   db->mask_for_hash = buckets - 1 - 3;
+  db->kernels = select_kernels();
   *db_ptr = db;
   db_place += sizeof(hm_u64_database_t);
 
   db->hash_table = (uint64_t *)(db_place);
-  db_place += sizeof(uint64_t) * buckets;
-  uint64_t *hash_table_end = (uint64_t *)(db_place);
 
   // Initiate the hash function with some random values.
   db->factor1 = 0xA6C3096657A14E89;
@@ -141,7 +318,10 @@ hm_error_t HM_CDECL hm_u64_compile(char *db_place, size_t db_place_size,
 
   // Find factor1 and factor2 not resulting in hash collisions overflowing
   // grouped buckets. At the same time check that all the elements are unique.
+  db->compile_attempts = 0;
   while (true) {
+    db->compile_attempts++;
+
     // Clear the hash table.
     clear_hash_table(db);
 
@@ -181,30 +361,8 @@ hm_error_t HM_CDECL hm_u64_compile(char *db_place, size_t db_place_size,
     db->factor2 = hm_u64_hash64(db, keys[0]);
   }
 
-  // Now we should change the value stored in the bucket to which 0 maps
-  // to some value which is not 0 and not mapped there (not to create a false
-  // positive).
-  uint64_t h0 = hm_u64_hash64(db, 0);
-  uint64_t b = h0 & db->mask_for_hash;
-  for (uint64_t shift = 0; shift < items_in_bucket; shift++) {
-    uint64_t b0 = b + shift;
-    if (db->hash_table[b0] == 0) {
-      while (true) {
-        db->hash_table[b0]++;
-        uint64_t h1 = hm_u64_hash64(db, db->hash_table[b0]);
-        uint64_t b1 = h1 & db->mask_for_hash;
-        if (b1 != (b0 & db->mask_for_hash)) {
-          break;
-        }
-      }
-    }
-  }
-
-  // Sort values insude buckets fot speed.
-  for (uint64_t *start = db->hash_table; start < hash_table_end;
-       start += items_in_bucket) {
-    qsort(start, items_in_bucket, sizeof(uint64_t), comp_uint64);
-  }
+  place_fillers(db);
+  sort_groups(db);
 
   debugf("compile factors: %d %d\n", db->factor1, db->factor2);
   debugf("hash_table: %p\n", db->hash_table);
@@ -214,10 +372,14 @@ hm_error_t HM_CDECL hm_u64_compile(char *db_place, size_t db_place_size,
 
 HM_PUBLIC_API
 bool HM_CDECL hm_u64_find(const hm_u64_database_t *db, const uint64_t key) {
-  uint64_t h = hm_u64_hash64(db, key);
-  uint64_t b = h & db->mask_for_hash;
-  return db->hash_table[b] == key || db->hash_table[b + 1] == key ||
-         db->hash_table[b + 2] == key || db->hash_table[b + 3] == key;
+  return db->kernels->find(db, key);
+}
+
+HM_PUBLIC_API
+void HM_CDECL hm_u64_find_batch(const hm_u64_database_t *db,
+                                const uint64_t *keys, bool *found,
+                                size_t count) {
+  db->kernels->find_batch(db, keys, found, count);
 }
 
 HM_PUBLIC_API
@@ -231,79 +393,412 @@ uint64_t HM_CDECL hm_u64_benchmark(const hm_u64_database_t *db,
   return count;
 }
 
-// Serialized form: factor1, factor2, buckets, then hash_table.
+HM_PUBLIC_API
+void HM_CDECL hm_u64_stats(const hm_u64_database_t *db, hm_u64_stats_t *stats) {
+  uint64_t buckets = get_buckets(db);
+
+  *stats = (hm_u64_stats_t){0};
+  for (uint64_t group = 0; group < buckets; group += items_in_bucket) {
+    size_t keys_in_group = 0;
+    for (uint64_t i = group; i < group + items_in_bucket; i++) {
+      if (is_key(db, i)) {
+        keys_in_group++;
+      }
+    }
+    stats->group_histogram[keys_in_group]++;
+    stats->elements += keys_in_group;
+  }
+
+  stats->buckets = buckets;
+  stats->load_factor = (double)(stats->elements) / buckets;
+  stats->compile_attempts = db->compile_attempts;
+  stats->header_bytes = sizeof(hm_u64_database_t);
+  stats->hash_table_bytes = buckets * sizeof(uint64_t);
+  stats->total_bytes = stats->header_bytes + stats->hash_table_bytes;
+}
+
+HM_PUBLIC_API
+void HM_CDECL hm_u64_view(const hm_u64_database_t *db, hm_u64_view_t *view) {
+  *view = (hm_u64_view_t){
+      .hash_table = db->hash_table,
+      .buckets = get_buckets(db),
+      .factor1 = db->factor1,
+      .factor2 = db->factor2,
+      .mask_for_hash = db->mask_for_hash,
+  };
+}
+
+// Serialized form: header (see format.h), then payload of uint64 numbers:
+// factor1, factor2, buckets, then hash_table.
+static const size_t payload_header_size = 3 * sizeof(uint64_t);
 
 HM_PUBLIC_API
 size_t HM_CDECL hm_u64_serialized_size(const hm_u64_database_t *db) {
-  return (3 + get_buckets(db)) * sizeof(uint64_t);
+  return HM_FORMAT_HEADER_SIZE + payload_header_size +
+         get_buckets(db) * sizeof(uint64_t);
 }
 
 HM_PUBLIC_API
 hm_error_t HM_CDECL hm_u64_serialize(char *buffer, size_t buffer_size,
                                      const hm_u64_database_t *db) {
-  if (buffer_size < hm_u64_serialized_size(db)) {
+  size_t serialized_size = hm_u64_serialized_size(db);
+  if (buffer_size < serialized_size) {
     return HM_ERROR_SMALL_PLACE;
   }
 
   uint64_t buckets = get_buckets(db);
 
-  uint64_t *dst = (uint64_t *)(buffer);
-  *dst = db->factor1;
-  dst++;
-  *dst = db->factor2;
-  dst++;
-  *dst = buckets;
+  char *payload = buffer + HM_FORMAT_HEADER_SIZE;
+  hm_store_le64(payload, db->factor1);
+  hm_store_le64(payload + sizeof(uint64_t), db->factor2);
+  hm_store_le64(payload + 2 * sizeof(uint64_t), buckets);
+  hm_store_le64_array(payload + payload_header_size, db->hash_table, buckets);
 
-  buffer += 3 * sizeof(uint64_t);
+  hm_format_write_header(buffer, HM_DB_U64,
+                         serialized_size - HM_FORMAT_HEADER_SIZE);
 
-  uint64_t *hash_table2 = (uint64_t *)(buffer);
-  for (int i = 0; i < buckets; i++) {
-    hash_table2[i] = db->hash_table[i];
-  }
+  return HM_SUCCESS;
+}
 
+// check_buckets checks the number of buckets from the payload of the given
+// size.
+static hm_error_t check_buckets(uint64_t buckets, size_t payload_size) {
+  if (buckets == 0) {
+    return HM_ERROR_NO_MASKS;
+  }
+  if (buckets < 16 || (buckets & (buckets - 1)) != 0 ||
+      (payload_size - payload_header_size) / sizeof(uint64_t) != buckets ||
+      (payload_size - payload_header_size) % sizeof(uint64_t) != 0) {
+    return HM_ERROR_BAD_SIZE;
+  }
   return HM_SUCCESS;
 }
 
+// read_serialized checks the serialized db and returns its payload and number
+// of buckets.
+static hm_error_t read_serialized(const char *buffer, size_t buffer_size,
+                                  bool check_payload, const char **payload,
+                                  uint64_t *buckets) {
+  size_t payload_size;
+  hm_error_t err = hm_format_read_header(buffer, buffer_size, HM_DB_U64,
+                                         check_payload, payload, &payload_size);
+  if (err != HM_SUCCESS) {
+    return err;
+  }
+  if (payload_size < payload_header_size) {
+    return HM_ERROR_BAD_SIZE;
+  }
+
+  *buckets = hm_load_le64(*payload + 2 * sizeof(uint64_t));
+  return check_buckets(*buckets, payload_size);
+}
+
 HM_PUBLIC_API
 hm_error_t HM_CDECL hm_u64_db_place_size_from_serialized(size_t *db_place_size,
                                                          const char *buffer,
                                                          size_t buffer_size) {
-  if (buffer_size <= 3 * sizeof(uint64_t)) {
+  const char *payload;
+  uint64_t buckets;
+  hm_error_t err =
+      read_serialized(buffer, buffer_size, false, &payload, &buckets);
+  if (err != HM_SUCCESS) {
+    return err;
+  }
+
+  *db_place_size = get_db_place(buckets);
+
+  return HM_SUCCESS;
+}
+
+HM_PUBLIC_API
+hm_error_t HM_CDECL hm_u64_deserialize(char *db_place, size_t db_place_size,
+                                       hm_u64_database_t **db_ptr,
+                                       const char *buffer, size_t buffer_size) {
+  return hm_u64_deserialize_ex(db_place, db_place_size, db_ptr, buffer,
+                               buffer_size, NULL);
+}
+
+HM_PUBLIC_API
+hm_error_t HM_CDECL hm_u64_deserialize_ex(
+    char *db_place, size_t db_place_size, hm_u64_database_t **db_ptr,
+    const char *buffer, size_t buffer_size,
+    const hm_load_options_t *options) {
+  const char *payload;
+  uint64_t buckets;
+  hm_error_t err =
+      read_serialized(buffer, buffer_size, false, &payload, &buckets);
+  if (err != HM_SUCCESS) {
+    return err;
+  }
+  size_t min_db_place_size = get_db_place(buckets);
+
+  // Align db_place forward, if needed.
+  {
+    char *db_place2 = align32(db_place);
+    db_place_size -= (db_place2 - db_place);
+    db_place = db_place2;
+  }
+
+  if (db_place_size < min_db_place_size - alignment) {
+    return HM_ERROR_SMALL_PLACE;
+  }
+
+  hm_u64_database_t *db = (hm_u64_database_t *)(db_place);
+  *db_ptr = db;
+  db->hash_table = (uint64_t *)(db_place + sizeof(hm_u64_database_t));
+
+  // The payload is checksummed while it is copied.
+  uint32_t crc = hm_crc32c(0, payload, payload_header_size);
+  hm_load_array(db->hash_table, payload + payload_header_size, buckets,
+                sizeof(uint64_t), options, &crc);
+  err = hm_format_check_crc(buffer, crc);
+  if (err != HM_SUCCESS) {
+    return err;
+  }
+
+  db->factor1 = hm_load_le64(payload);
+  db->factor2 = hm_load_le64(payload + sizeof(uint64_t));
+  db->mask_for_hash = buckets - 1 - 3;
+  db->kernels = select_kernels();
+  db->compile_attempts = 0;
+
+  debugf("factors: %d %d\n", db->factor1, db->factor2);
+
+  debugf("hash_table: %p\n", db->hash_table);
+
+  return hm_load_lock(db_place, min_db_place_size - alignment, options);
+}
+
+// read_serialized_fd reads and checks the header and the payload header of
+// the db serialized to fd, unless they are in header already. crc is started
+// with the payload header.
+static hm_error_t read_serialized_fd(int fd, hm_fd_header_t *header,
+                                     uint64_t payload_header[3],
+                                     uint32_t *crc) {
+  size_t payload_size;
+  hm_error_t err = hm_format_read_start_fd(fd, HM_DB_U64, header,
+                                           payload_header_size, &payload_size,
+                                           crc);
+  if (err != HM_SUCCESS) {
+    return err;
+  }
+  hm_load_le64_array(payload_header, header->data + HM_FORMAT_HEADER_SIZE, 3);
+  return check_buckets(payload_header[2], payload_size);
+}
+
+HM_PUBLIC_API
+hm_error_t HM_CDECL hm_u64_serialize_fd(int fd, const hm_u64_database_t *db) {
+  uint64_t buckets = get_buckets(db);
+  uint64_t payload_header[3] = {db->factor1, db->factor2, buckets};
+  hm_format_segment_t segments[] = {
+      {payload_header, 3, sizeof(uint64_t)},
+      {db->hash_table, buckets, sizeof(uint64_t)},
+  };
+  return hm_format_write_fd(fd, HM_DB_U64, segments, 2);
+}
+
+HM_PUBLIC_API
+hm_error_t HM_CDECL hm_u64_db_place_size_from_fd(size_t *db_place_size,
+                                                 hm_fd_header_t *header,
+                                                 int fd) {
+  uint64_t payload_header[3];
+  uint32_t crc;
+  hm_error_t err = read_serialized_fd(fd, header, payload_header, &crc);
+  if (err != HM_SUCCESS) {
+    return err;
+  }
+
+  *db_place_size = get_db_place(payload_header[2]);
+
+  return HM_SUCCESS;
+}
+
+HM_PUBLIC_API
+hm_error_t HM_CDECL hm_u64_deserialize_fd(char *db_place,
+                                          size_t db_place_size,
+                                          hm_u64_database_t **db_ptr,
+                                          hm_fd_header_t *header, int fd) {
+  uint64_t payload_header[3];
+  uint32_t crc;
+  hm_error_t err = read_serialized_fd(fd, header, payload_header, &crc);
+  if (err != HM_SUCCESS) {
+    return err;
+  }
+  uint64_t buckets = payload_header[2];
+  size_t min_db_place_size = get_db_place(buckets);
+
+  // Align db_place forward, if needed.
+  {
+    char *db_place2 = align32(db_place);
+    db_place_size -= (db_place2 - db_place);
+    db_place = db_place2;
+  }
+
+  if (db_place_size < min_db_place_size - alignment) {
     return HM_ERROR_SMALL_PLACE;
   }
 
-  const uint64_t *src = (const uint64_t *)(buffer);
+  hm_u64_database_t *db = (hm_u64_database_t *)(db_place);
+  *db_ptr = db;
+  db_place += sizeof(hm_u64_database_t);
+  db->hash_table = (uint64_t *)(db_place);
 
-  // Skip factor1 and factor2.
-  src++;
-  src++;
+  // The hash table is read right into its place.
+  err = hm_format_read_fd(fd, db->hash_table, buckets, sizeof(uint64_t), &crc);
+  if (err != HM_SUCCESS) {
+    return err;
+  }
+  err = hm_format_check_crc(header->data, crc);
+  if (err != HM_SUCCESS) {
+    return err;
+  }
 
-  uint64_t buckets = *src;
+  db->factor1 = payload_header[0];
+  db->factor2 = payload_header[1];
+  db->mask_for_hash = buckets - 1 - 3;
+  db->kernels = select_kernels();
+  db->compile_attempts = 0;
 
-  if (buckets == 0) {
-    return HM_ERROR_NO_MASKS;
+  return HM_SUCCESS;
+}
+
+// Packed form: header (see format.h), then payload:
+// uint64_t factor1
+// uint64_t factor2
+// varint buckets
+// varint number of keys
+// varints of deltas between sorted keys, starting from 0.
+// Unpacking puts the keys into the hash table with the same factors, so it
+// does not search for factors again.
+static const size_t packed_header_size = 2 * sizeof(uint64_t);
+
+static size_t count_keys(const hm_u64_database_t *db) {
+  uint64_t buckets = get_buckets(db);
+  size_t count = 0;
+  for (uint64_t b = 0; b < buckets; b++) {
+    count += is_key(db, b);
   }
+  return count;
+}
 
-  size_t min_buffer_size = (3 + buckets) * sizeof(uint64_t);
-  if (buffer_size < min_buffer_size) {
+static inline size_t packed_max_size(size_t count) {
+  return HM_FORMAT_HEADER_SIZE + packed_header_size +
+         (2 + count) * HM_VARINT_MAX_SIZE;
+}
+
+HM_PUBLIC_API
+size_t HM_CDECL hm_u64_packed_max_size(const hm_u64_database_t *db) {
+  return packed_max_size(count_keys(db));
+}
+
+HM_PUBLIC_API
+hm_error_t HM_CDECL hm_u64_pack(char *buffer, size_t buffer_size,
+                                const hm_u64_database_t *db,
+                                size_t *packed_size) {
+  size_t count = count_keys(db);
+  if (buffer_size < packed_max_size(count)) {
     return HM_ERROR_SMALL_PLACE;
   }
 
+  uint64_t buckets = get_buckets(db);
+  uint64_t *keys = malloc(count * sizeof(uint64_t));
+  if (keys == NULL) {
+    return HM_ERROR_NO_MEMORY;
+  }
+  size_t i = 0;
+  for (uint64_t b = 0; b < buckets; b++) {
+    if (is_key(db, b)) {
+      keys[i++] = db->hash_table[b];
+    }
+  }
+  qsort(keys, count, sizeof(uint64_t), comp_uint64);
+
+  char *dst = buffer + HM_FORMAT_HEADER_SIZE;
+  hm_store_le64(dst, db->factor1);
+  hm_store_le64(dst + sizeof(uint64_t), db->factor2);
+  dst += packed_header_size;
+  dst += hm_store_varint(dst, buckets);
+  dst += hm_store_varint(dst, count);
+  uint64_t prev_key = 0;
+  for (i = 0; i < count; i++) {
+    dst += hm_store_varint(dst, keys[i] - prev_key);
+    prev_key = keys[i];
+  }
+  free(keys);
+
+  *packed_size = dst - buffer;
+  hm_format_write_header(buffer, HM_DB_U64 | HM_FORMAT_PACKED,
+                         *packed_size - HM_FORMAT_HEADER_SIZE);
+
+  return HM_SUCCESS;
+}
+
+// read_packed checks the packed db, reads the numbers before the keys and
+// leaves src at the first key.
+static hm_error_t read_packed(const char *buffer, size_t buffer_size,
+                              bool check_payload, const char **src,
+                              const char **end, uint64_t *buckets,
+                              uint64_t *count) {
+  const char *payload;
+  size_t payload_size;
+  hm_error_t err = hm_format_read_header(
+      buffer, buffer_size, HM_DB_U64 | HM_FORMAT_PACKED, check_payload,
+      &payload, &payload_size);
+  if (err != HM_SUCCESS) {
+    return err;
+  }
+  if (payload_size < packed_header_size) {
+    return HM_ERROR_BAD_SIZE;
+  }
+  *src = payload + packed_header_size;
+  *end = payload + payload_size;
+
+  if (!hm_load_varint(src, *end, buckets) ||
+      !hm_load_varint(src, *end, count)) {
+    return HM_ERROR_BAD_FORMAT;
+  }
+  if (*buckets == 0 || *count == 0) {
+    return HM_ERROR_NO_MASKS;
+  }
+  // Each key takes at least one byte.
+  if (*buckets < 16 || *buckets > (1u << 30) ||
+      (*buckets & (*buckets - 1)) != 0 || *count > *buckets ||
+      *count > (uint64_t)(*end - *src)) {
+    return HM_ERROR_BAD_SIZE;
+  }
+
+  return HM_SUCCESS;
+}
+
+HM_PUBLIC_API
+hm_error_t HM_CDECL hm_u64_db_place_size_from_packed(size_t *db_place_size,
+                                                     const char *buffer,
+                                                     size_t buffer_size) {
+  const char *src, *end;
+  uint64_t buckets, count;
+  hm_error_t err = read_packed(buffer, buffer_size, false, &src, &end,
+                               &buckets, &count);
+  if (err != HM_SUCCESS) {
+    return err;
+  }
+
   *db_place_size = get_db_place(buckets);
 
   return HM_SUCCESS;
 }
 
 HM_PUBLIC_API
-hm_error_t HM_CDECL hm_u64_deserialize(char *db_place, size_t db_place_size,
-                                       hm_u64_database_t **db_ptr,
-                                       const char *buffer, size_t buffer_size) {
-  size_t min_db_place_size;
-  hm_error_t err = hm_u64_db_place_size_from_serialized(&min_db_place_size,
-                                                        buffer, buffer_size);
+hm_error_t HM_CDECL hm_u64_unpack(char *db_place, size_t db_place_size,
+                                  hm_u64_database_t **db_ptr,
+                                  const char *buffer, size_t buffer_size) {
+  const char *src, *end;
+  uint64_t buckets, count;
+  hm_error_t err = read_packed(buffer, buffer_size, true, &src, &end,
+                               &buckets, &count);
   if (err != HM_SUCCESS) {
     return err;
   }
+  size_t min_db_place_size = get_db_place(buckets);
 
   // Align db_place forward, if needed.
   {
@@ -316,29 +811,129 @@ hm_error_t HM_CDECL hm_u64_deserialize(char *db_place, size_t db_place_size,
     return HM_ERROR_SMALL_PLACE;
   }
 
-  const uint64_t *src = (const uint64_t *)(buffer);
   hm_u64_database_t *db = (hm_u64_database_t *)(db_place);
   *db_ptr = db;
-  db->factor1 = *src;
-  src++;
-  db->factor2 = *src;
-  src++;
-  uint64_t buckets = *src;
+  db->factor1 = hm_load_le64(buffer + HM_FORMAT_HEADER_SIZE);
+  db->factor2 = hm_load_le64(buffer + HM_FORMAT_HEADER_SIZE + sizeof(uint64_t));
   db->mask_for_hash = buckets - 1 - 3;
+  db->kernels = select_kernels();
+  db->compile_attempts = 0;
+  db->hash_table = (uint64_t *)(db_place + sizeof(hm_u64_database_t));
+  clear_hash_table(db);
+
+  // Keys are sorted, so they are unique. The factors were chosen by compile,
+  // so the groups do not overflow unless the buffer is forged.
+  uint64_t key = 0;
+  for (uint64_t i = 0; i < count; i++) {
+    uint64_t delta;
+    if (!hm_load_varint(&src, end, &delta) || delta == 0 ||
+        delta > UINT64_MAX - key) {
+      return HM_ERROR_BAD_FORMAT;
+    }
+    key += delta;
+    uint64_t b = hm_u64_hash64(db, key) & db->mask_for_hash;
+    uint64_t shift = 0;
+    while (shift < items_in_bucket && db->hash_table[b + shift] != 0) {
+      shift++;
+    }
+    if (shift == items_in_bucket) {
+      return HM_ERROR_BAD_FORMAT;
+    }
+    db->hash_table[b + shift] = key;
+  }
+  if (src != end) {
+    return HM_ERROR_BAD_SIZE;
+  }
 
-  buffer += 3 * sizeof(uint64_t);
-  db_place += sizeof(hm_u64_database_t);
+  place_fillers(db);
+  sort_groups(db);
 
-  db->hash_table = (uint64_t *)(db_place);
+  return HM_SUCCESS;
+}
 
-  const uint64_t *hash_table0 = (const uint64_t *)(buffer);
+// Image form: 64 byte header (factor1, factor2, buckets, see format.h), then
+// hash_table. Unlike the serialized form, the hash table stays aligned and is
+// used in place by hm_u64_image_view.
+static const size_t image_header_size = HM_FORMAT_IMAGE_HEADER_SIZE;
+
+HM_PUBLIC_API
+size_t HM_CDECL hm_u64_image_size(const hm_u64_database_t *db) {
+  return image_header_size + get_buckets(db) * sizeof(uint64_t);
+}
+
+HM_PUBLIC_API
+hm_error_t HM_CDECL hm_u64_image_write(char *image, size_t image_size,
+                                      const hm_u64_database_t *db) {
+  if (image_size < hm_u64_image_size(db)) {
+    return HM_ERROR_SMALL_PLACE;
+  }
+
+  uint64_t buckets = get_buckets(db);
+
+  hm_format_write_image_header(image, HM_DB_U64);
+  uint64_t *header = (uint64_t *)(image);
+  header[0] = db->factor1;
+  header[1] = db->factor2;
+  header[2] = buckets;
+
+  uint64_t *hash_table2 = (uint64_t *)(image + image_header_size);
   for (int i = 0; i < buckets; i++) {
-    db->hash_table[i] = hash_table0[i];
+    hash_table2[i] = db->hash_table[i];
   }
 
-  debugf("factors: %d %d\n", db->factor1, db->factor2);
+  return HM_SUCCESS;
+}
 
-  debugf("hash_table: %p\n", db->hash_table);
+HM_PUBLIC_API
+size_t HM_CDECL hm_u64_view_place_size(void) {
+  return sizeof(hm_u64_database_t) + alignment;
+}
+
+HM_PUBLIC_API
+hm_error_t HM_CDECL hm_u64_image_view(char *view_place, size_t view_place_size,
+                                     hm_u64_database_t **db_ptr,
+                                     const char *image, size_t image_size) {
+  if (((uintptr_t)(image) & (alignment - 1)) != 0) {
+    return HM_ERROR_BAD_ALIGNMENT;
+  }
+  if (image_size < image_header_size) {
+    return HM_ERROR_SMALL_PLACE;
+  }
+
+  hm_error_t hm_err = hm_format_check_image_header(image, HM_DB_U64);
+  if (hm_err != HM_SUCCESS) {
+    return hm_err;
+  }
+
+  const uint64_t *header = (const uint64_t *)(image);
+  uint64_t buckets = header[2];
+  if (buckets < 16 || (buckets & (buckets - 1)) != 0 ||
+      (image_size - image_header_size) / sizeof(uint64_t) != buckets ||
+      (image_size - image_header_size) % sizeof(uint64_t) != 0) {
+    return HM_ERROR_BAD_SIZE;
+  }
+
+  // Align view_place forward, if needed.
+  {
+    char *view_place2 = align32(view_place);
+    view_place_size -= (view_place2 - view_place);
+    view_place = view_place2;
+  }
+
+  if (view_place_size < sizeof(hm_u64_database_t)) {
+    return HM_ERROR_SMALL_PLACE;
+  }
+
+  hm_u64_database_t *db = (hm_u64_database_t *)(view_place);
+  *db_ptr = db;
+  db->factor1 = header[0];
+  db->factor2 = header[1];
+  db->mask_for_hash = buckets - 1 - 3;
+  db->kernels = select_kernels();
+  db->compile_attempts = 0;
+
+  // Lookups never write to the hash table, so the image can be read-only.
+  db->hash_table = (uint64_t *)(image + image_header_size);
 
   return HM_SUCCESS;
 }
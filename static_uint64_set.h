@@ -5,6 +5,7 @@
 #include <stdint.h>
 
 #include "common.h"
+#include "load.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -15,6 +16,45 @@ struct hm_u64_database;
 // hm_u64_database_t is in-memory database type for static set of uint64.
 typedef struct hm_u64_database hm_u64_database_t;
 
+// hm_u64_stats_t describes the layout and memory usage of a database.
+typedef struct hm_u64_stats {
+  // Number of keys stored in the database.
+  size_t elements;
+
+  // Number of buckets in the hash table. Buckets form groups of 4, a key can
+  // be stored in any bucket of its group.
+  size_t buckets;
+
+  // elements / buckets.
+  double load_factor;
+
+  // group_histogram[i] is the number of groups of 4 buckets holding i keys.
+  size_t group_histogram[5];
+
+  // Number of hash functions tried by compile before all groups had at most
+  // 4 keys. It is 0 if the database was deserialized.
+  unsigned int compile_attempts;
+
+  // Bytes used by the database struct and the hash table.
+  size_t header_bytes;
+  size_t hash_table_bytes;
+
+  // Sum of the above. db_place also has space for alignment.
+  size_t total_bytes;
+} hm_u64_stats_t;
+
+// hm_u64_view_t exposes the hash table searched by hm_u64_find, so lookups
+// can be reimplemented outside of the library over the same memory. key is
+// present if it is one of the 4 buckets starting at hash & mask_for_hash,
+// where hash is computed by hm_u64_hash64 of static_uint64_set.c with factor1
+// and factor2. Empty buckets are 0, and 0 is never found.
+typedef struct hm_u64_view {
+  const uint64_t *hash_table;
+  size_t buckets;
+  uint64_t factor1, factor2;
+  uint64_t mask_for_hash;
+} hm_u64_view_t;
+
 // hm_u64_db_place_size returns db_place size for static set of uint64.
 size_t HM_CDECL hm_u64_db_place_size(unsigned int elements);
 
@@ -30,22 +70,38 @@ hm_error_t HM_CDECL hm_u64_compile(char *db_place, size_t db_place_size,
 // hm_u64_find returns if the given uint64 key is present in the database.
 bool HM_CDECL hm_u64_find(const hm_u64_database_t *db, const uint64_t key);
 
+// hm_u64_find_batch looks up count keys and stores in found[i] if keys[i] is
+// present in the database. It is faster than calling hm_u64_find in a loop,
+// because memory accesses of neighbouring keys overlap.
+void HM_CDECL hm_u64_find_batch(const hm_u64_database_t *db,
+                                const uint64_t *keys, bool *found,
+                                size_t count);
+
 // hm_u64_benchmark runs hm_u64_find on a range of inputs and returns the number
 // of hits. It is used to microbenchmark the search.
 uint64_t HM_CDECL hm_u64_benchmark(const hm_u64_database_t *db,
                                    uint64_t begin_key, uint64_t end_key);
 
+// hm_u64_stats fills stats of the database. It walks the whole hash table, so
+// it is not intended for hot paths.
+void HM_CDECL hm_u64_stats(const hm_u64_database_t *db, hm_u64_stats_t *stats);
+
+// hm_u64_view fills view of the database. The pointer points into db_place.
+void HM_CDECL hm_u64_view(const hm_u64_database_t *db, hm_u64_view_t *view);
+
 // hm_u64_serialized_size returns how many bytes are needed to serialize the db.
 size_t HM_CDECL hm_u64_serialized_size(const hm_u64_database_t *db);
 
 // hm_u64_serialize serializes db to buffer.
 // Buffer size must be the equal to the one returned by hm_u64_serialized_size.
-// It can be stored and loaded in machine with the same endianess.
+// The serialized form starts with a header with format version and checksums
+// and is little endian, so it can be loaded on any machine.
 hm_error_t HM_CDECL hm_u64_serialize(char *buffer, size_t buffer_size,
                                      const hm_u64_database_t *db);
 
 // hm_u64_db_place_size_from_serialized returns size needed for db_place
-// using the buffer with serialized db as an input.
+// using the buffer with serialized db as an input. It checks the header, but
+// not the checksum of the data, which is checked by hm_u64_deserialize.
 hm_error_t HM_CDECL hm_u64_db_place_size_from_serialized(size_t *db_place_size,
                                                          const char *buffer,
                                                          size_t buffer_size);
@@ -55,10 +111,93 @@ hm_error_t HM_CDECL hm_u64_db_place_size_from_serialized(size_t *db_place_size,
 // hm_u64_db_place_size_from_serialized. After a successfull call db_ptr points
 // to a pointer to hm_u64_database_t structure, which can be used in hm_u64_find
 // calls. db_place can be modified during the call.
+// Returns HM_ERROR_BAD_FORMAT if the buffer is not a serialized db of this
+// type or version and HM_ERROR_BAD_CHECKSUM if it is corrupted.
 hm_error_t HM_CDECL hm_u64_deserialize(char *db_place, size_t db_place_size,
                                        hm_u64_database_t **db_ptr,
                                        const char *buffer, size_t buffer_size);
 
+// hm_u64_deserialize_ex is hm_u64_deserialize with options for large dbs, see
+// load.h. options can be NULL.
+hm_error_t HM_CDECL hm_u64_deserialize_ex(char *db_place, size_t db_place_size,
+                                          hm_u64_database_t **db_ptr,
+                                          const char *buffer,
+                                          size_t buffer_size,
+                                          const hm_load_options_t *options);
+
+// hm_u64_serialize_fd writes the serialized form of db to fd without a buffer
+// of the whole db, so saving takes constant extra memory. fd can be a file,
+// a pipe or a socket. Returns HM_ERROR_SYSTEM with errno set if writing
+// fails, in which case a part of the db may have been written.
+hm_error_t HM_CDECL hm_u64_serialize_fd(int fd, const hm_u64_database_t *db);
+
+// hm_u64_db_place_size_from_fd is hm_u64_db_place_size_from_serialized for
+// the db serialized to fd, which is read from its current position. It reads
+// only the beginning of the db and keeps it in header, see hm_fd_header_t.
+hm_error_t HM_CDECL hm_u64_db_place_size_from_fd(size_t *db_place_size,
+                                                 hm_fd_header_t *header,
+                                                 int fd);
+
+// hm_u64_deserialize_fd is hm_u64_deserialize reading the rest of the
+// serialized db after header from fd right into db_place, so loading takes
+// constant extra memory. fd is read sequentially, so it can be a file, a pipe
+// or a socket. header and db_place_size must be the ones filled by
+// hm_u64_db_place_size_from_fd. Returns HM_ERROR_SYSTEM with errno set if
+// reading fails.
+hm_error_t HM_CDECL hm_u64_deserialize_fd(char *db_place, size_t db_place_size,
+                                          hm_u64_database_t **db_ptr,
+                                          hm_fd_header_t *header, int fd);
+
+// hm_u64_packed_max_size returns the size of buffer sufficient for
+// hm_u64_pack.
+size_t HM_CDECL hm_u64_packed_max_size(const hm_u64_database_t *db);
+
+// hm_u64_pack writes db to buffer in packed form, which is much smaller than
+// the serialized form and is intended for transfers. Instead of the hash table
+// it stores the factors of the hash function and the sorted keys as
+// delta encoded varints. The size of the packed db is stored to packed_size.
+// Buffer size must be at least hm_u64_packed_max_size. Like the serialized
+// form, it has a header with checksums and can be loaded on any machine.
+hm_error_t HM_CDECL hm_u64_pack(char *buffer, size_t buffer_size,
+                                const hm_u64_database_t *db,
+                                size_t *packed_size);
+
+// hm_u64_db_place_size_from_packed returns size needed for db_place using
+// the buffer with packed db as an input.
+hm_error_t HM_CDECL hm_u64_db_place_size_from_packed(size_t *db_place_size,
+                                                     const char *buffer,
+                                                     size_t buffer_size);
+
+// hm_u64_unpack loads db from buffer with packed db. db_place_size must be
+// equal to the one returned by hm_u64_db_place_size_from_packed. The hash
+// table is rebuilt with the stored factors, which is much faster than
+// compilation. Returns the same errors as hm_u64_deserialize.
+hm_error_t HM_CDECL hm_u64_unpack(char *db_place, size_t db_place_size,
+                                  hm_u64_database_t **db_ptr,
+                                  const char *buffer, size_t buffer_size);
+
+// hm_u64_image_size returns how many bytes are needed for the image of db.
+size_t HM_CDECL hm_u64_image_size(const hm_u64_database_t *db);
+
+// hm_u64_image_write writes the image of db to image. The image is the memory
+// layout of db without pointers, so it can be used in place from another
+// address or process, e.g. mapped from shared memory. Unlike the
+// serialized form, it can only be used on a machine with the same endianess.
+hm_error_t HM_CDECL hm_u64_image_write(char *image, size_t image_size,
+                                      const hm_u64_database_t *db);
+
+// hm_u64_view_place_size returns view_place size for hm_u64_image_view.
+size_t HM_CDECL hm_u64_view_place_size(void);
+
+// hm_u64_image_view creates in view_place a database using the image in
+// place, without copying. image must be 32 byte aligned and stay mapped
+// while the database is used. It may be read-only. Returns
+// HM_ERROR_BAD_FORMAT if image is not an image of a static set of uint64
+// written on a machine with the same byte order.
+hm_error_t HM_CDECL hm_u64_image_view(char *view_place, size_t view_place_size,
+                                     hm_u64_database_t **db_ptr,
+                                     const char *image, size_t image_size);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
@@ -0,0 +1,30 @@
+#ifndef HM_TOOLS_CHECK_H
+#define HM_TOOLS_CHECK_H
+
+// Assertions of the C tests. A failed check prints its location and exits,
+// so ctest reports the test as failed.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define CHECK(cond)                                                            \
+  do {                                                                         \
+    if (!(cond)) {                                                             \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__,         \
+              #cond);                                                          \
+      exit(1);                                                                 \
+    }                                                                          \
+  } while (0)
+
+// CHECK_ERR checks that expr returns the error code want.
+#define CHECK_ERR(expr, want)                                                  \
+  do {                                                                         \
+    hm_error_t check_err_ = (expr);                                            \
+    if (check_err_ != (want)) {                                                \
+      fprintf(stderr, "%s:%d: %s returned %d, want %d\n", __FILE__, __LINE__,  \
+              #expr, check_err_, (want));                                      \
+      exit(1);                                                                 \
+    }                                                                          \
+  } while (0)
+
+#endif // HM_TOOLS_CHECK_H
@@ -0,0 +1,223 @@
+#include <inttypes.h>
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../cache.h"
+#include "../place.h"
+#include "../static_map.h"
+
+// Measures lookups in databases placed on different kinds of pages, see
+// place.h. Usage: place_benchmark [ranges] [cache_capacity (power of 2)] [samples].
+// 2M and 1G pages need a hugetlb pool, e.g.
+//   echo 1024 > /proc/sys/vm/nr_hugepages
+// and dTLB counters need perf_event_paranoid <= 2 (or root).
+
+// Fast hash function on uint32_t.
+// See https://github.com/skeeto/hash-prospector/issues/19
+uint32_t hash32(uint32_t x) {
+  x ^= x >> 16;
+  x *= 0x21f0aaad;
+  x ^= x >> 15;
+  x *= 0xd35a2d97;
+  x ^= x >> 15;
+  return x;
+}
+
+// open_dtlb_counter opens a counter of dTLB load misses of this thread.
+// Returns -1 if it is not available.
+int open_dtlb_counter(void) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HW_CACHE;
+  attr.config = PERF_COUNT_HW_CACHE_DTLB |
+                (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+struct measurement {
+  int counter;
+  struct timespec start;
+};
+
+void measurement_start(struct measurement *m) {
+  if (m->counter != -1) {
+    ioctl(m->counter, PERF_EVENT_IOC_RESET, 0);
+    ioctl(m->counter, PERF_EVENT_IOC_ENABLE, 0);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &m->start);
+}
+
+void measurement_stop(struct measurement *m, const char *name,
+                      const hm_place_t *place, int samples) {
+  struct timespec stop;
+  clock_gettime(CLOCK_MONOTONIC, &stop);
+  double elapsed =
+      (stop.tv_sec - m->start.tv_sec) + (stop.tv_nsec - m->start.tv_nsec) / 1e9;
+
+  printf("%-6s %-8s %8zu MiB %8.1f ns/lookup", name,
+         hm_page_kind_name(place->pages), place->mapped_size >> 20,
+         elapsed / samples * 1e9);
+
+  uint64_t misses;
+  if (m->counter != -1) {
+    ioctl(m->counter, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(m->counter, &misses, sizeof(misses)) == sizeof(misses)) {
+      printf(" %8.3f dTLB misses/lookup", (double)misses / samples);
+    }
+  } else {
+    printf("      n/a dTLB misses/lookup");
+  }
+  printf("\n");
+}
+
+int main(int argc, char *argv[]) {
+  unsigned int ranges = 4000000;
+  unsigned int capacity = 1 << 23;
+  int samples = 20000000;
+  if (argc > 1) {
+    ranges = atoi(argv[1]);
+  }
+  if (argc > 2) {
+    capacity = atoi(argv[2]);
+  }
+  if (argc > 3) {
+    samples = atoi(argv[3]);
+  }
+
+  struct measurement m;
+  m.counter = open_dtlb_counter();
+  if (m.counter == -1) {
+    printf("perf_event_open failed, dTLB misses are not measured.\n");
+  }
+
+  // Static map of random ranges, serialized once and deserialized into each
+  // place.
+  uint32_t *ips = malloc(sizeof(uint32_t) * ranges);
+  uint8_t *cidr_prefixes = malloc(sizeof(uint8_t) * ranges);
+  uint64_t *values = malloc(sizeof(uint64_t) * ranges);
+  uint32_t x = 1;
+  for (unsigned int i = 0; i < ranges; i++) {
+    x = hash32(x);
+    cidr_prefixes[i] = 20 + x % 13;
+    ips[i] = x & ~(uint32_t)((1ull << (32 - cidr_prefixes[i])) - 1);
+    values[i] = i;
+  }
+
+  size_t sm_place_size = hm_sm_db_place_size(ranges);
+  char *sm_place = malloc(sm_place_size);
+  hm_sm_database_t *sm;
+  hm_error_t hm_err = hm_sm_compile(sm_place, sm_place_size, &sm, ips,
+                                    cidr_prefixes, values, ranges);
+  if (hm_err != HM_SUCCESS) {
+    printf("hm_sm_compile failed: %d.\n", hm_err);
+    return 1;
+  }
+  size_t ser_size = hm_sm_serialized_size(sm);
+  char *ser = malloc(ser_size);
+  hm_err = hm_sm_serialize(ser, ser_size, sm);
+  if (hm_err != HM_SUCCESS) {
+    printf("hm_sm_serialize failed: %d.\n", hm_err);
+    return 1;
+  }
+  free(sm_place);
+  free(ips);
+  free(cidr_prefixes);
+  free(values);
+
+  size_t cache_place_size;
+  hm_err = hm_cache_place_size(&cache_place_size, capacity, 2);
+  if (hm_err != HM_SUCCESS) {
+    printf("hm_cache_place_size failed: %d.\n", hm_err);
+    return 1;
+  }
+
+  for (hm_page_kind_t kind = HM_PAGES_DEFAULT; kind <= HM_PAGES_1G; kind++) {
+    hm_place_t place;
+
+    // Static map.
+    size_t db_place_size;
+    hm_err = hm_sm_db_place_size_from_serialized(&db_place_size, ser, ser_size);
+    if (hm_err != HM_SUCCESS) {
+      printf("hm_sm_db_place_size_from_serialized failed: %d.\n", hm_err);
+      return 1;
+    }
+    hm_err = hm_place_alloc(&place, db_place_size, kind);
+    if (hm_err != HM_SUCCESS) {
+      printf("hm_place_alloc failed: %d.\n", hm_err);
+      return 1;
+    }
+    if (place.pages != kind) {
+      printf("%s pages are not available.\n", hm_page_kind_name(kind));
+      hm_place_free(&place);
+      continue;
+    }
+    hm_err = hm_sm_deserialize(place.data, place.size, &sm, ser, ser_size);
+    if (hm_err != HM_SUCCESS) {
+      printf("hm_sm_deserialize failed: %d.\n", hm_err);
+      return 1;
+    }
+
+    uint64_t sum = 0;
+    uint32_t ip = 1;
+    measurement_start(&m);
+    for (int i = 0; i < samples; i++) {
+      ip = hash32(ip);
+      sum += hm_sm_find(sm, ip);
+    }
+    measurement_stop(&m, "sm", &place, samples);
+    hm_place_free(&place);
+
+    // Cache.
+    hm_err = hm_place_alloc(&place, cache_place_size, kind);
+    if (hm_err != HM_SUCCESS) {
+      printf("hm_place_alloc failed: %d.\n", hm_err);
+      return 1;
+    }
+    if (place.pages != kind) {
+      printf("%s pages are not available for the cache.\n",
+             hm_page_kind_name(kind));
+      hm_place_free(&place);
+      continue;
+    }
+    hm_cache_t *cache;
+    hm_err = hm_cache_init(place.data, place.size, &cache, capacity, 2);
+    if (hm_err != HM_SUCCESS) {
+      printf("hm_cache_init failed: %d.\n", hm_err);
+      return 1;
+    }
+    bool existed, evicted;
+    uint32_t evicted_ip, evicted_value;
+    for (unsigned int i = 0; i < capacity; i++) {
+      hm_cache_add(cache, hash32(i + 1), i, &existed, &evicted, &evicted_ip,
+                   &evicted_value);
+    }
+
+    uint32_t value;
+    ip = 1;
+    measurement_start(&m);
+    for (int i = 0; i < samples; i++) {
+      // Look up IPs added above in random order.
+      ip = hash32(ip);
+      sum += hm_cache_has(cache, hash32(ip % capacity + 1), &value);
+    }
+    measurement_stop(&m, "cache", &place, samples);
+    hm_place_free(&place);
+
+    // Print the sum, so the compiler does not drop the lookups.
+    printf("checksum: %" PRIu64 "\n", sum);
+  }
+
+  return 0;
+}
@@ -0,0 +1,395 @@
+#include <algorithm>
+#include <map>
+#include <vector>
+
+#include "static_map_baselines.h"
+
+extern "C" {
+#include "../static_map.h"
+}
+
+// Fast hash function on uint32_t. Must match hash32 in static_map_benchmark.c.
+// See https://github.com/skeeto/hash-prospector/issues/19
+static inline uint32_t hash32(uint32_t x) {
+  x ^= x >> 16;
+  x *= 0x21f0aaad;
+  x ^= x >> 15;
+  x *= 0xd35a2d97;
+  x ^= x >> 15;
+  return x;
+}
+
+static inline uint32_t prefix_mask(uint8_t cidr_prefix) {
+  return cidr_prefix == 0 ? 0 : ~uint32_t(0) << (32 - cidr_prefix);
+}
+
+static bool valid_input(uint32_t ip, uint8_t cidr_prefix, uint64_t value) {
+  return cidr_prefix != 0 && cidr_prefix <= 32 && value != HM_NO_VALUE &&
+         (ip & ~prefix_mask(cidr_prefix)) == 0;
+}
+
+struct sm_baseline {
+  explicit sm_baseline(sm_baseline_kind_t kind) : kind(kind) {}
+  virtual ~sm_baseline() {}
+
+  const sm_baseline_kind_t kind;
+};
+
+// Path-compressed binary trie. Every node stores a prefix; a child is attached
+// by the first bit after the prefix of the parent.
+class patricia_trie : public sm_baseline {
+public:
+  patricia_trie() : sm_baseline(SM_BASELINE_PATRICIA) {
+    nodes_.push_back(node{});
+  }
+
+  void insert(uint32_t ip, uint8_t cidr_prefix, uint64_t value) {
+    uint32_t current = 0;
+    while (true) {
+      node &n = nodes_[current];
+      if (n.cidr_prefix == cidr_prefix) {
+        n.value = value;
+        return;
+      }
+
+      int bit = (ip >> (31 - n.cidr_prefix)) & 1;
+      uint32_t child_index = n.children[bit];
+      if (child_index == no_child) {
+        uint32_t leaf = new_node(ip, cidr_prefix, value);
+        nodes_[current].children[bit] = leaf;
+        return;
+      }
+
+      const node &child = nodes_[child_index];
+      uint32_t diff = child.ip ^ ip;
+      uint8_t common = diff == 0 ? 32 : __builtin_clz(diff);
+      common = std::min(common, std::min(child.cidr_prefix, cidr_prefix));
+
+      if (common == child.cidr_prefix) {
+        // The child is a prefix of the inserted range.
+        current = child_index;
+        continue;
+      }
+
+      int child_bit = (child.ip >> (31 - common)) & 1;
+      uint32_t split;
+      if (common == cidr_prefix) {
+        // The inserted range is a prefix of the child.
+        split = new_node(ip, cidr_prefix, value);
+      } else {
+        // The inserted range and the child diverge after common bits.
+        split = new_node(ip & prefix_mask(common), common, HM_NO_VALUE);
+        uint32_t leaf = new_node(ip, cidr_prefix, value);
+        nodes_[split].children[1 - child_bit] = leaf;
+      }
+      nodes_[split].children[child_bit] = child_index;
+      nodes_[current].children[bit] = split;
+      return;
+    }
+  }
+
+  __attribute__((noinline)) uint64_t find(uint32_t ip) const {
+    uint64_t best = HM_NO_VALUE;
+    uint32_t current = 0;
+    while (current != no_child) {
+      const node &n = nodes_[current];
+      if ((ip & prefix_mask(n.cidr_prefix)) != n.ip) {
+        break;
+      }
+      if (n.value != HM_NO_VALUE) {
+        best = n.value;
+      }
+      if (n.cidr_prefix == 32) {
+        break;
+      }
+      current = n.children[(ip >> (31 - n.cidr_prefix)) & 1];
+    }
+    return best;
+  }
+
+  size_t memory() const { return nodes_.size() * sizeof(node); }
+
+private:
+  static const uint32_t no_child = 0xFFFFFFFF;
+
+  struct node {
+    uint32_t ip = 0;
+    uint8_t cidr_prefix = 0;
+    uint64_t value = HM_NO_VALUE;
+    uint32_t children[2] = {no_child, no_child};
+  };
+
+  uint32_t new_node(uint32_t ip, uint8_t cidr_prefix, uint64_t value) {
+    node n;
+    n.ip = ip;
+    n.cidr_prefix = cidr_prefix;
+    n.value = value;
+    nodes_.push_back(n);
+    return nodes_.size() - 1;
+  }
+
+  std::vector<node> nodes_;
+};
+
+// flat_range is a range [start, next start) with one value.
+struct flat_range {
+  uint32_t start;
+  uint64_t value;
+};
+
+// flatten converts overlapping prefixes into sorted non-overlapping ranges.
+// The value of each range is resolved with the Patricia trie, so this does not
+// share any logic with hm_sm_compile.
+static std::vector<flat_range> flatten(const patricia_trie &trie,
+                                       const uint32_t *ips,
+                                       const uint8_t *cidr_prefixes,
+                                       size_t elements) {
+  std::vector<uint32_t> bounds;
+  bounds.reserve(elements * 2 + 1);
+  bounds.push_back(0);
+  for (size_t i = 0; i < elements; i++) {
+    bounds.push_back(ips[i]);
+    uint64_t end = uint64_t(ips[i]) + (uint64_t(1) << (32 - cidr_prefixes[i]));
+    if (end <= 0xFFFFFFFF) {
+      bounds.push_back(end);
+    }
+  }
+  std::sort(bounds.begin(), bounds.end());
+  bounds.erase(std::unique(bounds.begin(), bounds.end()), bounds.end());
+
+  std::vector<flat_range> ranges;
+  for (uint32_t start : bounds) {
+    uint64_t value = trie.find(start);
+    if (!ranges.empty() && ranges.back().value == value) {
+      continue;
+    }
+    ranges.push_back(flat_range{start, value});
+  }
+  return ranges;
+}
+
+class bsearch_ranges : public sm_baseline {
+public:
+  explicit bsearch_ranges(const std::vector<flat_range> &ranges)
+      : sm_baseline(SM_BASELINE_BSEARCH) {
+    starts_.reserve(ranges.size());
+    values_.reserve(ranges.size());
+    for (const flat_range &r : ranges) {
+      starts_.push_back(r.start);
+      values_.push_back(r.value);
+    }
+  }
+
+  __attribute__((noinline)) uint64_t find(uint32_t ip) const {
+    // starts_[0] is 0, so the result of upper_bound is never begin().
+    auto it = std::upper_bound(starts_.begin(), starts_.end(), ip);
+    return values_[it - starts_.begin() - 1];
+  }
+
+  size_t memory() const {
+    return starts_.size() * sizeof(uint32_t) + values_.size() * sizeof(uint64_t);
+  }
+
+private:
+  std::vector<uint32_t> starts_;
+  std::vector<uint64_t> values_;
+};
+
+class std_map_ranges : public sm_baseline {
+public:
+  explicit std_map_ranges(const std::vector<flat_range> &ranges)
+      : sm_baseline(SM_BASELINE_STD_MAP) {
+    for (const flat_range &r : ranges) {
+      map_.emplace_hint(map_.end(), r.start, r.value);
+    }
+  }
+
+  __attribute__((noinline)) uint64_t find(uint32_t ip) const {
+    // The map has the key 0, so the result of upper_bound is never begin().
+    auto it = map_.upper_bound(ip);
+    --it;
+    return it->second;
+  }
+
+  size_t memory() const {
+    // Typical red-black tree node: color, 3 pointers and the payload.
+    return map_.size() * (4 * sizeof(void *) + sizeof(uint32_t) +
+                          sizeof(uint64_t));
+  }
+
+private:
+  std::map<uint32_t, uint64_t> map_;
+};
+
+class dir_24_8 : public sm_baseline {
+public:
+  dir_24_8(const uint32_t *ips, const uint8_t *cidr_prefixes,
+           const uint64_t *values, size_t elements)
+      : sm_baseline(SM_BASELINE_DIR_24_8), tbl24_(1 << 24, no_entry),
+        values_(values, values + elements) {
+    // Apply shorter prefixes first, so longer prefixes override them.
+    std::vector<uint32_t> order(elements);
+    for (size_t i = 0; i < elements; i++) {
+      order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+      return cidr_prefixes[a] < cidr_prefixes[b];
+    });
+
+    for (uint32_t i : order) {
+      uint32_t ip = ips[i];
+      uint8_t cidr_prefix = cidr_prefixes[i];
+      if (cidr_prefix <= 24) {
+        uint32_t first = ip >> 8;
+        uint32_t count = 1 << (24 - cidr_prefix);
+        std::fill(tbl24_.begin() + first, tbl24_.begin() + first + count, i);
+        continue;
+      }
+
+      uint32_t &entry = tbl24_[ip >> 8];
+      if ((entry & group_flag) == 0) {
+        uint32_t group = tbl8_.size() / 256;
+        tbl8_.resize(tbl8_.size() + 256, entry);
+        entry = group | group_flag;
+      }
+      uint32_t group = entry & ~group_flag;
+      uint32_t first = group * 256 + (ip & 0xFF);
+      uint32_t count = 1 << (32 - cidr_prefix);
+      std::fill(tbl8_.begin() + first, tbl8_.begin() + first + count, i);
+    }
+  }
+
+  __attribute__((noinline)) uint64_t find(uint32_t ip) const {
+    uint32_t entry = tbl24_[ip >> 8];
+    if (entry & group_flag) {
+      entry = tbl8_[(entry & ~group_flag) * 256 + (ip & 0xFF)];
+    }
+    return entry == no_entry ? HM_NO_VALUE : values_[entry];
+  }
+
+  size_t memory() const {
+    return (tbl24_.size() + tbl8_.size()) * sizeof(uint32_t) +
+           values_.size() * sizeof(uint64_t);
+  }
+
+private:
+  // Entries store index of input element or index of tbl8 group.
+  static const uint32_t group_flag = 0x80000000;
+  static const uint32_t no_entry = 0x7FFFFFFF;
+
+  std::vector<uint32_t> tbl24_;
+  std::vector<uint32_t> tbl8_;
+  std::vector<uint64_t> values_;
+};
+
+template <typename Engine> static uint64_t run(const Engine *e, int samples) {
+  uint64_t sum = 0;
+  uint32_t ip = 1;
+  for (int i = 0; i < samples; i++) {
+    ip = hash32(ip);
+    if (e->find(ip) != HM_NO_VALUE) {
+      sum++;
+    }
+  }
+  return sum;
+}
+
+extern "C" const char *sm_baseline_name(sm_baseline_kind_t kind) {
+  switch (kind) {
+  case SM_BASELINE_BSEARCH:
+    return "BSEARCH";
+  case SM_BASELINE_STD_MAP:
+    return "STD_MAP";
+  case SM_BASELINE_DIR_24_8:
+    return "DIR_24_8";
+  case SM_BASELINE_PATRICIA:
+    return "PATRICIA";
+  default:
+    return "UNKNOWN";
+  }
+}
+
+extern "C" sm_baseline_t *sm_baseline_build(sm_baseline_kind_t kind,
+                                            const uint32_t *ips,
+                                            const uint8_t *cidr_prefixes,
+                                            const uint64_t *values,
+                                            size_t elements) {
+  for (size_t i = 0; i < elements; i++) {
+    if (!valid_input(ips[i], cidr_prefixes[i], values[i])) {
+      return NULL;
+    }
+  }
+
+  if (kind == SM_BASELINE_DIR_24_8) {
+    return new dir_24_8(ips, cidr_prefixes, values, elements);
+  }
+
+  patricia_trie *trie = new patricia_trie();
+  for (size_t i = 0; i < elements; i++) {
+    trie->insert(ips[i], cidr_prefixes[i], values[i]);
+  }
+  if (kind == SM_BASELINE_PATRICIA) {
+    return trie;
+  }
+
+  std::vector<flat_range> ranges = flatten(*trie, ips, cidr_prefixes, elements);
+  delete trie;
+
+  switch (kind) {
+  case SM_BASELINE_BSEARCH:
+    return new bsearch_ranges(ranges);
+  case SM_BASELINE_STD_MAP:
+    return new std_map_ranges(ranges);
+  default:
+    return NULL;
+  }
+}
+
+extern "C" uint64_t sm_baseline_find(const sm_baseline_t *baseline,
+                                     uint32_t ip) {
+  switch (baseline->kind) {
+  case SM_BASELINE_BSEARCH:
+    return static_cast<const bsearch_ranges *>(baseline)->find(ip);
+  case SM_BASELINE_STD_MAP:
+    return static_cast<const std_map_ranges *>(baseline)->find(ip);
+  case SM_BASELINE_DIR_24_8:
+    return static_cast<const dir_24_8 *>(baseline)->find(ip);
+  case SM_BASELINE_PATRICIA:
+    return static_cast<const patricia_trie *>(baseline)->find(ip);
+  default:
+    return HM_NO_VALUE;
+  }
+}
+
+extern "C" uint64_t sm_baseline_benchmark(const sm_baseline_t *baseline,
+                                          int samples) {
+  switch (baseline->kind) {
+  case SM_BASELINE_BSEARCH:
+    return run(static_cast<const bsearch_ranges *>(baseline), samples);
+  case SM_BASELINE_STD_MAP:
+    return run(static_cast<const std_map_ranges *>(baseline), samples);
+  case SM_BASELINE_DIR_24_8:
+    return run(static_cast<const dir_24_8 *>(baseline), samples);
+  case SM_BASELINE_PATRICIA:
+    return run(static_cast<const patricia_trie *>(baseline), samples);
+  default:
+    return 0;
+  }
+}
+
+extern "C" size_t sm_baseline_memory(const sm_baseline_t *baseline) {
+  switch (baseline->kind) {
+  case SM_BASELINE_BSEARCH:
+    return static_cast<const bsearch_ranges *>(baseline)->memory();
+  case SM_BASELINE_STD_MAP:
+    return static_cast<const std_map_ranges *>(baseline)->memory();
+  case SM_BASELINE_DIR_24_8:
+    return static_cast<const dir_24_8 *>(baseline)->memory();
+  case SM_BASELINE_PATRICIA:
+    return static_cast<const patricia_trie *>(baseline)->memory();
+  default:
+    return 0;
+  }
+}
+
+extern "C" void sm_baseline_free(sm_baseline_t *baseline) { delete baseline; }
@@ -0,0 +1,66 @@
+#ifndef HM_STATIC_MAP_BASELINES_H
+#define HM_STATIC_MAP_BASELINES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Self-contained IP-to-value engines used as reference points in
+// static_map_benchmark. All of them implement the same longest prefix match
+// semantics as hm_sm_find and return HM_NO_VALUE if nothing matches.
+
+// sm_baseline_kind_t enumerates baseline engines.
+typedef enum sm_baseline_kind {
+  // Binary search over a sorted array of non-overlapping ranges.
+  SM_BASELINE_BSEARCH = 0,
+
+  // std::map keyed by range start, lookup via upper_bound.
+  SM_BASELINE_STD_MAP = 1,
+
+  // DIR-24-8: 2^24 entries indexed by the first 24 bits of IP and groups of
+  // 256 entries for longer prefixes.
+  SM_BASELINE_DIR_24_8 = 2,
+
+  // Path-compressed binary trie.
+  SM_BASELINE_PATRICIA = 3,
+
+  // Number of baseline engines.
+  SM_BASELINES = 4,
+} sm_baseline_kind_t;
+
+struct sm_baseline;
+
+// sm_baseline_t is a compiled baseline engine.
+typedef struct sm_baseline sm_baseline_t;
+
+// sm_baseline_name returns human readable name of the engine.
+const char *sm_baseline_name(sm_baseline_kind_t kind);
+
+// sm_baseline_build builds the engine from the same inputs as hm_sm_compile.
+// Returns NULL if some input is invalid.
+sm_baseline_t *sm_baseline_build(sm_baseline_kind_t kind, const uint32_t *ips,
+                                 const uint8_t *cidr_prefixes,
+                                 const uint64_t *values, size_t elements);
+
+// sm_baseline_find returns the value corresponding to the given IP.
+uint64_t sm_baseline_find(const sm_baseline_t *baseline, uint32_t ip);
+
+// sm_baseline_benchmark runs sm_baseline_find on the pseudo-random sequence of
+// IPs produced by iterating hash32 from the IP 1 and returns the number of
+// matches. The loop is specialized per engine, so no dispatch is measured.
+uint64_t sm_baseline_benchmark(const sm_baseline_t *baseline, int samples);
+
+// sm_baseline_memory returns approximate memory usage of the engine (bytes).
+size_t sm_baseline_memory(const sm_baseline_t *baseline);
+
+// sm_baseline_free frees the engine.
+void sm_baseline_free(sm_baseline_t *baseline);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif // HM_STATIC_MAP_BASELINES_H
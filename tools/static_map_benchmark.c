@@ -1,15 +1,25 @@
+#include <assert.h>
 #include <inttypes.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
+// Hyperscan and libipset are optional, see CMakeLists.txt. Without them only
+// hipermap and the self-contained baselines are measured.
+#ifdef HM_WITH_HYPERSCAN
 #include <hs/hs.h>
+#endif
+#ifdef HM_WITH_IPSET
 #include <ipset/ipset.h>
+#endif
 
 #include "../static_map.h"
+#include "static_map_baselines.h"
 
+#ifdef HM_WITH_HYPERSCAN
 const size_t IP_REGEXP_BUF_LEN =
     1 + 4 * 3 + 11 + 1; // ^, 3 bytes, one [] range, one zero byte.
 
@@ -38,6 +48,7 @@ size_t ip_to_regexp(char *dst, int ip_bytes[4], int mask_bits) {
 
   return cursor - dst;
 }
+#endif // HM_WITH_HYPERSCAN
 
 // Fast hash function on uint32_t.
 // See
@@ -52,6 +63,7 @@ uint32_t hash32(uint32_t x) {
   return x;
 }
 
+#ifdef HM_WITH_HYPERSCAN
 struct match_context {
   int count;    // Set to 0 when initializing.
   int final_id; // Set to -1 when initializing.
@@ -68,6 +80,7 @@ int matcher(unsigned int id, unsigned long long from, unsigned long long to,
   c->final_id = id;
   return 0;
 }
+#endif // HM_WITH_HYPERSCAN
 
 void fill_ip(char *bytes, uint32_t ip) {
   bytes[0] = (ip >> 24) & 0xFF;
@@ -97,9 +110,11 @@ int main(int argc, char *argv[]) {
   size_t len = 0;
   size_t cap = 0;
 
+#ifdef HM_WITH_IPSET
   ipset_init_library();
 
   struct ip_set *ip_set = ipset_new();
+#endif
 
   while (1) {
     int ip_bytes[4];
@@ -111,9 +126,6 @@ int main(int argc, char *argv[]) {
     }
     if (r == 5) {
       // Match.
-      char *pattern = malloc(IP_REGEXP_BUF_LEN); // FIXME memory leak
-      size_t pattern_size = ip_to_regexp(pattern, ip_bytes, mask_bits);
-      assert(pattern_size <= IP_REGEXP_BUF_LEN);
       if (len == cap) {
         cap = (cap + 1) * 2;
         patterns = realloc(patterns, cap * sizeof(char *));
@@ -121,11 +133,21 @@ int main(int argc, char *argv[]) {
         cidr_prefixes = realloc(cidr_prefixes, cap * sizeof(uint8_t));
         values = realloc(values, cap * sizeof(uint64_t));
       }
+
+#ifdef HM_WITH_HYPERSCAN
+      char *pattern = malloc(IP_REGEXP_BUF_LEN); // FIXME memory leak
+      size_t pattern_size = ip_to_regexp(pattern, ip_bytes, mask_bits);
+      assert(pattern_size <= IP_REGEXP_BUF_LEN);
       patterns[len] = pattern;
+      printf("IP: %d.%d.%d.%d/%d -> %s\n", ip_bytes[0], ip_bytes[1],
+             ip_bytes[2], ip_bytes[3], mask_bits, pattern);
+#endif
 
+#ifdef HM_WITH_IPSET
       struct cork_ipv4 ip = {
           ._ = {.u8 = {ip_bytes[0], ip_bytes[1], ip_bytes[2], ip_bytes[3]}}};
       ipset_ipv4_add_network(ip_set, &ip, mask_bits);
+#endif
 
       ips[len] = ((uint32_t)(ip_bytes[0]) << 24) |
                  ((uint32_t)(ip_bytes[1]) << 16) |
@@ -133,9 +155,6 @@ int main(int argc, char *argv[]) {
       cidr_prefixes[len] = mask_bits;
       values[len] = len;
 
-      printf("IP: %d.%d.%d.%d/%d -> %s\n", ip_bytes[0], ip_bytes[1],
-             ip_bytes[2], ip_bytes[3], mask_bits, pattern);
-
       len++;
     }
 
@@ -147,6 +166,7 @@ int main(int argc, char *argv[]) {
 
   fclose(fp);
 
+#ifdef HM_WITH_HYPERSCAN
   unsigned int *ids = malloc(sizeof(int) * len);
   for (int i = 0; i < len; i++) {
     ids[i] = i;
@@ -182,6 +202,7 @@ int main(int argc, char *argv[]) {
     printf("hs_alloc_scratch failed: %d.\n", hs_err);
     return 1;
   }
+#endif // HM_WITH_HYPERSCAN
 
   size_t hm_db_place_len = hm_sm_db_place_size(len);
   char *hm_db_place = malloc(hm_db_place_len);
@@ -194,6 +215,18 @@ int main(int argc, char *argv[]) {
   }
   printf("size of hipermap db is: %d bytes.\n", (int)hm_db_place_len);
 
+  sm_baseline_t *baselines[SM_BASELINES];
+  for (int kind = 0; kind < SM_BASELINES; kind++) {
+    baselines[kind] =
+        sm_baseline_build(kind, ips, cidr_prefixes, values, len);
+    if (baselines[kind] == NULL) {
+      printf("sm_baseline_build failed for %s.\n", sm_baseline_name(kind));
+      return 1;
+    }
+    printf("size of %s db is: %d bytes.\n", sm_baseline_name(kind),
+           (int)sm_baseline_memory(baselines[kind]));
+  }
+
   // Check edge cases.
   uint64_t v1 = hm_sm_find(hm_db, 0x00000000);
   uint64_t v2 = hm_sm_find(hm_db, 0xFFFFFFFF);
@@ -202,15 +235,24 @@ int main(int argc, char *argv[]) {
 
   uint32_t ip = 1;
   const int SAMPLE_SIZE = 100000000;
+#ifdef HM_WITH_HYPERSCAN
   unsigned int length = 4;
   unsigned int scan_flags = 0;
   match_event_handler onEvent = matcher;
+#endif
 
   // Compare results.
   unsigned char ip_bytes[4];
   for (int i = 0; i < SAMPLE_SIZE; i++) {
     ip = hash32(ip);
     fill_ip(ip_bytes, ip);
+
+    uint64_t hm_res = hm_sm_find(hm_db, ip);
+#if defined(HM_WITH_HYPERSCAN) || defined(HM_WITH_IPSET)
+    bool hm_match = hm_res != HM_NO_VALUE;
+#endif
+
+#ifdef HM_WITH_HYPERSCAN
     struct match_context context = {
         .count = 0,
         .final_id = -1,
@@ -223,30 +265,37 @@ int main(int argc, char *argv[]) {
       return 1;
     }
     bool hyperscan_match = (context.count != 0);
+    if (hyperscan_match != hm_match) {
+      printf("MISMATCH! hyperscan_match=%d hm_match=%d hyperscan=%d hm=%" PRIu64
+             " ",
+             hyperscan_match, hm_match, context.final_id, hm_res);
+      print_ip(ip);
+    }
+#endif
 
+#ifdef HM_WITH_IPSET
     struct cork_ipv4 cip = {
         ._ = {.u8 = {ip_bytes[0], ip_bytes[1], ip_bytes[2], ip_bytes[3]}}};
     bool ip_set_match = ipset_contains_ipv4(ip_set, &cip);
-
-    uint64_t hm_res = hm_sm_find(hm_db, ip);
-    bool hm_match = hm_res != HM_NO_VALUE;
-
-    if (hyperscan_match != ip_set_match) {
-      printf("MISMATCH! hyperscan=%b ip_set=%b ", hyperscan_match,
-             ip_set_match);
+    if (ip_set_match != hm_match) {
+      printf("MISMATCH! ip_set_match=%d hm_match=%d ", ip_set_match, hm_match);
       print_ip(ip);
     }
-    if (hyperscan_match != hm_match) {
-      printf("MISMATCH! hyperscan_match=%d hm_match=%d hyperscan=%d hm=%" PRIu64
-             " ",
-             hyperscan_match, hm_match, context.final_id, hm_res);
-      print_ip(ip);
+#endif
+    for (int kind = 0; kind < SM_BASELINES; kind++) {
+      uint64_t baseline_res = sm_baseline_find(baselines[kind], ip);
+      if (baseline_res != hm_res) {
+        printf("MISMATCH! %s=%" PRIu64 " hm=%" PRIu64 " ",
+               sm_baseline_name(kind), baseline_res, hm_res);
+        print_ip(ip);
+      }
     }
   }
 
   struct timespec benchmark_start, benchmark_stop;
   double benchmark_time;
 
+#ifdef HM_WITH_HYPERSCAN
   clock_gettime(CLOCK_MONOTONIC, &benchmark_start);
   int hyperscan_sum = 0;
   ip = 1;
@@ -276,7 +325,9 @@ int main(int argc, char *argv[]) {
          benchmark_time);
   printf("One IP is analyzed in %g s\n", benchmark_time / SAMPLE_SIZE);
   printf("Found %d matches.\n", hyperscan_sum);
+#endif // HM_WITH_HYPERSCAN
 
+#ifdef HM_WITH_IPSET
   clock_gettime(CLOCK_MONOTONIC, &benchmark_start);
   ip = 1;
   int ip_set_sum = 0;
@@ -296,6 +347,7 @@ int main(int argc, char *argv[]) {
   printf("IPSET: %d IPs were analyzed in %f s.\n", SAMPLE_SIZE, benchmark_time);
   printf("One IP is analyzed in %g s\n", benchmark_time / SAMPLE_SIZE);
   printf("Found %d matches.\n", ip_set_sum);
+#endif // HM_WITH_IPSET
 
   // Serialize the db.
   size_t ser_size = hm_sm_serialized_size(hm_db);
@@ -343,6 +395,21 @@ int main(int argc, char *argv[]) {
   printf("One IP is analyzed in %g s\n", benchmark_time / SAMPLE_SIZE);
   printf("Found %d matches.\n", hipermap_sum);
 
+  for (int kind = 0; kind < SM_BASELINES; kind++) {
+    clock_gettime(CLOCK_MONOTONIC, &benchmark_start);
+    uint64_t baseline_sum = sm_baseline_benchmark(baselines[kind], SAMPLE_SIZE);
+    clock_gettime(CLOCK_MONOTONIC, &benchmark_stop);
+    benchmark_time =
+        ((double)benchmark_stop.tv_sec + 1.0e-9 * benchmark_stop.tv_nsec) -
+        ((double)benchmark_start.tv_sec + 1.0e-9 * benchmark_start.tv_nsec);
+    printf("%s: %d IPs were analyzed in %f s.\n", sm_baseline_name(kind),
+           SAMPLE_SIZE, benchmark_time);
+    printf("One IP is analyzed in %g s\n", benchmark_time / SAMPLE_SIZE);
+    printf("Found %" PRIu64 " matches.\n", baseline_sum);
+    sm_baseline_free(baselines[kind]);
+  }
+
+#ifdef HM_WITH_HYPERSCAN
   hs_err = hs_free_scratch(scratch);
   if (hs_err != HS_SUCCESS) {
     printf("hs_free_scratch failed: %d.\n", hs_err);
@@ -355,5 +422,9 @@ int main(int argc, char *argv[]) {
     return 1;
   }
 
+#endif // HM_WITH_HYPERSCAN
+
+#ifdef HM_WITH_IPSET
   ipset_free(ip_set);
+#endif
 }
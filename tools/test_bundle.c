@@ -0,0 +1,239 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../bundle.h"
+#include "../crc32c.h"
+#include "../static_map.h"
+#include "../static_uint64_map.h"
+#include "../static_uint64_set.h"
+#include "check.h"
+
+// Layout of the bundle, see bundle.c.
+#define HEADER_SIZE 64
+#define HEADER_VERSION_OFFSET 8
+#define HEADER_CRC_OFFSET 28
+#define TOC_ENTRY_SIZE 64
+#define TOC_OFFSET_OFFSET 48
+
+#define KEYS 1000
+
+// dbs holds one database of each type. Places must outlive the databases.
+typedef struct dbs {
+  char *places[3];
+  hm_sm_database_t *sm;
+  hm_u64_database_t *u64;
+  hm_u64map_database_t *u64map;
+} dbs_t;
+
+static void compile_dbs(dbs_t *dbs) {
+  // 10.0.0.0/8 -> 1, 192.168.0.0/16 -> 2.
+  uint32_t ips[] = {0x0A000000, 0xC0A80000};
+  uint8_t prefixes[] = {8, 16};
+  uint64_t values[] = {1, 2};
+  size_t sm_size = hm_sm_db_place_size(2);
+  dbs->places[0] = malloc(sm_size);
+  CHECK(dbs->places[0] != NULL);
+  CHECK_ERR(hm_sm_compile(dbs->places[0], sm_size, &dbs->sm, ips, prefixes,
+                          values, 2),
+            HM_SUCCESS);
+
+  uint64_t keys[KEYS], map_values[KEYS];
+  for (int i = 0; i < KEYS; i++) {
+    keys[i] = 1000 + i;
+    map_values[i] = 2 * keys[i];
+  }
+  size_t u64_size = hm_u64_db_place_size(KEYS);
+  dbs->places[1] = malloc(u64_size);
+  CHECK(dbs->places[1] != NULL);
+  CHECK_ERR(hm_u64_compile(dbs->places[1], u64_size, &dbs->u64, keys, KEYS),
+            HM_SUCCESS);
+
+  size_t u64map_size = hm_u64map_db_place_size(KEYS);
+  dbs->places[2] = malloc(u64map_size);
+  CHECK(dbs->places[2] != NULL);
+  CHECK_ERR(hm_u64map_compile(dbs->places[2], u64map_size, &dbs->u64map, keys,
+                              map_values, KEYS),
+            HM_SUCCESS);
+}
+
+static void free_dbs(dbs_t *dbs) {
+  for (int i = 0; i < 3; i++) {
+    free(dbs->places[i]);
+  }
+}
+
+// check_bundle checks that the bundle holds the databases of compile_dbs
+// under names sm, u64 and u64map.
+static void check_bundle(const hm_bundle_t *bundle) {
+  CHECK(hm_bundle_count(bundle) == 3);
+  CHECK(strcmp(hm_bundle_name(bundle, 0), "sm") == 0);
+  CHECK(hm_bundle_type(bundle, 0) == HM_DB_SM);
+  CHECK(strcmp(hm_bundle_name(bundle, 2), "u64map") == 0);
+  CHECK(hm_bundle_type(bundle, 2) == HM_DB_U64MAP);
+
+  const hm_sm_database_t *sm = hm_bundle_find(bundle, "sm", HM_DB_SM);
+  CHECK(sm != NULL);
+  CHECK(sm == hm_bundle_db(bundle, 0));
+  CHECK(hm_sm_find(sm, 0x0A010203) == 1);
+  CHECK(hm_sm_find(sm, 0xC0A80101) == 2);
+  CHECK(hm_sm_find(sm, 0x08080808) == UINT64_MAX);
+
+  const hm_u64_database_t *u64 = hm_bundle_find(bundle, "u64", HM_DB_U64);
+  CHECK(u64 != NULL);
+  CHECK(hm_u64_find(u64, 1000));
+  CHECK(hm_u64_find(u64, 1000 + KEYS - 1));
+  CHECK(!hm_u64_find(u64, 1000 + KEYS));
+
+  const hm_u64map_database_t *u64map =
+      hm_bundle_find(bundle, "u64map", HM_DB_U64MAP);
+  CHECK(u64map != NULL);
+  CHECK(hm_u64map_find(u64map, 1000) == 2000);
+  CHECK(hm_u64map_find(u64map, 999) == 0);
+
+  // Both the name and the type must match.
+  CHECK(hm_bundle_find(bundle, "u64", HM_DB_U64MAP) == NULL);
+  CHECK(hm_bundle_find(bundle, "missing", HM_DB_U64) == NULL);
+}
+
+// fix_crc updates the checksum of the header after it or the table of
+// contents was changed on purpose.
+static void fix_crc(char *buffer, size_t count) {
+  uint32_t crc = hm_crc32c(0, buffer, HEADER_CRC_OFFSET);
+  crc = hm_crc32c(crc, buffer + HEADER_SIZE, count * TOC_ENTRY_SIZE);
+  memcpy(buffer + HEADER_CRC_OFFSET, &crc, sizeof(crc));
+}
+
+static void test_bad_entries(const dbs_t *dbs) {
+  size_t size;
+  hm_bundle_entry_t duplicate[] = {
+      {"a", HM_DB_U64, dbs->u64},
+      {"a", HM_DB_U64MAP, dbs->u64map},
+  };
+  CHECK_ERR(hm_bundle_size(&size, duplicate, 2), HM_ERROR_BAD_VALUE);
+
+  char long_name[HM_BUNDLE_NAME_SIZE + 1];
+  memset(long_name, 'x', HM_BUNDLE_NAME_SIZE);
+  long_name[HM_BUNDLE_NAME_SIZE] = 0;
+  hm_bundle_entry_t too_long[] = {{long_name, HM_DB_U64, dbs->u64}};
+  CHECK_ERR(hm_bundle_size(&size, too_long, 1), HM_ERROR_BAD_VALUE);
+  // The longest name fits.
+  long_name[HM_BUNDLE_NAME_SIZE - 1] = 0;
+  CHECK_ERR(hm_bundle_size(&size, too_long, 1), HM_SUCCESS);
+
+  hm_bundle_entry_t empty_name[] = {{"", HM_DB_U64, dbs->u64}};
+  CHECK_ERR(hm_bundle_size(&size, empty_name, 1), HM_ERROR_BAD_VALUE);
+
+  hm_bundle_entry_t bad_type[] = {{"a", (hm_db_type_t)(42), dbs->u64}};
+  CHECK_ERR(hm_bundle_size(&size, bad_type, 1), HM_ERROR_BAD_VALUE);
+}
+
+static void test_corruption(const char *bundle_data, size_t size) {
+  char *buffer = aligned_alloc(64, size);
+  CHECK(buffer != NULL);
+  hm_bundle_t *bundle;
+
+  // Header fields.
+  memcpy(buffer, bundle_data, size);
+  buffer[0] ^= 1;
+  CHECK_ERR(hm_bundle_view(&bundle, buffer, size, false), HM_ERROR_BAD_FORMAT);
+  memcpy(buffer, bundle_data, size);
+  buffer[HEADER_VERSION_OFFSET] ^= 1;
+  CHECK_ERR(hm_bundle_view(&bundle, buffer, size, false), HM_ERROR_BAD_FORMAT);
+
+  // Any byte of the table of contents is covered by the header checksum.
+  memcpy(buffer, bundle_data, size);
+  buffer[HEADER_SIZE + 5] ^= 1;
+  CHECK_ERR(hm_bundle_view(&bundle, buffer, size, false),
+            HM_ERROR_BAD_CHECKSUM);
+
+  // An invalid table of contents with a valid checksum: an image offset
+  // which is not aligned and one past the end.
+  uint64_t offset;
+  memcpy(buffer, bundle_data, size);
+  memcpy(&offset, buffer + HEADER_SIZE + TOC_OFFSET_OFFSET, sizeof(offset));
+  offset += 8;
+  memcpy(buffer + HEADER_SIZE + TOC_OFFSET_OFFSET, &offset, sizeof(offset));
+  fix_crc(buffer, 3);
+  CHECK_ERR(hm_bundle_view(&bundle, buffer, size, false), HM_ERROR_BAD_FORMAT);
+  offset = size + 64;
+  memcpy(buffer + HEADER_SIZE + TOC_OFFSET_OFFSET, &offset, sizeof(offset));
+  fix_crc(buffer, 3);
+  CHECK_ERR(hm_bundle_view(&bundle, buffer, size, false), HM_ERROR_BAD_FORMAT);
+
+  // Images are only checked with verify. The last byte belongs to the last
+  // image, since images start aligned and the bundle ends right after the
+  // padding of the last one, which is zero.
+  memcpy(buffer, bundle_data, size);
+  size_t i = size - 1;
+  while (buffer[i] == 0) {
+    i--;
+  }
+  buffer[i] ^= 1;
+  CHECK_ERR(hm_bundle_view(&bundle, buffer, size, true),
+            HM_ERROR_BAD_CHECKSUM);
+  CHECK_ERR(hm_bundle_view(&bundle, buffer, size, false), HM_SUCCESS);
+  hm_bundle_free(bundle);
+
+  // Truncated bundles.
+  memcpy(buffer, bundle_data, size);
+  CHECK_ERR(hm_bundle_view(&bundle, buffer, size - 64, false),
+            HM_ERROR_BAD_FORMAT);
+  CHECK_ERR(hm_bundle_view(&bundle, buffer, HEADER_SIZE - 1, false),
+            HM_ERROR_BAD_FORMAT);
+
+  free(buffer);
+}
+
+int main(void) {
+  dbs_t dbs;
+  compile_dbs(&dbs);
+  hm_bundle_entry_t entries[] = {
+      {"sm", HM_DB_SM, dbs.sm},
+      {"u64", HM_DB_U64, dbs.u64},
+      {"u64map", HM_DB_U64MAP, dbs.u64map},
+  };
+
+  size_t size;
+  CHECK_ERR(hm_bundle_size(&size, entries, 3), HM_SUCCESS);
+  CHECK(size % 64 == 0);
+  char *buffer = aligned_alloc(64, size);
+  CHECK(buffer != NULL);
+  CHECK_ERR(hm_bundle_write(buffer, size - 64, entries, 3), HM_ERROR_BAD_SIZE);
+  CHECK_ERR(hm_bundle_write(buffer, size, entries, 3), HM_SUCCESS);
+
+  hm_bundle_t *bundle;
+  CHECK_ERR(hm_bundle_view(&bundle, buffer, size, true), HM_SUCCESS);
+  check_bundle(bundle);
+  hm_bundle_free(bundle);
+
+  test_bad_entries(&dbs);
+  test_corruption(buffer, size);
+
+  // The file is the same as the bundle in memory.
+  char path[64];
+  snprintf(path, sizeof(path), "/tmp/hipermap-test-bundle-%d",
+           (int)getpid());
+  CHECK_ERR(hm_bundle_write_file(path, entries, 3), HM_SUCCESS);
+  CHECK_ERR(hm_bundle_open(&bundle, path, true), HM_SUCCESS);
+  check_bundle(bundle);
+  hm_bundle_free(bundle);
+  FILE *f = fopen(path, "rb");
+  CHECK(f != NULL);
+  char *file_data = malloc(size + 1);
+  CHECK(file_data != NULL);
+  CHECK(fread(file_data, 1, size + 1, f) == size);
+  CHECK(memcmp(file_data, buffer, size) == 0);
+  fclose(f);
+  free(file_data);
+  unlink(path);
+
+  CHECK_ERR(hm_bundle_open(&bundle, path, false), HM_ERROR_SYSTEM);
+
+  free(buffer);
+  free_dbs(&dbs);
+  printf("PASS\n");
+  return 0;
+}
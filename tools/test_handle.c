@@ -0,0 +1,82 @@
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../handle.h"
+#include "check.h"
+
+#define READERS 4
+#define SWAPS 5000
+
+// object_t stands for a database. The writer clears alive after
+// hm_handle_swap returns it, where the real code would free it.
+typedef struct object {
+  uint64_t alive;
+  uint64_t id;
+} object_t;
+
+static object_t objects[SWAPS + 1];
+static hm_handle_t handle;
+static bool stop;
+
+// reader pins objects and checks that they stay alive while pinned. Objects
+// are published in the order of their ids, so a reader never goes back.
+static void *reader(void *arg) {
+  uint64_t *pins = arg;
+  uint64_t last_id = 0;
+  while (!__atomic_load_n(&stop, __ATOMIC_ACQUIRE)) {
+    unsigned int ticket;
+    object_t *object = hm_handle_acquire(&handle, &ticket);
+    CHECK(object->id >= last_id);
+    last_id = object->id;
+    CHECK(__atomic_load_n(&object->alive, __ATOMIC_ACQUIRE) == 1);
+    // Lets the writer swap while the object is pinned, even on a single CPU.
+    sched_yield();
+    CHECK(__atomic_load_n(&object->alive, __ATOMIC_ACQUIRE) == 1);
+    hm_handle_release(&handle, ticket);
+    (*pins)++;
+  }
+  return NULL;
+}
+
+int main(void) {
+  for (uint64_t i = 0; i <= SWAPS; i++) {
+    objects[i].id = i;
+  }
+  objects[0].alive = 1;
+  hm_handle_init(&handle, &objects[0]);
+
+  // A single thread.
+  unsigned int ticket;
+  CHECK(hm_handle_acquire(&handle, &ticket) == &objects[0]);
+  hm_handle_release(&handle, ticket);
+  CHECK(hm_handle_swap(&handle, &objects[0]) == &objects[0]);
+
+  pthread_t threads[READERS];
+  uint64_t pins[READERS] = {0};
+  for (int i = 0; i < READERS; i++) {
+    CHECK(pthread_create(&threads[i], NULL, reader, &pins[i]) == 0);
+  }
+
+  for (int i = 1; i <= SWAPS; i++) {
+    __atomic_store_n(&objects[i].alive, 1, __ATOMIC_RELEASE);
+    object_t *old = hm_handle_swap(&handle, &objects[i]);
+    CHECK(old == &objects[i - 1]);
+    __atomic_store_n(&old->alive, 0, __ATOMIC_RELEASE);
+  }
+
+  __atomic_store_n(&stop, true, __ATOMIC_RELEASE);
+  uint64_t total_pins = 0;
+  for (int i = 0; i < READERS; i++) {
+    CHECK(pthread_join(threads[i], NULL) == 0);
+    total_pins += pins[i];
+  }
+  CHECK(total_pins > 0);
+  CHECK(handle.readers[0].count == 0 && handle.readers[1].count == 0);
+
+  printf("PASS\n");
+  return 0;
+}
@@ -0,0 +1,231 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../cpu.h"
+#include "../static_map.h"
+#include "../static_uint64_map.h"
+#include "../static_uint64_set.h"
+#include "check.h"
+
+// Lookup kernels are selected by the features allowed when a database is
+// compiled. The test compiles the databases under each mask and compares
+// lookups with reference implementations.
+
+#define PREFIXES 2000
+#define KEYS 10000
+
+// Enough queries to go through the main loops and the tails of batches.
+#define IP_QUERIES (4 * PREFIXES + 4099)
+#define KEY_QUERIES (2 * KEYS + 3)
+
+static uint64_t splitmix64(uint64_t *state) {
+  uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+  return z ^ (z >> 31);
+}
+
+static uint32_t prefix_mask(uint8_t prefix) {
+  return (uint32_t)(0xFFFFFFFFull << (32 - prefix));
+}
+
+// Input of hm_sm_compile. Half of the prefixes are nested in 10.0.0.0/14 to
+// make long scans of a few /16 buckets.
+static uint32_t ips[PREFIXES];
+static uint8_t prefixes[PREFIXES];
+static uint64_t values[PREFIXES];
+static uint32_t ip_queries[IP_QUERIES];
+
+static uint64_t keys[KEYS];
+static uint64_t map_values[KEYS];
+static uint64_t key_queries[KEY_QUERIES];
+
+static void generate(void) {
+  uint64_t state = 42;
+  for (int i = 0; i < PREFIXES;) {
+    uint64_t r = splitmix64(&state);
+    if (i % 2 == 0) {
+      prefixes[i] = 8 + r % 25;
+      ips[i] = (uint32_t)(r >> 32) % 0xC8000000 + 0x01000000;
+    } else {
+      prefixes[i] = 20 + r % 13;
+      ips[i] = 0x0A000000 | (uint32_t)(r >> 32) % 0x40000;
+    }
+    ips[i] &= prefix_mask(prefixes[i]);
+    values[i] = i;
+    bool duplicate = false;
+    for (int j = 0; j < i; j++) {
+      if (ips[j] == ips[i] && prefixes[j] == prefixes[i]) {
+        duplicate = true;
+        break;
+      }
+    }
+    if (!duplicate) {
+      i++;
+    }
+  }
+
+  // Both sides of the start and of the end of each prefix, then random IPs.
+  for (int i = 0; i < PREFIXES; i++) {
+    uint32_t last = ips[i] | ~prefix_mask(prefixes[i]);
+    ip_queries[4 * i] = ips[i] - 1;
+    ip_queries[4 * i + 1] = ips[i];
+    ip_queries[4 * i + 2] = last;
+    ip_queries[4 * i + 3] = last + 1;
+  }
+  for (int i = 4 * PREFIXES; i < IP_QUERIES; i++) {
+    uint64_t r = splitmix64(&state);
+    ip_queries[i] = (r & 1) ? (uint32_t)(r >> 32)
+                            : 0x0A000000 | (uint32_t)(r >> 32) % 0x40000;
+  }
+
+  // splitmix64 is a bijection of the counter, so keys are unique.
+  for (int i = 0; i < KEYS; i++) {
+    do {
+      keys[i] = splitmix64(&state);
+    } while (keys[i] == 0);
+    map_values[i] = i + 1;
+  }
+  for (int i = 0; i < KEYS; i++) {
+    key_queries[i] = keys[i];
+    key_queries[KEYS + i] = splitmix64(&state);
+  }
+  key_queries[2 * KEYS] = 0;
+  key_queries[2 * KEYS + 1] = keys[0] + 1;
+  key_queries[2 * KEYS + 2] = UINT64_MAX;
+}
+
+// ref_sm_find returns the value of the longest prefix containing ip.
+static uint64_t ref_sm_find(uint32_t ip) {
+  uint64_t value = HM_NO_VALUE;
+  int longest = 0;
+  for (int i = 0; i < PREFIXES; i++) {
+    if ((ip & prefix_mask(prefixes[i])) == ips[i] && prefixes[i] > longest) {
+      value = values[i];
+      longest = prefixes[i];
+    }
+  }
+  return value;
+}
+
+// ref_index returns the index of key in keys or -1.
+static int ref_index(uint64_t key) {
+  for (int i = 0; i < KEYS; i++) {
+    if (keys[i] == key) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+static uint64_t sm_want[IP_QUERIES];
+static int key_want[KEY_QUERIES];
+
+static void check_sm(const hm_sm_database_t *db) {
+  static uint64_t got[IP_QUERIES];
+  hm_sm_find_batch(db, ip_queries, got, IP_QUERIES);
+  for (int i = 0; i < IP_QUERIES; i++) {
+    CHECK(hm_sm_find(db, ip_queries[i]) == sm_want[i]);
+    CHECK(got[i] == sm_want[i]);
+  }
+  // Batches shorter than the vector width and than the prefetch distance.
+  for (size_t count = 1; count <= 17; count++) {
+    got[count] = 12345;
+    hm_sm_find_batch(db, ip_queries + 7, got, count);
+    for (size_t i = 0; i < count; i++) {
+      CHECK(got[i] == sm_want[7 + i]);
+    }
+    CHECK(got[count] == 12345);
+  }
+}
+
+static void check_u64(const hm_u64_database_t *db) {
+  static bool got[KEY_QUERIES];
+  hm_u64_find_batch(db, key_queries, got, KEY_QUERIES);
+  for (int i = 0; i < KEY_QUERIES; i++) {
+    bool want = key_want[i] != -1;
+    CHECK(hm_u64_find(db, key_queries[i]) == want);
+    CHECK(got[i] == want);
+  }
+  for (size_t count = 1; count <= 17; count++) {
+    hm_u64_find_batch(db, key_queries + KEYS - 8, got, count);
+    for (size_t i = 0; i < count; i++) {
+      CHECK(got[i] == (key_want[KEYS - 8 + i] != -1));
+    }
+  }
+}
+
+static void check_u64map(const hm_u64map_database_t *db) {
+  static uint64_t got[KEY_QUERIES];
+  hm_u64map_find_batch(db, key_queries, got, KEY_QUERIES);
+  for (int i = 0; i < KEY_QUERIES; i++) {
+    uint64_t want = key_want[i] == -1 ? 0 : map_values[key_want[i]];
+    CHECK(hm_u64map_find(db, key_queries[i]) == want);
+    CHECK(got[i] == want);
+  }
+  for (size_t count = 1; count <= 17; count++) {
+    got[count] = 12345;
+    hm_u64map_find_batch(db, key_queries + KEYS - 8, got, count);
+    for (size_t i = 0; i < count; i++) {
+      int index = key_want[KEYS - 8 + i];
+      CHECK(got[i] == (index == -1 ? 0 : map_values[index]));
+    }
+    CHECK(got[count] == 12345);
+  }
+}
+
+int main(void) {
+  generate();
+  for (int i = 0; i < IP_QUERIES; i++) {
+    sm_want[i] = ref_sm_find(ip_queries[i]);
+  }
+  for (int i = 0; i < KEY_QUERIES; i++) {
+    key_want[i] = ref_index(key_queries[i]);
+  }
+
+  size_t sm_size = hm_sm_db_place_size(PREFIXES);
+  size_t u64_size = hm_u64_db_place_size(KEYS);
+  size_t u64map_size = hm_u64map_db_place_size(KEYS);
+  char *sm_place = malloc(sm_size);
+  char *u64_place = malloc(u64_size);
+  char *u64map_place = malloc(u64map_size);
+  CHECK(sm_place != NULL && u64_place != NULL && u64map_place != NULL);
+
+  unsigned int detected = hm_cpu_features();
+  const unsigned int masks[] = {
+      0,
+      HM_CPU_SSE42,
+      HM_CPU_SSE42 | HM_CPU_AVX2 | HM_CPU_BMI2,
+      ~0u,
+  };
+  for (size_t m = 0; m < sizeof(masks) / sizeof(masks[0]); m++) {
+    hm_cpu_set_features_mask(masks[m]);
+    CHECK(hm_cpu_features() == (detected & masks[m]));
+
+    hm_sm_database_t *sm;
+    CHECK_ERR(hm_sm_compile(sm_place, sm_size, &sm, ips, prefixes, values,
+                            PREFIXES),
+              HM_SUCCESS);
+    check_sm(sm);
+
+    hm_u64_database_t *u64;
+    CHECK_ERR(hm_u64_compile(u64_place, u64_size, &u64, keys, KEYS),
+              HM_SUCCESS);
+    check_u64(u64);
+
+    hm_u64map_database_t *u64map;
+    CHECK_ERR(hm_u64map_compile(u64map_place, u64map_size, &u64map, keys,
+                                map_values, KEYS),
+              HM_SUCCESS);
+    check_u64map(u64map);
+  }
+  CHECK(hm_cpu_features() == detected);
+
+  free(sm_place);
+  free(u64_place);
+  free(u64map_place);
+  printf("PASS\n");
+  return 0;
+}
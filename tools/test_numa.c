@@ -0,0 +1,80 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../numa.h"
+#include "../static_uint64_set.h"
+#include "check.h"
+
+#define KEYS 1000
+
+// check_set checks that db is the set of keys from 100 to 100 + KEYS - 1.
+static void check_set(const hm_u64_database_t *db) {
+  CHECK(db != NULL);
+  CHECK(!hm_u64_find(db, 99));
+  CHECK(hm_u64_find(db, 100));
+  CHECK(hm_u64_find(db, 100 + KEYS - 1));
+  CHECK(!hm_u64_find(db, 100 + KEYS));
+}
+
+// check_replicas checks the copies of all nodes and the fallback to node 0.
+static void check_replicas(const hm_replicas_t *replicas) {
+  int nodes = hm_numa_nodes();
+  for (int node = 0; node < nodes; node++) {
+    check_set(hm_replicas_node(replicas, node));
+  }
+  check_set(hm_replicas_local(replicas));
+  CHECK(hm_replicas_local(replicas) ==
+        hm_replicas_node(replicas, hm_numa_current_node()));
+  CHECK(hm_replicas_node(replicas, -1) == hm_replicas_node(replicas, 0));
+  CHECK(hm_replicas_node(replicas, nodes) == hm_replicas_node(replicas, 0));
+}
+
+int main(void) {
+  int nodes = hm_numa_nodes();
+  CHECK(nodes >= 1);
+  int current = hm_numa_current_node();
+  CHECK(current >= 0 && current < nodes);
+
+  uint64_t keys[KEYS];
+  for (int i = 0; i < KEYS; i++) {
+    keys[i] = 100 + i;
+  }
+  size_t db_place_size = hm_u64_db_place_size(KEYS);
+  char *db_place = malloc(db_place_size);
+  CHECK(db_place != NULL);
+  hm_u64_database_t *db;
+  CHECK_ERR(hm_u64_compile(db_place, db_place_size, &db, keys, KEYS),
+            HM_SUCCESS);
+
+  hm_replicas_t *replicas;
+  CHECK_ERR(hm_replicas_create_from_db(&replicas, HM_DB_U64, db,
+                                       HM_PAGES_THP),
+            HM_SUCCESS);
+  // The copies do not depend on the original database.
+  CHECK(hm_replicas_node(replicas, 0) != db);
+  check_replicas(replicas);
+  hm_replicas_free(replicas);
+
+  size_t buffer_size = hm_u64_serialized_size(db);
+  char *buffer = malloc(buffer_size);
+  CHECK(buffer != NULL);
+  CHECK_ERR(hm_u64_serialize(buffer, buffer_size, db), HM_SUCCESS);
+  CHECK_ERR(hm_replicas_create(&replicas, HM_DB_U64, buffer, buffer_size,
+                               HM_PAGES_DEFAULT),
+            HM_SUCCESS);
+  check_replicas(replicas);
+  hm_replicas_free(replicas);
+
+  CHECK_ERR(hm_replicas_create(&replicas, HM_DB_U64, buffer, buffer_size / 2,
+                               HM_PAGES_DEFAULT),
+            HM_ERROR_BAD_SIZE);
+  CHECK_ERR(hm_replicas_create_from_db(&replicas, (hm_db_type_t)(42), db,
+                                       HM_PAGES_DEFAULT),
+            HM_ERROR_BAD_VALUE);
+
+  free(buffer);
+  free(db_place);
+  printf("PASS\n");
+  return 0;
+}
@@ -0,0 +1,102 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../place.h"
+#include "check.h"
+
+#define SIZE_2M ((size_t)1 << 21)
+#define SIZE_1G ((size_t)1 << 30)
+
+// free_hugepages returns the number of free huge pages of the given size in
+// the hugetlb pool or 0 if the system does not have such pages.
+static long free_hugepages(size_t page_size) {
+  char path[128];
+  snprintf(path, sizeof(path),
+           "/sys/kernel/mm/hugepages/hugepages-%zukB/free_hugepages",
+           page_size >> 10);
+  FILE *f = fopen(path, "r");
+  if (f == NULL) {
+    return 0;
+  }
+  long pages = 0;
+  if (fscanf(f, "%ld", &pages) != 1) {
+    pages = 0;
+  }
+  fclose(f);
+  return pages;
+}
+
+// page_size returns the size of pages of the kind.
+static size_t page_size(hm_page_kind_t pages) {
+  switch (pages) {
+  case HM_PAGES_DEFAULT:
+    return (size_t)sysconf(_SC_PAGESIZE);
+  case HM_PAGES_THP:
+  case HM_PAGES_2M:
+    return SIZE_2M;
+  case HM_PAGES_1G:
+    return SIZE_1G;
+  }
+  return 0;
+}
+
+// check_alloc allocates a place of size with max_pages and checks that it is
+// zeroed, writable and backed by pages not larger than max_pages.
+static hm_page_kind_t check_alloc(size_t size, hm_page_kind_t max_pages) {
+  hm_place_t place;
+  CHECK_ERR(hm_place_alloc(&place, size, max_pages), HM_SUCCESS);
+  CHECK(place.pages <= max_pages);
+  CHECK(place.size == size);
+  size_t page = page_size(place.pages);
+  CHECK((uintptr_t)place.data % page == 0);
+  CHECK(place.mapped_size % page == 0);
+  CHECK(place.mapped_size >= size && place.mapped_size - size < page);
+  for (size_t i = 0; i < place.mapped_size; i++) {
+    CHECK(place.data[i] == 0);
+  }
+  for (size_t i = 0; i < place.mapped_size; i++) {
+    place.data[i] = (char)i;
+  }
+  hm_page_kind_t pages = place.pages;
+  hm_place_free(&place);
+  CHECK(place.data == NULL && place.size == 0 && place.mapped_size == 0);
+  return pages;
+}
+
+int main(void) {
+  // Not a multiple of any page size.
+  size_t size = 3 * SIZE_2M / 2 + 5;
+
+  hm_page_kind_t pages;
+  for (hm_page_kind_t kind = HM_PAGES_DEFAULT; kind <= HM_PAGES_1G; kind++) {
+    pages = check_alloc(size, kind);
+    if (kind == HM_PAGES_DEFAULT) {
+      CHECK(pages == HM_PAGES_DEFAULT);
+    }
+  }
+
+  // pages is the kind used for HM_PAGES_1G. Without free 1G pages the place
+  // falls back to a smaller kind, and without 2M pages too, to THP or default
+  // pages.
+  if (free_hugepages(SIZE_1G) == 0) {
+    CHECK(pages != HM_PAGES_1G);
+    if (free_hugepages(SIZE_2M) == 0) {
+      CHECK(pages == HM_PAGES_THP || pages == HM_PAGES_DEFAULT);
+    }
+  }
+
+  hm_place_t place;
+  CHECK_ERR(hm_place_alloc(&place, 0, HM_PAGES_DEFAULT), HM_ERROR_BAD_SIZE);
+  CHECK_ERR(hm_place_alloc(&place, size, (hm_page_kind_t)(HM_PAGES_1G + 1)),
+            HM_ERROR_BAD_VALUE);
+  CHECK_ERR(hm_place_alloc(&place, SIZE_MAX, HM_PAGES_1G), HM_ERROR_NO_MEMORY);
+
+  CHECK(strcmp(hm_page_kind_name(HM_PAGES_1G), "1G") == 0);
+  CHECK(strcmp(hm_page_kind_name((hm_page_kind_t)(42)), "unknown") == 0);
+
+  printf("PASS\n");
+  return 0;
+}
@@ -0,0 +1,225 @@
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../shm.h"
+#include "../static_uint64_set.h"
+#include "check.h"
+
+#define KEYS 1000
+
+// compile_set compiles the set of keys from first to first + KEYS - 1 in
+// *db_place, which must be freed.
+static hm_u64_database_t *compile_set(uint64_t first, char **db_place_ptr) {
+  uint64_t keys[KEYS];
+  for (int i = 0; i < KEYS; i++) {
+    keys[i] = first + i;
+  }
+  size_t db_place_size = hm_u64_db_place_size(KEYS);
+  char *db_place = malloc(db_place_size);
+  CHECK(db_place != NULL);
+  hm_u64_database_t *db;
+  CHECK_ERR(hm_u64_compile(db_place, db_place_size, &db, keys, KEYS),
+            HM_SUCCESS);
+  *db_place_ptr = db_place;
+  return db;
+}
+
+// check_view checks that the view is the set compiled by compile_set(first).
+static void check_view(const hm_shm_view_t *view, uint64_t first) {
+  CHECK(hm_shm_view_type(view) == HM_DB_U64);
+  const hm_u64_database_t *db = hm_shm_view_db(view);
+  CHECK(!hm_u64_find(db, first - 1));
+  CHECK(hm_u64_find(db, first));
+  CHECK(hm_u64_find(db, first + KEYS - 1));
+  CHECK(!hm_u64_find(db, first + KEYS));
+}
+
+// wait_child waits for the child and checks that it exited with status 0.
+static void wait_child(pid_t pid) {
+  int status;
+  CHECK(waitpid(pid, &status, 0) == pid);
+  CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+// test_publish publishes two versions and attaches to them from a child
+// process.
+static void test_publish(const char *name) {
+  hm_shm_publisher_t *publisher;
+  CHECK_ERR(hm_shm_publisher_create(&publisher, name), HM_SUCCESS);
+  CHECK(hm_shm_publisher_version(publisher) == 0);
+
+  hm_shm_subscriber_t *subscriber;
+  CHECK_ERR(hm_shm_subscriber_open(&subscriber, name), HM_SUCCESS);
+  CHECK(hm_shm_subscriber_version(subscriber) == 0);
+  hm_shm_view_t *view;
+  CHECK_ERR(hm_shm_attach(subscriber, &view), HM_ERROR_NO_DATABASE);
+
+  char *db_place;
+  hm_u64_database_t *db1 = compile_set(100, &db_place);
+  CHECK_ERR(hm_shm_publish(publisher, HM_DB_U64, db1), HM_SUCCESS);
+  // The database is copied, so it can be freed right away.
+  free(db_place);
+  CHECK(hm_shm_publisher_version(publisher) == 1);
+
+  pid_t pid = fork();
+  CHECK(pid != -1);
+  if (pid == 0) {
+    hm_shm_subscriber_t *child;
+    CHECK_ERR(hm_shm_subscriber_open(&child, name), HM_SUCCESS);
+    CHECK(hm_shm_subscriber_version(child) == 1);
+    hm_shm_view_t *child_view;
+    CHECK_ERR(hm_shm_attach(child, &child_view), HM_SUCCESS);
+    CHECK(hm_shm_view_version(child_view) == 1);
+    check_view(child_view, 100);
+    hm_shm_view_free(child_view);
+    hm_shm_subscriber_free(child);
+    exit(0);
+  }
+  wait_child(pid);
+
+  CHECK(hm_shm_subscriber_version(subscriber) == 1);
+  hm_shm_view_t *view1;
+  CHECK_ERR(hm_shm_attach(subscriber, &view1), HM_SUCCESS);
+  check_view(view1, 100);
+
+  hm_u64_database_t *db2 = compile_set(5000, &db_place);
+  CHECK_ERR(hm_shm_publish(publisher, HM_DB_U64, db2), HM_SUCCESS);
+  free(db_place);
+  CHECK(hm_shm_publisher_version(publisher) == 2);
+  CHECK(hm_shm_subscriber_version(subscriber) == 2);
+  hm_shm_view_t *view2;
+  CHECK_ERR(hm_shm_attach(subscriber, &view2), HM_SUCCESS);
+  CHECK(hm_shm_view_version(view2) == 2);
+  check_view(view2, 5000);
+
+  // The old view stays valid after the new version and the publisher are
+  // gone.
+  hm_shm_publisher_free(publisher);
+  CHECK(hm_shm_subscriber_version(subscriber) == HM_SHM_VERSION_CLOSED);
+  CHECK_ERR(hm_shm_attach(subscriber, &view), HM_ERROR_CLOSED);
+  check_view(view1, 100);
+  check_view(view2, 5000);
+  hm_shm_view_free(view1);
+  hm_shm_view_free(view2);
+  hm_shm_subscriber_free(subscriber);
+
+  CHECK_ERR(hm_shm_subscriber_open(&subscriber, name), HM_ERROR_SYSTEM);
+}
+
+// test_replace replaces a publisher with a new one under the same name.
+static void test_replace(const char *name) {
+  char *db_place;
+  hm_u64_database_t *db = compile_set(100, &db_place);
+
+  hm_shm_publisher_t *old_publisher;
+  CHECK_ERR(hm_shm_publisher_create(&old_publisher, name), HM_SUCCESS);
+  CHECK_ERR(hm_shm_publish(old_publisher, HM_DB_U64, db), HM_SUCCESS);
+  hm_shm_subscriber_t *old_subscriber;
+  CHECK_ERR(hm_shm_subscriber_open(&old_subscriber, name), HM_SUCCESS);
+  CHECK(hm_shm_subscriber_version(old_subscriber) == 1);
+
+  hm_shm_publisher_t *publisher;
+  CHECK_ERR(hm_shm_publisher_create(&publisher, name), HM_SUCCESS);
+  CHECK(hm_shm_subscriber_version(old_subscriber) == HM_SHM_VERSION_CLOSED);
+  hm_shm_view_t *view;
+  CHECK_ERR(hm_shm_attach(old_subscriber, &view), HM_ERROR_CLOSED);
+  hm_shm_subscriber_free(old_subscriber);
+
+  // Freeing the old publisher does not remove the segment of the new one.
+  hm_shm_publisher_free(old_publisher);
+  CHECK_ERR(hm_shm_publish(publisher, HM_DB_U64, db), HM_SUCCESS);
+  hm_shm_subscriber_t *subscriber;
+  CHECK_ERR(hm_shm_subscriber_open(&subscriber, name), HM_SUCCESS);
+  CHECK(hm_shm_subscriber_version(subscriber) == 1);
+  CHECK_ERR(hm_shm_attach(subscriber, &view), HM_SUCCESS);
+  check_view(view, 100);
+  hm_shm_view_free(view);
+  hm_shm_subscriber_free(subscriber);
+  hm_shm_publisher_free(publisher);
+  free(db_place);
+}
+
+// test_dead_publisher attaches to a segment left by a publisher which exited
+// without freeing it.
+static void test_dead_publisher(const char *name) {
+  pid_t pid = fork();
+  CHECK(pid != -1);
+  if (pid == 0) {
+    hm_shm_publisher_t *publisher;
+    CHECK_ERR(hm_shm_publisher_create(&publisher, name), HM_SUCCESS);
+    char *db_place;
+    hm_u64_database_t *db = compile_set(100, &db_place);
+    CHECK_ERR(hm_shm_publish(publisher, HM_DB_U64, db), HM_SUCCESS);
+    exit(0);
+  }
+  wait_child(pid);
+
+  hm_shm_subscriber_t *subscriber;
+  CHECK_ERR(hm_shm_subscriber_open(&subscriber, name), HM_SUCCESS);
+  CHECK(hm_shm_subscriber_version(subscriber) == 1);
+  hm_shm_view_t *view;
+  CHECK_ERR(hm_shm_attach(subscriber, &view), HM_ERROR_NO_DATABASE);
+
+  // A new publisher marks the abandoned segment closed.
+  hm_shm_publisher_t *publisher;
+  CHECK_ERR(hm_shm_publisher_create(&publisher, name), HM_SUCCESS);
+  CHECK(hm_shm_subscriber_version(subscriber) == HM_SHM_VERSION_CLOSED);
+  CHECK_ERR(hm_shm_attach(subscriber, &view), HM_ERROR_CLOSED);
+  hm_shm_subscriber_free(subscriber);
+  hm_shm_publisher_free(publisher);
+}
+
+// test_torn_announcement attaches to a segment whose publisher died in the
+// middle of an announcement, leaving the sequence lock odd.
+static void test_torn_announcement(const char *name) {
+  char *db_place;
+  hm_u64_database_t *db = compile_set(100, &db_place);
+  hm_shm_publisher_t *publisher;
+  CHECK_ERR(hm_shm_publisher_create(&publisher, name), HM_SUCCESS);
+  CHECK_ERR(hm_shm_publish(publisher, HM_DB_U64, db), HM_SUCCESS);
+  hm_shm_subscriber_t *subscriber;
+  CHECK_ERR(hm_shm_subscriber_open(&subscriber, name), HM_SUCCESS);
+
+  // The sequence lock is the second uint64_t of the control segment.
+  int fd = shm_open(name, O_RDWR, 0);
+  CHECK(fd != -1);
+  uint64_t *control =
+      mmap(NULL, 2 * sizeof(uint64_t), PROT_READ | PROT_WRITE, MAP_SHARED,
+           fd, 0);
+  close(fd);
+  CHECK(control != MAP_FAILED);
+  uint64_t seq = control[1];
+  CHECK(seq % 2 == 0);
+  control[1] = seq + 1;
+
+  hm_shm_view_t *view;
+  CHECK_ERR(hm_shm_attach(subscriber, &view), HM_ERROR_NO_DATABASE);
+
+  control[1] = seq;
+  CHECK_ERR(hm_shm_attach(subscriber, &view), HM_SUCCESS);
+  check_view(view, 100);
+  hm_shm_view_free(view);
+  munmap(control, 2 * sizeof(uint64_t));
+  hm_shm_subscriber_free(subscriber);
+  hm_shm_publisher_free(publisher);
+  free(db_place);
+}
+
+int main(void) {
+  char name[64];
+  snprintf(name, sizeof(name), "/hipermap-test-shm-%d", (int)getpid());
+
+  test_publish(name);
+  test_replace(name);
+  test_dead_publisher(name);
+  test_torn_announcement(name);
+
+  shm_unlink(name);
+  printf("PASS\n");
+  return 0;
+}